@@ -23,11 +23,19 @@ struct RenderStats : public metrics::Stats {
         int spp;
         unsigned concurrency;
         unsigned schedulers;
+        unsigned prefetch;
+        std::string selectionPolicy;
 
+        size_t queueBudget;
+        size_t spillBudget;
         size_t geomCacheSize;
         size_t bvhCacheSize;
+        size_t memoryBudget;
         unsigned primGroupSize;
         unsigned svdagRes;
+        bool raySort;
+        std::string topLevelTraversal;
+        bool persistentBVHs;
     } config;
 
     struct {
@@ -56,9 +64,9 @@ struct RenderStats : public metrics::Stats {
         metrics::Counter<size_t> botLevelLoaded { "bytes" };
         metrics::Counter<size_t> botLevelEvicted { "bytes" };
 
-        // Data loaded from disk by the OOC acceleration structure. This might slightly differ from
-        // botLevelLoaded because that measures the size of the in-memory representation instead of
-        // the serialized (flatbuffer) size.
+        // Data loaded from disk by the OOC acceleration structure and the geometry cache. This differs from
+        // botLevelLoaded / geometryLoaded because those measure the size of the in-memory representation
+        // instead of the serialized (flatbuffer, possibly compressed) size.
         metrics::Counter<size_t> oocTotalDiskRead { "bytes" };
 
         // Memory used by the top-level BVH and the svdags associated with the top-level leaf nodes
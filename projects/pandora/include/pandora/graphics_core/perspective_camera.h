@@ -13,6 +13,10 @@ public:
     PerspectiveCamera(float aspectRatio, float fovX, float lensRadius, float focalDistance, glm::mat4 transform = glm::mat4(1.0f));
 
     glm::mat4 getTransform() const;
+    inline float aspectRatio() const { return m_aspectRatio; };
+    inline float fovX() const { return m_fovX; };
+    inline float lensRadius() const { return m_lensRadius; };
+    inline float focalDistance() const { return m_focalDistance; };
     void setTransform(const glm::mat4& m);
 
     Ray generateRay(const glm::vec2& sample) const;
@@ -27,6 +27,8 @@ public:
     Interaction transformToWorld(const Interaction& si) const;
     SurfaceInteraction transformToWorld(const SurfaceInteraction& si) const;
 
+    inline const glm::mat4& matrix() const { return m_matrix; };
+
 private:
     glm::mat4 m_matrix { glm::identity<glm::mat4>() };
     glm::mat4 m_inverseMatrix { glm::identity<glm::mat4>() };
@@ -45,6 +45,7 @@ public:
     virtual void render(int concurrentPaths, const PerspectiveCamera& camera, Sensor& sensor, const Scene& scene, const Accel& accel, size_t seed = 891379);
 
 protected:
+    // Paths are not spawned while the task graph is over its memory budget; they are deferred until the queues drain.
     void spawnNewPaths(int numPaths);
 
     void uniformSampleAllLights(const SurfaceInteraction& si, const BounceRayState& bounceRayState, PcgRng& rng);
@@ -73,6 +74,7 @@ protected:
         const PerspectiveCamera* pCamera;
         Sensor* pSensor;
         std::atomic_int currentRayIndex;
+        std::atomic_int deferredPaths;
         size_t seed;
         glm::ivec2 resolution;
         glm::vec2 fResolution;
@@ -11,6 +11,7 @@ public:
     AreaLight(glm::vec3 emittedLight);
 
     glm::vec3 light(const Interaction& ref, const glm::vec3& w) const;
+    inline glm::vec3 emittedLight() const { return m_emmitedLight; };
 
     LightSample sampleLi(const Interaction& ref, PcgRng& rng) const final;
     float pdfLi(const Interaction& ref, const glm::vec3& wi) const final;
@@ -14,6 +14,10 @@ public:
     LightSample sampleLi(const Interaction& ref, PcgRng& rng) const final;
     float pdfLi(const Interaction& ref, const glm::vec3& wi) const final;
 
+    inline const glm::mat4& lightToWorldMatrix() const { return m_transform.matrix(); };
+    inline Spectrum L() const { return m_l; };
+    inline glm::vec3 direction() const { return m_wLight; };
+
 private:
     Transform m_transform;
     const Spectrum m_l;
@@ -13,6 +13,10 @@ public:
 
     Spectrum Le(const Ray& w) const final;
 
+    inline const glm::mat4& lightToWorldMatrix() const { return m_lightToWorld; };
+    inline Spectrum L() const { return m_l; };
+    inline const std::shared_ptr<Texture<glm::vec3>>& texture() const { return m_texture; };
+
 private:
     glm::vec3 lightToWorld(const glm::vec3& v) const;
     glm::vec3 worldToLight(const glm::vec3& v) const;
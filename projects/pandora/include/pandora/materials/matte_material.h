@@ -10,6 +10,9 @@ public:
     MatteMaterial(const std::shared_ptr<Texture<Spectrum>>& kd, const std::shared_ptr<Texture<float>>& sigma);
 
     void computeScatteringFunctions(SurfaceInteraction& si, MemoryArena& arena) const final;
+
+    inline const std::shared_ptr<Texture<Spectrum>>& kd() const { return m_kd; };
+    inline const std::shared_ptr<Texture<float>>& sigma() const { return m_sigma; };
 private:
     std::shared_ptr<Texture<Spectrum>> m_kd;// Diffuse reflection
     std::shared_ptr<Texture<float>> m_sigma;// Roughness
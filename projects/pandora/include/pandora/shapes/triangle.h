@@ -24,6 +24,8 @@ public:
         std::vector<glm::vec3>&& normals,
         std::vector<glm::vec2>&& texCoords,
         const glm::mat4& transform);
+    // Non-resident shape whose data was serialized before (see serializedStateHandle).
+    TriangleShape(const tasking::Allocation& serializedStateHandle, unsigned numPrimitives, const Bounds& bounds);
 
     // Evictable
     size_t sizeBytes() const final;
@@ -59,6 +61,8 @@ public:
     static std::vector<TriangleShape> loadFromFile(std::filesystem::path filePath, glm::mat4 transform = glm::mat4(1.0f), bool ignoreVertexNormals = false);
 
     void serialize(tasking::Serializer& serializer) final;
+    // Location of the data written by the last call to serialize.
+    const tasking::Allocation& serializedStateHandle() const;
 
     static TriangleShape loadSerialized(const serialization::TriangleMesh* pSerializedTriangleMesh, const glm::mat4& transformMatrix);
     //static std::vector<TriangleShape> loadSerialized(const serialization::TriangleMesh* pSerializedTriangleMesh);
@@ -67,6 +71,7 @@ private:
     // Evictable
     void doEvict() final;
     void doMakeResident(tasking::Deserializer& deserializer) final;
+    void getSerializedAllocations(std::vector<tasking::Allocation>& allocations) const final;
 
     static std::optional<TriangleShape> loadFromFileSingleShape(const aiScene* scene, glm::mat4 objTransform, bool ignoreVertexNormals);
     static TriangleShape createAssimpMesh(const aiScene* scene, const unsigned meshIndex, const glm::mat4& transform, bool ignoreVertexNormals);
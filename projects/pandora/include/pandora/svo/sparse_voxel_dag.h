@@ -1,4 +1,5 @@
 #pragma once
+#include "pandora/flatbuffers/sparse_voxel_dag_generated.h"
 #include "pandora/graphics_core/pandora.h"
 #include "pandora/svo/sparse_voxel_octree.h"
 #include "pandora/utility/contiguous_allocator_ts.h"
@@ -26,17 +27,29 @@ public:
 
     static void compressDAGs(gsl::span<SparseVoxelDAG*> svos);
 
+    // Serialize DAGs that were compressed together by compressDAGs. The node array that they share is stored only once.
+    static flatbuffers::Offset<serialization::SparseVoxelDAGs> serializeDAGs(flatbuffers::FlatBufferBuilder& builder, gsl::span<const SparseVoxelDAG* const> svdags);
+    static std::vector<SparseVoxelDAG> loadSerializedDAGs(const serialization::SparseVoxelDAGs* pSerializedDAGs);
+
 #ifdef PANDORA_ISPC_SUPPORT
     void intersectSIMD(ispc::RaySOA rays, ispc::HitSOA hits, int N) const;
 #endif
     std::optional<float> intersectScalar(Ray ray) const;
+    // Traverse up to 8 rays at once, one ray per SIMD lane. Returns a bit mask of the rays that hit the SVDAG and stores
+    //  their entry distance (as returned by intersectScalar) in outEntryDistances.
+    uint32_t intersect8(gsl::span<const Ray> rays, gsl::span<float, 8> outEntryDistances) const;
     void testSVDAG() const;
 
     std::pair<std::vector<glm::vec3>, std::vector<glm::ivec3>> generateSurfaceMesh() const;
 
+    // World space extent of the smallest voxel
+    inline float voxelSize() const { return m_boundsExtent.x / static_cast<float>(m_resolution); };
+
     size_t sizeBytes() const;
 
 private:
+    SparseVoxelDAG() = default;
+
     using NodeOffset = uint32_t; // Either uint32_t or uint16_t
     //using AbsoluteNodeOffset = size_t;
 
@@ -12,6 +12,8 @@ public:
     T evaluate(const glm::vec2& point) const final;
     T evaluate(const SurfaceInteraction& intersection) const final;
 
+    inline const T& value() const { return m_value; };
+
 private:
     const T m_value;
 };
@@ -14,7 +14,10 @@ public:
     T evaluate(const glm::vec2& point) const;
     T evaluate(const SurfaceInteraction& intersection) const final;
 
+    inline const std::filesystem::path& filePath() const { return m_filePath; };
+
 private:
+    std::filesystem::path m_filePath;
     glm::ivec2 m_resolution;
     glm::vec2 m_resolutionF;
     int m_channels;
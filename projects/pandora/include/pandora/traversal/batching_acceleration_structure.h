@@ -10,11 +10,18 @@
 #include "pandora/traversal/batching.h"
 #include "pandora/traversal/embree_cache.h"
 #include "pandora/traversal/pauseable_bvh/pauseable_bvh4.h"
+#include "pandora/traversal/persistent_bvh_cache.h"
 #include "pandora/utility/enumerate.h"
+#include "pandora/utility/free_list_allocator_ts.h"
+#include <EASTL/fixed_vector.h>
+#include <array>
+#include <atomic>
 #include <embree3/rtcore.h>
 #include <execution>
 #include <glm/gtc/type_ptr.hpp>
 #include <gsl/span>
+#include <libmorton/morton.h>
+#include <memory>
 #include <optional>
 #include <spdlog/spdlog.h>
 #include <stream/cache/lru_cache.h>
@@ -42,31 +49,107 @@ public:
 private:
     friend class BatchingAccelerationStructureBuilder;
     class BatchingPoint;
+
+    // Rays that are queued at a batching point only carry the data that is needed for traversal. The user state and the
+    //  closest hit found so far are only needed once the ray leaves the acceleration structure, so they are stored out
+    //  of line (in m_hitRayStates / m_anyHitRayStates) and referenced by handle. The top-level BVH passes the handle
+    //  around as the user state of the ray.
+    using RayStateHandle = uint32_t;
+    struct HitRayData {
+        SurfaceInteraction si;
+        HitRayState state;
+    };
+    struct QueuedRay {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        float tnear;
+        float tfar;
+        uint32_t numTopLevelIntersections;
+        RayStateHandle stateHandle;
+        // Distance at which the ray enters the SVDAG of the batching point (tnear without an SVDAG). Used to skip empty
+        //  space in the bottom-level BVH and as sort key.
+        float entryDistance;
+        // PauseableBVHInsertHandle split in two so that the node handle fills the padding before the stack.
+        uint32_t insertNodeHandle;
+        uint64_t insertStack;
+
+        QueuedRay(const Ray& ray, RayStateHandle stateHandle, float entryDistance, const PauseableBVHInsertHandle& insertHandle);
+        Ray ray() const;
+        PauseableBVHInsertHandle insertHandle() const;
+    };
+    static_assert(sizeof(QueuedRay) == 56);
+
+    // The top-level BVH is re-traversed every time a ray is resumed, so it uses compressed (quantized) nodes to
+    //  reduce its memory footprint and traversal bandwidth.
+    using TopLevelBVH = PauseableBVH4<BatchingPoint, RayStateHandle, RayStateHandle, PauseableBVHNodeLayout::Quantized>;
+
     BatchingAccelerationStructure(
-        RTCDevice embreeDevice, PauseableBVH4<BatchingPoint, HitRayState, AnyHitRayState>&& topLevelBVH,
+        RTCDevice embreeDevice, TopLevelBVH&& topLevelBVH,
         tasking::TaskHandle<std::tuple<Ray, SurfaceInteraction, HitRayState>> hitTask, tasking::TaskHandle<std::tuple<Ray, HitRayState>> missTask,
         tasking::TaskHandle<std::tuple<Ray, AnyHitRayState>> anyHitTask, tasking::TaskHandle<std::tuple<Ray, AnyHitRayState>> anyMissTask,
-        tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph, size_t embreeSceneCacheSize);
+        tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph, size_t embreeSceneCacheSize,
+        std::unique_ptr<PersistentBVHCache>&& pPersistentBVHCache, bool sortRays);
 
-    using TopLevelBVH = PauseableBVH4<BatchingPoint, HitRayState, AnyHitRayState>;
     using OnHitTask = tasking::TaskHandle<std::tuple<Ray, SurfaceInteraction, HitRayState>>;
     using OnMissTask = tasking::TaskHandle<std::tuple<Ray, HitRayState>>;
     using OnAnyHitTask = tasking::TaskHandle<std::tuple<Ray, AnyHitRayState>>;
     using OnAnyMissTask = tasking::TaskHandle<std::tuple<Ray, AnyHitRayState>>;
 
+    // Called when a ray leaves the top-level BVH: releases the ray state and passes the ray on to the user.
+    void exitHitRay(const Ray& ray, RayStateHandle stateHandle) const;
+    void exitAnyHitRay(const Ray& ray, RayStateHandle stateHandle, bool hit) const;
+
     class BatchingPoint {
     public:
-        BatchingPoint(SubScene&& subScene, std::vector<Shape*>&& shapes, SparseVoxelDAG&& svdag, tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph);
-        BatchingPoint(SubScene&& subScene, std::vector<Shape*>&& shapes, tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph);
-
-        std::optional<bool> intersect(Ray&, SurfaceInteraction&, const HitRayState&, const PauseableBVHInsertHandle&) const;
-        std::optional<bool> intersectAny(Ray&, const AnyHitRayState&, const PauseableBVHInsertHandle&) const;
+        // The bottom-level BVH is built with Embree when the batching point is flushed, unless a persistent BVH is given.
+        BatchingPoint(SubScene&& subScene, std::vector<Shape*>&& shapes, SparseVoxelDAG&& svdag, tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph, PersistentBVH* pPersistentBVH = nullptr);
+        BatchingPoint(SubScene&& subScene, std::vector<Shape*>&& shapes, tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph, PersistentBVH* pPersistentBVH = nullptr);
+
+        std::optional<bool> intersect(Ray&, SurfaceInteraction&, const RayStateHandle&, const PauseableBVHInsertHandle&) const;
+        std::optional<bool> intersectAny(Ray&, const RayStateHandle&, const PauseableBVHInsertHandle&) const;
+
+        // Batched versions of intersect / intersectAny used when the top-level BVH resumes a batch of rays. The rays are
+        //  culled against the SVDAG 8 at a time.
+        void intersectBatch(
+            gsl::span<Ray* const>, gsl::span<SurfaceInteraction* const>, gsl::span<const RayStateHandle>,
+            gsl::span<const PauseableBVHInsertHandle>, gsl::span<std::optional<bool>> outResults) const;
+        void intersectAnyBatch(
+            gsl::span<Ray* const>, gsl::span<const RayStateHandle>, gsl::span<const PauseableBVHInsertHandle>,
+            gsl::span<std::optional<bool>> outResults) const;
 
         Bounds getBounds() const;
 
     private:
         bool intersectInternal(RTCScene scene, Ray&, SurfaceInteraction&) const;
         bool intersectAnyInternal(RTCScene scene, Ray&) const;
+        bool intersectInternal(const PersistentBVH& bvh, Ray&, SurfaceInteraction&) const;
+
+        // Queue the rays that are not culled by the SVDAG at the task, or fill in false for the rays that are culled.
+        void enqueueBatch(
+            tasking::TaskHandle<QueuedRay> task, gsl::span<Ray* const>, gsl::span<const RayStateHandle>,
+            gsl::span<const PauseableBVHInsertHandle>, gsl::span<std::optional<bool>> outResults) const;
+
+        // Trace a whole batch through the bottom-level BVH as a stream of SoA packets (marked as coherent), calling
+        //  f(i, const RTCRayHit&) / f(i, bool occluded) for every ray. Smaller batches are traced one ray at a time.
+        static constexpr size_t minStreamSize = 16;
+        template <typename F>
+        void intersectStream(RTCScene scene, gsl::span<const QueuedRay> rays, std::pmr::memory_resource* pMemoryResource, F&& f) const;
+        template <typename F>
+        void intersectAnyStream(RTCScene scene, gsl::span<const QueuedRay> rays, std::pmr::memory_resource* pMemoryResource, F&& f) const;
+        bool processHit(RTCScene scene, const RTCRayHit& embreeRayHit, Ray&, SurfaceInteraction&) const;
+
+        // Start of the ray in the bottom-level BVH. The geometry of the batching point is not hit before the ray enters the
+        //  first filled voxel of the SVDAG so the empty space in front of it is skipped (with one voxel of slack to cover
+        //  rounding errors in the voxelization and the SVDAG traversal).
+        float bottomLevelTnear(const QueuedRay& ray) const;
+
+        // Order the rays of a batch by direction octant and then by the Morton code of their entry point.
+        void sortRays(gsl::span<QueuedRay> rays, std::pmr::memory_resource* pMemoryResource) const;
+
+        // Estimated number of bytes that need to be loaded (geometry) or built (BVH) before the batching point can be flushed.
+        size_t estimateLoadCost() const;
+        // Add the shapes to a residency group of the geometry cache (see m_pGeometryResidency).
+        void trackGeometryResidency();
 
         friend class BatchingAccelerationStructure<HitRayState, AnyHitRayState>;
         void setParent(BatchingAccelerationStructure<HitRayState, AnyHitRayState>* pParent, EmbreeSceneCache* pEmbreeCache);
@@ -74,7 +157,9 @@ private:
         struct StaticData {
             std::vector<tasking::CachedPtr<Shape>> shapeOwners;
 
+            // Either the Embree scene or the persistent BVH is set.
             std::shared_ptr<CachedEmbreeScene> scene;
+            tasking::CachedPtr<PersistentBVH> pPersistentBVH;
         };
 
     private:
@@ -87,18 +172,32 @@ private:
 
         tasking::LRUCacheTS* m_pGeometryCache;
         EmbreeSceneCache* m_pEmbreeCache;
+        PersistentBVH* m_pPersistentBVH;
+        PersistentBVHCache* m_pPersistentBVHCache { nullptr };
         tasking::TaskGraph* m_pTaskGraph;
+        bool m_sortRays { false };
+
+        // Kept up to date by the caches so that estimateLoadCost() does not have to query them for every shape. Shared by
+        //  the copies of the batching point.
+        std::shared_ptr<tasking::LRUCacheTS::ResidencyGroup> m_pGeometryResidency;
+        std::shared_ptr<std::atomic_bool> m_pEmbreeSceneCached;
+        size_t m_geometrySize { 0 };
 
-        tasking::TaskHandle<std::tuple<Ray, SurfaceInteraction, HitRayState, PauseableBVHInsertHandle>> m_intersectTask;
-        tasking::TaskHandle<std::tuple<Ray, AnyHitRayState, PauseableBVHInsertHandle>> m_intersectAnyTask;
+        tasking::TaskHandle<QueuedRay> m_intersectTask;
+        tasking::TaskHandle<QueuedRay> m_intersectAnyTask;
     };
 
 private:
     RTCDevice m_embreeDevice;
     TopLevelBVH m_topLevelBVH;
     LRUEmbreeSceneCache m_embreeSceneCache;
+    std::unique_ptr<PersistentBVHCache> m_pPersistentBVHCache;
+
+    mutable FreeListAllocatorTS<HitRayData> m_hitRayStates;
+    mutable FreeListAllocatorTS<AnyHitRayState> m_anyHitRayStates;
 
     bool m_enableOcclusionCulling;
+    bool m_sortRays;
     tasking::TaskGraph* m_pTaskGraph;
 
     tasking::TaskHandle<std::tuple<Ray, SurfaceInteraction, HitRayState>> m_onHitTask;
@@ -109,22 +208,51 @@ private:
 
 class BatchingAccelerationStructureBuilder {
 public:
+    // sortRays enables reordering of the rays in a batch (for coherence) before they traverse the bottom-level BVH.
+    // topLevelTraversal selects how the top-level traversal state of paused rays is stored.
+    // If the geometry cache shares a memory governor then the bottom-level BVH caches share it too (instead of using
+    //  botLevelBVHCacheSize).
+    BatchingAccelerationStructureBuilder(
+        const Scene* pScene, tasking::LRUCacheTS* pCache, tasking::TaskGraph* pTaskGraph, unsigned primitivesPerBatchingPoint, size_t botLevelBVHCacheSize, unsigned svdagRes, bool sortRays = false,
+        PauseableBVHTraversal topLevelTraversal = PauseableBVHTraversal::ChildMask);
+    // Use sub scenes and SVDAGs that were created before (loaded from a scene package). svdags is either empty or contains
+    //  one (compressed) SVDAG per sub scene.
     BatchingAccelerationStructureBuilder(
-        const Scene* pScene, tasking::LRUCacheTS* pCache, tasking::TaskGraph* pTaskGraph, unsigned primitivesPerBatchingPoint, size_t botLevelBVHCacheSize, unsigned svdagRes);
+        std::vector<SubScene>&& subScenes, std::vector<SparseVoxelDAG>&& svdags, tasking::LRUCacheTS* pCache, tasking::TaskGraph* pTaskGraph, size_t botLevelBVHCacheSize, bool sortRays = false,
+        PauseableBVHTraversal topLevelTraversal = PauseableBVHTraversal::ChildMask);
 
     static void preprocessScene(Scene& scene, tasking::LRUCacheTS& oldCache, tasking::CacheBuilder& newCacheBuilder, unsigned primitivesPerBatchingPoint);
 
+    // Build the bottom-level BVHs of the sub scenes now and write them to the serializer, so that flushing a batching point
+    //  loads its BVH instead of building it with Embree. Sub scenes with instanced scene nodes still use Embree.
+    void createPersistentBVHs(std::unique_ptr<tasking::Serializer>&& pSerializer);
+    // Use persistent BVHs that were written before (one per sub scene, nullptr for sub scenes that use Embree) and that were
+    //  registered with the cache builder.
+    void usePersistentBVHs(std::vector<std::unique_ptr<PersistentBVH>>&& bvhs, tasking::LRUCacheTS::Builder&& cacheBuilder);
+
+    // Sub scenes, SVDAGs and persistent BVHs from which the batching points will be created (for writing a scene package).
+    gsl::span<const SubScene> subScenes() const;
+    gsl::span<const SparseVoxelDAG> svdags() const;
+    gsl::span<const std::unique_ptr<PersistentBVH>> persistentBVHs() const;
+
     template <typename HitRayState, typename AnyHitRayState>
     BatchingAccelerationStructure<HitRayState, AnyHitRayState> build(
         tasking::TaskHandle<std::tuple<Ray, SurfaceInteraction, HitRayState>> hitTask, tasking::TaskHandle<std::tuple<Ray, HitRayState>> missTask,
         tasking::TaskHandle<std::tuple<Ray, AnyHitRayState>> anyHitTask, tasking::TaskHandle<std::tuple<Ray, AnyHitRayState>> anyMissTask);
 
+private:
+    void createSVDAGs(unsigned resolution);
+
 private:
     const size_t m_botLevelBVHCacheSize;
-    const unsigned m_svdagRes;
+    const bool m_sortRays;
+    const PauseableBVHTraversal m_topLevelTraversal;
 
     RTCDevice m_embreeDevice;
     std::vector<SubScene> m_subScenes;
+    std::vector<SparseVoxelDAG> m_svdags;
+    std::vector<std::unique_ptr<PersistentBVH>> m_persistentBVHs;
+    std::optional<tasking::LRUCacheTS::Builder> m_persistentBVHCacheBuilder;
 
     tasking::LRUCacheTS* m_pGeometryCache;
     tasking::TaskGraph* m_pTaskGraph;
@@ -138,27 +266,41 @@ inline glm::vec3 randomVec3()
 
 template <typename HitRayState, typename AnyHitRayState>
 BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::BatchingPoint(
-    SubScene&& subScene, std::vector<Shape*>&& shapes, SparseVoxelDAG&& svdag, tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph)
+    SubScene&& subScene, std::vector<Shape*>&& shapes, SparseVoxelDAG&& svdag, tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph, PersistentBVH* pPersistentBVH)
     : m_subScene(std::move(subScene))
     , m_shapes(std::move(shapes))
     , m_bounds(m_subScene.computeBounds())
     , m_color(randomVec3())
     , m_svdag(std::move(svdag))
     , m_pGeometryCache(pGeometryCache)
+    , m_pPersistentBVH(pPersistentBVH)
     , m_pTaskGraph(pTaskGraph)
 {
+    trackGeometryResidency();
 }
 
 template <typename HitRayState, typename AnyHitRayState>
 BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::BatchingPoint(
-    SubScene&& subScene, std::vector<Shape*>&& shapes, tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph)
+    SubScene&& subScene, std::vector<Shape*>&& shapes, tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph, PersistentBVH* pPersistentBVH)
     : m_subScene(std::move(subScene))
     , m_shapes(std::move(shapes))
     , m_bounds(m_subScene.computeBounds())
     , m_color(randomVec3())
     , m_pGeometryCache(pGeometryCache)
+    , m_pPersistentBVH(pPersistentBVH)
     , m_pTaskGraph(pTaskGraph)
 {
+    trackGeometryResidency();
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::trackGeometryResidency()
+{
+    m_pGeometryResidency = std::make_shared<tasking::LRUCacheTS::ResidencyGroup>();
+    for (const Shape* pShape : m_shapes) {
+        m_pGeometryCache->addToResidencyGroup(pShape, m_pGeometryResidency);
+        m_geometrySize += m_pGeometryCache->residentSizeBytes(pShape);
+    }
 }
 
 template <typename HitRayState, typename AnyHitRayState>
@@ -166,7 +308,16 @@ void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::
     BatchingAccelerationStructure<HitRayState, AnyHitRayState>* pParent, EmbreeSceneCache* pEmbreeCache)
 {
     //m_pParent = pParent;
-    m_intersectTask = m_pTaskGraph->addTask<std::tuple<Ray, SurfaceInteraction, HitRayState, PauseableBVHInsertHandle>, StaticData>(
+    m_pEmbreeCache = pEmbreeCache;
+    m_pPersistentBVHCache = pParent->m_pPersistentBVHCache.get();
+    if (!m_pPersistentBVH) {
+        // The sub scene is the key of its Embree scene so this has to be done once the batching point is at its final
+        //  address (in the top-level BVH).
+        m_pEmbreeSceneCached = std::make_shared<std::atomic_bool>(false);
+        pEmbreeCache->trackResidency(&m_subScene, m_pEmbreeSceneCached.get());
+    }
+    m_sortRays = pParent->m_sortRays;
+    m_intersectTask = m_pTaskGraph->addTask<QueuedRay, StaticData>(
         "BatchingAccelerationStructure::leafIntersect",
         [=]() -> StaticData {
             //g_stats.memory.batches = m_pTaskGraph->approxMemoryUsage();
@@ -174,6 +325,7 @@ void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::
             StaticData staticData;
             {
                 OPTICK_EVENT("MakeShapesResident");
+                m_pGeometryCache->prefetch(gsl::span<Shape* const>(m_shapes));
                 staticData.shapeOwners.resize(m_shapes.size());
                 tbb::blocked_range<size_t> shapeRange { 0, m_shapes.size() };
                 tbb::parallel_for(shapeRange,
@@ -186,48 +338,87 @@ void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::
 
             {
                 OPTICK_EVENT("LoadOrBuildBVH");
-                staticData.scene = pEmbreeCache->fromSubScene(&m_subScene);
+                if (m_pPersistentBVH)
+                    staticData.pPersistentBVH = m_pPersistentBVHCache->makeResident(m_pPersistentBVH);
+                else
+                    staticData.scene = pEmbreeCache->fromSubScene(&m_subScene);
             }
 
             return staticData;
         },
-        [=](gsl::span<std::tuple<Ray, SurfaceInteraction, HitRayState, PauseableBVHInsertHandle>> data,
-            const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
+        [=]() { return estimateLoadCost(); },
+        [=](gsl::span<QueuedRay> data, const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
+            if (m_sortRays)
+                sortRays(data, pMemoryResource);
+
             {
                 auto stopWatch = g_stats.timings.botLevelTraversalTime.getScopedStopwatch();
 
-                RTCScene embreeScene = pStaticData->scene->scene;
-                for (auto& [ray, si, state, insertHandle] : data) {
-                    intersectInternal(embreeScene, ray, si);
+                if (const PersistentBVH* pPersistentBVH = pStaticData->pPersistentBVH.get()) {
+                    for (auto& queuedRay : data) {
+                        Ray ray = queuedRay.ray();
+                        ray.tnear = bottomLevelTnear(queuedRay);
+                        SurfaceInteraction& si = pParent->m_hitRayStates.get(queuedRay.stateHandle).si;
+                        if (intersectInternal(*pPersistentBVH, ray, si))
+                            queuedRay.tfar = ray.tfar;
+                    }
+                } else {
+                    RTCScene embreeScene = pStaticData->scene->scene;
+                    if (data.size() < minStreamSize) {
+                        for (auto& queuedRay : data) {
+                            Ray ray = queuedRay.ray();
+                            ray.tnear = bottomLevelTnear(queuedRay);
+                            SurfaceInteraction& si = pParent->m_hitRayStates.get(queuedRay.stateHandle).si;
+                            if (intersectInternal(embreeScene, ray, si))
+                                queuedRay.tfar = ray.tfar;
+                        }
+                    } else {
+                        intersectStream(embreeScene, data, pMemoryResource, [&](size_t i, const RTCRayHit& embreeRayHit) {
+                            auto& queuedRay = data[i];
+                            Ray ray = queuedRay.ray();
+                            SurfaceInteraction& si = pParent->m_hitRayStates.get(queuedRay.stateHandle).si;
+                            if (processHit(embreeScene, embreeRayHit, ray, si))
+                                queuedRay.tfar = ray.tfar;
+                        });
+                    }
                 }
             }
 
             {
                 auto stopWatch = g_stats.timings.topLevelTraversalTime.getScopedStopwatch();
 
-                for (auto& [ray, si, state, insertHandle] : data) {
-                    auto optHit = pParent->m_topLevelBVH.intersect(ray, si, state, insertHandle);
-                    if (optHit) { // Ray exited BVH
-                        assert(!optHit.value());
-
-                        if (si.pSceneObject) {
-                            // Ray hit something
-                            assert(si.pSceneObject);
-                            m_pTaskGraph->enqueue(pParent->m_onHitTask, std::tuple { ray, si, state });
-                        } else {
-                            m_pTaskGraph->enqueue(pParent->m_onMissTask, std::tuple { ray, state });
-                        }
-                    }
+                std::pmr::vector<Ray> rays { pMemoryResource };
+                std::pmr::vector<SurfaceInteraction*> surfaceInteractions { pMemoryResource };
+                std::pmr::vector<RayStateHandle> stateHandles { pMemoryResource };
+                std::pmr::vector<PauseableBVHInsertHandle> insertHandles { pMemoryResource };
+                rays.reserve(data.size());
+                surfaceInteractions.reserve(data.size());
+                stateHandles.reserve(data.size());
+                insertHandles.reserve(data.size());
+                for (const auto& queuedRay : data) {
+                    rays.push_back(queuedRay.ray());
+                    surfaceInteractions.push_back(&pParent->m_hitRayStates.get(queuedRay.stateHandle).si);
+                    stateHandles.push_back(queuedRay.stateHandle);
+                    insertHandles.push_back(queuedRay.insertHandle());
                 }
+
+                // NOTE: the ray state belongs to whichever thread processes the ray next once it has been paused.
+                pParent->m_topLevelBVH.intersectBatch(
+                    rays, surfaceInteractions, stateHandles, insertHandles, pMemoryResource,
+                    [&](size_t i, bool hit) {
+                        assert(!hit);
+                        pParent->exitHitRay(rays[i], stateHandles[i]);
+                    });
             }
         });
-    m_intersectAnyTask = m_pTaskGraph->addTask<std::tuple<Ray, AnyHitRayState, PauseableBVHInsertHandle>, StaticData>(
+    m_intersectAnyTask = m_pTaskGraph->addTask<QueuedRay, StaticData>(
         "BatchingAccelerationStructure::leafIntersectAny",
         [=]() -> StaticData {
             StaticData staticData;
 
             {
                 OPTICK_EVENT("MakeShapesResident");
+                m_pGeometryCache->prefetch(gsl::span<Shape* const>(m_shapes));
                 staticData.shapeOwners.resize(m_shapes.size());
                 tbb::blocked_range<size_t> shapeRange { 0, m_shapes.size() };
                 tbb::parallel_for(shapeRange,
@@ -240,49 +431,96 @@ void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::
 
             {
                 OPTICK_EVENT("LoadOrBuildBVH");
-                staticData.scene = pEmbreeCache->fromSubScene(&m_subScene);
+                if (m_pPersistentBVH)
+                    staticData.pPersistentBVH = m_pPersistentBVHCache->makeResident(m_pPersistentBVH);
+                else
+                    staticData.scene = pEmbreeCache->fromSubScene(&m_subScene);
             }
 
             return staticData;
         },
-        [=](gsl::span<std::tuple<Ray, AnyHitRayState, PauseableBVHInsertHandle>> data, const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
-            std::vector<uint32_t> hits;
-            hits.resize(data.size());
-            std::fill(std::begin(hits), std::end(hits), false);
+        [=]() { return estimateLoadCost(); },
+        [=](gsl::span<QueuedRay> data, const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
+            if (m_sortRays)
+                sortRays(data, pMemoryResource);
+
+            std::pmr::vector<uint32_t> hits(data.size(), false, pMemoryResource);
 
             {
                 auto stopWatch = g_stats.timings.botLevelTraversalTime.getScopedStopwatch();
 
-                RTCScene embreeScene = pStaticData->scene->scene;
-                for (auto&& [i, data] : enumerate(data)) {
-                    auto& [ray, state, insertHandle] = data;
-                    hits[i] = intersectAnyInternal(embreeScene, ray);
+                if (const PersistentBVH* pPersistentBVH = pStaticData->pPersistentBVH.get()) {
+                    for (auto&& [i, queuedRay] : enumerate(data)) {
+                        Ray ray = queuedRay.ray();
+                        ray.tnear = bottomLevelTnear(queuedRay);
+                        hits[i] = pPersistentBVH->intersectAny(ray);
+                        if (hits[i])
+                            queuedRay.tfar = -std::numeric_limits<float>::infinity();
+                    }
+                } else {
+                    RTCScene embreeScene = pStaticData->scene->scene;
+                    if (data.size() < minStreamSize) {
+                        for (auto&& [i, queuedRay] : enumerate(data)) {
+                            Ray ray = queuedRay.ray();
+                            ray.tnear = bottomLevelTnear(queuedRay);
+                            hits[i] = intersectAnyInternal(embreeScene, ray);
+                            queuedRay.tfar = ray.tfar;
+                        }
+                    } else {
+                        intersectAnyStream(embreeScene, data, pMemoryResource, [&](size_t i, bool occluded) {
+                            hits[i] = occluded;
+                            if (occluded)
+                                data[i].tfar = -std::numeric_limits<float>::infinity();
+                        });
+                    }
                 }
             }
 
             {
                 auto stopWatch = g_stats.timings.topLevelTraversalTime.getScopedStopwatch();
 
-                for (auto&& [i, data] : enumerate(data)) {
-                    auto& [ray, state, insertHandle] = data;
-
+                // Occluded rays are done; the others resume top-level traversal together.
+                std::pmr::vector<Ray> rays { pMemoryResource };
+                std::pmr::vector<RayStateHandle> stateHandles { pMemoryResource };
+                std::pmr::vector<PauseableBVHInsertHandle> insertHandles { pMemoryResource };
+                rays.reserve(data.size());
+                stateHandles.reserve(data.size());
+                insertHandles.reserve(data.size());
+                for (auto&& [i, queuedRay] : enumerate(data)) {
                     if (hits[i]) {
-                        m_pTaskGraph->enqueue(pParent->m_onAnyHitTask, std::tuple { ray, state });
+                        pParent->exitAnyHitRay(queuedRay.ray(), queuedRay.stateHandle, true);
                     } else {
-                        auto optHit = pParent->m_topLevelBVH.intersectAny(ray, state, insertHandle);
-                        if (optHit) {
-                            assert(!optHit.value());
-                            if (optHit.value())
-                                m_pTaskGraph->enqueue(pParent->m_onAnyHitTask, std::tuple { ray, state });
-                            else
-                                m_pTaskGraph->enqueue(pParent->m_onAnyMissTask, std::tuple { ray, state });
-                        }
+                        rays.push_back(queuedRay.ray());
+                        stateHandles.push_back(queuedRay.stateHandle);
+                        insertHandles.push_back(queuedRay.insertHandle());
                     }
                 }
+
+                pParent->m_topLevelBVH.intersectAnyBatch(
+                    rays, stateHandles, insertHandles, pMemoryResource,
+                    [&](size_t i, bool hit) {
+                        assert(!hit);
+                        pParent->exitAnyHitRay(rays[i], stateHandles[i], hit);
+                    });
             }
         });
 }
 
+template <typename HitRayState, typename AnyHitRayState>
+size_t BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::estimateLoadCost() const
+{
+    size_t loadCost = m_pGeometryResidency->nonResidentSizeBytes();
+
+    // Building a BVH is assumed to be about as expensive as loading the geometry it is built over. Persistent BVHs are
+    //  loaded instead of built.
+    if (m_pPersistentBVH)
+        loadCost += m_pPersistentBVHCache->nonResidentSizeBytes(m_pPersistentBVH);
+    else if (!m_pEmbreeSceneCached->load(std::memory_order_relaxed))
+        loadCost += m_geometrySize;
+
+    return loadCost;
+}
+
 template <typename HitRayState, typename AnyHitRayState>
 Bounds BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::getBounds() const
 {
@@ -292,51 +530,118 @@ Bounds BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint
 template <typename HitRayState, typename AnyHitRayState>
 inline std::optional<SurfaceInteraction> BatchingAccelerationStructure<HitRayState, AnyHitRayState>::intersectDebug(Ray& ray) const
 {
-    SurfaceInteraction si;
-    if (m_topLevelBVH.intersect(ray, si, HitRayState {}))
-        return si;
-    else
-        return {};
+    auto [stateHandle, pRayData] = m_hitRayStates.allocate(HitRayData { SurfaceInteraction {}, HitRayState {} });
+    if (!m_topLevelBVH.intersect(ray, pRayData->si, stateHandle))
+        return {}; // Paused; the ray state is released when the ray leaves the acceleration structure.
+
+    const SurfaceInteraction si = pRayData->si;
+    m_hitRayStates.release(stateHandle);
+    return si;
 }
 
 template <typename HitRayState, typename AnyHitRayState>
 std::optional<bool> BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersect(
-    Ray& ray, SurfaceInteraction& si, const HitRayState& userState, const PauseableBVHInsertHandle& bvhInsertHandle) const
+    Ray& ray, SurfaceInteraction& si, const RayStateHandle& stateHandle, const PauseableBVHInsertHandle& bvhInsertHandle) const
 {
+    float entryDistance = ray.tnear;
     if (m_svdag) {
-        // auto stopWatch = g_stats.timings.svdagTraversalTime.getScopedStopwatch();
-        //g_stats.svdag.numIntersectionTests++;
-
-        if (!m_svdag->intersectScalar(ray)) {
-            //g_stats.svdag.numRaysCulled++;
+        // The svdag stats are only counted by the batched path (enqueueBatch).
+        auto optEntryDistance = m_svdag->intersectScalar(ray);
+        if (!optEntryDistance) {
             return false;
         }
+        entryDistance = *optEntryDistance;
     }
 
     ray.numTopLevelIntersections += 1;
-    m_pTaskGraph->enqueue(m_intersectTask, std::tuple { ray, si, userState, bvhInsertHandle });
+    m_pTaskGraph->enqueue(m_intersectTask, QueuedRay { ray, stateHandle, entryDistance, bvhInsertHandle });
     return {};
 }
 
 template <typename HitRayState, typename AnyHitRayState>
 std::optional<bool> BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersectAny(
-    Ray& ray, const AnyHitRayState& userState, const PauseableBVHInsertHandle& bvhInsertHandle) const
+    Ray& ray, const RayStateHandle& stateHandle, const PauseableBVHInsertHandle& bvhInsertHandle) const
 {
+    float entryDistance = ray.tnear;
     if (m_svdag) {
-        //auto stopWatch = g_stats.timings.svdagTraversalTime.getScopedStopwatch();
-        //g_stats.svdag.numIntersectionTests++;
-
-        if (!m_svdag->intersectScalar(ray)) {
-            //g_stats.svdag.numRaysCulled++;
+        // The svdag stats are only counted by the batched path (enqueueBatch).
+        auto optEntryDistance = m_svdag->intersectScalar(ray);
+        if (!optEntryDistance) {
             return false;
         }
+        entryDistance = *optEntryDistance;
     }
 
     ray.numTopLevelIntersections += 1;
-    m_pTaskGraph->enqueue(m_intersectAnyTask, std::tuple { ray, userState, bvhInsertHandle });
+    m_pTaskGraph->enqueue(m_intersectAnyTask, QueuedRay { ray, stateHandle, entryDistance, bvhInsertHandle });
     return {};
 }
 
+template <typename HitRayState, typename AnyHitRayState>
+void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersectBatch(
+    gsl::span<Ray* const> rays, gsl::span<SurfaceInteraction* const>, gsl::span<const RayStateHandle> stateHandles,
+    gsl::span<const PauseableBVHInsertHandle> bvhInsertHandles, gsl::span<std::optional<bool>> outResults) const
+{
+    enqueueBatch(m_intersectTask, rays, stateHandles, bvhInsertHandles, outResults);
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersectAnyBatch(
+    gsl::span<Ray* const> rays, gsl::span<const RayStateHandle> stateHandles,
+    gsl::span<const PauseableBVHInsertHandle> bvhInsertHandles, gsl::span<std::optional<bool>> outResults) const
+{
+    enqueueBatch(m_intersectAnyTask, rays, stateHandles, bvhInsertHandles, outResults);
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::enqueueBatch(
+    tasking::TaskHandle<QueuedRay> task, gsl::span<Ray* const> rays, gsl::span<const RayStateHandle> stateHandles,
+    gsl::span<const PauseableBVHInsertHandle> bvhInsertHandles, gsl::span<std::optional<bool>> outResults) const
+{
+    constexpr size_t packetSize = 8;
+    std::array<Ray, packetSize> packet;
+    std::array<float, packetSize> entryDistances;
+    eastl::fixed_vector<QueuedRay, packetSize, false> queuedRays;
+    const size_t numRays = static_cast<size_t>(rays.size());
+    size_t numCulled = 0;
+    for (size_t packetStart = 0; packetStart < numRays; packetStart += packetSize) {
+        const size_t numLanes = std::min(numRays - packetStart, packetSize);
+
+        uint32_t hitMask = (1u << numLanes) - 1;
+        if (m_svdag) {
+            for (size_t lane = 0; lane < numLanes; lane++)
+                packet[lane] = *rays[packetStart + lane];
+            hitMask = m_svdag->intersect8(gsl::span<const Ray>(packet.data(), numLanes), entryDistances);
+        } else {
+            for (size_t lane = 0; lane < numLanes; lane++)
+                entryDistances[lane] = rays[packetStart + lane]->tnear;
+        }
+
+        queuedRays.clear();
+        for (size_t lane = 0; lane < numLanes; lane++) {
+            const size_t i = packetStart + lane;
+            if (!(hitMask & (1u << lane))) {
+                outResults[i] = false;
+                numCulled++;
+                continue;
+            }
+
+            Ray& ray = *rays[i];
+            ray.numTopLevelIntersections += 1;
+            queuedRays.push_back(QueuedRay { ray, stateHandles[i], entryDistances[lane], bvhInsertHandles[i] });
+            outResults[i] = {};
+        }
+        if (!queuedRays.empty())
+            m_pTaskGraph->enqueue(task, gsl::span<const QueuedRay>(queuedRays.data(), queuedRays.size()));
+    }
+
+    if (m_svdag) {
+        // Counted once per batch because updating the (atomic) counters for every ray is too expensive.
+        g_stats.svdag.numIntersectionTests += numRays;
+        g_stats.svdag.numRaysCulled += numCulled;
+    }
+}
+
 template <typename HitRayState, typename AnyHitRayState>
 bool BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersectInternal(
     RTCScene scene, Ray& ray, SurfaceInteraction& si) const
@@ -363,6 +668,166 @@ bool BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::
     rtcInitIntersectContext(&context);
     rtcIntersect1(scene, &context, &embreeRayHit);
 
+    return processHit(scene, embreeRayHit, ray, si);
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+template <typename F>
+void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersectStream(
+    RTCScene scene, gsl::span<const QueuedRay> rays, std::pmr::memory_resource* pMemoryResource, F&& f) const
+{
+    constexpr int packetSize = 16;
+    const size_t numPackets = (rays.size() + packetSize - 1) / packetSize;
+
+    std::pmr::vector<RTCRayHit16> packets(numPackets, pMemoryResource);
+    for (size_t packetIdx = 0; packetIdx < numPackets; packetIdx++) {
+        RTCRayHit16& packet = packets[packetIdx];
+        for (int lane = 0; lane < packetSize; lane++) {
+            const size_t i = packetIdx * packetSize + lane;
+            if (i < rays.size()) {
+                const auto& ray = rays[i];
+                packet.ray.org_x[lane] = ray.origin.x;
+                packet.ray.org_y[lane] = ray.origin.y;
+                packet.ray.org_z[lane] = ray.origin.z;
+                packet.ray.dir_x[lane] = ray.direction.x;
+                packet.ray.dir_y[lane] = ray.direction.y;
+                packet.ray.dir_z[lane] = ray.direction.z;
+                packet.ray.tnear[lane] = bottomLevelTnear(ray);
+                packet.ray.tfar[lane] = ray.tfar;
+            } else {
+                // Rays with tnear > tfar are inactive.
+                packet.ray.org_x[lane] = packet.ray.org_y[lane] = packet.ray.org_z[lane] = 0.0f;
+                packet.ray.dir_x[lane] = packet.ray.dir_y[lane] = packet.ray.dir_z[lane] = 1.0f;
+                packet.ray.tnear[lane] = 1.0f;
+                packet.ray.tfar[lane] = 0.0f;
+            }
+            packet.ray.time[lane] = 0.0f;
+            packet.ray.mask[lane] = 0xFFFFFFFF;
+            packet.ray.id[lane] = static_cast<unsigned>(i);
+            packet.ray.flags[lane] = 0;
+            packet.hit.geomID[lane] = RTC_INVALID_GEOMETRY_ID;
+            for (int level = 0; level < RTC_MAX_INSTANCE_LEVEL_COUNT; level++)
+                packet.hit.instID[level][lane] = RTC_INVALID_GEOMETRY_ID;
+        }
+    }
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+    rtcIntersectNM(scene, &context, reinterpret_cast<RTCRayHitN*>(packets.data()), packetSize, static_cast<unsigned>(numPackets), sizeof(RTCRayHit16));
+
+    for (size_t i = 0; i < rays.size(); i++) {
+        const RTCRayHit16& packet = packets[i / packetSize];
+        const int lane = static_cast<int>(i % packetSize);
+
+        RTCRayHit embreeRayHit;
+        embreeRayHit.ray.tfar = packet.ray.tfar[lane];
+        embreeRayHit.hit.Ng_x = packet.hit.Ng_x[lane];
+        embreeRayHit.hit.Ng_y = packet.hit.Ng_y[lane];
+        embreeRayHit.hit.Ng_z = packet.hit.Ng_z[lane];
+        embreeRayHit.hit.u = packet.hit.u[lane];
+        embreeRayHit.hit.v = packet.hit.v[lane];
+        embreeRayHit.hit.primID = packet.hit.primID[lane];
+        embreeRayHit.hit.geomID = packet.hit.geomID[lane];
+        for (int level = 0; level < RTC_MAX_INSTANCE_LEVEL_COUNT; level++)
+            embreeRayHit.hit.instID[level] = packet.hit.instID[level][lane];
+        f(i, embreeRayHit);
+    }
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+template <typename F>
+void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersectAnyStream(
+    RTCScene scene, gsl::span<const QueuedRay> rays, std::pmr::memory_resource* pMemoryResource, F&& f) const
+{
+    constexpr int packetSize = 16;
+    const size_t numPackets = (rays.size() + packetSize - 1) / packetSize;
+
+    std::pmr::vector<RTCRay16> packets(numPackets, pMemoryResource);
+    for (size_t packetIdx = 0; packetIdx < numPackets; packetIdx++) {
+        RTCRay16& packet = packets[packetIdx];
+        for (int lane = 0; lane < packetSize; lane++) {
+            const size_t i = packetIdx * packetSize + lane;
+            if (i < rays.size()) {
+                const auto& ray = rays[i];
+                packet.org_x[lane] = ray.origin.x;
+                packet.org_y[lane] = ray.origin.y;
+                packet.org_z[lane] = ray.origin.z;
+                packet.dir_x[lane] = ray.direction.x;
+                packet.dir_y[lane] = ray.direction.y;
+                packet.dir_z[lane] = ray.direction.z;
+                packet.tnear[lane] = bottomLevelTnear(ray);
+                packet.tfar[lane] = ray.tfar;
+            } else {
+                // Rays with tnear > tfar are inactive.
+                packet.org_x[lane] = packet.org_y[lane] = packet.org_z[lane] = 0.0f;
+                packet.dir_x[lane] = packet.dir_y[lane] = packet.dir_z[lane] = 1.0f;
+                packet.tnear[lane] = 1.0f;
+                packet.tfar[lane] = 0.0f;
+            }
+            packet.time[lane] = 0.0f;
+            packet.mask[lane] = 0xFFFFFFFF;
+            packet.id[lane] = static_cast<unsigned>(i);
+            packet.flags[lane] = 0;
+        }
+    }
+
+    RTCIntersectContext context;
+    rtcInitIntersectContext(&context);
+    context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+    rtcOccludedNM(scene, &context, reinterpret_cast<RTCRayN*>(packets.data()), packetSize, static_cast<unsigned>(numPackets), sizeof(RTCRay16));
+
+    static constexpr float minInf = -std::numeric_limits<float>::infinity();
+    for (size_t i = 0; i < rays.size(); i++)
+        f(i, packets[i / packetSize].tfar[i % packetSize] == minInf);
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+float BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::bottomLevelTnear(const QueuedRay& ray) const
+{
+    if (!m_svdag)
+        return ray.tnear;
+
+    // The entry distance is measured in units of the ray direction.
+    const float slack = m_svdag->voxelSize() / glm::length(ray.direction);
+    return std::max(ray.tnear, ray.entryDistance - slack);
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::sortRays(
+    gsl::span<QueuedRay> rays, std::pmr::memory_resource* pMemoryResource) const
+{
+    // Rays in the same octant that enter the batching point close to each other are likely to visit the same nodes of
+    //  the bottom-level BVH (and to end up in the same packet).
+    const glm::vec3 boundsMin = m_bounds.min;
+    const glm::vec3 invBoundsExtent = 1.0f / glm::max(m_bounds.extent(), glm::vec3(std::numeric_limits<float>::min()));
+
+    std::pmr::vector<std::pair<uint64_t, uint32_t>> keys { pMemoryResource };
+    keys.reserve(rays.size());
+    for (uint32_t i = 0; i < static_cast<uint32_t>(rays.size()); i++) {
+        const auto& ray = rays[i];
+
+        const glm::vec3 entryPoint = ray.origin + ray.entryDistance * ray.direction;
+        const glm::uvec3 gridPos(glm::clamp((entryPoint - boundsMin) * invBoundsExtent, 0.0f, 1.0f) * 1023.0f);
+        const uint64_t mortonCode = libmorton::morton3D_32_encode(
+            static_cast<uint_fast16_t>(gridPos.x), static_cast<uint_fast16_t>(gridPos.y), static_cast<uint_fast16_t>(gridPos.z));
+        const uint64_t octant = (ray.direction.x < 0 ? 1 : 0) | (ray.direction.y < 0 ? 2 : 0) | (ray.direction.z < 0 ? 4 : 0);
+
+        keys.push_back({ (octant << 30) | mortonCode, i });
+    }
+    std::sort(std::begin(keys), std::end(keys));
+
+    std::pmr::vector<QueuedRay> sortedRays { pMemoryResource };
+    sortedRays.reserve(rays.size());
+    for (const auto& [key, i] : keys)
+        sortedRays.push_back(rays[i]);
+    std::copy(std::begin(sortedRays), std::end(sortedRays), std::begin(rays));
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+bool BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::processHit(
+    RTCScene scene, const RTCRayHit& embreeRayHit, Ray& ray, SurfaceInteraction& si) const
+{
     static constexpr float minInf = -std::numeric_limits<float>::infinity();
     if (embreeRayHit.ray.tfar == minInf || embreeRayHit.ray.tfar == ray.tfar)
         return false;
@@ -436,6 +901,23 @@ bool BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::
     }
 }
 
+template <typename HitRayState, typename AnyHitRayState>
+bool BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersectInternal(
+    const PersistentBVH& bvh, Ray& ray, SurfaceInteraction& si) const
+{
+    if (!bvh.intersect(ray, si))
+        return false;
+
+    // Flip the normal if it is facing away from the ray.
+    if (glm::dot(si.normal, -ray.direction) < 0)
+        si.normal = -si.normal;
+    if (glm::dot(si.shading.normal, -ray.direction) < 0)
+        si.shading.normal = -si.shading.normal;
+
+    si.shading.batchingPointColor = m_color;
+    return true;
+}
+
 template <typename HitRayState, typename AnyHitRayState>
 bool BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint::intersectAnyInternal(
     RTCScene scene, Ray& ray) const
@@ -474,83 +956,53 @@ inline BatchingAccelerationStructure<HitRayState, AnyHitRayState> BatchingAccele
     OPTICK_EVENT();
     spdlog::info("Creating batching points");
 
+    std::unique_ptr<PersistentBVHCache> pPersistentBVHCache;
+    if (m_persistentBVHCacheBuilder)
+        pPersistentBVHCache = std::make_unique<PersistentBVHCache>(
+            std::move(m_persistentBVHs), *m_persistentBVHCacheBuilder, m_botLevelBVHCacheSize, m_pGeometryCache->memoryGovernor(), m_pGeometryCache);
+    auto getPersistentBVH = [&](size_t i) { return pPersistentBVHCache ? pPersistentBVHCache->get(i) : nullptr; };
+
     using BatchingPointT = typename BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingPoint;
     std::vector<BatchingPointT> batchingPoints;
-    if (m_svdagRes > 0) {
-        std::vector<std::optional<SparseVoxelDAG>> svdags;
-        svdags.resize(m_subScenes.size());
-
-        spdlog::info("Creating SVOs");
-
-        // TODO: make cache thread safe and update this code...
-        // Because the caches are not thread safe (yet) we have to load the data from the main thread..
-        // We keep track of how many threads are working so that we never load new data faster than we can process it.
-        const unsigned maxParallelism = std::max(1u, std::thread::hardware_concurrency() - 1);
-        std::atomic_uint parallelTasks { 0 };
-
-        tbb::task_group tg;
-        for (size_t i = 0; i < m_subScenes.size(); i++) {
-            while (parallelTasks.load(std::memory_order::memory_order_acquire) >= maxParallelism)
-                continue;
-
-            // Make resident sequentially
-            const auto& subScene = m_subScenes[i];
-            auto shapesOwningPtrs = detail::makeSubSceneResident(subScene, *m_pGeometryCache);
-
-            // Voxelize and create SVO in parallel
-            parallelTasks.fetch_add(1);
-            tg.run([i, &subScene, shapesOwningPtrs = std::move(shapesOwningPtrs), &svdags, &parallelTasks, this]() {
-                svdags[i] = detail::createSVDAGfromSubScene(subScene, m_svdagRes);
-                parallelTasks.fetch_sub(1);
-            });
-        }
-        tg.wait();
-
-        for (const auto& svdag : svdags)
-            g_stats.memory.svdagsBeforeCompression += svdag->sizeBytes();
-
-        spdlog::info("Compressing SVO to SVDAGs");
-        std::vector<SparseVoxelDAG*> pSvdags;
-        for (auto& svdag : svdags)
-            pSvdags.push_back(&svdag.value());
-        SparseVoxelDAG::compressDAGs(pSvdags);
-
-        for (const auto& svdag : svdags)
-            g_stats.memory.svdagsAfterCompression += svdag->sizeBytes();
-
+    if (!m_svdags.empty()) {
         for (size_t i = 0; i < m_subScenes.size(); i++) {
             auto& subScene = m_subScenes[i];
             auto shapes = detail::getSubSceneShapes(subScene);
-            batchingPoints.emplace_back(std::move(subScene), std::move(shapes), std::move(*svdags[i]), m_pGeometryCache, m_pTaskGraph);
+            batchingPoints.emplace_back(std::move(subScene), std::move(shapes), std::move(m_svdags[i]), m_pGeometryCache, m_pTaskGraph, getPersistentBVH(i));
         }
     } else {
-        for (auto& subScene : m_subScenes) {
+        for (size_t i = 0; i < m_subScenes.size(); i++) {
+            auto& subScene = m_subScenes[i];
             auto shapes = detail::getSubSceneShapes(subScene);
-            batchingPoints.emplace_back(std::move(subScene), std::move(shapes), m_pGeometryCache, m_pTaskGraph);
+            batchingPoints.emplace_back(std::move(subScene), std::move(shapes), m_pGeometryCache, m_pTaskGraph, getPersistentBVH(i));
         }
     }
 
     spdlog::info("Constructing top level BVH over {} batching points", batchingPoints.size());
 
     // Moves batching points into internal structure
-    PauseableBVH4<BatchingPointT, HitRayState, AnyHitRayState> topLevelBVH { batchingPoints };
+    typename BatchingAccelerationStructure<HitRayState, AnyHitRayState>::TopLevelBVH topLevelBVH { batchingPoints, m_topLevelTraversal };
     g_stats.scene.numBatchingPoints = batchingPoints.size();
     g_stats.memory.topBVH = topLevelBVH.sizeBytes();
     g_stats.memory.topBVHLeafs = batchingPoints.size() * sizeof(BatchingPointT);
     spdlog::info("PausableBVH constructed");
     return BatchingAccelerationStructure<HitRayState, AnyHitRayState>(
-        m_embreeDevice, std::move(topLevelBVH), hitTask, missTask, anyHitTask, anyMissTask, m_pGeometryCache, m_pTaskGraph, m_botLevelBVHCacheSize);
+        m_embreeDevice, std::move(topLevelBVH), hitTask, missTask, anyHitTask, anyMissTask, m_pGeometryCache, m_pTaskGraph, m_botLevelBVHCacheSize,
+        std::move(pPersistentBVHCache), m_sortRays);
 }
 
 template <typename HitRayState, typename AnyHitRayState>
 inline BatchingAccelerationStructure<HitRayState, AnyHitRayState>::BatchingAccelerationStructure(
-    RTCDevice embreeDevice, PauseableBVH4<BatchingPoint, HitRayState, AnyHitRayState>&& topLevelBVH,
+    RTCDevice embreeDevice, TopLevelBVH&& topLevelBVH,
     tasking::TaskHandle<std::tuple<Ray, SurfaceInteraction, HitRayState>> hitTask, tasking::TaskHandle<std::tuple<Ray, HitRayState>> missTask,
     tasking::TaskHandle<std::tuple<Ray, AnyHitRayState>> anyHitTask, tasking::TaskHandle<std::tuple<Ray, AnyHitRayState>> anyMissTask,
-    tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph, size_t embreeSceneCacheSize)
+    tasking::LRUCacheTS* pGeometryCache, tasking::TaskGraph* pTaskGraph, size_t embreeSceneCacheSize,
+    std::unique_ptr<PersistentBVHCache>&& pPersistentBVHCache, bool sortRays)
     : m_embreeDevice(embreeDevice)
     , m_topLevelBVH(std::move(topLevelBVH))
-    , m_embreeSceneCache(embreeSceneCacheSize)
+    , m_embreeSceneCache(embreeSceneCacheSize, pGeometryCache->memoryGovernor(), pGeometryCache)
+    , m_pPersistentBVHCache(std::move(pPersistentBVHCache))
+    , m_sortRays(sortRays)
     , m_pTaskGraph(pTaskGraph)
     , m_onHitTask(hitTask)
     , m_onMissTask(missTask)
@@ -572,15 +1024,13 @@ inline void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::intersec
 {
     auto stopWatch = g_stats.timings.topLevelTraversalTime.getScopedStopwatch();
 
+    auto [stateHandle, pRayData] = m_hitRayStates.allocate(HitRayData { SurfaceInteraction {}, state });
+
     auto mutRay = ray;
-    SurfaceInteraction si;
-    auto optHit = m_topLevelBVH.intersect(mutRay, si, state);
+    auto optHit = m_topLevelBVH.intersect(mutRay, pRayData->si, stateHandle);
     if (optHit) {
         assert(!optHit.value());
-        if (optHit.value())
-            m_pTaskGraph->enqueue(m_onHitTask, std::tuple { mutRay, si, state });
-        else
-            m_pTaskGraph->enqueue(m_onMissTask, std::tuple { mutRay, state });
+        exitHitRay(mutRay, stateHandle);
     }
 }
 
@@ -589,14 +1039,64 @@ inline void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::intersec
 {
     auto stopWatch = g_stats.timings.topLevelTraversalTime.getScopedStopwatch();
 
+    auto [stateHandle, pState] = m_anyHitRayStates.allocate(state);
+
     auto mutRay = ray;
-    auto optHit = m_topLevelBVH.intersectAny(mutRay, state);
+    auto optHit = m_topLevelBVH.intersectAny(mutRay, stateHandle);
     if (optHit) {
         assert(!optHit.value());
-        if (optHit.value())
-            m_pTaskGraph->enqueue(m_onAnyHitTask, std::tuple { mutRay, state });
-        else
-            m_pTaskGraph->enqueue(m_onAnyMissTask, std::tuple { mutRay, state });
+        exitAnyHitRay(mutRay, stateHandle, optHit.value());
     }
 }
+
+template <typename HitRayState, typename AnyHitRayState>
+inline void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::exitHitRay(const Ray& ray, RayStateHandle stateHandle) const
+{
+    const HitRayData rayData = m_hitRayStates.get(stateHandle);
+    m_hitRayStates.release(stateHandle);
+
+    if (rayData.si.pSceneObject)
+        m_pTaskGraph->enqueue(m_onHitTask, std::tuple { ray, rayData.si, rayData.state });
+    else
+        m_pTaskGraph->enqueue(m_onMissTask, std::tuple { ray, rayData.state });
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+inline void BatchingAccelerationStructure<HitRayState, AnyHitRayState>::exitAnyHitRay(const Ray& ray, RayStateHandle stateHandle, bool hit) const
+{
+    const AnyHitRayState state = m_anyHitRayStates.get(stateHandle);
+    m_anyHitRayStates.release(stateHandle);
+
+    if (hit)
+        m_pTaskGraph->enqueue(m_onAnyHitTask, std::tuple { ray, state });
+    else
+        m_pTaskGraph->enqueue(m_onAnyMissTask, std::tuple { ray, state });
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+inline BatchingAccelerationStructure<HitRayState, AnyHitRayState>::QueuedRay::QueuedRay(
+    const Ray& ray, RayStateHandle stateHandle, float entryDistance, const PauseableBVHInsertHandle& insertHandle)
+    : origin(ray.origin)
+    , direction(ray.direction)
+    , tnear(ray.tnear)
+    , tfar(ray.tfar)
+    , numTopLevelIntersections(static_cast<uint32_t>(ray.numTopLevelIntersections))
+    , stateHandle(stateHandle)
+    , entryDistance(entryDistance)
+    , insertNodeHandle(insertHandle.first)
+    , insertStack(insertHandle.second)
+{
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+inline Ray BatchingAccelerationStructure<HitRayState, AnyHitRayState>::QueuedRay::ray() const
+{
+    return Ray { origin, direction, tnear, tfar, numTopLevelIntersections };
+}
+
+template <typename HitRayState, typename AnyHitRayState>
+inline PauseableBVHInsertHandle BatchingAccelerationStructure<HitRayState, AnyHitRayState>::QueuedRay::insertHandle() const
+{
+    return { insertNodeHandle, insertStack };
+}
 }
\ No newline at end of file
@@ -51,7 +51,7 @@ inline flatbuffers::Offset<serialization::WiVeBVH8> WiVeBVH8<LeafObj>::serialize
 template <typename LeafObj>
 inline size_t WiVeBVH8<LeafObj>::sizeBytes() const
 {
-    return sizeof(decltype(*this)) + m_innerNodeAllocator.sizeBytes() + m_leafIndexAllocator.sizeBytes();
+    return sizeof(decltype(*this)) + m_innerNodeAllocator.sizeBytes() + m_leafIndexAllocator.sizeBytes() + m_leafObjects.capacity() * sizeof(LeafObj);
 }
 
 template <typename LeafObj>
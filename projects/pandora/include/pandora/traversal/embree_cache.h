@@ -3,14 +3,19 @@
 #include "pandora/graphics_core/pandora.h"
 #include "pandora/traversal/sub_scene.h"
 #include "stream/cache/lru_cache.h"
+#include "stream/cache/memory_governor.h"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <embree3/rtcore.h>
+#include <future>
 #include <glm/mat4x4.hpp>
-#include <list>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace pandora {
@@ -31,14 +36,37 @@ struct EmbreeSceneCache {
 public:
     //virtual std::shared_ptr<CachedEmbreeScene> fromSceneNode(const SceneNode* pSceneNode) = 0;
     virtual std::shared_ptr<CachedEmbreeScene> fromSubScene(const SubScene* pSubScene) = 0;
+
+    // Keep *pIsCached up to date with whether the BVH of the sub scene is in the cache (used to estimate the cost of
+    //  fromSubScene() without querying the cache). The flag must outlive the cache.
+    virtual void trackResidency(const SubScene* pSubScene, std::atomic_bool* pIsCached) = 0;
 };
 
-struct LRUEmbreeSceneCache : public EmbreeSceneCache {
+// Instanced scene nodes get cache items (keyed by the scene node) of their own that are shared by all sub scenes that
+//  instance them. A scene keeps the scenes that it instances alive, so an instanced scene is built once while any of its
+//  users is resident and is only evicted when none of them has used it for a while.
+//
+// Evicts scenes using GreedyDual-Size ("Cost-Aware WWW Proxy Caching Algorithms" by Cao and Irani): the priority of a
+//  scene is its build time per byte plus an inflation value that is raised to the priority of every evicted scene. Scenes
+//  that are expensive to rebuild relative to their size are kept longer, while scenes that are not used age out.
+struct LRUEmbreeSceneCache : public EmbreeSceneCache, public tasking::MemoryGovernor::Client {
 public:
-    LRUEmbreeSceneCache(size_t maxSize);
-    ~LRUEmbreeSceneCache();
+    // With a memory governor the cache shares the budget of the governor (instead of maxSize) with the other caches.
+    //  pGeometryCache is the cache that holds the geometry that the BVHs are built over.
+    LRUEmbreeSceneCache(size_t maxSize, tasking::MemoryGovernor* pMemoryGovernor = nullptr, const tasking::MemoryGovernor::Client* pGeometryCache = nullptr);
+    ~LRUEmbreeSceneCache() override;
 
     std::shared_ptr<CachedEmbreeScene> fromSubScene(const SubScene* pSubScene) override;
+    void trackResidency(const SubScene* pSubScene, std::atomic_bool* pIsCached) override;
+
+    size_t memoryUsage() const override;
+    size_t evictMemory(size_t memoryToFree) override;
+
+protected:
+    // Returns the cached scene or builds it. Concurrent requests for a scene that is being built wait for that build.
+    //  If the build throws then the exception is passed on to the waiting threads and the next request builds again.
+    template <typename F>
+    std::shared_ptr<CachedEmbreeScene> getOrBuild(const void* pKey, F&& createScene);
 
 private:
     std::shared_ptr<CachedEmbreeScene> fromSceneNode(const SceneNode* pSceneNode);
@@ -46,7 +74,13 @@ private:
     std::shared_ptr<CachedEmbreeScene> createEmbreeScene(const SceneNode* pSceneNode);
     std::shared_ptr<CachedEmbreeScene> createEmbreeScene(const SubScene* pSubScene);
 
+    struct CacheItem;
+    void restorePriority(CacheItem& item);
+    // Called with m_mutex held whenever an item is inserted into or erased from m_scenes.
+    void updateResidency(const void* pKey, bool isCached);
+
     void evict();
+    void evictUnused(size_t targetSize);
 
     static bool memoryMonitorCallback(void* pThisMem, ssize_t bytes, bool post);
     static int computeMaxInstanceDepthRecurse(const SceneNode* pNode, int depth = 0);
@@ -54,17 +88,118 @@ private:
 private:
     const size_t m_maxSize;
     std::atomic_size_t m_size { 0 };
+    tasking::MemoryGovernor* m_pMemoryGovernor;
 
+    // Protects m_scenes, m_residencyFlags and m_inflation (it is not held while scenes are being built).
     std::mutex m_mutex;
 
     struct CacheItem {
-        const void* pKey;
-        std::shared_ptr<CachedEmbreeScene> scene;
+        // Ready once the scene has been built.
+        std::shared_future<std::shared_ptr<CachedEmbreeScene>> scene;
+        bool isBuilt { false };
+        double priority { 0.0 };
+        double buildTime { 0.0 }; // Seconds
+        size_t sizeBytes { 1 };
+        // Keys of the scenes that are instanced by this scene.
+        std::vector<const void*> instancedScenes;
     };
-    std::list<CacheItem> m_scenes;
-    std::unordered_map<const void*, std::list<CacheItem>::iterator> m_lookUp;
+    std::unordered_map<const void*, CacheItem> m_scenes;
+    std::unordered_map<const void*, std::atomic_bool*> m_residencyFlags;
+    double m_inflation { 0.0 };
 
     RTCDevice m_embreeDevice;
+
+    // Build time and size of the scenes that were built by this thread while building the current scene. Child scenes
+    //  are built (by the same thread) while building their parent and have cache items of their own, so their cost
+    //  should not be counted twice.
+    static inline thread_local double t_nestedBuildTime = 0.0;
+    static inline thread_local int64_t t_nestedBuildSize = 0;
+    // Keys of the (instanced) scenes that are referenced by the scene that this thread is building.
+    static inline thread_local std::vector<const void*>* t_pInstancedScenes = nullptr;
 };
 
-}
\ No newline at end of file
+template <typename F>
+inline std::shared_ptr<CachedEmbreeScene> LRUEmbreeSceneCache::getOrBuild(const void* pKey, F&& createScene)
+{
+    if (t_pInstancedScenes)
+        t_pInstancedScenes->push_back(pKey);
+
+    std::promise<std::shared_ptr<CachedEmbreeScene>> buildPromise;
+    {
+        std::unique_lock l { m_mutex };
+        if (auto iter = m_scenes.find(pKey); iter != std::end(m_scenes)) {
+            auto& item = iter->second;
+            if (item.isBuilt) {
+                // The promise is fulfilled before the item is marked as built so this does not block.
+                restorePriority(item);
+                return item.scene.get();
+            }
+
+            // Another thread is building the scene: wait for it to finish (without holding the lock).
+            auto sceneFuture = item.scene;
+            l.unlock();
+            return sceneFuture.get();
+        }
+
+        CacheItem item;
+        item.scene = buildPromise.get_future().share();
+        m_scenes[pKey] = std::move(item);
+        updateResidency(pKey, true);
+    }
+
+    // Build without holding the lock so that misses on different scenes are built concurrently. Other builds may
+    //  allocate memory at the same time so the size is an estimate (it is only used to prioritize eviction).
+    const double outerNestedBuildTime = std::exchange(t_nestedBuildTime, 0.0);
+    const int64_t outerNestedBuildSize = std::exchange(t_nestedBuildSize, 0);
+    std::vector<const void*> instancedScenes;
+    auto* pOuterInstancedScenes = std::exchange(t_pInstancedScenes, &instancedScenes);
+    const size_t sizeBefore = m_size.load();
+    const auto buildStart = std::chrono::high_resolution_clock::now();
+
+    std::shared_ptr<CachedEmbreeScene> pScene;
+    try {
+        pScene = createScene();
+    } catch (...) {
+        {
+            std::lock_guard l { m_mutex };
+            m_scenes.erase(pKey);
+            updateResidency(pKey, false);
+        }
+        buildPromise.set_exception(std::current_exception());
+        t_nestedBuildTime = outerNestedBuildTime;
+        t_nestedBuildSize = outerNestedBuildSize;
+        t_pInstancedScenes = pOuterInstancedScenes;
+        throw;
+    }
+    t_pInstancedScenes = pOuterInstancedScenes;
+    // A scene node may be instanced many times by the same scene.
+    std::sort(std::begin(instancedScenes), std::end(instancedScenes));
+    instancedScenes.erase(std::unique(std::begin(instancedScenes), std::end(instancedScenes)), std::end(instancedScenes));
+
+    const double totalBuildTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - buildStart).count();
+    const int64_t totalBuildSize = static_cast<int64_t>(m_size.load()) - static_cast<int64_t>(sizeBefore);
+    const double buildTime = std::max(totalBuildTime - t_nestedBuildTime, 0.0);
+    const int64_t buildSize = std::max(totalBuildSize - t_nestedBuildSize, int64_t(1));
+    t_nestedBuildTime = outerNestedBuildTime + totalBuildTime;
+    t_nestedBuildSize = outerNestedBuildSize + totalBuildSize;
+
+    // Wake up the threads that are waiting for this build before another thread can see the item as built (and call
+    //  get() on its future while holding the lock).
+    buildPromise.set_value(pScene);
+    {
+        std::lock_guard l { m_mutex };
+        // Items that are being built are never evicted.
+        auto& item = m_scenes[pKey];
+        item.isBuilt = true;
+        item.buildTime = buildTime;
+        item.sizeBytes = static_cast<size_t>(buildSize);
+        item.instancedScenes = std::move(instancedScenes);
+        restorePriority(item);
+    }
+
+    if (m_pMemoryGovernor)
+        m_pMemoryGovernor->recordLoadTime(this, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(buildTime)));
+    return pScene;
+}
+
+}
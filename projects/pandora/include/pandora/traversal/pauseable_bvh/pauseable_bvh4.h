@@ -5,21 +5,44 @@
 #include "pandora/utility/contiguous_allocator_ts.h"
 #include "simd/intrinsics.h"
 #include "simd/simd4.h"
+#include "simd/simd8.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
 #include <embree3/rtcore.h>
+#include <gsl/span>
 #include <iostream>
 #include <limits>
+#include <memory_resource>
 #include <nmmintrin.h> // popcnt
 #include <optional>
 #include <spdlog/spdlog.h>
 #include <tbb/concurrent_vector.h>
 #include <tuple>
+#include <type_traits>
 
 namespace pandora {
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
+enum class PauseableBVHNodeLayout {
+    Full, // 32-bit floating point child bounds (112 bytes per node)
+    Quantized // 8-bit child bounds relative to the bounds of the node (64 bytes per node)
+};
+
+// How the traversal state of a paused ray is stored in the second half of its PauseableBVHInsertHandle.
+enum class PauseableBVHTraversal {
+    // 4 bits per level marking the children of the ancestors that still need to be visited.
+    ChildMask,
+    // Only the child slot of the current node that was visited last. The children of a node are visited in a fixed
+    //  order (by distance, or by slot for any hit rays) so the next child is found by testing the node again. Ancestors
+    //  are reached through the parent pointers and tested again as well.
+    ParentPointer
+};
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout = PauseableBVHNodeLayout::Full>
 class PauseableBVH4 : PauseableBVH<LeafObj, HitRayState, AnyHitRayState> {
 public:
-    PauseableBVH4(gsl::span<LeafObj> object);
+    PauseableBVH4(gsl::span<LeafObj> object, PauseableBVHTraversal traversal = PauseableBVHTraversal::ChildMask);
     PauseableBVH4(PauseableBVH4&&) = default;
     ~PauseableBVH4() = default;
 
@@ -34,18 +57,50 @@ public:
     std::optional<bool> intersectAny(Ray& ray, const AnyHitRayState& userState) const override final;
     std::optional<bool> intersectAny(Ray& ray, const AnyHitRayState& userState, PauseableBVHInsertHandle handle) const override final;
 
+    // Resume the traversal of a batch of paused rays (e.g. all rays that were flushed from the same leaf). Rays that are
+    //  at the same node are tested against its children together (8 rays per SIMD test) so that a node is fetched once
+    //  per group of rays rather than once per ray. Rays that reach the same leaf in a traversal step are handed to the
+    //  leaf together through LeafObj::intersectBatch / intersectAnyBatch, which report a result per ray with the same
+    //  meaning as the return value of LeafObj::intersect / intersectAny.
+    // onExit(i, hit) is called for every ray that exits the BVH. Rays that are paused by a leaf are not reported and
+    //  their ray / surface interaction / user state are not accessed after the ray was handed to the leaf.
+    template <typename F>
+    void intersectBatch(
+        gsl::span<Ray> rays, gsl::span<SurfaceInteraction* const> surfaceInteractions, gsl::span<const HitRayState> userStates,
+        gsl::span<const PauseableBVHInsertHandle> insertHandles, std::pmr::memory_resource* pMemoryResource, F&& onExit) const;
+    template <typename F>
+    void intersectAnyBatch(
+        gsl::span<Ray> rays, gsl::span<const AnyHitRayState> userStates,
+        gsl::span<const PauseableBVHInsertHandle> insertHandles, std::pmr::memory_resource* pMemoryResource, F&& onExit) const;
+
     gsl::span<LeafObj> leafs() { return m_leafs; }
 
 private:
+    struct SIMDRay;
     template <bool AnyHit, typename UserState>
     std::optional<bool> intersectT(Ray& ray, SurfaceInteraction& hitInfo, const UserState& userState, PauseableBVHInsertHandle insertInfo) const;
+    template <bool AnyHit, typename UserState>
+    std::optional<bool> intersectParentPointerT(Ray& ray, SurfaceInteraction& hitInfo, const UserState& userState, PauseableBVHInsertHandle insertInfo) const;
+    template <bool AnyHit, typename UserState, typename F>
+    void intersectBatchT(
+        gsl::span<Ray> rays, gsl::span<SurfaceInteraction* const> surfaceInteractions, gsl::span<const UserState> userStates,
+        gsl::span<const PauseableBVHInsertHandle> insertHandles, std::pmr::memory_resource* pMemoryResource, F&& onExit) const;
 
     struct TestBVHData {
         int numPrimitives = 0;
         int maxDepth = 0;
         std::array<int, 5> numChildrenHistogram = { 0, 0, 0, 0, 0 };
     };
-    struct BVHNode;
+    struct FullBVHNode;
+    struct QuantizedBVHNode;
+    using BVHNode = std::conditional_t<NodeLayout == PauseableBVHNodeLayout::Quantized, QuantizedBVHNode, FullBVHNode>;
+    static SIMDRay createSIMDRay(const Ray& ray);
+    static simd::mask4 intersectChildren(const BVHNode& node, const SIMDRay& ray, simd::vec4_f32& outDistances);
+
+    // Parent pointer traversal: returns the child to visit after lastChild (4 if there is none).
+    static constexpr uint64_t noChildVisited = 0xFFFFFFFFFFFFFFFF;
+    template <bool AnyHit>
+    static unsigned nextChild(uint32_t hitMask, const std::array<float, 4>& distances, uint64_t lastChild);
     void testBVH() const;
     void testBVHRecurse(const BVHNode* node, int depth, TestBVHData& out) const;
 
@@ -71,14 +126,30 @@ private:
         uint32_t leafID { 0 };
     };
 
-    struct alignas(16) BVHNode {
+    struct SIMDRay {
+        simd::vec4_f32 originX;
+        simd::vec4_f32 originY;
+        simd::vec4_f32 originZ;
+
+        simd::vec4_f32 invDirectionX;
+        simd::vec4_f32 invDirectionY;
+        simd::vec4_f32 invDirectionZ;
+
+        simd::vec4_f32 tnear;
+        simd::vec4_f32 tfar;
+    };
+
+    struct ChildBounds {
         simd::vec4_f32 minX;
         simd::vec4_f32 minY;
         simd::vec4_f32 minZ;
         simd::vec4_f32 maxX;
         simd::vec4_f32 maxY;
         simd::vec4_f32 maxZ;
+    };
 
+    // Topology of the tree; shared by all node layouts.
+    struct BVHNodeLinks {
         uint32_t firstChildHandle;
         uint32_t firstLeafHandle;
 
@@ -94,17 +165,52 @@ private:
 
         uint32_t getInnerChildHandle(unsigned childIdx) const;
         uint32_t getLeafChildHandle(unsigned childIdx) const;
+        unsigned getInnerChildIndex(uint32_t childHandle) const;
     };
-    static_assert(sizeof(BVHNode) <= 128);
+
+    struct alignas(16) FullBVHNode : public BVHNodeLinks {
+        simd::vec4_f32 minX;
+        simd::vec4_f32 minY;
+        simd::vec4_f32 minZ;
+        simd::vec4_f32 maxX;
+        simd::vec4_f32 maxY;
+        simd::vec4_f32 maxZ;
+
+        void setChildBounds(gsl::span<const Bounds> childBounds);
+        ChildBounds getChildBounds() const;
+    };
+    static_assert(sizeof(FullBVHNode) <= 128);
+
+    // Child bounds are stored as 8-bit offsets from the lower corner of the node bounds. The step size is a power of two
+    //  per axis so that dequantization is exact, and bounds are rounded outwards so that they always contain the child.
+    struct alignas(64) QuantizedBVHNode : public BVHNodeLinks {
+        glm::vec3 origin;
+        glm::vec3 scale;
+        std::array<uint8_t, 4> minX;
+        std::array<uint8_t, 4> minY;
+        std::array<uint8_t, 4> minZ;
+        std::array<uint8_t, 4> maxX;
+        std::array<uint8_t, 4> maxY;
+        std::array<uint8_t, 4> maxZ;
+
+        void setChildBounds(gsl::span<const Bounds> childBounds);
+        ChildBounds getChildBounds() const;
+
+    private:
+        static simd::vec4_f32 dequantize(const std::array<uint8_t, 4>& values, float origin, float scale);
+    };
+    static_assert(sizeof(QuantizedBVHNode) == 64);
 
     std::vector<BVHNode> m_bvhNodes;
     std::vector<LeafObj> m_leafs;
 
     uint32_t m_rootHandle;
+    PauseableBVHTraversal m_traversal;
 };
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::PauseableBVH4(gsl::span<LeafObj> leafs)
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::PauseableBVH4(gsl::span<LeafObj> leafs, PauseableBVHTraversal traversal)
+    : m_traversal(traversal)
 {
     // Create a representatin of the leafs that Embree will understand
     std::vector<RTCBuildPrimitive> embreeBuildPrimitives;
@@ -187,8 +293,8 @@ inline PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::PauseableBVH4(gsl::s
     testBVH();
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline size_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::sizeBytes() const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline size_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::sizeBytes() const
 {
     size_t size = sizeof(decltype(*this));
     size += m_bvhNodes.size() * sizeof(BVHNode);
@@ -196,62 +302,40 @@ inline size_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::sizeBytes() c
     return size;
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::intersect(Ray& ray, SurfaceInteraction& si, const HitRayState& userState) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersect(Ray& ray, SurfaceInteraction& si, const HitRayState& userState) const
 {
     return intersect(ray, si, userState, { m_rootHandle, 0xFFFFFFFFFFFFFFFF });
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::intersect(Ray& ray, SurfaceInteraction& si, const HitRayState& userState, PauseableBVHInsertHandle insertInfo) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersect(Ray& ray, SurfaceInteraction& si, const HitRayState& userState, PauseableBVHInsertHandle insertInfo) const
 {
     return intersectT<false, HitRayState>(ray, si, userState, insertInfo);
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::intersectAny(Ray& ray, const AnyHitRayState& userState) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersectAny(Ray& ray, const AnyHitRayState& userState) const
 {
     SurfaceInteraction dummySI {};
     return intersectT<true>(ray, dummySI, userState, { m_rootHandle, 0xFFFFFFFFFFFFFFFF });
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::intersectAny(Ray& ray, const AnyHitRayState& userState, PauseableBVHInsertHandle insertInfo) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersectAny(Ray& ray, const AnyHitRayState& userState, PauseableBVHInsertHandle insertInfo) const
 {
     SurfaceInteraction dummySI {};
     return intersectT<true>(ray, dummySI, userState, insertInfo);
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
 template <bool AnyHit, typename UserState>
-inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::intersectT(Ray& ray, SurfaceInteraction& si, const UserState& userState, PauseableBVHInsertHandle insertInfo) const
+inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersectT(Ray& ray, SurfaceInteraction& si, const UserState& userState, PauseableBVHInsertHandle insertInfo) const
 {
-    struct SIMDRay {
-        simd::vec4_f32 originX;
-        simd::vec4_f32 originY;
-        simd::vec4_f32 originZ;
+    if (m_traversal == PauseableBVHTraversal::ParentPointer)
+        return intersectParentPointerT<AnyHit>(ray, si, userState, insertInfo);
 
-        simd::vec4_f32 invDirectionX;
-        simd::vec4_f32 invDirectionY;
-        simd::vec4_f32 invDirectionZ;
-
-        simd::vec4_f32 tnear;
-        simd::vec4_f32 tfar;
-    };
-    const glm::vec3 invDir = 1.0f / ray.direction;
-
-    SIMDRay simdRay;
-    simdRay.originX = simd::vec4_f32(ray.origin.x);
-    simdRay.originY = simd::vec4_f32(ray.origin.y);
-    simdRay.originZ = simd::vec4_f32(ray.origin.z);
-    simdRay.invDirectionX = simd::vec4_f32(invDir.x);
-    simdRay.invDirectionY = simd::vec4_f32(invDir.y);
-    simdRay.invDirectionZ = simd::vec4_f32(invDir.z);
-    //simdRay.invDirectionX = simd::vec4_f32(ray.direction.x == 0.0f ? std::numeric_limits<float>::infinity() : 1.0f / ray.direction.x);
-    //simdRay.invDirectionY = simd::vec4_f32(ray.direction.y == 0.0f ? std::numeric_limits<float>::infinity() : 1.0f / ray.direction.y);
-    //simdRay.invDirectionZ = simd::vec4_f32(ray.direction.z == 0.0f ? std::numeric_limits<float>::infinity() : 1.0f / ray.direction.z);
-    simdRay.tnear = simd::vec4_f32(ray.tnear);
-    simdRay.tfar = simd::vec4_f32(ray.tfar);
+    SIMDRay simdRay = createSIMDRay(ray);
 
     // Stack
     bool hit = false;
@@ -260,7 +344,7 @@ inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::
     while (true) {
         // Get traversal bits at the current depth
         int bitPos = 4 * node->depth;
-        uint64_t interestBitMask = (stack >> bitPos) & 0b1111;
+        uint64_t interestBitMask = (stack >> bitPos) & node->validMask;
         if (interestBitMask != 0) {
             // clang-format off
             const simd::mask4 interestMask(
@@ -271,21 +355,8 @@ inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::
             // clang-format on
 
             // Find the nearest intersection of hte ray and the child boxes
-            const simd::vec4_f32 tx1 = (node->minX - simdRay.originX) * simdRay.invDirectionX;
-            const simd::vec4_f32 tx2 = (node->maxX - simdRay.originX) * simdRay.invDirectionX;
-            const simd::vec4_f32 ty1 = (node->minY - simdRay.originY) * simdRay.invDirectionY;
-            const simd::vec4_f32 ty2 = (node->maxY - simdRay.originY) * simdRay.invDirectionY;
-            const simd::vec4_f32 tz1 = (node->minZ - simdRay.originZ) * simdRay.invDirectionZ;
-            const simd::vec4_f32 tz2 = (node->maxZ - simdRay.originZ) * simdRay.invDirectionZ;
-            const simd::vec4_f32 txMin = simd::min(tx1, tx2);
-            const simd::vec4_f32 tyMin = simd::min(ty1, ty2);
-            const simd::vec4_f32 tzMin = simd::min(tz1, tz2);
-            const simd::vec4_f32 txMax = simd::max(tx1, tx2);
-            const simd::vec4_f32 tyMax = simd::max(ty1, ty2);
-            const simd::vec4_f32 tzMax = simd::max(tz1, tz2);
-            const simd::vec4_f32 tmin = simd::max(simdRay.tnear, simd::max(txMin, simd::max(tyMin, tzMin)));
-            const simd::vec4_f32 tmax = simd::min(simdRay.tfar, simd::min(txMax, simd::min(tyMax, tzMax)));
-            const simd::mask4 hitMask = tmin <= tmax;
+            simd::vec4_f32 tmin;
+            const simd::mask4 hitMask = intersectChildren(*node, simdRay, tmin);
 
             const simd::mask4 toVisitMask = hitMask && interestMask;
             if (toVisitMask.any()) {
@@ -354,8 +425,420 @@ inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::
     return hit;
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::testBVH() const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+template <bool AnyHit, typename UserState>
+inline std::optional<bool> PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersectParentPointerT(Ray& ray, SurfaceInteraction& si, const UserState& userState, PauseableBVHInsertHandle insertInfo) const
+{
+    SIMDRay simdRay = createSIMDRay(ray);
+
+    bool hit = false;
+    auto [nodeHandle, lastChild] = insertInfo;
+    while (true) {
+        const BVHNode* node = &m_bvhNodes[nodeHandle];
+
+        simd::vec4_f32 tmin;
+        const simd::mask4 hitMask = intersectChildren(*node, simdRay, tmin);
+        std::array<float, 4> distances;
+        tmin.store(distances);
+
+        const unsigned childIndex = nextChild<AnyHit>(hitMask.bitMask() & node->validMask, distances, lastChild);
+        if (childIndex < 4) {
+            if (node->isInnerNode(childIndex)) {
+                nodeHandle = node->getInnerChildHandle(childIndex);
+                lastChild = noChildVisited;
+                continue;
+            }
+
+            // Reached leaf
+            lastChild = childIndex;
+            const auto& leaf = m_leafs[node->getLeafChildHandle(childIndex)];
+            if constexpr (AnyHit) {
+                auto optResult = leaf.intersectAny(ray, userState, { nodeHandle, lastChild });
+                if (!optResult)
+                    return {}; // Ray was paused
+
+                if (*optResult)
+                    return true;
+            } else {
+                auto optResult = leaf.intersect(ray, si, userState, { nodeHandle, lastChild });
+                if (!optResult)
+                    return {}; // Ray was paused
+
+                if (*optResult) {
+                    hit = true;
+                    simdRay.tfar = simd::vec4_f32(ray.tfar);
+                }
+            }
+            continue;
+        }
+
+        // No children left to visit; continue with the siblings of this node.
+        if (node->depth == 0)
+            break;
+
+        const BVHNode* parent = &m_bvhNodes[node->parentHandle];
+        lastChild = parent->getInnerChildIndex(nodeHandle);
+        nodeHandle = node->parentHandle;
+    }
+
+    return hit;
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline typename PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::SIMDRay PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::createSIMDRay(const Ray& ray)
+{
+    const glm::vec3 invDir = 1.0f / ray.direction;
+
+    SIMDRay simdRay;
+    simdRay.originX = simd::vec4_f32(ray.origin.x);
+    simdRay.originY = simd::vec4_f32(ray.origin.y);
+    simdRay.originZ = simd::vec4_f32(ray.origin.z);
+    simdRay.invDirectionX = simd::vec4_f32(invDir.x);
+    simdRay.invDirectionY = simd::vec4_f32(invDir.y);
+    simdRay.invDirectionZ = simd::vec4_f32(invDir.z);
+    simdRay.tnear = simd::vec4_f32(ray.tnear);
+    simdRay.tfar = simd::vec4_f32(ray.tfar);
+    return simdRay;
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline simd::mask4 PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersectChildren(const BVHNode& node, const SIMDRay& simdRay, simd::vec4_f32& outDistances)
+{
+    const ChildBounds childBounds = node.getChildBounds();
+    const simd::vec4_f32 tx1 = (childBounds.minX - simdRay.originX) * simdRay.invDirectionX;
+    const simd::vec4_f32 tx2 = (childBounds.maxX - simdRay.originX) * simdRay.invDirectionX;
+    const simd::vec4_f32 ty1 = (childBounds.minY - simdRay.originY) * simdRay.invDirectionY;
+    const simd::vec4_f32 ty2 = (childBounds.maxY - simdRay.originY) * simdRay.invDirectionY;
+    const simd::vec4_f32 tz1 = (childBounds.minZ - simdRay.originZ) * simdRay.invDirectionZ;
+    const simd::vec4_f32 tz2 = (childBounds.maxZ - simdRay.originZ) * simdRay.invDirectionZ;
+    const simd::vec4_f32 txMin = simd::min(tx1, tx2);
+    const simd::vec4_f32 tyMin = simd::min(ty1, ty2);
+    const simd::vec4_f32 tzMin = simd::min(tz1, tz2);
+    const simd::vec4_f32 txMax = simd::max(tx1, tx2);
+    const simd::vec4_f32 tyMax = simd::max(ty1, ty2);
+    const simd::vec4_f32 tzMax = simd::max(tz1, tz2);
+    const simd::vec4_f32 tmin = simd::max(simdRay.tnear, simd::max(txMin, simd::max(tyMin, tzMin)));
+    const simd::vec4_f32 tmax = simd::min(simdRay.tfar, simd::min(txMax, simd::min(tyMax, tzMax)));
+    outDistances = tmin;
+    return tmin <= tmax;
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+template <bool AnyHit>
+inline unsigned PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::nextChild(uint32_t hitMask, const std::array<float, 4>& distances, uint64_t lastChild)
+{
+    // Children are ordered by (distance, slot) for closest hit rays and by slot for any hit rays. The distance of the
+    //  last visited child is computed exactly the same as before, so it can be used to continue where the ray left off.
+    unsigned result = 4;
+    for (unsigned childIdx = 0; childIdx < 4; childIdx++) {
+        if (!(hitMask & (1 << childIdx)))
+            continue;
+
+        if constexpr (AnyHit) {
+            if (lastChild == noChildVisited || childIdx > lastChild)
+                return childIdx;
+        } else {
+            if (lastChild != noChildVisited) {
+                const float lastDistance = distances[lastChild];
+                if (distances[childIdx] < lastDistance || (distances[childIdx] == lastDistance && childIdx <= lastChild))
+                    continue;
+            }
+            if (result == 4 || distances[childIdx] < distances[result])
+                result = childIdx;
+        }
+    }
+    return result;
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+template <typename F>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersectBatch(
+    gsl::span<Ray> rays, gsl::span<SurfaceInteraction* const> surfaceInteractions, gsl::span<const HitRayState> userStates,
+    gsl::span<const PauseableBVHInsertHandle> insertHandles, std::pmr::memory_resource* pMemoryResource, F&& onExit) const
+{
+    intersectBatchT<false, HitRayState>(rays, surfaceInteractions, userStates, insertHandles, pMemoryResource, onExit);
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+template <typename F>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersectAnyBatch(
+    gsl::span<Ray> rays, gsl::span<const AnyHitRayState> userStates,
+    gsl::span<const PauseableBVHInsertHandle> insertHandles, std::pmr::memory_resource* pMemoryResource, F&& onExit) const
+{
+    intersectBatchT<true, AnyHitRayState>(rays, {}, userStates, insertHandles, pMemoryResource, onExit);
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+template <bool AnyHit, typename UserState, typename F>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::intersectBatchT(
+    gsl::span<Ray> rays, gsl::span<SurfaceInteraction* const> surfaceInteractions, gsl::span<const UserState> userStates,
+    gsl::span<const PauseableBVHInsertHandle> insertHandles, std::pmr::memory_resource* pMemoryResource, F&& onExit) const
+{
+    assert(userStates.size() == rays.size() && insertHandles.size() == rays.size());
+    assert(AnyHit || surfaceInteractions.size() == rays.size());
+
+    struct TraversalState {
+        uint32_t nodeHandle;
+        uint64_t stack; // Or the last visited child for parent pointer traversal
+        glm::vec3 invDirection;
+        bool hit;
+    };
+    std::pmr::vector<TraversalState> traversalStates { pMemoryResource };
+    traversalStates.reserve(rays.size());
+
+    // Rays that still need to take a traversal step, sorted by the node they are at at the start of every round.
+    //  The node handle is stored in the upper 32 bits and the ray index in the lower 32 bits.
+    const auto makeKey = [](uint32_t nodeHandle, uint32_t rayIdx) { return (static_cast<uint64_t>(nodeHandle) << 32) | rayIdx; };
+    std::pmr::vector<uint64_t> activeRays { pMemoryResource };
+    std::pmr::vector<uint64_t> nextActiveRays { pMemoryResource };
+    activeRays.reserve(rays.size());
+    nextActiveRays.reserve(rays.size());
+
+    // Rays that reached a leaf during the current round (leaf handle in the upper 32 bits and ray index in the lower 32
+    //  bits) and the buffers used to hand them to the leaf.
+    std::pmr::vector<uint64_t> leafVisits { pMemoryResource };
+    std::pmr::vector<Ray*> leafRays { pMemoryResource };
+    std::pmr::vector<SurfaceInteraction*> leafSurfaceInteractions { pMemoryResource };
+    std::pmr::vector<UserState> leafUserStates { pMemoryResource };
+    std::pmr::vector<PauseableBVHInsertHandle> leafInsertHandles { pMemoryResource };
+    std::pmr::vector<std::optional<bool>> leafResults { pMemoryResource };
+    for (uint32_t i = 0; i < static_cast<uint32_t>(rays.size()); i++) {
+        const auto [nodeHandle, stack] = insertHandles[i];
+        traversalStates.push_back({ nodeHandle, stack, 1.0f / rays[i].direction, false });
+        activeRays.push_back(makeKey(nodeHandle, i));
+    }
+
+    // No children left to visit; find the first ancestor that has work left. Only the depth and parent handle of the
+    //  ancestors are needed to do so, the bounds are tested when the ray takes its next traversal step.
+    const auto ascend = [&](uint32_t rayIdx, const BVHNode* node) {
+        auto& traversalState = traversalStates[rayIdx];
+        if (m_traversal == PauseableBVHTraversal::ParentPointer) {
+            if (node->depth == 0) {
+                if constexpr (AnyHit)
+                    onExit(rayIdx, false);
+                else
+                    onExit(rayIdx, traversalState.hit);
+                return;
+            }
+
+            const BVHNode* parent = &m_bvhNodes[node->parentHandle];
+            traversalState.stack = parent->getInnerChildIndex(traversalState.nodeHandle);
+            traversalState.nodeHandle = node->parentHandle;
+            nextActiveRays.push_back(makeKey(traversalState.nodeHandle, rayIdx));
+            return;
+        }
+
+        while (true) {
+            // Set all bits after bitPos to 1
+            traversalState.stack |= (0xFFFFFFFFFFFFFFFF << (4 * node->depth));
+            if (traversalState.stack == 0xFFFFFFFFFFFFFFFF) {
+                if constexpr (AnyHit)
+                    onExit(rayIdx, false);
+                else
+                    onExit(rayIdx, traversalState.hit);
+                return;
+            }
+
+            traversalState.nodeHandle = node->parentHandle;
+            node = &m_bvhNodes[traversalState.nodeHandle];
+            if (((traversalState.stack >> (4 * node->depth)) & node->validMask) != 0) {
+                nextActiveRays.push_back(makeKey(traversalState.nodeHandle, rayIdx));
+                return;
+            }
+        }
+    };
+
+    constexpr size_t packetSize = 8;
+    while (!activeRays.empty()) {
+        std::sort(std::begin(activeRays), std::end(activeRays));
+        nextActiveRays.clear();
+
+        for (size_t groupStart = 0; groupStart < activeRays.size();) {
+            const uint32_t nodeHandle = static_cast<uint32_t>(activeRays[groupStart] >> 32);
+            size_t groupEnd = groupStart + 1;
+            while (groupEnd < activeRays.size() && static_cast<uint32_t>(activeRays[groupEnd] >> 32) == nodeHandle)
+                groupEnd++;
+
+            const BVHNode* node = &m_bvhNodes[nodeHandle];
+            const ChildBounds childBounds = node->getChildBounds();
+            std::array<float, 4> minX, minY, minZ, maxX, maxY, maxZ;
+            childBounds.minX.store(minX);
+            childBounds.minY.store(minY);
+            childBounds.minZ.store(minZ);
+            childBounds.maxX.store(maxX);
+            childBounds.maxY.store(maxY);
+            childBounds.maxZ.store(maxZ);
+            const int bitPos = 4 * node->depth;
+
+            for (size_t packetStart = groupStart; packetStart < groupEnd; packetStart += packetSize) {
+                const size_t numLanes = std::min(groupEnd - packetStart, packetSize);
+
+                // Gather the rays into SIMD registers. Unused lanes repeat the first ray and are ignored afterwards.
+                std::array<uint32_t, packetSize> rayIndices;
+                std::array<float, packetSize> originX, originY, originZ, invDirectionX, invDirectionY, invDirectionZ, tnear, tfar;
+                for (size_t lane = 0; lane < packetSize; lane++) {
+                    const uint32_t rayIdx = static_cast<uint32_t>(activeRays[packetStart + (lane < numLanes ? lane : 0)]);
+                    const Ray& ray = rays[rayIdx];
+                    const glm::vec3 invDirection = traversalStates[rayIdx].invDirection;
+                    rayIndices[lane] = rayIdx;
+                    originX[lane] = ray.origin.x;
+                    originY[lane] = ray.origin.y;
+                    originZ[lane] = ray.origin.z;
+                    invDirectionX[lane] = invDirection.x;
+                    invDirectionY[lane] = invDirection.y;
+                    invDirectionZ[lane] = invDirection.z;
+                    tnear[lane] = ray.tnear;
+                    tfar[lane] = ray.tfar;
+                }
+                simd::vec8_f32 simdOriginX, simdOriginY, simdOriginZ, simdInvDirectionX, simdInvDirectionY, simdInvDirectionZ, simdTnear, simdTfar;
+                simdOriginX.load(originX);
+                simdOriginY.load(originY);
+                simdOriginZ.load(originZ);
+                simdInvDirectionX.load(invDirectionX);
+                simdInvDirectionY.load(invDirectionY);
+                simdInvDirectionZ.load(invDirectionZ);
+                simdTnear.load(tnear);
+                simdTfar.load(tfar);
+
+                // Test the packet against each of the children of the node.
+                std::array<int, 4> childHitMasks { 0, 0, 0, 0 };
+                std::array<std::array<float, packetSize>, 4> childDistances {};
+                for (unsigned childIdx = 0; childIdx < 4; childIdx++) {
+                    if (!(node->validMask & (1 << childIdx)))
+                        continue;
+
+                    const simd::vec8_f32 tx1 = (simd::vec8_f32(minX[childIdx]) - simdOriginX) * simdInvDirectionX;
+                    const simd::vec8_f32 tx2 = (simd::vec8_f32(maxX[childIdx]) - simdOriginX) * simdInvDirectionX;
+                    const simd::vec8_f32 ty1 = (simd::vec8_f32(minY[childIdx]) - simdOriginY) * simdInvDirectionY;
+                    const simd::vec8_f32 ty2 = (simd::vec8_f32(maxY[childIdx]) - simdOriginY) * simdInvDirectionY;
+                    const simd::vec8_f32 tz1 = (simd::vec8_f32(minZ[childIdx]) - simdOriginZ) * simdInvDirectionZ;
+                    const simd::vec8_f32 tz2 = (simd::vec8_f32(maxZ[childIdx]) - simdOriginZ) * simdInvDirectionZ;
+                    const simd::vec8_f32 tmin = simd::max(simdTnear, simd::max(simd::min(tx1, tx2), simd::max(simd::min(ty1, ty2), simd::min(tz1, tz2))));
+                    const simd::vec8_f32 tmax = simd::min(simdTfar, simd::min(simd::max(tx1, tx2), simd::min(simd::max(ty1, ty2), simd::max(tz1, tz2))));
+                    childHitMasks[childIdx] = (tmin <= tmax).bitMask();
+                    tmin.store(childDistances[childIdx]);
+                }
+
+                // Take a traversal step for each ray in the packet.
+                for (size_t lane = 0; lane < numLanes; lane++) {
+                    const uint32_t rayIdx = rayIndices[lane];
+                    auto& traversalState = traversalStates[rayIdx];
+
+                    uint32_t hitBitMask = 0;
+                    for (unsigned childIdx = 0; childIdx < 4; childIdx++)
+                        hitBitMask |= static_cast<uint32_t>((childHitMasks[childIdx] >> lane) & 0x1) << childIdx;
+
+                    unsigned childIndex;
+                    if (m_traversal == PauseableBVHTraversal::ParentPointer) {
+                        const std::array<float, 4> distances {
+                            childDistances[0][lane], childDistances[1][lane], childDistances[2][lane], childDistances[3][lane]
+                        };
+                        childIndex = nextChild<AnyHit>(hitBitMask, distances, traversalState.stack);
+                        if (childIndex == 4) {
+                            ascend(rayIdx, node);
+                            continue;
+                        }
+                        traversalState.stack = node->isInnerNode(childIndex) ? noChildVisited : childIndex;
+                    } else {
+                        const uint64_t interestBitMask = (traversalState.stack >> bitPos) & node->validMask;
+                        uint64_t toVisitBitMask = hitBitMask & interestBitMask;
+                        if (toVisitBitMask == 0) {
+                            ascend(rayIdx, node);
+                            continue;
+                        }
+
+                        // Find nearest active child for this ray
+                        if constexpr (AnyHit) {
+                            childIndex = simd::bitScan4(toVisitBitMask);
+                        } else {
+                            float minDistance = std::numeric_limits<float>::max();
+                            childIndex = 0;
+                            for (unsigned childIdx = 0; childIdx < 4; childIdx++) {
+                                if ((toVisitBitMask & (1llu << childIdx)) && childDistances[childIdx][lane] < minDistance) {
+                                    minDistance = childDistances[childIdx][lane];
+                                    childIndex = childIdx;
+                                }
+                            }
+                        }
+
+                        toVisitBitMask ^= (1llu << childIndex); // Set the bit of the child we are visiting to 0
+                        traversalState.stack ^= (interestBitMask << bitPos); // Set the bits in the stack corresponding to the current node to 0
+                        traversalState.stack |= (toVisitBitMask << bitPos); // And replace them by the new mask
+                    }
+
+                    if (node->isInnerNode(childIndex)) {
+                        traversalState.nodeHandle = node->getInnerChildHandle(childIndex);
+                        nextActiveRays.push_back(makeKey(traversalState.nodeHandle, rayIdx));
+                        continue;
+                    }
+
+                    // Reached leaf
+                    leafVisits.push_back(makeKey(node->getLeafChildHandle(childIndex), rayIdx));
+                }
+            }
+
+            groupStart = groupEnd;
+        }
+
+        // Hand the rays to the leafs they reached, all rays that reached the same leaf at once. The traversal state of
+        //  these rays was not changed after visiting the leaf so it is also the state at which they resume.
+        std::sort(std::begin(leafVisits), std::end(leafVisits));
+        for (size_t visitStart = 0; visitStart < leafVisits.size();) {
+            const uint32_t leafHandle = static_cast<uint32_t>(leafVisits[visitStart] >> 32);
+            size_t visitEnd = visitStart + 1;
+            while (visitEnd < leafVisits.size() && static_cast<uint32_t>(leafVisits[visitEnd] >> 32) == leafHandle)
+                visitEnd++;
+
+            leafRays.clear();
+            leafSurfaceInteractions.clear();
+            leafUserStates.clear();
+            leafInsertHandles.clear();
+            for (size_t i = visitStart; i < visitEnd; i++) {
+                const uint32_t rayIdx = static_cast<uint32_t>(leafVisits[i]);
+                const auto& traversalState = traversalStates[rayIdx];
+                leafRays.push_back(&rays[rayIdx]);
+                if constexpr (!AnyHit)
+                    leafSurfaceInteractions.push_back(surfaceInteractions[rayIdx]);
+                leafUserStates.push_back(userStates[rayIdx]);
+                leafInsertHandles.push_back({ traversalState.nodeHandle, traversalState.stack });
+            }
+            leafResults.assign(visitEnd - visitStart, std::optional<bool> {});
+
+            const auto& leaf = m_leafs[leafHandle];
+            if constexpr (AnyHit)
+                leaf.intersectAnyBatch(leafRays, leafUserStates, leafInsertHandles, leafResults);
+            else
+                leaf.intersectBatch(leafRays, leafSurfaceInteractions, leafUserStates, leafInsertHandles, leafResults);
+
+            for (size_t i = visitStart; i < visitEnd; i++) {
+                const uint32_t rayIdx = static_cast<uint32_t>(leafVisits[i]);
+                auto& traversalState = traversalStates[rayIdx];
+                const auto& optResult = leafResults[i - visitStart];
+                if (!optResult)
+                    continue; // Ray was paused
+
+                if constexpr (AnyHit) {
+                    if (*optResult) {
+                        onExit(rayIdx, true);
+                        continue;
+                    }
+                } else {
+                    if (*optResult)
+                        traversalState.hit = true;
+                }
+                nextActiveRays.push_back(makeKey(traversalState.nodeHandle, rayIdx));
+            }
+
+            visitStart = visitEnd;
+        }
+        leafVisits.clear();
+
+        std::swap(activeRays, nextActiveRays);
+    }
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::testBVH() const
 {
     TestBVHData results;
     testBVHRecurse(&m_bvhNodes[m_rootHandle], 0, results);
@@ -371,8 +854,8 @@ inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::testBVH() const
     std::cout << std::endl;
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::testBVHRecurse(const BVHNode* node, int depth, TestBVHData& out) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::testBVHRecurse(const BVHNode* node, int depth, TestBVHData& out) const
 {
     unsigned numChildrenReference = 0;
     for (unsigned childIdx = 0; childIdx < 4; childIdx++) {
@@ -394,8 +877,8 @@ inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::testBVHRecurse(
     out.numChildrenHistogram[numChildren]++;
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::generateFinalBVH(ConstructionInnerNode* node, gsl::span<LeafObj> leafs)
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::generateFinalBVH(ConstructionInnerNode* node, gsl::span<LeafObj> leafs)
 {
     // Allocate root node
     uint32_t handle { 0 };
@@ -407,32 +890,15 @@ inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::generateFin
     return handle;
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::generateFinalBVHRecurse(ConstructionInnerNode* constructionInnerNode, uint32_t parentHandle, uint32_t depth, uint32_t outHandle, gsl::span<LeafObj> leafs)
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::generateFinalBVHRecurse(ConstructionInnerNode* constructionInnerNode, uint32_t parentHandle, uint32_t depth, uint32_t outHandle, gsl::span<LeafObj> leafs)
 {
     assert(constructionInnerNode->children.size() == constructionInnerNode->childrenBounds.size());
     BVHNode& outNode = m_bvhNodes[outHandle];
 
     // Copy the bounding boxes
-    std::array<float, 4> minX, minY, minZ, maxX, maxY, maxZ;
-    for (size_t i = 0; i < constructionInnerNode->children.size(); i++) {
-        const auto& childBounds = constructionInnerNode->childrenBounds[i];
-        minX[i] = childBounds.min.x;
-        minY[i] = childBounds.min.y;
-        minZ[i] = childBounds.min.z;
-        maxX[i] = childBounds.max.x;
-        maxY[i] = childBounds.max.y;
-        maxZ[i] = childBounds.max.z;
-    }
-    for (size_t i = constructionInnerNode->children.size(); i < 4; i++) {
-        minX[i] = minY[i] = minZ[i] = maxX[i] = maxY[i] = maxZ[i] = 0.0f;
-    }
-    outNode.minX.load(minX);
-    outNode.minY.load(minY);
-    outNode.minZ.load(minZ);
-    outNode.maxX.load(maxX);
-    outNode.maxY.load(maxY);
-    outNode.maxZ.load(maxZ);
+    const auto& childrenBounds = constructionInnerNode->childrenBounds;
+    outNode.setChildBounds(gsl::span<const Bounds>(childrenBounds.data(), childrenBounds.size()));
 
     outNode.depth = depth;
     outNode.parentHandle = parentHandle;
@@ -482,16 +948,16 @@ inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::generateFinalBV
     }
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline void* PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::innerNodeCreate(RTCThreadLocalAllocator alloc, unsigned numChildren, void* userPtr)
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void* PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::innerNodeCreate(RTCThreadLocalAllocator alloc, unsigned numChildren, void* userPtr)
 {
     auto ptr = rtcThreadLocalAlloc(alloc, sizeof(ConstructionInnerNode), 8);
     new (ptr) ConstructionInnerNode();
     return ptr;
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::innerNodeSetChildren(void* nodePtr, void** childPtr, unsigned numChildren, void* userPtr)
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::innerNodeSetChildren(void* nodePtr, void** childPtr, unsigned numChildren, void* userPtr)
 {
     assert(numChildren <= 4);
 
@@ -502,8 +968,8 @@ inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::innerNodeSetChi
     }
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::innerNodeSetBounds(void* nodePtr, const RTCBounds** embreeBounds, unsigned numChildren, void* userPtr)
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::innerNodeSetBounds(void* nodePtr, const RTCBounds** embreeBounds, unsigned numChildren, void* userPtr)
 {
     assert(numChildren <= 4);
 
@@ -521,8 +987,8 @@ inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::innerNodeSetBou
     }
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline void* PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::leafCreate(RTCThreadLocalAllocator alloc, const RTCBuildPrimitive* prims, size_t numPrims, void* userPtr)
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void* PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::leafCreate(RTCThreadLocalAllocator alloc, const RTCBuildPrimitive* prims, size_t numPrims, void* userPtr)
 {
     assert(numPrims == 1);
 
@@ -532,38 +998,147 @@ inline void* PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::leafCreate(RTC
     return pLeafNode;
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::BVHNode::numChildren() const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::FullBVHNode::setChildBounds(gsl::span<const Bounds> childBounds)
+{
+    assert(childBounds.size() <= 4);
+
+    std::array<float, 4> minX, minY, minZ, maxX, maxY, maxZ;
+    for (size_t i = 0; i < childBounds.size(); i++) {
+        minX[i] = childBounds[i].min.x;
+        minY[i] = childBounds[i].min.y;
+        minZ[i] = childBounds[i].min.z;
+        maxX[i] = childBounds[i].max.x;
+        maxY[i] = childBounds[i].max.y;
+        maxZ[i] = childBounds[i].max.z;
+    }
+    for (size_t i = childBounds.size(); i < 4; i++) {
+        minX[i] = minY[i] = minZ[i] = maxX[i] = maxY[i] = maxZ[i] = 0.0f;
+    }
+    this->minX.load(minX);
+    this->minY.load(minY);
+    this->minZ.load(minZ);
+    this->maxX.load(maxX);
+    this->maxY.load(maxY);
+    this->maxZ.load(maxZ);
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline typename PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::ChildBounds PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::FullBVHNode::getChildBounds() const
+{
+    return { minX, minY, minZ, maxX, maxY, maxZ };
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline void PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::QuantizedBVHNode::setChildBounds(gsl::span<const Bounds> childBounds)
+{
+    assert(childBounds.size() <= 4);
+
+    Bounds nodeBounds;
+    for (const Bounds& bounds : childBounds)
+        nodeBounds.extend(bounds);
+    origin = nodeBounds.min;
+
+    std::array<std::array<uint8_t, 4>*, 3> quantizedMin { &minX, &minY, &minZ };
+    std::array<std::array<uint8_t, 4>*, 3> quantizedMax { &maxX, &maxY, &maxZ };
+    for (int axis = 0; axis < 3; axis++) {
+        // Smallest power of two step size with which 255 steps cover the node bounds.
+        const float nodeMax = nodeBounds.max[axis];
+        int exponent;
+        std::frexp((nodeMax - origin[axis]) / 255.0f, &exponent);
+        scale[axis] = std::ldexp(1.0f, exponent);
+        while (origin[axis] + 255.0f * scale[axis] < nodeMax)
+            scale[axis] *= 2.0f;
+
+        for (size_t i = 0; i < 4; i++) {
+            if (i >= childBounds.size()) {
+                (*quantizedMin[axis])[i] = (*quantizedMax[axis])[i] = 0;
+                continue;
+            }
+
+            // Round outwards, correcting for rounding errors in the division.
+            const float childMin = childBounds[i].min[axis];
+            const float childMax = childBounds[i].max[axis];
+            int qMin = std::clamp(static_cast<int>(std::floor((childMin - origin[axis]) / scale[axis])), 0, 255);
+            int qMax = std::clamp(static_cast<int>(std::ceil((childMax - origin[axis]) / scale[axis])), 0, 255);
+            while (qMin > 0 && origin[axis] + static_cast<float>(qMin) * scale[axis] > childMin)
+                qMin--;
+            while (qMax < 255 && origin[axis] + static_cast<float>(qMax) * scale[axis] < childMax)
+                qMax++;
+            (*quantizedMin[axis])[i] = static_cast<uint8_t>(qMin);
+            (*quantizedMax[axis])[i] = static_cast<uint8_t>(qMax);
+        }
+    }
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline typename PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::ChildBounds PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::QuantizedBVHNode::getChildBounds() const
+{
+    return {
+        dequantize(minX, origin.x, scale.x),
+        dequantize(minY, origin.y, scale.y),
+        dequantize(minZ, origin.z, scale.z),
+        dequantize(maxX, origin.x, scale.x),
+        dequantize(maxY, origin.y, scale.y),
+        dequantize(maxZ, origin.z, scale.z)
+    };
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline simd::vec4_f32 PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::QuantizedBVHNode::dequantize(const std::array<uint8_t, 4>& values, float origin, float scale)
+{
+    uint32_t packedValues;
+    std::memcpy(&packedValues, values.data(), sizeof(packedValues));
+    const simd::vec4_f32 floatValues { _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(packedValues)))) };
+    return simd::vec4_f32(origin) + floatValues * simd::vec4_f32(scale);
+}
+
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::BVHNodeLinks::numChildren() const
 {
     return _mm_popcnt_u32(validMask);
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline bool PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::BVHNode::isLeaf(unsigned childIdx) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline bool PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::BVHNodeLinks::isLeaf(unsigned childIdx) const
 {
     return (validMask & leafMask) & (1 << childIdx);
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline bool PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::BVHNode::isInnerNode(unsigned childIdx) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline bool PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::BVHNodeLinks::isInnerNode(unsigned childIdx) const
 {
     return (validMask & (~leafMask)) & (1 << childIdx);
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::BVHNode::getInnerChildHandle(unsigned childIdx) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::BVHNodeLinks::getInnerChildHandle(unsigned childIdx) const
 {
     uint32_t innerNodeMaskBefore = (validMask & (~leafMask)) & ((1 << childIdx) - 1);
     auto innerNodesBefore = _mm_popcnt_u32(innerNodeMaskBefore);
     return firstChildHandle + innerNodesBefore;
 }
 
-template <typename LeafObj, typename HitRayState, typename AnyHitRayState>
-inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState>::BVHNode::getLeafChildHandle(unsigned childIdx) const
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline uint32_t PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::BVHNodeLinks::getLeafChildHandle(unsigned childIdx) const
 {
     uint32_t leafNodeMaskBefore = (validMask & leafMask) & ((1 << childIdx) - 1);
     auto leafNodesBefore = _mm_popcnt_u32(leafNodeMaskBefore);
     return firstLeafHandle + leafNodesBefore;
 }
 
+template <typename LeafObj, typename HitRayState, typename AnyHitRayState, PauseableBVHNodeLayout NodeLayout>
+inline unsigned PauseableBVH4<LeafObj, HitRayState, AnyHitRayState, NodeLayout>::BVHNodeLinks::getInnerChildIndex(uint32_t childHandle) const
+{
+    // Inverse of getInnerChildHandle
+    uint32_t innerNodesBefore = childHandle - firstChildHandle;
+    for (unsigned childIdx = 0; childIdx < 4; childIdx++) {
+        if (isInnerNode(childIdx) && innerNodesBefore-- == 0)
+            return childIdx;
+    }
+
+    assert(false);
+    return 4;
+}
+
 }
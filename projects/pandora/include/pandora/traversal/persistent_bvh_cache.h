@@ -0,0 +1,98 @@
+#pragma once
+#include "pandora/graphics_core/pandora.h"
+#include "pandora/traversal/bvh/wive_bvh8_build8.h"
+#include "pandora/traversal/sub_scene.h"
+#include <gsl/span>
+#include <memory>
+#include <optional>
+#include <stream/cache/cached_ptr.h>
+#include <stream/cache/evictable.h>
+#include <stream/cache/lru_cache_ts.h>
+#include <stream/serialize/serializer.h>
+#include <vector>
+
+namespace pandora {
+
+struct PersistentBVHLeaf {
+public:
+    PersistentBVHLeaf(const SceneObject* pSceneObject, uint32_t primID);
+
+    Bounds getBounds() const;
+    bool intersect(Ray& ray, SurfaceInteraction& si) const;
+    bool intersectAny(Ray& ray) const;
+
+public:
+    const SceneObject* pSceneObject;
+    uint32_t primID;
+};
+
+// Bottom-level BVH of a sub scene that is built once (while preprocessing) and then only loaded from disk when it has been
+//  evicted. The leafs are stored as (scene object index, primitive ID) pairs so the serialized BVH does not depend on the
+//  addresses of the scene objects and can be reused by later renders of the same (scene package) sub scene.
+class PersistentBVH : public tasking::Evictable {
+public:
+    // Build the BVH (resident). All shapes of the sub scene should be resident.
+    PersistentBVH(const SubScene& subScene);
+    // BVH that was serialized before (not resident).
+    PersistentBVH(const SubScene& subScene, const tasking::Allocation& bvhAllocation, const tasking::Allocation& leafsAllocation, uint32_t numLeafs, size_t residentSizeBytes);
+    ~PersistentBVH() override = default;
+
+    // Only sub scenes without instanced scene nodes are supported.
+    static bool supportsSubScene(const SubScene& subScene);
+
+    bool intersect(Ray& ray, SurfaceInteraction& si) const;
+    bool intersectAny(Ray& ray) const;
+
+    size_t sizeBytes() const override;
+    void serialize(tasking::Serializer& serializer) override;
+
+    const tasking::Allocation& bvhAllocation() const;
+    const tasking::Allocation& leafsAllocation() const;
+    uint32_t numLeafs() const;
+    // Size of the BVH when it is resident (as measured when it was serialized).
+    size_t residentSizeBytes() const;
+
+private:
+    void doEvict() override;
+    void doMakeResident(tasking::Deserializer& deserializer) override;
+    void getSerializedAllocations(std::vector<tasking::Allocation>& allocations) const override;
+
+private:
+    struct SerializedLeaf {
+        uint32_t sceneObjectIndex;
+        uint32_t primID;
+    };
+
+    std::vector<const SceneObject*> m_sceneObjects;
+    std::optional<WiVeBVH8Build8<PersistentBVHLeaf>> m_bvh;
+
+    tasking::Allocation m_bvhAllocation;
+    tasking::Allocation m_leafsAllocation;
+    uint32_t m_numLeafs { 0 };
+    size_t m_residentSizeBytes { 0 };
+};
+
+// Creates a PersistentBVH for every supported sub scene and registers it with the cache builder (which writes it to disk
+//  and evicts it). The returned vector contains one item per sub scene (nullptr for unsupported sub scenes).
+std::vector<std::unique_ptr<PersistentBVH>> createPersistentBVHs(
+    gsl::span<const SubScene> subScenes, tasking::LRUCacheTS& geometryCache, tasking::CacheBuilder& cacheBuilder);
+
+class PersistentBVHCache {
+public:
+    // With a memory governor the BVHs share the budget of the governor (instead of maxSize) with the geometry cache.
+    PersistentBVHCache(
+        std::vector<std::unique_ptr<PersistentBVH>>&& bvhs, tasking::LRUCacheTS::Builder& cacheBuilder, size_t maxSize,
+        tasking::MemoryGovernor* pMemoryGovernor = nullptr, const tasking::MemoryGovernor::Client* pGeometryCache = nullptr);
+
+    // Returns nullptr if the sub scene does not have a persistent BVH (should be traced with Embree instead).
+    PersistentBVH* get(size_t subSceneIndex) const;
+
+    tasking::CachedPtr<PersistentBVH> makeResident(PersistentBVH* pBVH);
+    size_t nonResidentSizeBytes(const PersistentBVH* pBVH) const;
+
+private:
+    std::vector<std::unique_ptr<PersistentBVH>> m_bvhs;
+    tasking::LRUCacheTS m_cache;
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "pandora/graphics_core/render_config.h"
+#include "pandora/svo/sparse_voxel_dag.h"
+#include "pandora/traversal/persistent_bvh_cache.h"
+#include "pandora/traversal/sub_scene.h"
+#include <filesystem>
+#include <gsl/span>
+#include <memory>
+#include <optional>
+#include <stream/cache/lru_cache_ts.h>
+#include <stream/serialize/file_serializer.h>
+#include <stream/serialize/serializer.h>
+#include <vector>
+
+namespace pandora {
+
+// A scene package is a folder that stores a scene after it has been preprocessed for the batching acceleration structure
+//  (split shapes, sub scenes and compressed SVDAGs), so that the scene can be rendered again without parsing the source
+//  file and without repeating the preprocessing. The geometry is stored in separate files which are read when a shape is
+//  made resident (see tasking::openSplitFileDeserializer).
+//
+// Writing a package:
+//  1. Preprocess the scene into a geometry cache that uses the serializer from createScenePackageGeometrySerializer.
+//  2. Create the sub scenes and SVDAGs (BatchingAccelerationStructureBuilder). Optionally create the persistent BVHs with
+//     the serializer from createScenePackageBVHSerializer.
+//  3. Call writeScenePackage.
+//
+// Only the materials and lights that the importers create when textures are not loaded are supported (MatteMaterial with
+//  constant textures, area lights, distant lights and environment lights).
+
+// Settings that the contents of a package depend on. A package is only reused when all of them match and when the source
+//  file did not change since the package was written.
+struct ScenePackageKey {
+    std::filesystem::path sourceFile;
+    unsigned cameraID;
+    unsigned subdiv;
+    unsigned primitivesPerBatchingPoint;
+    unsigned svdagRes;
+    bool persistentBVHs;
+};
+
+struct ScenePackage {
+    RenderConfig renderConfig;
+    std::vector<SubScene> subScenes;
+    std::vector<SparseVoxelDAG> svdags; // One per sub scene, empty if the package was written without SVDAGs
+
+    // All shapes of the scene have been registered (non-resident) with this builder.
+    tasking::LRUCacheTS::Builder geometryCacheBuilder;
+
+    // One per sub scene (nullptr for sub scenes that use Embree), empty if the package was written without persistent BVHs.
+    //  The BVHs have been registered (non-resident) with the cache builder.
+    std::vector<std::unique_ptr<PersistentBVH>> persistentBVHs;
+    std::optional<tasking::LRUCacheTS::Builder> persistentBVHCacheBuilder;
+};
+
+// NOTE: removes any existing package in the folder.
+std::unique_ptr<tasking::Serializer> createScenePackageGeometrySerializer(std::filesystem::path folder, tasking::FileCompression compression = tasking::FileCompression::None);
+std::unique_ptr<tasking::Serializer> createScenePackageBVHSerializer(std::filesystem::path folder);
+void writeScenePackage(
+    std::filesystem::path folder,
+    const ScenePackageKey& key,
+    const RenderConfig& renderConfig,
+    const tasking::LRUCacheTS& geometryCache,
+    gsl::span<const SubScene> subScenes,
+    gsl::span<const SparseVoxelDAG> svdags,
+    gsl::span<const std::unique_ptr<PersistentBVH>> persistentBVHs);
+
+bool isScenePackageValid(std::filesystem::path folder, const ScenePackageKey& key);
+ScenePackage loadScenePackage(std::filesystem::path folder);
+
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <tbb/enumerable_thread_specific.h>
+#include <utility>
+#include <vector>
+
+namespace pandora {
+
+// Thread safe allocator for short lived items that are referenced by a 32-bit handle. Memory is allocated in chunks
+//  which are not moved or freed until the allocator is destroyed, so references stay valid until the item is released.
+// Released handles are recycled through thread local free lists. Threads that release more handles than they allocate
+//  hand the surplus to other threads through a shared pool (in groups of transferSize handles).
+// Items that have not been released when the allocator is destroyed are not destructed.
+template <typename T>
+class FreeListAllocatorTS {
+public:
+    FreeListAllocatorTS();
+    ~FreeListAllocatorTS();
+
+    using Handle = uint32_t;
+    template <typename... Args>
+    std::pair<Handle, T*> allocate(Args&&... args);
+    void release(Handle handle);
+
+    inline T& get(Handle handle) const;
+
+    size_t sizeBytes() const;
+
+private:
+    void refill(std::vector<Handle>& freeList);
+
+private:
+    static constexpr uint32_t chunkBits = 16;
+    static constexpr uint32_t chunkSize = 1u << chunkBits;
+    static constexpr uint32_t maxChunks = 1u << (32 - chunkBits);
+    static constexpr uint32_t transferSize = 256;
+    static_assert(chunkSize % transferSize == 0);
+
+    struct alignas(std::alignment_of_v<T>) EmptyItem {
+    private:
+        std::byte m_padding[sizeof(T)];
+    };
+    std::unique_ptr<std::atomic<EmptyItem*>[]> m_chunks;
+    std::atomic_uint32_t m_numChunks { 0 };
+    std::atomic_uint64_t m_currentSize { 0 };
+
+    std::mutex m_sharedFreeListsMutex;
+    std::vector<std::vector<Handle>> m_sharedFreeLists;
+    tbb::enumerable_thread_specific<std::vector<Handle>> m_threadLocalFreeLists;
+};
+
+template <typename T>
+inline FreeListAllocatorTS<T>::FreeListAllocatorTS()
+    : m_chunks(new std::atomic<EmptyItem*>[maxChunks])
+{
+    for (uint32_t i = 0; i < maxChunks; i++)
+        m_chunks[i].store(nullptr, std::memory_order_relaxed);
+}
+
+template <typename T>
+inline FreeListAllocatorTS<T>::~FreeListAllocatorTS()
+{
+    for (uint32_t i = 0; i < maxChunks; i++)
+        delete[] m_chunks[i].load();
+}
+
+template <typename T>
+template <typename... Args>
+inline std::pair<typename FreeListAllocatorTS<T>::Handle, T*> FreeListAllocatorTS<T>::allocate(Args&&... args)
+{
+    auto& freeList = m_threadLocalFreeLists.local();
+    if (freeList.empty())
+        refill(freeList);
+
+    const Handle handle = freeList.back();
+    freeList.pop_back();
+
+    T* pItem = new (&get(handle)) T(std::forward<Args>(args)...);
+    return { handle, pItem };
+}
+
+template <typename T>
+inline void FreeListAllocatorTS<T>::release(Handle handle)
+{
+    get(handle).~T();
+
+    auto& freeList = m_threadLocalFreeLists.local();
+    freeList.push_back(handle);
+    if (freeList.size() >= 2 * transferSize) {
+        std::vector<Handle> surplus { std::end(freeList) - transferSize, std::end(freeList) };
+        freeList.resize(freeList.size() - transferSize);
+
+        std::lock_guard l { m_sharedFreeListsMutex };
+        m_sharedFreeLists.push_back(std::move(surplus));
+    }
+}
+
+template <typename T>
+inline T& FreeListAllocatorTS<T>::get(Handle handle) const
+{
+    EmptyItem* pChunk = m_chunks[handle >> chunkBits].load(std::memory_order_acquire);
+    assert(pChunk);
+    return reinterpret_cast<T&>(pChunk[handle & (chunkSize - 1)]);
+}
+
+template <typename T>
+inline size_t FreeListAllocatorTS<T>::sizeBytes() const
+{
+    return m_numChunks.load(std::memory_order_relaxed) * chunkSize * sizeof(T);
+}
+
+template <typename T>
+inline void FreeListAllocatorTS<T>::refill(std::vector<Handle>& freeList)
+{
+    {
+        std::lock_guard l { m_sharedFreeListsMutex };
+        if (!m_sharedFreeLists.empty()) {
+            freeList = std::move(m_sharedFreeLists.back());
+            m_sharedFreeLists.pop_back();
+            return;
+        }
+    }
+
+    // Take a range of handles that have never been used. The range never straddles two chunks.
+    const uint64_t first = m_currentSize.fetch_add(transferSize);
+    if (first + transferSize > uint64_t(maxChunks) * chunkSize)
+        throw std::bad_alloc();
+
+    std::atomic<EmptyItem*>& chunk = m_chunks[first >> chunkBits];
+    if (!chunk.load(std::memory_order_acquire)) {
+        EmptyItem* pExpected = nullptr;
+        EmptyItem* pNewChunk = new EmptyItem[chunkSize];
+        if (chunk.compare_exchange_strong(pExpected, pNewChunk))
+            m_numChunks.fetch_add(1, std::memory_order_relaxed);
+        else
+            delete[] pNewChunk;
+    }
+
+    // Reverse order so that the handles are handed out in increasing order.
+    freeList.reserve(transferSize);
+    for (uint32_t i = 0; i < transferSize; i++)
+        freeList.push_back(static_cast<Handle>(first + transferSize - 1 - i));
+}
+
+}
@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <cstdlib>
 #include <memory>
+#include <memory_resource>
 #include <vector>
 
 namespace pandora {
@@ -11,7 +12,11 @@ class MemoryArena {
 public:
     static const size_t maxAlignment = 64;
 
-    MemoryArena(size_t blockSizeBytes = 4096);
+    // Blocks are allocated from pMemoryResource (e.g. the scratch memory that is passed to task graph kernels).
+    MemoryArena(size_t blockSizeBytes = 4096, std::pmr::memory_resource* pMemoryResource = std::pmr::get_default_resource());
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+    ~MemoryArena();
 
     template <class T, class... Args>
     T* allocate(Args... args); // Allocate multiple items at once (contiguous in memory)
@@ -28,10 +33,11 @@ private:
 private: 
     // Currently allocated blocks
     const size_t m_memoryBlockSize;
-    std::vector<std::unique_ptr<std::byte[]>> m_usedMemoryBlocks;
+    std::pmr::memory_resource* m_pMemoryResource;
+    std::pmr::vector<std::byte*> m_usedMemoryBlocks;
 
     // Unused blocks that were allocated before a call to reset
-    std::vector<std::unique_ptr<std::byte[]>> m_unusedMemoryBlocks;
+    std::pmr::vector<std::byte*> m_unusedMemoryBlocks;
 
     std::byte* m_currentBlockData;
     size_t m_currentBlockSpace; // In bytes
@@ -18,11 +18,19 @@ nlohmann::json RenderStats::getMetricsSnapshot() const
     ret["config"]["spp"] = config.spp;
     ret["config"]["concurrency"] = config.concurrency;
     ret["config"]["schedulers"] = config.schedulers;
+    ret["config"]["prefetch"] = config.prefetch;
+    ret["config"]["selection_policy"] = config.selectionPolicy;
     ret["config"]["concurrency"] = config.concurrency;
     ret["config"]["svdagres"] = config.svdagRes;
+    ret["config"]["ray_sort"] = config.raySort;
+    ret["config"]["top_level_traversal"] = config.topLevelTraversal;
+    ret["config"]["persistent_bvhs"] = config.persistentBVHs;
 
+    ret["config"]["ooc"]["queue_budget"] = config.queueBudget;
+    ret["config"]["ooc"]["spill_budget"] = config.spillBudget;
     ret["config"]["ooc"]["geom_cache_size"] = config.geomCacheSize;
     ret["config"]["ooc"]["bvh_cache_size"] = config.bvhCacheSize;
+    ret["config"]["ooc"]["memory_budget"] = config.memoryBudget;
     ret["config"]["ooc"]["prims_per_batching_point"] = config.primGroupSize;
     ret["config"]["ooc"]["num_batching_points"] = scene.numBatchingPoints;
 
@@ -46,7 +54,7 @@ nlohmann::json RenderStats::getMetricsSnapshot() const
 
     ret["memory"]["bot_level_loaded"] = memory.botLevelLoaded;
     ret["memory"]["bot_level_evicted"] = memory.botLevelEvicted;
-    //ret["memory"]["ooc_total_disk_read"] = memory.oocTotalDiskRead;
+    ret["memory"]["ooc_total_disk_read"] = memory.oocTotalDiskRead;
 
     ret["memory"]["top_bvh"] = memory.topBVH;
     ret["memory"]["top_bvh_leafs"] = memory.topBVHLeafs;
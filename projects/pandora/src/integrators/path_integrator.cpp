@@ -21,15 +21,16 @@ PathIntegrator::PathIntegrator(
           pTaskGraph->addTask<std::tuple<Ray, SurfaceInteraction, RayState>>(
               "PathIntegrator::hit",
               [this](gsl::span<const std::tuple<Ray, SurfaceInteraction, RayState>> hits, std::pmr::memory_resource* pMemoryResource) {
+                  // Shading allocations only live until the next hit so the arena blocks are reused.
+                  MemoryArena memoryArena { 4096, pMemoryResource };
                   for (auto [ray, si, state] : hits) {
                       if (ray.numTopLevelIntersections > 0)
                           m_pCurrentRenderData->pAOVNumTopLevelIntersections->addSplat(
                               state.pixel, ray.numTopLevelIntersections);
 
-                      // TODO: make this use pMemoryResource
-                      MemoryArena memoryArena;
                       si.computeScatteringFunctions(ray, memoryArena);
                       this->rayHit(ray, si, state, memoryArena);
+                      memoryArena.reset();
                   }
               }))
     , m_missTask(
@@ -69,6 +70,12 @@ PathIntegrator::PathIntegrator(
                   }
               }))
 {
+    // Hit / miss handlers terminate paths (or continue them with at most a couple of rays) so they should be
+    //  flushed first when the ray queues exceed the memory budget.
+    pTaskGraph->markAsSink(m_hitTask);
+    pTaskGraph->markAsSink(m_missTask);
+    pTaskGraph->markAsSink(m_anyHitTask);
+    pTaskGraph->markAsSink(m_anyMissTask);
 }
 
 void PathIntegrator::rayHit(const Ray& ray, const SurfaceInteraction& si, BounceRayState state, MemoryArena& memoryArena)
@@ -32,6 +32,7 @@ void SamplerIntegrator::render(int concurrentPaths, const PerspectiveCamera& cam
     pRenderData->pCamera = &camera;
     pRenderData->pSensor = &sensor;
     pRenderData->currentRayIndex.store(0);
+    pRenderData->deferredPaths.store(0);
     pRenderData->seed = PcgRng(seed).uniformU64();
     pRenderData->resolution = resolution;
     pRenderData->fResolution = glm::vec2(resolution);
@@ -61,6 +62,12 @@ void SamplerIntegrator::render(int concurrentPaths, const PerspectiveCamera& cam
     spawnNewPaths(concurrentPaths);
     m_pTaskGraph->run();
 
+    // Paths that were deferred because of the memory budget may still be pending once all queues have drained.
+    while (const int deferredPaths = m_pCurrentRenderData->deferredPaths.exchange(0)) {
+        spawnNewPaths(deferredPaths);
+        m_pTaskGraph->run();
+    }
+
     m_pCurrentRenderData->pAOVNumTopLevelIntersections->writeImage("num_top_level_intersections.exr");
 
     m_lightShapeOwners.clear();
@@ -126,6 +133,12 @@ void SamplerIntegrator::spawnShadowRay(const Ray& shadowRay, PcgRng& rng, const
 void SamplerIntegrator::spawnNewPaths(int numPaths)
 {
     auto* pRenderData = m_pCurrentRenderData.get();
+    if (m_pTaskGraph->isOverMemoryBudget()) {
+        pRenderData->deferredPaths.fetch_add(numPaths, std::memory_order_relaxed);
+        return;
+    }
+    if (pRenderData->deferredPaths.load(std::memory_order_relaxed) > 0)
+        numPaths += pRenderData->deferredPaths.exchange(0);
     const int startIndex = pRenderData->currentRayIndex.fetch_add(numPaths);
     const int maxSample = pRenderData->maxPixelIndex * m_maxSpp;
     const int endIndex = std::min(startIndex + numPaths, pRenderData->maxPixelIndex * m_maxSpp);
@@ -8,6 +8,7 @@
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <cassert>
+#include <cmath>
 #include <fstream>
 #include <glm/gtc/matrix_transform.hpp>
 #include <optick.h>
@@ -69,6 +70,102 @@ static std::vector<glm::vec3> transformNormals(std::vector<glm::vec3>&& normals,
     return out;
 }
 
+// Octahedral normal encoding with 16 bits per coordinate:
+// "A Survey of Efficient Representations for Independent Unit Vectors" - Cigolle et al.
+static uint32_t encodeOctahedralNormal(const glm::vec3& n)
+{
+    const float l1Norm = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1Norm == 0.0f)
+        return 0x80008000; // Maps to (0, 0, 1)
+
+    glm::vec2 p = glm::vec2(n.x, n.y) / l1Norm;
+    if (n.z < 0.0f) {
+        p = glm::vec2(
+            (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    }
+
+    const auto quantize = [](float v) {
+        return static_cast<uint32_t>(std::round(glm::clamp(v * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f));
+    };
+    return quantize(p.x) << 16 | quantize(p.y);
+}
+
+static glm::vec3 decodeOctahedralNormal(uint32_t encoded)
+{
+    const glm::vec2 p = glm::vec2(encoded >> 16, encoded & 0xFFFF) / 65535.0f * 2.0f - 1.0f;
+    glm::vec3 n { p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y) };
+    if (n.z < 0.0f) {
+        n.x = (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(n);
+}
+
+// Neighbouring triangles mostly refer to nearby vertices, so the differences between consecutive indices are small
+//  numbers which compress much better than the indices themselves.
+static std::vector<int32_t> deltaEncodeIndices(const std::vector<glm::uvec3>& indices)
+{
+    std::vector<int32_t> deltas;
+    deltas.reserve(indices.size() * 3);
+    uint32_t previous = 0;
+    for (const glm::uvec3& triangle : indices) {
+        for (int i = 0; i < 3; i++) {
+            deltas.push_back(static_cast<int32_t>(triangle[i] - previous));
+            previous = triangle[i];
+        }
+    }
+    return deltas;
+}
+
+static std::vector<glm::uvec3> deserializeIndices(const pandora::serialization::TriangleMesh* pSerializedTriangleMesh)
+{
+    std::vector<glm::uvec3> indices;
+    if (const auto* pIndexDeltas = pSerializedTriangleMesh->indexDeltas()) {
+        indices.resize(pIndexDeltas->size() / 3);
+        uint32_t previous = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            for (int j = 0; j < 3; j++) {
+                previous += static_cast<uint32_t>(pIndexDeltas->Get(static_cast<flatbuffers::uoffset_t>(3 * i + j)));
+                indices[i][j] = previous;
+            }
+        }
+    } else {
+        indices.resize(pSerializedTriangleMesh->indices()->size());
+        std::transform(
+            pSerializedTriangleMesh->indices()->begin(),
+            pSerializedTriangleMesh->indices()->end(),
+            std::begin(indices),
+            [](const pandora::serialization::Vec3u* t) {
+                return pandora::deserialize(*t);
+            });
+    }
+    return indices;
+}
+
+static std::vector<glm::vec3> deserializeNormals(const pandora::serialization::TriangleMesh* pSerializedTriangleMesh)
+{
+    std::vector<glm::vec3> normals;
+    if (const auto* pOctahedralNormals = pSerializedTriangleMesh->octahedralNormals()) {
+        normals.resize(pOctahedralNormals->size());
+        std::transform(
+            pOctahedralNormals->begin(),
+            pOctahedralNormals->end(),
+            std::begin(normals),
+            decodeOctahedralNormal);
+    } else if (pSerializedTriangleMesh->normals()) {
+        normals.resize(pSerializedTriangleMesh->normals()->size());
+        std::transform(
+            pSerializedTriangleMesh->normals()->begin(),
+            pSerializedTriangleMesh->normals()->end(),
+            std::begin(normals),
+            [](const pandora::serialization::Vec3* n) {
+                return pandora::deserialize(*n);
+            });
+    }
+    return normals;
+}
+
 namespace pandora {
 
 TriangleShape::TriangleShape(
@@ -125,6 +222,14 @@ TriangleShape::TriangleShape(
     g_stats.memory.geometryLoaded += sizeBytes();
 }
 
+TriangleShape::TriangleShape(const tasking::Allocation& serializedStateHandle, unsigned numPrimitives, const Bounds& bounds)
+    : Shape(false)
+    , m_bounds(bounds)
+    , m_numPrimitives(numPrimitives)
+    , m_serializedStateHandle(serializedStateHandle)
+{
+}
+
 void TriangleShape::subdivide()
 {
     ALWAYS_ASSERT(m_normals.empty() || m_normals.size() == m_positions.size());
@@ -187,15 +292,7 @@ void TriangleShape::doMakeResident(tasking::Deserializer& deserializer)
     const void* pData = deserializer.map(m_serializedStateHandle);
     const auto* pSerializedTriangleMesh = serialization::GetTriangleMesh(pData);
 
-    m_indices.resize(pSerializedTriangleMesh->indices()->size());
-    std::transform(
-        pSerializedTriangleMesh->indices()->begin(),
-        pSerializedTriangleMesh->indices()->end(),
-        std::begin(m_indices),
-        [](const serialization::Vec3u* t) {
-            return deserialize(*t);
-        });
-    m_indices.shrink_to_fit();
+    m_indices = deserializeIndices(pSerializedTriangleMesh);
 
     m_positions.resize(pSerializedTriangleMesh->positions()->size());
     std::transform(
@@ -207,17 +304,7 @@ void TriangleShape::doMakeResident(tasking::Deserializer& deserializer)
         });
     m_positions.shrink_to_fit();
 
-    if (pSerializedTriangleMesh->normals()) {
-        m_normals.resize(pSerializedTriangleMesh->normals()->size());
-        std::transform(
-            pSerializedTriangleMesh->normals()->begin(),
-            pSerializedTriangleMesh->normals()->end(),
-            std::begin(m_normals),
-            [](const serialization::Vec3* n) {
-                return deserialize(*n);
-            });
-        m_normals.shrink_to_fit();
-    }
+    m_normals = deserializeNormals(pSerializedTriangleMesh);
 
     if (pSerializedTriangleMesh->texCoords()) {
         m_texCoords.resize(pSerializedTriangleMesh->texCoords()->size());
@@ -234,6 +321,12 @@ void TriangleShape::doMakeResident(tasking::Deserializer& deserializer)
     deserializer.unmap(pData);
 
     g_stats.memory.geometryLoaded += sizeBytes() - sizeBefore;
+    g_stats.memory.oocTotalDiskRead += deserializer.diskSize(m_serializedStateHandle);
+}
+
+void TriangleShape::getSerializedAllocations(std::vector<tasking::Allocation>& allocations) const
+{
+    allocations.push_back(m_serializedStateHandle);
 }
 
 unsigned TriangleShape::numPrimitives() const
@@ -491,14 +584,15 @@ std::vector<TriangleShape> TriangleShape::loadFromFile(std::filesystem::path fil
 void TriangleShape::serialize(tasking::Serializer& serializer)
 {
     flatbuffers::FlatBufferBuilder builder;
-    auto triangles = builder.CreateVectorOfStructs(
-        reinterpret_cast<const serialization::Vec3u*>(m_indices.data()), m_indices.size());
+    auto indexDeltas = builder.CreateVector(deltaEncodeIndices(m_indices));
     auto positions = builder.CreateVectorOfStructs(
         reinterpret_cast<const serialization::Vec3*>(m_positions.data()), m_positions.size());
-    flatbuffers::Offset<flatbuffers::Vector<const serialization::Vec3*>> normals = 0;
-    if (!m_normals.empty())
-        normals = builder.CreateVectorOfStructs(
-            reinterpret_cast<const serialization::Vec3*>(m_normals.data()), m_normals.size());
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> octahedralNormals = 0;
+    if (!m_normals.empty()) {
+        std::vector<uint32_t> encodedNormals(m_normals.size());
+        std::transform(std::begin(m_normals), std::end(m_normals), std::begin(encodedNormals), encodeOctahedralNormal);
+        octahedralNormals = builder.CreateVector(encodedNormals);
+    }
     flatbuffers::Offset<flatbuffers::Vector<const serialization::Vec2*>> texCoords = 0;
     if (!m_texCoords.empty())
         texCoords = builder.CreateVectorOfStructs(
@@ -507,11 +601,13 @@ void TriangleShape::serialize(tasking::Serializer& serializer)
     auto bounds = m_bounds.serialize();
     auto triangleMesh = serialization::CreateTriangleMesh(
         builder,
-        triangles,
+        0,
         positions,
-        normals,
+        0,
         texCoords,
-        &bounds);
+        &bounds,
+        indexDeltas,
+        octahedralNormals);
     builder.Finish(triangleMesh);
 
     const void* pSerializedBuffer = builder.GetBufferPointer();
@@ -524,20 +620,16 @@ void TriangleShape::serialize(tasking::Serializer& serializer)
     m_serializedStateHandle = allocation;
 }
 
+const tasking::Allocation& TriangleShape::serializedStateHandle() const
+{
+    return m_serializedStateHandle;
+}
+
 TriangleShape TriangleShape::loadSerialized(const serialization::TriangleMesh* pSerializedTriangleMesh, const glm::mat4& transformMatrix)
 {
     Transform transform(transformMatrix);
 
-    std::vector<glm::uvec3> indices;
-    indices.resize(pSerializedTriangleMesh->indices()->size());
-    std::transform(
-        pSerializedTriangleMesh->indices()->begin(),
-        pSerializedTriangleMesh->indices()->end(),
-        std::begin(indices),
-        [](const serialization::Vec3u* t) {
-            return deserialize(*t);
-        });
-    indices.shrink_to_fit();
+    std::vector<glm::uvec3> indices = deserializeIndices(pSerializedTriangleMesh);
 
     std::vector<glm::vec3> positions;
     positions.resize(pSerializedTriangleMesh->positions()->size());
@@ -550,17 +642,9 @@ TriangleShape TriangleShape::loadSerialized(const serialization::TriangleMesh* p
         });
     positions.shrink_to_fit();
 
-    std::vector<glm::vec3> normals;
-    if (pSerializedTriangleMesh->normals()) {
-        normals.resize(pSerializedTriangleMesh->normals()->size());
-        std::transform(
-            pSerializedTriangleMesh->normals()->begin(),
-            pSerializedTriangleMesh->normals()->end(),
-            std::begin(normals),
-            [&](const serialization::Vec3* n) {
-                return transform.transformNormalToWorld(deserialize(*n));
-            });
-    }
+    std::vector<glm::vec3> normals = deserializeNormals(pSerializedTriangleMesh);
+    for (glm::vec3& normal : normals)
+        normal = transform.transformNormalToWorld(normal);
     normals.shrink_to_fit();
 
     std::vector<glm::vec2> texCoords;
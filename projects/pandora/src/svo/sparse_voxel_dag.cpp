@@ -1,4 +1,5 @@
 #include "pandora/svo/sparse_voxel_dag.h"
+#include "pandora/flatbuffers/data_conversion.h"
 #include "pandora/graphics_core/ray.h"
 #include "pandora/svo/voxel_grid.h"
 #include "pandora/utility/error_handling.h"
@@ -15,6 +16,7 @@
 #include <limits>
 #include <optick.h>
 #include <simd/simd4.h>
+#include <simd/simd8.h>
 
 namespace pandora {
 
@@ -224,6 +226,54 @@ void SparseVoxelDAG::compressDAGs(gsl::span<SparseVoxelDAG*> svos)
     std::cout << "Combined SVDAG size after compression: " << svos[0]->sizeBytes() << " bytes" << std::endl;
 }
 
+flatbuffers::Offset<serialization::SparseVoxelDAGs> SparseVoxelDAG::serializeDAGs(flatbuffers::FlatBufferBuilder& builder, gsl::span<const SparseVoxelDAG* const> svdags)
+{
+    ALWAYS_ASSERT(!svdags.empty());
+
+    // After compression the first DAG owns the nodes of all DAGs.
+    const SparseVoxelDAG* pOwner = svdags[0];
+    ALWAYS_ASSERT(pOwner->m_data == pOwner->m_nodeAllocator.data());
+    for (const auto* pSvdag : svdags)
+        ALWAYS_ASSERT(pSvdag->m_data == pOwner->m_data, "SVDAGs must be compressed together before serialization");
+
+    auto nodes = builder.CreateVector(pOwner->m_nodeAllocator);
+
+    std::vector<flatbuffers::Offset<serialization::SparseVoxelDAG>> serializedDAGs;
+    for (const auto* pSvdag : svdags) {
+        const auto boundsMin = serialize(pSvdag->m_boundsMin);
+        const auto boundsExtent = serialize(pSvdag->m_boundsExtent);
+        serializedDAGs.push_back(serialization::CreateSparseVoxelDAG(
+            builder, pSvdag->m_resolution, &boundsMin, &boundsExtent, pSvdag->m_rootNodeOffset));
+    }
+    return serialization::CreateSparseVoxelDAGs(builder, nodes, builder.CreateVector(serializedDAGs));
+}
+
+std::vector<SparseVoxelDAG> SparseVoxelDAG::loadSerializedDAGs(const serialization::SparseVoxelDAGs* pSerializedDAGs)
+{
+    const auto* pNodes = pSerializedDAGs->nodes();
+
+    std::vector<SparseVoxelDAG> svdags;
+    svdags.reserve(pSerializedDAGs->dags()->size());
+    for (const auto* pSerializedDAG : *pSerializedDAGs->dags()) {
+        SparseVoxelDAG svdag;
+        svdag.m_resolution = pSerializedDAG->resolution();
+        svdag.m_boundsMin = deserialize(*pSerializedDAG->bounds_min());
+        svdag.m_boundsExtent = deserialize(*pSerializedDAG->bounds_extent());
+        svdag.m_invBoundsExtent = 1.0f / svdag.m_boundsExtent;
+        svdag.m_rootNodeOffset = pSerializedDAG->root_node_offset();
+        ALWAYS_ASSERT(svdag.m_rootNodeOffset < pNodes->size());
+        svdags.push_back(std::move(svdag));
+    }
+
+    // Same layout as after compressDAGs: the first DAG owns the nodes.
+    if (!svdags.empty()) {
+        svdags[0].m_nodeAllocator.assign(pNodes->begin(), pNodes->end());
+        for (auto& svdag : svdags)
+            svdag.m_data = svdags[0].m_nodeAllocator.data();
+    }
+    return svdags;
+}
+
 void SparseVoxelDAG::testSVDAG() const
 {
     // Traverse voxels along the ray as long as the current voxel stays within the octree
@@ -552,18 +602,225 @@ std::optional<float> SparseVoxelDAG::intersectScalar(Ray ray) const
     if (scale >= CAST_STACK_DEPTH) {
         return {};
     } else {
-        /*// Output result
         alignas(16) float ret[4];
         tMinVec.storeAligned(ret);
 
-        // TODO: scale tmax back to world space without all this mess
-        const float tmax = ret[0];
-        const glm::vec3 intersectionSVDAGSpace = (ray.origin + tmax * ray.direction);
-        const glm::vec3 intersection = m_boundsMin + m_boundsExtent * (intersectionSVDAGSpace - glm::vec3(1.0f));
-        return glm::distance(ray.origin, intersection);*/
+        // Only the origin was transformed to SVDAG space, which is a uniformly scaled version of world space. So the
+        //  distance along the (unscaled) direction only has to be scaled back.
+        return ret[0] * m_boundsExtent.x;
+    }
+}
+
+// Expand a bit mask (one bit per lane) to a SIMD mask
+static inline simd::mask8 bitsToMask8(uint32_t bits)
+{
+    const simd::vec8_u32 laneBits(1, 2, 4, 8, 16, 32, 64, 128);
+    return (simd::vec8_u32(bits) & laneBits) > simd::vec8_u32(0);
+}
+
+// Value in the lanes where mask is set and 0 elsewhere
+static inline simd::vec8_u32 maskToBits8(const simd::mask8& mask, uint32_t value)
+{
+    return simd::blend(simd::vec8_u32(0), simd::vec8_u32(value), mask);
+}
+
+// exp2(scale - CAST_STACK_DEPTH) constructed directly from the exponent bits (same as scaleExp2LUT[scale])
+static inline simd::vec8_f32 scaleExp2(const simd::vec8_u32& scale)
+{
+    return simd::intBitsToFloat((scale + simd::vec8_u32(127 - CAST_STACK_DEPTH)) << 23);
+}
+
+uint32_t SparseVoxelDAG::intersect8(gsl::span<const Ray> rays, gsl::span<float, 8> outEntryDistances) const
+{
+    // SIMD version of intersectScalar where each lane traverses the SVDAG with its own ray. See intersectScalar for an
+    //  explanation of the algorithm. The vector code computes both the PUSH and the ADVANCE/POP step for every lane
+    //  and blends the results; only the descriptor fetches and the stack operations are done per lane.
+    constexpr int simdWidth = 8;
+    assert(rays.size() <= simdWidth);
+    if (rays.empty())
+        return 0;
+
+    // Gather the rays into SIMD registers. Unused lanes repeat the first ray and are never active.
+    std::array<float, simdWidth> originX, originY, originZ, directionX, directionY, directionZ;
+    for (int lane = 0; lane < simdWidth; lane++) {
+        const Ray& ray = rays[lane < static_cast<int>(rays.size()) ? lane : 0];
+        originX[lane] = ray.origin.x;
+        originY[lane] = ray.origin.y;
+        originZ[lane] = ray.origin.z;
+        directionX[lane] = ray.direction.x;
+        directionY[lane] = ray.direction.y;
+        directionZ[lane] = ray.direction.z;
+    }
+
+    const simd::vec8_f32 zero(0.0f);
+    const simd::vec8_f32 one(1.0f);
+    const simd::vec8_f32 rayOriginX = one + simd::vec8_f32(m_invBoundsExtent.x) * (simd::vec8_f32(originX) - simd::vec8_f32(m_boundsMin.x));
+    const simd::vec8_f32 rayOriginY = one + simd::vec8_f32(m_invBoundsExtent.y) * (simd::vec8_f32(originY) - simd::vec8_f32(m_boundsMin.y));
+    const simd::vec8_f32 rayOriginZ = one + simd::vec8_f32(m_invBoundsExtent.z) * (simd::vec8_f32(originZ) - simd::vec8_f32(m_boundsMin.z));
+
+    // Compute the coefficients of tx(x), ty(y) and tz(z) and mirror the coordinate system so that the ray direction is
+    //  negative along each axis. Small direction components are clamped (keeping their sign) to avoid division by zero.
+    const auto computeCoefficients = [&](const std::array<float, simdWidth>& direction, const simd::vec8_f32& rayOrigin) {
+        constexpr float epsilon = 1.1920928955078125e-07f; // std::exp2f(-CAST_STACK_DEPTH);
+        const simd::vec8_u32 directionBits = simd::floatBitsToInt(simd::vec8_f32(direction));
+        const simd::vec8_f32 absDirection = simd::intBitsToFloat(directionBits & simd::vec8_u32(0x7FFFFFFF));
+        const simd::vec8_f32 directionSign = simd::intBitsToFloat((directionBits & simd::vec8_u32(0x80000000)) | simd::floatBitsToInt(one));
+
+        const simd::vec8_f32 tCoef = simd::vec8_f32(-1.0f) / simd::max(absDirection, simd::vec8_f32(epsilon));
+        const simd::vec8_f32 tBias = tCoef * rayOrigin;
+        const simd::mask8 positive = directionSign > zero;
+        return std::tuple { tCoef, simd::blend(tBias, simd::vec8_f32(3.0f) * tCoef - tBias, positive), positive };
+    };
+    const auto [tCoefX, tBiasX, positiveX] = computeCoefficients(directionX, rayOriginX);
+    const auto [tCoefY, tBiasY, positiveY] = computeCoefficients(directionY, rayOriginY);
+    const auto [tCoefZ, tBiasZ, positiveZ] = computeCoefficients(directionZ, rayOriginZ);
+    const simd::vec8_u32 octantMask = simd::vec8_u32(7) ^ (maskToBits8(positiveX, 1) | maskToBits8(positiveY, 2) | maskToBits8(positiveZ, 4));
+
+    // Initialize the active span of t-values
+    const simd::vec8_f32 two(2.0f);
+    simd::vec8_f32 tMin = simd::max(zero, simd::max(two * tCoefX - tBiasX, simd::max(two * tCoefY - tBiasY, two * tCoefZ - tBiasZ)));
+    const simd::vec8_f32 tMax = simd::min(tCoefX - tBiasX, simd::min(tCoefY - tBiasY, tCoefZ - tBiasZ));
+    uint32_t activeBits = static_cast<uint32_t>((tMin < tMax).bitMask()) & ((1u << rays.size()) - 1);
+    if (activeBits == 0)
         return 0;
+
+    // Intersection of the rays with the root node (cube at [1, 2])
+    const simd::vec8_f32 oneAndHalf(1.5f);
+    const simd::mask8 rootMaskX = oneAndHalf * tCoefX - tBiasX > tMin;
+    const simd::mask8 rootMaskY = oneAndHalf * tCoefY - tBiasY > tMin;
+    const simd::mask8 rootMaskZ = oneAndHalf * tCoefZ - tBiasZ > tMin;
+    simd::vec8_u32 idx = maskToBits8(rootMaskX, 1) | maskToBits8(rootMaskY, 2) | maskToBits8(rootMaskZ, 4);
+    simd::vec8_f32 posX = simd::blend(one, oneAndHalf, rootMaskX);
+    simd::vec8_f32 posY = simd::blend(one, oneAndHalf, rootMaskY);
+    simd::vec8_f32 posZ = simd::blend(one, oneAndHalf, rootMaskZ);
+    simd::vec8_u32 scale(CAST_STACK_DEPTH - 1);
+
+    std::array<const Descriptor*, simdWidth> parents;
+    parents.fill(reinterpret_cast<const Descriptor*>(m_data + m_rootNodeOffset));
+    std::array<std::array<const Descriptor*, simdWidth>, CAST_STACK_DEPTH + 1> stack;
+
+    uint32_t hitBits = 0;
+    while (activeBits != 0) {
+        // === INTERSECT ===
+        const simd::vec8_f32 tCornerX = posX * tCoefX - tBiasX;
+        const simd::vec8_f32 tCornerY = posY * tCoefY - tBiasY;
+        const simd::vec8_f32 tCornerZ = posZ * tCoefZ - tBiasZ;
+
+        // Fetch the descriptors and PUSH the lanes whose current voxel is valid
+        std::array<uint32_t, simdWidth> childIndices, scales;
+        (simd::vec8_u32(7) - ((idx & simd::vec8_u32(7)) ^ octantMask)).store(childIndices);
+        scale.store(scales);
+        uint32_t pushBits = 0, leafBits = 0;
+        for (uint32_t laneBits = activeBits; laneBits != 0; laneBits &= laneBits - 1) {
+            const int lane = simd::bitScan32(laneBits);
+            const Descriptor* parent = parents[lane];
+            const int childIndex = static_cast<int>(childIndices[lane]);
+            if (!parent->isValid(childIndex))
+                continue;
+
+            stack[scales[lane]][lane] = parent;
+            if (parent->isLeaf(childIndex)) {
+                leafBits |= 1u << lane;
+            } else {
+                parents[lane] = getChild(parent, childIndex);
+                pushBits |= 1u << lane;
+            }
+        }
+
+        if (leafBits != 0) {
+            // Only the origin was transformed to SVDAG space (see intersectScalar)
+            std::array<float, simdWidth> distances;
+            tMin.store(distances);
+            for (uint32_t laneBits = leafBits; laneBits != 0; laneBits &= laneBits - 1) {
+                const int lane = simd::bitScan32(laneBits);
+                outEntryDistances[lane] = distances[lane] * m_boundsExtent.x;
+            }
+            hitBits |= leafBits;
+            activeBits &= ~leafBits;
+        }
+
+        const uint32_t advanceBits = activeBits & ~pushBits;
+        if (pushBits != 0) {
+            // === PUSH ===
+            // Select the child voxel that the ray enters first.
+            const simd::vec8_f32 half = scaleExp2(scale - simd::vec8_u32(1));
+            const simd::mask8 centerMaskX = half * tCoefX + tCornerX > tMin;
+            const simd::mask8 centerMaskY = half * tCoefY + tCornerY > tMin;
+            const simd::mask8 centerMaskZ = half * tCoefZ + tCornerZ > tMin;
+            const simd::vec8_u32 pushIdx = maskToBits8(centerMaskX, 1) | maskToBits8(centerMaskY, 2) | maskToBits8(centerMaskZ, 4);
+            const simd::vec8_f32 pushPosX = simd::blend(posX, posX + half, centerMaskX);
+            const simd::vec8_f32 pushPosY = simd::blend(posY, posY + half, centerMaskY);
+            const simd::vec8_f32 pushPosZ = simd::blend(posZ, posZ + half, centerMaskZ);
+
+            const simd::mask8 pushMask = bitsToMask8(pushBits);
+            posX = simd::blend(posX, pushPosX, pushMask);
+            posY = simd::blend(posY, pushPosY, pushMask);
+            posZ = simd::blend(posZ, pushPosZ, pushMask);
+            idx = simd::blend(idx, pushIdx, pushMask);
+            scale = simd::blend(scale, scale - simd::vec8_u32(1), pushMask);
+        }
+
+        if (advanceBits != 0) {
+            // === ADVANCE ===
+            // Step along the ray
+            const simd::vec8_f32 stepSize = scaleExp2(scale);
+            const simd::vec8_f32 tcMax = simd::min(tCornerX, simd::min(tCornerY, tCornerZ));
+            const simd::mask8 stepMaskX = tCornerX <= tcMax;
+            const simd::mask8 stepMaskY = tCornerY <= tcMax;
+            const simd::mask8 stepMaskZ = tCornerZ <= tcMax;
+            simd::vec8_f32 advancePosX = simd::blend(posX, posX - stepSize, stepMaskX);
+            simd::vec8_f32 advancePosY = simd::blend(posY, posY - stepSize, stepMaskY);
+            simd::vec8_f32 advancePosZ = simd::blend(posZ, posZ - stepSize, stepMaskZ);
+            const simd::vec8_u32 stepBits = maskToBits8(stepMaskX, 1) | maskToBits8(stepMaskY, 2) | maskToBits8(stepMaskZ, 4);
+
+            // Proceed with pop if the bit flips disagree with the ray direction
+            simd::vec8_u32 advanceScale = scale;
+            const uint32_t popBits = static_cast<uint32_t>((((idx ^ stepBits) & stepBits) > simd::vec8_u32(0)).bitMask()) & advanceBits;
+            if (popBits != 0) {
+                // === POP ===
+                // Find the highest differing bit between the two positions
+                const simd::vec8_u32 differingBitsX = simd::blend(simd::vec8_u32(0), simd::floatBitsToInt(advancePosX) ^ simd::floatBitsToInt(advancePosX + stepSize), stepMaskX);
+                const simd::vec8_u32 differingBitsY = simd::blend(simd::vec8_u32(0), simd::floatBitsToInt(advancePosY) ^ simd::floatBitsToInt(advancePosY + stepSize), stepMaskY);
+                const simd::vec8_u32 differingBitsZ = simd::blend(simd::vec8_u32(0), simd::floatBitsToInt(advancePosZ) ^ simd::floatBitsToInt(advancePosZ + stepSize), stepMaskZ);
+                std::array<uint32_t, simdWidth> differingBits;
+                (differingBitsX | differingBitsY | differingBitsZ).store(differingBits);
+
+                // Restore parent voxel from the stack, rays that leave the octree miss
+                for (uint32_t laneBits = popBits; laneBits != 0; laneBits &= laneBits - 1) {
+                    const int lane = simd::bitScan32(laneBits);
+                    const int newScale = simd::bitScanReverse32(differingBits[lane]);
+                    scales[lane] = static_cast<uint32_t>(newScale);
+                    if (newScale < CAST_STACK_DEPTH)
+                        parents[lane] = stack[newScale][lane];
+                    else
+                        activeBits &= ~(1u << lane);
+                }
+                advanceScale.load(scales);
+            }
+
+            // Round cube position and extract child slot index
+            const simd::vec8_u32 shX = simd::floatBitsToInt(advancePosX) >> advanceScale;
+            const simd::vec8_u32 shY = simd::floatBitsToInt(advancePosY) >> advanceScale;
+            const simd::vec8_u32 shZ = simd::floatBitsToInt(advancePosZ) >> advanceScale;
+            advancePosX = simd::intBitsToFloat(shX << advanceScale);
+            advancePosY = simd::intBitsToFloat(shY << advanceScale);
+            advancePosZ = simd::intBitsToFloat(shZ << advanceScale);
+            const simd::vec8_u32 lowBit(1);
+            const simd::vec8_u32 advanceIdx = (shX & lowBit) | ((shY & lowBit) << 1) | ((shZ & lowBit) << 2);
+
+            const simd::mask8 advanceMask = bitsToMask8(advanceBits);
+            posX = simd::blend(posX, advancePosX, advanceMask);
+            posY = simd::blend(posY, advancePosY, advanceMask);
+            posZ = simd::blend(posZ, advancePosZ, advanceMask);
+            idx = simd::blend(idx, advanceIdx, advanceMask);
+            scale = simd::blend(scale, advanceScale, advanceMask);
+            tMin = simd::blend(tMin, tcMax, advanceMask);
+        }
     }
+
+    return hitBits;
 }
+
 std::pair<std::vector<glm::vec3>, std::vector<glm::ivec3>> SparseVoxelDAG::generateSurfaceMesh() const
 {
     std::vector<glm::vec3> positions;
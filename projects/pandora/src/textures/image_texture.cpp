@@ -14,6 +14,7 @@ namespace pandora {
 
 template <class T>
 ImageTexture<T>::ImageTexture(std::filesystem::path filePath)
+    : m_filePath(filePath)
 {
     ALWAYS_ASSERT(std::filesystem::exists(filePath));
     auto in = OIIO::ImageInput::open(filePath.string());
@@ -4,11 +4,14 @@
 #include "pandora/utility/enumerate.h"
 #include "pandora/utility/error_handling.h"
 #include "pandora/utility/math.h"
+#include <algorithm>
 #include <mutex>
 #include <optick.h>
 #include <spdlog/spdlog.h>
 #include <stream/cache/lru_cache.h>
 #include <stream/cache/lru_cache_ts.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
 #include <tbb/task_group.h>
 #include <tuple>
 #include <unordered_map>
@@ -292,24 +295,37 @@ std::vector<tasking::CachedPtr<Shape>> makeSubSceneResident(const pandora::SubSc
 {
     OPTICK_EVENT();
 
-    std::vector<tasking::CachedPtr<Shape>> owningPtrs;
+    std::vector<Shape*> shapes;
     for (const auto& pSceneObject : subScene.sceneObjects) {
-        owningPtrs.emplace_back(geometryCache.makeResident(pSceneObject->pShape.get()));
+        shapes.push_back(pSceneObject->pShape.get());
     }
 
-    std::function<void(const SceneNode*)> makeResidentRecurse = [&](const SceneNode* pSceneNode) {
+    std::function<void(const SceneNode*)> collectShapesRecurse = [&](const SceneNode* pSceneNode) {
         for (const auto& pSceneObject : pSceneNode->objects) {
-            owningPtrs.emplace_back(geometryCache.makeResident(pSceneObject->pShape.get()));
+            shapes.push_back(pSceneObject->pShape.get());
         }
 
         for (const auto& [pChild, _] : pSceneNode->children) {
-            makeResidentRecurse(pChild.get());
+            collectShapesRecurse(pChild.get());
         }
     };
     for (const auto& [pChild, _] : subScene.sceneNodes) {
-        makeResidentRecurse(pChild);
+        collectShapesRecurse(pChild);
     }
 
+    // Instanced shapes may occur multiple times; a worker would spin until another worker has loaded it.
+    std::sort(std::begin(shapes), std::end(shapes));
+    shapes.erase(std::unique(std::begin(shapes), std::end(shapes)), std::end(shapes));
+
+    // Read all shapes from disk in a single batch.
+    geometryCache.prefetch(gsl::span<Shape* const>(shapes));
+
+    // Wait for the reads and deserialize the shapes in parallel.
+    std::vector<tasking::CachedPtr<Shape>> owningPtrs(shapes.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, shapes.size()), [&](tbb::blocked_range<size_t> localRange) {
+        for (size_t i = localRange.begin(); i < localRange.end(); i++)
+            owningPtrs[i] = geometryCache.makeResident(shapes[i]);
+    });
     return owningPtrs;
 }
 
@@ -5,12 +5,15 @@
 #include "pandora/utility/enumerate.h"
 #include "pandora/utility/error_handling.h"
 #include "pandora/utility/math.h"
+#include <atomic>
 #include <deque>
 #include <embree3/rtcore.h>
 #include <memory>
 #include <optick.h>
 #include <spdlog/spdlog.h>
 #include <tbb/concurrent_vector.h>
+#include <tbb/task_group.h>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <unordered_set>
@@ -27,9 +30,12 @@ BatchingAccelerationStructureBuilder::BatchingAccelerationStructureBuilder(
     tasking::TaskGraph* pTaskGraph,
     unsigned primitivesPerBatchingPoint,
     size_t botLevelBVHCacheSize,
-    unsigned svdagRes)
+    unsigned svdagRes,
+    bool sortRays,
+    PauseableBVHTraversal topLevelTraversal)
     : m_botLevelBVHCacheSize(botLevelBVHCacheSize)
-    , m_svdagRes(svdagRes)
+    , m_sortRays(sortRays)
+    , m_topLevelTraversal(topLevelTraversal)
     , m_pGeometryCache(pCache)
     , m_pTaskGraph(pTaskGraph)
 {
@@ -38,6 +44,115 @@ BatchingAccelerationStructureBuilder::BatchingAccelerationStructureBuilder(
 
     spdlog::info("Splitting scene into sub scenes");
     m_subScenes = detail::createSubScenes(*pScene, primitivesPerBatchingPoint, m_embreeDevice);
+
+    if (svdagRes > 0)
+        createSVDAGs(svdagRes);
+}
+
+BatchingAccelerationStructureBuilder::BatchingAccelerationStructureBuilder(
+    std::vector<SubScene>&& subScenes,
+    std::vector<SparseVoxelDAG>&& svdags,
+    tasking::LRUCacheTS* pCache,
+    tasking::TaskGraph* pTaskGraph,
+    size_t botLevelBVHCacheSize,
+    bool sortRays,
+    PauseableBVHTraversal topLevelTraversal)
+    : m_botLevelBVHCacheSize(botLevelBVHCacheSize)
+    , m_sortRays(sortRays)
+    , m_topLevelTraversal(topLevelTraversal)
+    , m_subScenes(std::move(subScenes))
+    , m_svdags(std::move(svdags))
+    , m_pGeometryCache(pCache)
+    , m_pTaskGraph(pTaskGraph)
+{
+    ALWAYS_ASSERT(m_svdags.empty() || m_svdags.size() == m_subScenes.size());
+
+    m_embreeDevice = rtcNewDevice(nullptr);
+    rtcSetDeviceErrorFunction(m_embreeDevice, embreeErrorFunc, nullptr);
+
+    for (const auto& svdag : m_svdags)
+        g_stats.memory.svdagsAfterCompression += svdag.sizeBytes();
+}
+
+gsl::span<const SubScene> BatchingAccelerationStructureBuilder::subScenes() const
+{
+    return m_subScenes;
+}
+
+gsl::span<const SparseVoxelDAG> BatchingAccelerationStructureBuilder::svdags() const
+{
+    return m_svdags;
+}
+
+gsl::span<const std::unique_ptr<PersistentBVH>> BatchingAccelerationStructureBuilder::persistentBVHs() const
+{
+    return m_persistentBVHs;
+}
+
+void BatchingAccelerationStructureBuilder::createPersistentBVHs(std::unique_ptr<tasking::Serializer>&& pSerializer)
+{
+    OPTICK_EVENT();
+
+    tasking::LRUCacheTS::Builder cacheBuilder { std::move(pSerializer) };
+    m_persistentBVHs = pandora::createPersistentBVHs(m_subScenes, *m_pGeometryCache, cacheBuilder);
+    m_persistentBVHCacheBuilder = std::move(cacheBuilder);
+}
+
+void BatchingAccelerationStructureBuilder::usePersistentBVHs(std::vector<std::unique_ptr<PersistentBVH>>&& bvhs, tasking::LRUCacheTS::Builder&& cacheBuilder)
+{
+    ALWAYS_ASSERT(bvhs.size() == m_subScenes.size());
+    m_persistentBVHs = std::move(bvhs);
+    m_persistentBVHCacheBuilder = std::move(cacheBuilder);
+}
+
+void BatchingAccelerationStructureBuilder::createSVDAGs(unsigned resolution)
+{
+    OPTICK_EVENT();
+
+    std::vector<std::optional<SparseVoxelDAG>> svdags;
+    svdags.resize(m_subScenes.size());
+
+    spdlog::info("Creating SVOs");
+
+    // TODO: make cache thread safe and update this code...
+    // Because the caches are not thread safe (yet) we have to load the data from the main thread..
+    // We keep track of how many threads are working so that we never load new data faster than we can process it.
+    const unsigned maxParallelism = std::max(1u, std::thread::hardware_concurrency() - 1);
+    std::atomic_uint parallelTasks { 0 };
+
+    tbb::task_group tg;
+    for (size_t i = 0; i < m_subScenes.size(); i++) {
+        while (parallelTasks.load(std::memory_order::memory_order_acquire) >= maxParallelism)
+            continue;
+
+        // Make resident sequentially
+        const auto& subScene = m_subScenes[i];
+        auto shapesOwningPtrs = detail::makeSubSceneResident(subScene, *m_pGeometryCache);
+
+        // Voxelize and create SVO in parallel
+        parallelTasks.fetch_add(1);
+        tg.run([i, &subScene, shapesOwningPtrs = std::move(shapesOwningPtrs), &svdags, &parallelTasks, resolution]() {
+            svdags[i] = detail::createSVDAGfromSubScene(subScene, resolution);
+            parallelTasks.fetch_sub(1);
+        });
+    }
+    tg.wait();
+
+    for (const auto& svdag : svdags)
+        g_stats.memory.svdagsBeforeCompression += svdag->sizeBytes();
+
+    spdlog::info("Compressing SVO to SVDAGs");
+    std::vector<SparseVoxelDAG*> pSvdags;
+    for (auto& svdag : svdags)
+        pSvdags.push_back(&svdag.value());
+    SparseVoxelDAG::compressDAGs(pSvdags);
+
+    for (const auto& svdag : svdags)
+        g_stats.memory.svdagsAfterCompression += svdag->sizeBytes();
+
+    m_svdags.reserve(svdags.size());
+    for (auto& svdag : svdags)
+        m_svdags.push_back(std::move(*svdag));
 }
 
 void BatchingAccelerationStructureBuilder::preprocessScene(Scene& scene, tasking::LRUCacheTS& oldCache, tasking::CacheBuilder& newCacheBuilder, unsigned primitivesPerBatchingPoint)
@@ -2,10 +2,14 @@
 #include "pandora/core/stats.h"
 #include "pandora/graphics_core/scene.h"
 #include "pandora/utility/enumerate.h"
+#include <algorithm>
+#include <chrono>
+#include <future>
 #include <glm/gtc/type_ptr.hpp>
 #include <optick.h>
 #include <spdlog/spdlog.h>
 #include <tbb/task_arena.h>
+#include <utility>
 
 static void embreeErrorFunc(void* userPtr, const RTCError code, const char* str)
 {
@@ -66,76 +70,83 @@ CachedEmbreeScene::~CachedEmbreeScene()
     childrenScenes.clear();
 }
 
-LRUEmbreeSceneCache::LRUEmbreeSceneCache(size_t maxSize)
-    : m_maxSize(maxSize)
+LRUEmbreeSceneCache::LRUEmbreeSceneCache(size_t maxSize, tasking::MemoryGovernor* pMemoryGovernor, const tasking::MemoryGovernor::Client* pGeometryCache)
+    : m_maxSize(pMemoryGovernor ? pMemoryGovernor->memoryBudget() : maxSize)
+    , m_pMemoryGovernor(pMemoryGovernor)
     , m_embreeDevice(rtcNewDevice(nullptr))
 {
     rtcSetDeviceErrorFunction(m_embreeDevice, embreeErrorFunc, nullptr);
     rtcSetDeviceMemoryMonitorFunction(m_embreeDevice, memoryMonitorCallback, this);
+
+    // A BVH cannot be traversed without its geometry.
+    if (m_pMemoryGovernor)
+        m_pMemoryGovernor->registerClient(this, pGeometryCache);
 }
 
 LRUEmbreeSceneCache::~LRUEmbreeSceneCache()
 {
     spdlog::info("~LRUEmbreeSceneCache(): memory usage = {} bytes", m_size.load());
+    if (m_pMemoryGovernor)
+        m_pMemoryGovernor->unregisterClient(this);
 
     rtcReleaseDevice(m_embreeDevice);
 }
 
-std::shared_ptr<CachedEmbreeScene> LRUEmbreeSceneCache::fromSceneNode(const SceneNode* pSceneNode)
+void LRUEmbreeSceneCache::restorePriority(CacheItem& item)
 {
-    const void* pKey = pSceneNode;
-    if (auto lutIter = m_lookUp.find(pKey); lutIter != std::end(m_lookUp)) {
-        // Item is used => update LRU
-        auto& listIter = lutIter->second;
-        m_scenes.splice(std::end(m_scenes), m_scenes, listIter);
-        listIter = --std::end(m_scenes);
-
-        return listIter->scene;
-    } else {
-        m_scenes.emplace_back(CacheItem { pKey, createEmbreeScene(pSceneNode) });
-        auto listIter = --std::end(m_scenes);
-        m_lookUp[pKey] = listIter;
+    item.priority = m_inflation + item.buildTime / item.sizeBytes;
 
-        return listIter->scene;
+    // Using a scene also uses the scenes that it instances. Those are shared with other sub scenes so they should
+    //  stay resident when this scene is evicted, instead of aging while they are kept alive by this scene.
+    for (const void* pInstancedKey : item.instancedScenes) {
+        if (auto iter = m_scenes.find(pInstancedKey); iter != std::end(m_scenes) && iter->second.isBuilt)
+            restorePriority(iter->second);
     }
 }
 
-std::shared_ptr<CachedEmbreeScene> LRUEmbreeSceneCache::fromSubScene(const SubScene* pSubScene)
+std::shared_ptr<CachedEmbreeScene> LRUEmbreeSceneCache::fromSceneNode(const SceneNode* pSceneNode)
 {
-    std::lock_guard l { m_mutex };
+    return getOrBuild(pSceneNode, [&]() { return createEmbreeScene(pSceneNode); });
+}
 
+std::shared_ptr<CachedEmbreeScene> LRUEmbreeSceneCache::fromSubScene(const SubScene* pSubScene)
+{
     // NOTE: run in task arena to prevent deadlocks (or crashes on Windows). Embree uses TBB in the BVH builders
-    //  which means that the TBB task scheduler is invoked while we're holding a lock. This means that another
-    //  of our scheduler/worker tasks may get executed during the BVH construction. Such a task may also want to
-    //  build an Embree BVH so it will enter this function and request for the lock (the thread would be requesting
-    //  a lock from the same thread (but different task)). The TBB task arena was designed to prevent this issue by
-    //  only allowing tasks to be run that were specified within the arena (so only Embree builder tasks).
+    //  which means that the TBB task scheduler is invoked while we're building a scene that other threads may be
+    //  waiting for. This means that another of our scheduler/worker tasks may get executed during the BVH
+    //  construction. Such a task may request the scene that is being built and wait for it on the thread that is
+    //  supposed to finish the build. The TBB task arena was designed to prevent this issue by only allowing tasks
+    //  to be run that were specified within the arena (so only Embree builder tasks). Each build uses its own arena
+    //  so builds of different scenes run in parallel.
     tbb::task_arena ta;
-    return ta.execute([&]() {
-        const void* pKey = pSubScene;
-        if (auto lutIter = m_lookUp.find(pKey); lutIter != std::end(m_lookUp)) {
-            // Remove from list and add to end
-            auto& listIter = lutIter->second;
-            m_scenes.splice(std::end(m_scenes), m_scenes, listIter);
-            listIter = --std::end(m_scenes);
-
-            return listIter->scene;
-        } else {
-            auto sizeBefore = m_size.load();
-            auto embreeScene = createEmbreeScene(pSubScene);
-            auto sizeAfter = m_size.load();
-            //spdlog::info("Created Embree BVH of {} bytes", sizeAfter - sizeBefore);
+    auto pScene = ta.execute([&]() {
+        return getOrBuild(pSubScene, [&]() { return createEmbreeScene(pSubScene); });
+    });
 
-            if (m_size.load() > m_maxSize)
-                evict();
+    // Evict after releasing the lock: the governor may ask this cache to evict as well. The new scene is referenced
+    //  by pScene so it will not be evicted.
+    if (m_pMemoryGovernor) {
+        m_pMemoryGovernor->enforceBudget();
+    } else if (m_size.load() > m_maxSize) {
+        std::lock_guard l { m_mutex };
+        if (m_size.load() > m_maxSize)
+            evict();
+    }
+    return pScene;
+}
 
-            m_scenes.emplace_back(CacheItem { pKey, embreeScene });
-            auto listIter = --std::end(m_scenes);
-            m_lookUp[pKey] = listIter;
+void LRUEmbreeSceneCache::trackResidency(const SubScene* pSubScene, std::atomic_bool* pIsCached)
+{
+    std::lock_guard l { m_mutex };
+    m_residencyFlags[pSubScene] = pIsCached;
+    pIsCached->store(m_scenes.find(pSubScene) != std::end(m_scenes));
+}
 
-            return listIter->scene;
-        }
-    });
+void LRUEmbreeSceneCache::updateResidency(const void* pKey, bool isCached)
+{
+    // Scenes that are being built count as cached as well: requesting them does not trigger another build.
+    if (auto iter = m_residencyFlags.find(pKey); iter != std::end(m_residencyFlags))
+        iter->second->store(isCached, std::memory_order_relaxed);
 }
 
 std::shared_ptr<CachedEmbreeScene> LRUEmbreeSceneCache::createEmbreeScene(const SceneNode* pSceneNode)
@@ -156,7 +167,7 @@ std::shared_ptr<CachedEmbreeScene> LRUEmbreeSceneCache::createEmbreeScene(const
 
     std::vector<std::shared_ptr<CachedEmbreeScene>> children;
     for (const auto& [pChildNode, optTransform] : pSceneNode->children) {
-        std::shared_ptr<CachedEmbreeScene> pChildScene = fromSceneNode(pSceneNode);
+        std::shared_ptr<CachedEmbreeScene> pChildScene = fromSceneNode(pChildNode.get());
         children.push_back(pChildScene);
 
         RTCGeometry embreeInstanceGeometry = rtcNewGeometry(m_embreeDevice, RTC_GEOMETRY_TYPE_INSTANCE);
@@ -245,23 +256,46 @@ std::shared_ptr<CachedEmbreeScene> LRUEmbreeSceneCache::createEmbreeScene(const
     return std::make_shared<CachedEmbreeScene>(embreeScene, std::move(children));
 }
 
+size_t LRUEmbreeSceneCache::memoryUsage() const
+{
+    return m_size.load();
+}
+
+size_t LRUEmbreeSceneCache::evictMemory(size_t memoryToFree)
+{
+    std::lock_guard l { m_mutex };
+    const size_t sizeBefore = m_size.load();
+    evictUnused(sizeBefore > memoryToFree ? sizeBefore - memoryToFree : 0);
+    const size_t sizeAfter = m_size.load();
+    return sizeBefore > sizeAfter ? sizeBefore - sizeAfter : 0;
+}
+
 void LRUEmbreeSceneCache::evict()
 {
     spdlog::info("LRUEmbreeSceneCache::evict");
-    for (auto iter = std::begin(m_scenes); iter != std::end(m_scenes);) {
-        // If a scene is still actively being used then there is no point in removing it
-        if (iter->scene.use_count() > 1) {
-            iter++;
-            continue;
-        }
+    evictUnused(m_maxSize * 3 / 4);
+    spdlog::info("Size of BVHs after evict: {}", m_size.load());
+}
 
-        m_lookUp.erase(iter->pKey);
-        iter = m_scenes.erase(iter); // Make iter point to the next item (calling iter++ after erase will reference free'd memory)
+void LRUEmbreeSceneCache::evictUnused(size_t targetSize)
+{
+    // If a scene is still actively being used then there is no point in removing it
+    std::vector<std::pair<double, const void*>> candidates;
+    for (const auto& [pKey, item] : m_scenes) {
+        if (item.isBuilt && item.scene.get().use_count() == 1)
+            candidates.emplace_back(item.priority, pKey);
+    }
+    std::sort(std::begin(candidates), std::end(candidates));
 
-        if (m_size.load() < m_maxSize * 3 / 4)
+    for (const auto& [priority, pKey] : candidates) {
+        if (m_size.load() <= targetSize)
             break;
+
+        // Ages the remaining scenes: their priorities are now closer to the inflation value.
+        m_inflation = priority;
+        m_scenes.erase(pKey);
+        updateResidency(pKey, false);
     }
-    spdlog::info("Size of BVHs after evict: {}", m_size.load());
 }
 
 bool LRUEmbreeSceneCache::memoryMonitorCallback(void* pThisMem, ssize_t bytes, bool post)
@@ -0,0 +1,221 @@
+#include "pandora/traversal/persistent_bvh_cache.h"
+#include "pandora/core/stats.h"
+#include "pandora/graphics_core/scene.h"
+#include "pandora/graphics_core/shape.h"
+#include "pandora/traversal/batching.h"
+#include "pandora/utility/error_handling.h"
+#include <cstring>
+#include <optick.h>
+#include <spdlog/spdlog.h>
+#include <unordered_map>
+
+namespace pandora {
+
+PersistentBVHLeaf::PersistentBVHLeaf(const SceneObject* pSceneObject, uint32_t primID)
+    : pSceneObject(pSceneObject)
+    , primID(primID)
+{
+}
+
+Bounds PersistentBVHLeaf::getBounds() const
+{
+    return pSceneObject->pShape->getPrimitiveBounds(primID);
+}
+
+bool PersistentBVHLeaf::intersect(Ray& ray, SurfaceInteraction& si) const
+{
+    const Shape* pShape = pSceneObject->pShape.get();
+    RayHit rayHit {};
+    if (pShape->intersectPrimitive(ray, rayHit, primID)) {
+        si = pShape->fillSurfaceInteraction(ray, rayHit);
+        si.pSceneObject = pSceneObject;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool PersistentBVHLeaf::intersectAny(Ray& ray) const
+{
+    RayHit dummyRayHit;
+    return pSceneObject->pShape->intersectPrimitive(ray, dummyRayHit, primID);
+}
+
+PersistentBVH::PersistentBVH(const SubScene& subScene)
+    : Evictable(true)
+    , m_sceneObjects(std::begin(subScene.sceneObjects), std::end(subScene.sceneObjects))
+{
+    ALWAYS_ASSERT(supportsSubScene(subScene));
+
+    std::vector<PersistentBVHLeaf> leafs;
+    for (const SceneObject* pSceneObject : m_sceneObjects) {
+        for (unsigned primID = 0; primID < pSceneObject->pShape->numPrimitives(); primID++)
+            leafs.emplace_back(pSceneObject, primID);
+    }
+    m_numLeafs = static_cast<uint32_t>(leafs.size());
+
+    m_bvh.emplace(leafs);
+    g_stats.memory.botLevelLoaded += m_bvh->sizeBytes();
+}
+
+PersistentBVH::PersistentBVH(const SubScene& subScene, const tasking::Allocation& bvhAllocation, const tasking::Allocation& leafsAllocation, uint32_t numLeafs, size_t residentSizeBytes)
+    : Evictable(false)
+    , m_sceneObjects(std::begin(subScene.sceneObjects), std::end(subScene.sceneObjects))
+    , m_bvhAllocation(bvhAllocation)
+    , m_leafsAllocation(leafsAllocation)
+    , m_numLeafs(numLeafs)
+    , m_residentSizeBytes(residentSizeBytes)
+{
+    ALWAYS_ASSERT(supportsSubScene(subScene));
+}
+
+bool PersistentBVH::supportsSubScene(const SubScene& subScene)
+{
+    return subScene.sceneNodes.empty() && !subScene.sceneObjects.empty();
+}
+
+bool PersistentBVH::intersect(Ray& ray, SurfaceInteraction& si) const
+{
+    ALWAYS_ASSERT(m_bvh.has_value());
+    return m_bvh->intersect(ray, si);
+}
+
+bool PersistentBVH::intersectAny(Ray& ray) const
+{
+    ALWAYS_ASSERT(m_bvh.has_value());
+    return m_bvh->intersectAny(ray);
+}
+
+size_t PersistentBVH::sizeBytes() const
+{
+    size_t size = sizeof(*this) + m_sceneObjects.size() * sizeof(const SceneObject*);
+    if (m_bvh.has_value())
+        size += m_bvh->sizeBytes();
+    return size;
+}
+
+void PersistentBVH::serialize(tasking::Serializer& serializer)
+{
+    flatbuffers::FlatBufferBuilder fbb;
+    auto serializedBVH = m_bvh->serialize(fbb);
+    fbb.Finish(serializedBVH);
+
+    auto [bvhAllocation, pBVHMem] = serializer.allocateAndMap(fbb.GetSize());
+    std::memcpy(pBVHMem, fbb.GetBufferPointer(), fbb.GetSize());
+    m_bvhAllocation = bvhAllocation;
+
+    // Store the leafs relative to the sub scene so that they remain valid when the scene is loaded again.
+    std::unordered_map<const SceneObject*, uint32_t> sceneObjectIndices;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_sceneObjects.size()); i++)
+        sceneObjectIndices[m_sceneObjects[i]] = i;
+
+    gsl::span<const PersistentBVHLeaf> leafs = m_bvh->leafs();
+    auto [leafsAllocation, pLeafsMem] = serializer.allocateAndMap(leafs.size() * sizeof(SerializedLeaf));
+    auto* pSerializedLeafs = static_cast<SerializedLeaf*>(pLeafsMem);
+    for (const auto& leaf : leafs)
+        *pSerializedLeafs++ = SerializedLeaf { sceneObjectIndices[leaf.pSceneObject], leaf.primID };
+    m_leafsAllocation = leafsAllocation;
+    m_numLeafs = static_cast<uint32_t>(leafs.size());
+    m_residentSizeBytes = sizeBytes();
+
+    serializer.unmapPreviousAllocations();
+}
+
+const tasking::Allocation& PersistentBVH::bvhAllocation() const
+{
+    return m_bvhAllocation;
+}
+
+const tasking::Allocation& PersistentBVH::leafsAllocation() const
+{
+    return m_leafsAllocation;
+}
+
+uint32_t PersistentBVH::numLeafs() const
+{
+    return m_numLeafs;
+}
+
+size_t PersistentBVH::residentSizeBytes() const
+{
+    return m_residentSizeBytes;
+}
+
+void PersistentBVH::doEvict()
+{
+    g_stats.memory.botLevelEvicted += m_bvh->sizeBytes();
+    m_bvh.reset();
+}
+
+void PersistentBVH::doMakeResident(tasking::Deserializer& deserializer)
+{
+    OPTICK_EVENT();
+
+    const auto* pSerializedLeafs = static_cast<const SerializedLeaf*>(deserializer.map(m_leafsAllocation));
+    std::vector<PersistentBVHLeaf> leafs;
+    leafs.reserve(m_numLeafs);
+    for (uint32_t i = 0; i < m_numLeafs; i++)
+        leafs.emplace_back(m_sceneObjects[pSerializedLeafs[i].sceneObjectIndex], pSerializedLeafs[i].primID);
+    deserializer.unmap(pSerializedLeafs);
+
+    const void* pBVHMem = deserializer.map(m_bvhAllocation);
+    m_bvh.emplace(serialization::GetWiVeBVH8(pBVHMem), gsl::span<const PersistentBVHLeaf>(leafs));
+    deserializer.unmap(pBVHMem);
+
+    g_stats.memory.botLevelLoaded += m_bvh->sizeBytes();
+    g_stats.memory.oocTotalDiskRead += deserializer.diskSize(m_leafsAllocation) + deserializer.diskSize(m_bvhAllocation);
+}
+
+void PersistentBVH::getSerializedAllocations(std::vector<tasking::Allocation>& allocations) const
+{
+    allocations.push_back(m_leafsAllocation);
+    allocations.push_back(m_bvhAllocation);
+}
+
+std::vector<std::unique_ptr<PersistentBVH>> createPersistentBVHs(
+    gsl::span<const SubScene> subScenes, tasking::LRUCacheTS& geometryCache, tasking::CacheBuilder& cacheBuilder)
+{
+    OPTICK_EVENT();
+    spdlog::info("Creating persistent bottom level BVHs");
+
+    std::vector<std::unique_ptr<PersistentBVH>> bvhs;
+    for (const SubScene& subScene : subScenes) {
+        if (!PersistentBVH::supportsSubScene(subScene)) {
+            bvhs.push_back(nullptr);
+            continue;
+        }
+
+        auto shapeOwners = detail::makeSubSceneResident(subScene, geometryCache);
+        auto pBVH = std::make_unique<PersistentBVH>(subScene);
+        cacheBuilder.registerCacheable(pBVH.get(), true);
+        bvhs.push_back(std::move(pBVH));
+    }
+    return bvhs;
+}
+
+PersistentBVHCache::PersistentBVHCache(
+    std::vector<std::unique_ptr<PersistentBVH>>&& bvhs, tasking::LRUCacheTS::Builder& cacheBuilder, size_t maxSize,
+    tasking::MemoryGovernor* pMemoryGovernor, const tasking::MemoryGovernor::Client* pGeometryCache)
+    : m_bvhs(std::move(bvhs))
+    , m_cache(pMemoryGovernor ? cacheBuilder.build(*pMemoryGovernor, pGeometryCache) : cacheBuilder.build(maxSize))
+{
+}
+
+PersistentBVH* PersistentBVHCache::get(size_t subSceneIndex) const
+{
+    return m_bvhs[subSceneIndex].get();
+}
+
+tasking::CachedPtr<PersistentBVH> PersistentBVHCache::makeResident(PersistentBVH* pBVH)
+{
+    // Loading replaces building the BVH, so count it as such.
+    auto stopWatch = g_stats.timings.botLevelBuildTime.getScopedStopwatch();
+    return m_cache.makeResident(pBVH);
+}
+
+size_t PersistentBVHCache::nonResidentSizeBytes(const PersistentBVH* pBVH) const
+{
+    return m_cache.nonResidentSizeBytes(pBVH);
+}
+
+}
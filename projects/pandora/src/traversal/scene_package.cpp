@@ -0,0 +1,481 @@
+#include "pandora/traversal/scene_package.h"
+#include "pandora/flatbuffers/data_conversion.h"
+#include "pandora/flatbuffers/scene_package_generated.h"
+#include "pandora/graphics_core/perspective_camera.h"
+#include "pandora/graphics_core/scene.h"
+#include "pandora/lights/area_light.h"
+#include "pandora/lights/distant_light.h"
+#include "pandora/lights/environment_light.h"
+#include "pandora/materials/matte_material.h"
+#include "pandora/shapes/triangle.h"
+#include "pandora/textures/constant_texture.h"
+#include "pandora/textures/image_texture.h"
+#include "pandora/utility/error_handling.h"
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <mio/mmap.hpp>
+#include <optick.h>
+#include <spdlog/spdlog.h>
+#include <stream/serialize/file_serializer.h>
+#include <string>
+#include <unordered_map>
+
+using namespace std::string_literals;
+
+namespace pandora {
+
+// Shapes store the words of the tasking::Allocation of the SplitFileSerializer, so the version should also be
+//  increased when the layout of those allocations changes.
+static constexpr uint32_t scenePackageVersion = 4;
+static constexpr size_t geometryFileSize = 512 * 1024 * 1024;
+static constexpr auto geometryCacheMode = mio_cache_control::cache_mode::no_buffering;
+static constexpr size_t bvhFileSize = 512 * 1024 * 1024;
+static constexpr auto bvhCacheMode = mio_cache_control::cache_mode::no_buffering;
+static constexpr uint32_t noMaterial = std::numeric_limits<uint32_t>::max();
+
+static std::filesystem::path sceneFilePath(const std::filesystem::path& folder)
+{
+    return folder / "scene.bin";
+}
+
+static std::filesystem::path geometryFolderPath(const std::filesystem::path& folder)
+{
+    return folder / "geometry";
+}
+
+static std::filesystem::path bvhFolderPath(const std::filesystem::path& folder)
+{
+    return folder / "bvh";
+}
+
+static serialization::ScenePackageAllocation serializeAllocation(const tasking::Allocation& allocation)
+{
+    static_assert(sizeof(tasking::Allocation) == 3 * sizeof(uint64_t));
+    return serialization::ScenePackageAllocation(allocation.words[0], allocation.words[1], allocation.words[2]);
+}
+
+static tasking::Allocation deserializeAllocation(const serialization::ScenePackageAllocation* pSerializedAllocation)
+{
+    ALWAYS_ASSERT(pSerializedAllocation);
+    tasking::Allocation allocation;
+    allocation.words[0] = pSerializedAllocation->word0();
+    allocation.words[1] = pSerializedAllocation->word1();
+    allocation.words[2] = pSerializedAllocation->word2();
+    return allocation;
+}
+
+static int64_t sourceFileTime(const std::filesystem::path& sourceFile)
+{
+    return static_cast<int64_t>(std::filesystem::last_write_time(sourceFile).time_since_epoch().count());
+}
+
+std::unique_ptr<tasking::Serializer> createScenePackageGeometrySerializer(std::filesystem::path folder, tasking::FileCompression compression)
+{
+    // Remove the scene file first so that a package that is only partially written is never considered valid.
+    std::filesystem::create_directories(folder);
+    std::filesystem::remove(sceneFilePath(folder));
+    return tasking::SplitFileSerializer::createPersistent(geometryFolderPath(folder), geometryFileSize, geometryCacheMode, compression);
+}
+
+std::unique_ptr<tasking::Serializer> createScenePackageBVHSerializer(std::filesystem::path folder)
+{
+    std::filesystem::create_directories(folder);
+    std::filesystem::remove(sceneFilePath(folder));
+    return tasking::SplitFileSerializer::createPersistent(bvhFolderPath(folder), bvhFileSize, bvhCacheMode);
+}
+
+void writeScenePackage(
+    std::filesystem::path folder,
+    const ScenePackageKey& key,
+    const RenderConfig& renderConfig,
+    const tasking::LRUCacheTS& geometryCache,
+    gsl::span<const SubScene> subScenes,
+    gsl::span<const SparseVoxelDAG> svdags,
+    gsl::span<const std::unique_ptr<PersistentBVH>> persistentBVHs)
+{
+    OPTICK_EVENT();
+    spdlog::info("Writing scene package to \"{}\"", folder.string());
+
+    flatbuffers::FlatBufferBuilder builder;
+
+    std::unordered_map<const Shape*, uint32_t> shapeIndices;
+    std::vector<flatbuffers::Offset<serialization::ScenePackageShape>> serializedShapes;
+    auto getShapeIndex = [&](const Shape* pShape) {
+        if (auto iter = shapeIndices.find(pShape); iter != std::end(shapeIndices))
+            return iter->second;
+
+        const auto* pTriangleShape = dynamic_cast<const TriangleShape*>(pShape);
+        if (!pTriangleShape)
+            THROW_ERROR("Scene package only supports triangle shapes");
+
+        const auto serializedAllocation = serializeAllocation(pTriangleShape->serializedStateHandle());
+        const auto bounds = pShape->getBounds().serialize();
+        serializedShapes.push_back(serialization::CreateScenePackageShape(
+            builder, &serializedAllocation, pShape->numPrimitives(), &bounds, geometryCache.residentSizeBytes(pShape)));
+
+        const auto shapeIndex = static_cast<uint32_t>(shapeIndices.size());
+        shapeIndices[pShape] = shapeIndex;
+        return shapeIndex;
+    };
+
+    std::unordered_map<const Material*, uint32_t> materialIndices;
+    std::vector<flatbuffers::Offset<serialization::ScenePackageMaterial>> serializedMaterials;
+    auto getMaterialIndex = [&](const Material* pMaterial) {
+        if (!pMaterial)
+            return noMaterial;
+        if (auto iter = materialIndices.find(pMaterial); iter != std::end(materialIndices))
+            return iter->second;
+
+        const auto* pMatteMaterial = dynamic_cast<const MatteMaterial*>(pMaterial);
+        if (!pMatteMaterial)
+            THROW_ERROR("Scene package only supports matte materials");
+        const auto* pKd = dynamic_cast<const ConstantTexture<Spectrum>*>(pMatteMaterial->kd().get());
+        const auto* pSigma = dynamic_cast<const ConstantTexture<float>*>(pMatteMaterial->sigma().get());
+        if (!pKd || !pSigma)
+            THROW_ERROR("Scene package only supports materials with constant textures");
+
+        const auto kd = serialize(pKd->value());
+        serializedMaterials.push_back(serialization::CreateScenePackageMaterial(builder, &kd, pSigma->value()));
+
+        const auto materialIndex = static_cast<uint32_t>(materialIndices.size());
+        materialIndices[pMaterial] = materialIndex;
+        return materialIndex;
+    };
+
+    std::unordered_map<const SceneObject*, uint32_t> sceneObjectIndices;
+    std::vector<flatbuffers::Offset<serialization::ScenePackageSceneObject>> serializedSceneObjects;
+    auto getSceneObjectIndex = [&](const SceneObject* pSceneObject) {
+        if (auto iter = sceneObjectIndices.find(pSceneObject); iter != std::end(sceneObjectIndices))
+            return iter->second;
+
+        const uint32_t shapeIndex = getShapeIndex(pSceneObject->pShape.get());
+        const uint32_t materialIndex = getMaterialIndex(pSceneObject->pMaterial.get());
+        const auto areaLight = serialize(pSceneObject->pAreaLight ? pSceneObject->pAreaLight->emittedLight() : glm::vec3(0.0f));
+        serializedSceneObjects.push_back(serialization::CreateScenePackageSceneObject(
+            builder, shapeIndex, materialIndex, pSceneObject->pAreaLight != nullptr, &areaLight));
+
+        const auto sceneObjectIndex = static_cast<uint32_t>(sceneObjectIndices.size());
+        sceneObjectIndices[pSceneObject] = sceneObjectIndex;
+        return sceneObjectIndex;
+    };
+
+    // Nodes are stored in the order in which they are first visited (children before their parents) so the index of a
+    //  node is only known after its children have been visited. Reserve index 0 for the root.
+    std::unordered_map<const SceneNode*, uint32_t> sceneNodeIndices;
+    std::vector<flatbuffers::Offset<serialization::ScenePackageSceneNode>> serializedSceneNodes { 1 };
+    std::function<uint32_t(const SceneNode*)> getSceneNodeIndex = [&](const SceneNode* pSceneNode) -> uint32_t {
+        if (auto iter = sceneNodeIndices.find(pSceneNode); iter != std::end(sceneNodeIndices))
+            return iter->second;
+
+        std::vector<uint32_t> objects;
+        for (const auto& pSceneObject : pSceneNode->objects)
+            objects.push_back(getSceneObjectIndex(pSceneObject.get()));
+
+        std::vector<uint32_t> children;
+        std::vector<uint8_t> childHasTransform;
+        std::vector<serialization::Mat4> childTransforms;
+        for (const auto& [pChild, optTransform] : pSceneNode->children) {
+            children.push_back(getSceneNodeIndex(pChild.get()));
+            childHasTransform.push_back(optTransform.has_value());
+            childTransforms.push_back(serialize(optTransform.value_or(glm::identity<glm::mat4>())));
+        }
+
+        const auto serializedSceneNode = serialization::CreateScenePackageSceneNodeDirect(
+            builder, &objects, &children, &childHasTransform, &childTransforms);
+
+        uint32_t sceneNodeIndex = 0;
+        if (pSceneNode == renderConfig.pScene->pRoot.get()) {
+            serializedSceneNodes[0] = serializedSceneNode;
+        } else {
+            sceneNodeIndex = static_cast<uint32_t>(serializedSceneNodes.size());
+            serializedSceneNodes.push_back(serializedSceneNode);
+        }
+        sceneNodeIndices[pSceneNode] = sceneNodeIndex;
+        return sceneNodeIndex;
+    };
+    getSceneNodeIndex(renderConfig.pScene->pRoot.get());
+
+    std::vector<flatbuffers::Offset<serialization::ScenePackageDistantLight>> serializedDistantLights;
+    std::vector<flatbuffers::Offset<serialization::ScenePackageEnvironmentLight>> serializedEnvironmentLights;
+    for (const InfiniteLight* pLight : renderConfig.pScene->infiniteLights) {
+        if (const auto* pDistantLight = dynamic_cast<const DistantLight*>(pLight)) {
+            const auto lightToWorld = serialize(pDistantLight->lightToWorldMatrix());
+            const auto L = serialize(pDistantLight->L());
+            const auto direction = serialize(pDistantLight->direction());
+            serializedDistantLights.push_back(serialization::CreateScenePackageDistantLight(builder, &lightToWorld, &L, &direction));
+        } else if (const auto* pEnvironmentLight = dynamic_cast<const EnvironmentLight*>(pLight)) {
+            const auto* pTexture = dynamic_cast<const ImageTexture<glm::vec3>*>(pEnvironmentLight->texture().get());
+            if (!pTexture)
+                THROW_ERROR("Scene package only supports environment lights with an image texture");
+
+            const auto lightToWorld = serialize(pEnvironmentLight->lightToWorldMatrix());
+            const auto L = serialize(pEnvironmentLight->L());
+            serializedEnvironmentLights.push_back(serialization::CreateScenePackageEnvironmentLightDirect(
+                builder, &lightToWorld, &L, pTexture->filePath().string().c_str()));
+        } else {
+            THROW_ERROR("Scene package encountered unsupported infinite light type");
+        }
+    }
+
+    const PerspectiveCamera& camera = *renderConfig.camera;
+    const auto cameraTransform = serialize(camera.getTransform());
+    const auto serializedCamera = serialization::CreateScenePackageCamera(
+        builder, camera.aspectRatio(), camera.fovX(), camera.lensRadius(), camera.focalDistance(), &cameraTransform,
+        renderConfig.resolution.x, renderConfig.resolution.y);
+
+    std::vector<flatbuffers::Offset<serialization::ScenePackageSubScene>> serializedSubScenes;
+    for (const SubScene& subScene : subScenes) {
+        std::vector<uint32_t> sceneObjects;
+        for (const SceneObject* pSceneObject : subScene.sceneObjects)
+            sceneObjects.push_back(sceneObjectIndices.at(pSceneObject));
+
+        std::vector<uint32_t> sceneNodes;
+        std::vector<uint8_t> nodeHasTransform;
+        std::vector<serialization::Mat4> nodeTransforms;
+        for (const auto& [pSceneNode, optTransform] : subScene.sceneNodes) {
+            sceneNodes.push_back(sceneNodeIndices.at(pSceneNode));
+            nodeHasTransform.push_back(optTransform.has_value());
+            nodeTransforms.push_back(serialize(optTransform.value_or(glm::identity<glm::mat4>())));
+        }
+
+        serializedSubScenes.push_back(serialization::CreateScenePackageSubSceneDirect(
+            builder, &sceneObjects, &sceneNodes, &nodeHasTransform, &nodeTransforms));
+    }
+
+    flatbuffers::Offset<serialization::SparseVoxelDAGs> serializedSVDAGs = 0;
+    if (!svdags.empty()) {
+        ALWAYS_ASSERT(static_cast<size_t>(svdags.size()) == static_cast<size_t>(subScenes.size()));
+        std::vector<const SparseVoxelDAG*> pSvdags;
+        for (const auto& svdag : svdags)
+            pSvdags.push_back(&svdag);
+        serializedSVDAGs = SparseVoxelDAG::serializeDAGs(builder, pSvdags);
+    }
+
+    std::vector<flatbuffers::Offset<serialization::ScenePackagePersistentBVH>> serializedBVHs;
+    if (key.persistentBVHs) {
+        ALWAYS_ASSERT(static_cast<size_t>(persistentBVHs.size()) == static_cast<size_t>(subScenes.size()));
+        for (const auto& pBVH : persistentBVHs) {
+            if (pBVH) {
+                const auto bvhAllocation = serializeAllocation(pBVH->bvhAllocation());
+                const auto leafsAllocation = serializeAllocation(pBVH->leafsAllocation());
+                serializedBVHs.push_back(serialization::CreateScenePackagePersistentBVH(
+                    builder, &bvhAllocation, &leafsAllocation, pBVH->numLeafs(), pBVH->residentSizeBytes()));
+            } else {
+                serializedBVHs.push_back(serialization::CreateScenePackagePersistentBVH(builder));
+            }
+        }
+    }
+
+    const auto sourceFile = std::filesystem::absolute(key.sourceFile).string();
+    const auto scenePackage = serialization::CreateScenePackageDirect(
+        builder,
+        scenePackageVersion,
+        sourceFile.c_str(),
+        std::filesystem::file_size(key.sourceFile),
+        sourceFileTime(key.sourceFile),
+        key.cameraID,
+        key.subdiv,
+        key.primitivesPerBatchingPoint,
+        key.svdagRes,
+        key.persistentBVHs,
+        serializedCamera,
+        &serializedMaterials,
+        &serializedShapes,
+        &serializedSceneObjects,
+        &serializedSceneNodes,
+        &serializedDistantLights,
+        &serializedEnvironmentLights,
+        &serializedSubScenes,
+        serializedSVDAGs,
+        &serializedBVHs);
+    serialization::FinishScenePackageBuffer(builder, scenePackage);
+
+    // Write to a temporary file first so that the package only becomes valid once it has been written completely.
+    const auto tmpFilePath = folder / "scene.bin.tmp";
+    {
+        std::ofstream file { tmpFilePath, std::ios::binary | std::ios::trunc };
+        if (!file.is_open())
+            THROW_ERROR("Could not create scene package file "s + tmpFilePath.string());
+        file.write(reinterpret_cast<const char*>(builder.GetBufferPointer()), builder.GetSize());
+    }
+    std::filesystem::rename(tmpFilePath, sceneFilePath(folder));
+
+    spdlog::info("Scene package contains {} shapes and {} sub scenes", serializedShapes.size(), serializedSubScenes.size());
+}
+
+static const serialization::ScenePackage* mapScenePackage(const std::filesystem::path& folder, mio::mmap_source& mappedFile)
+{
+    const auto filePath = sceneFilePath(folder);
+    if (!std::filesystem::exists(filePath))
+        return nullptr;
+
+    std::error_code error;
+    mappedFile.map(filePath.string(), error);
+    if (error)
+        return nullptr;
+
+    flatbuffers::Verifier verifier { reinterpret_cast<const uint8_t*>(mappedFile.data()), mappedFile.size() };
+    if (!serialization::VerifyScenePackageBuffer(verifier))
+        return nullptr;
+
+    const auto* pScenePackage = serialization::GetScenePackage(mappedFile.data());
+    if (pScenePackage->version() != scenePackageVersion)
+        return nullptr;
+    return pScenePackage;
+}
+
+bool isScenePackageValid(std::filesystem::path folder, const ScenePackageKey& key)
+{
+    mio::mmap_source mappedFile;
+    const auto* pScenePackage = mapScenePackage(folder, mappedFile);
+    if (!pScenePackage) {
+        spdlog::info("No (compatible) scene package found in \"{}\"", folder.string());
+        return false;
+    }
+
+    if (!std::filesystem::exists(key.sourceFile) || !pScenePackage->source_file()
+        || pScenePackage->source_file()->str() != std::filesystem::absolute(key.sourceFile).string()
+        || pScenePackage->source_file_size() != std::filesystem::file_size(key.sourceFile)
+        || pScenePackage->source_file_time() != sourceFileTime(key.sourceFile)) {
+        spdlog::info("Scene package in \"{}\" was created from a different (version of the) scene file", folder.string());
+        return false;
+    }
+
+    if (pScenePackage->camera_id() != key.cameraID || pScenePackage->subdiv() != key.subdiv
+        || pScenePackage->primitives_per_batching_point() != key.primitivesPerBatchingPoint
+        || pScenePackage->svdag_resolution() != key.svdagRes
+        || pScenePackage->persistent_bvhs() != key.persistentBVHs) {
+        spdlog::info("Scene package in \"{}\" was created with different settings", folder.string());
+        return false;
+    }
+
+    return true;
+}
+
+ScenePackage loadScenePackage(std::filesystem::path folder)
+{
+    OPTICK_EVENT();
+    spdlog::info("Loading scene package from \"{}\"", folder.string());
+
+    mio::mmap_source mappedFile;
+    const auto* pScenePackage = mapScenePackage(folder, mappedFile);
+    if (!pScenePackage)
+        THROW_ERROR("Could not load scene package from "s + folder.string());
+
+    tasking::LRUCacheTS::Builder cacheBuilder { tasking::openSplitFileDeserializer(geometryFolderPath(folder), geometryCacheMode) };
+
+    std::vector<std::shared_ptr<Shape>> shapes;
+    for (const auto* pSerializedShape : *pScenePackage->shapes()) {
+        const auto allocation = deserializeAllocation(pSerializedShape->allocation());
+        auto pShape = std::make_shared<TriangleShape>(allocation, pSerializedShape->num_primitives(), Bounds(*pSerializedShape->bounds()));
+        cacheBuilder.registerSerialized(pShape.get(), pSerializedShape->resident_size_bytes());
+        shapes.push_back(pShape);
+    }
+
+    std::vector<std::shared_ptr<Material>> materials;
+    for (const auto* pSerializedMaterial : *pScenePackage->materials()) {
+        auto pKd = std::make_shared<ConstantTexture<Spectrum>>(deserialize(*pSerializedMaterial->kd()));
+        auto pSigma = std::make_shared<ConstantTexture<float>>(pSerializedMaterial->sigma());
+        materials.push_back(std::make_shared<MatteMaterial>(pKd, pSigma));
+    }
+
+    SceneBuilder sceneBuilder;
+    std::vector<std::shared_ptr<SceneObject>> sceneObjects;
+    for (const auto* pSerializedSceneObject : *pScenePackage->scene_objects()) {
+        auto pShape = shapes[pSerializedSceneObject->shape()];
+        const uint32_t materialIndex = pSerializedSceneObject->material();
+        auto pMaterial = materialIndex == noMaterial ? nullptr : materials[materialIndex];
+        if (pSerializedSceneObject->has_area_light()) {
+            auto pAreaLight = std::make_unique<AreaLight>(deserialize(*pSerializedSceneObject->area_light()));
+            sceneObjects.push_back(sceneBuilder.addSceneObject(pShape, pMaterial, std::move(pAreaLight)));
+        } else {
+            sceneObjects.push_back(sceneBuilder.addSceneObject(pShape, pMaterial));
+        }
+    }
+
+    std::vector<std::shared_ptr<SceneNode>> sceneNodes;
+    for (size_t i = 0; i < pScenePackage->scene_nodes()->size(); i++)
+        sceneNodes.push_back(sceneBuilder.addSceneNode());
+    for (uint32_t i = 0; i < pScenePackage->scene_nodes()->size(); i++) {
+        const auto* pSerializedSceneNode = pScenePackage->scene_nodes()->Get(i);
+        auto pSceneNode = sceneNodes[i];
+        for (const uint32_t sceneObjectIndex : *pSerializedSceneNode->objects())
+            sceneBuilder.attachObject(pSceneNode, sceneObjects[sceneObjectIndex]);
+
+        for (uint32_t j = 0; j < pSerializedSceneNode->children()->size(); j++) {
+            auto pChild = sceneNodes[pSerializedSceneNode->children()->Get(j)];
+            if (pSerializedSceneNode->child_has_transform()->Get(j))
+                sceneBuilder.attachNode(pSceneNode, pChild, deserialize(*pSerializedSceneNode->child_transforms()->Get(j)));
+            else
+                sceneBuilder.attachNode(pSceneNode, pChild);
+        }
+    }
+    sceneBuilder.makeRootNode(sceneNodes[0]);
+
+    for (const auto* pSerializedLight : *pScenePackage->distant_lights()) {
+        sceneBuilder.addInfiniteLight(std::make_unique<DistantLight>(
+            deserialize(*pSerializedLight->light_to_world()), deserialize(*pSerializedLight->L()), deserialize(*pSerializedLight->direction())));
+    }
+    for (const auto* pSerializedLight : *pScenePackage->environment_lights()) {
+        auto pTexture = std::make_shared<ImageTexture<glm::vec3>>(pSerializedLight->texture_file()->str());
+        sceneBuilder.addInfiniteLight(std::make_unique<EnvironmentLight>(
+            deserialize(*pSerializedLight->light_to_world()), deserialize(*pSerializedLight->L()), pTexture));
+    }
+
+    RenderConfig renderConfig;
+    renderConfig.pScene = std::make_unique<Scene>(sceneBuilder.build());
+
+    const auto* pSerializedCamera = pScenePackage->camera();
+    renderConfig.camera = std::make_unique<PerspectiveCamera>(
+        pSerializedCamera->aspect_ratio(), pSerializedCamera->fov_x(), pSerializedCamera->lens_radius(),
+        pSerializedCamera->focal_distance(), deserialize(*pSerializedCamera->transform()));
+    renderConfig.resolution = glm::ivec2(pSerializedCamera->resolution_x(), pSerializedCamera->resolution_y());
+
+    std::vector<SubScene> subScenes;
+    for (const auto* pSerializedSubScene : *pScenePackage->sub_scenes()) {
+        SubScene subScene;
+        for (const uint32_t sceneObjectIndex : *pSerializedSubScene->scene_objects())
+            subScene.sceneObjects.push_back(sceneObjects[sceneObjectIndex].get());
+
+        for (uint32_t i = 0; i < pSerializedSubScene->scene_nodes()->size(); i++) {
+            SceneNode* pSceneNode = sceneNodes[pSerializedSubScene->scene_nodes()->Get(i)].get();
+            std::optional<glm::mat4> optTransform;
+            if (pSerializedSubScene->node_has_transform()->Get(i))
+                optTransform = deserialize(*pSerializedSubScene->node_transforms()->Get(i));
+            subScene.sceneNodes.push_back({ pSceneNode, optTransform });
+        }
+        subScenes.push_back(std::move(subScene));
+    }
+
+    std::vector<SparseVoxelDAG> svdags;
+    if (pScenePackage->svdags())
+        svdags = SparseVoxelDAG::loadSerializedDAGs(pScenePackage->svdags());
+
+    std::vector<std::unique_ptr<PersistentBVH>> persistentBVHs;
+    std::optional<tasking::LRUCacheTS::Builder> persistentBVHCacheBuilder;
+    if (pScenePackage->persistent_bvhs()) {
+        ALWAYS_ASSERT(pScenePackage->bvhs()->size() == subScenes.size());
+        persistentBVHCacheBuilder.emplace(tasking::openSplitFileDeserializer(bvhFolderPath(folder), bvhCacheMode));
+        for (uint32_t i = 0; i < pScenePackage->bvhs()->size(); i++) {
+            const auto* pSerializedBVH = pScenePackage->bvhs()->Get(i);
+            if (pSerializedBVH->num_leafs() == 0) {
+                persistentBVHs.push_back(nullptr);
+                continue;
+            }
+
+            auto pBVH = std::make_unique<PersistentBVH>(
+                subScenes[i], deserializeAllocation(pSerializedBVH->bvh_allocation()), deserializeAllocation(pSerializedBVH->leafs_allocation()),
+                pSerializedBVH->num_leafs(), pSerializedBVH->resident_size_bytes());
+            persistentBVHCacheBuilder->registerSerialized(pBVH.get(), pSerializedBVH->resident_size_bytes());
+            persistentBVHs.push_back(std::move(pBVH));
+        }
+    }
+
+    spdlog::info("Loaded scene package with {} shapes and {} sub scenes", shapes.size(), subScenes.size());
+    return ScenePackage {
+        std::move(renderConfig), std::move(subScenes), std::move(svdags), std::move(cacheBuilder), std::move(persistentBVHs), std::move(persistentBVHCacheBuilder)
+    };
+}
+
+}
@@ -1,15 +1,24 @@
 #include "pandora/utility/memory_arena.h"
 
 namespace pandora {
-MemoryArena::MemoryArena(size_t blockSize)
+MemoryArena::MemoryArena(size_t blockSize, std::pmr::memory_resource* pMemoryResource)
     : m_memoryBlockSize(blockSize)
-    , m_usedMemoryBlocks()
-    , m_unusedMemoryBlocks()
+    , m_pMemoryResource(pMemoryResource)
+    , m_usedMemoryBlocks(pMemoryResource)
+    , m_unusedMemoryBlocks(pMemoryResource)
     , m_currentBlockData(nullptr)
     , m_currentBlockSpace(0)
 {
 }
 
+MemoryArena::~MemoryArena()
+{
+    for (std::byte* pBlock : m_usedMemoryBlocks)
+        m_pMemoryResource->deallocate(pBlock, m_memoryBlockSize, maxAlignment);
+    for (std::byte* pBlock : m_unusedMemoryBlocks)
+        m_pMemoryResource->deallocate(pBlock, m_memoryBlockSize, maxAlignment);
+}
+
 void MemoryArena::reset()
 {
     m_currentBlockData = nullptr;
@@ -23,17 +32,17 @@ void MemoryArena::reset()
 
 void MemoryArena::allocateBlock()
 {
-    std::unique_ptr<std::byte[]> data;
+    std::byte* pData;
     if (m_unusedMemoryBlocks.empty())
     {
-        data = std::make_unique<std::byte[]>(m_memoryBlockSize);
+        pData = reinterpret_cast<std::byte*>(m_pMemoryResource->allocate(m_memoryBlockSize, maxAlignment));
     } else {
-        data = std::move(m_unusedMemoryBlocks.back());
+        pData = m_unusedMemoryBlocks.back();
         m_unusedMemoryBlocks.pop_back();
     }
-    m_currentBlockData = data.get();
+    m_currentBlockData = pData;
     m_currentBlockSpace = m_memoryBlockSize;
-    m_usedMemoryBlocks.push_back(std::move(data));
+    m_usedMemoryBlocks.push_back(pData);
 }
 
 void* MemoryArena::tryAlignedAllocInCurrentBlock(size_t amount, size_t alignment)
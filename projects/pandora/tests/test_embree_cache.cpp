@@ -0,0 +1,158 @@
+#include "pandora/traversal/embree_cache.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace pandora;
+
+// Exposes getOrBuild so that the tests can control when (and whether) a build finishes.
+struct TestEmbreeSceneCache : public LRUEmbreeSceneCache {
+public:
+    TestEmbreeSceneCache()
+        : LRUEmbreeSceneCache(std::numeric_limits<size_t>::max())
+    {
+    }
+
+    using LRUEmbreeSceneCache::getOrBuild;
+};
+
+class EmbreeSceneCacheTest : public ::testing::Test {
+protected:
+    EmbreeSceneCacheTest()
+        : m_device(rtcNewDevice(nullptr))
+    {
+    }
+    ~EmbreeSceneCacheTest() override
+    {
+        rtcReleaseDevice(m_device);
+    }
+
+    std::shared_ptr<CachedEmbreeScene> createEmptyScene()
+    {
+        RTCScene scene = rtcNewScene(m_device);
+        rtcCommitScene(scene);
+        return std::make_shared<CachedEmbreeScene>(scene, std::vector<std::shared_ptr<CachedEmbreeScene>> {});
+    }
+
+private:
+    RTCDevice m_device;
+};
+
+TEST_F(EmbreeSceneCacheTest, ConcurrentRequestsBuildOnce)
+{
+    TestEmbreeSceneCache cache;
+    const int key = 0;
+
+    std::atomic_int numBuilds { 0 };
+    std::promise<void> buildStarted, finishBuild;
+    auto finishBuildFuture = finishBuild.get_future().share();
+    auto build = [&]() {
+        numBuilds.fetch_add(1);
+        buildStarted.set_value();
+        finishBuildFuture.wait();
+        return createEmptyScene();
+    };
+
+    auto firstRequest = std::async(std::launch::async, [&]() { return cache.getOrBuild(&key, build); });
+    buildStarted.get_future().wait();
+
+    // The first build is still running so these requests have to wait for it instead of building again.
+    std::vector<std::future<std::shared_ptr<CachedEmbreeScene>>> otherRequests;
+    for (int i = 0; i < 4; i++)
+        otherRequests.push_back(std::async(std::launch::async, [&]() { return cache.getOrBuild(&key, build); }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    finishBuild.set_value();
+
+    const auto pScene = firstRequest.get();
+    ASSERT_NE(pScene, nullptr);
+    for (auto& request : otherRequests)
+        ASSERT_EQ(request.get(), pScene);
+    ASSERT_EQ(numBuilds.load(), 1);
+
+    // Once built, the scene is returned from the cache.
+    ASSERT_EQ(cache.getOrBuild(&key, build), pScene);
+    ASSERT_EQ(numBuilds.load(), 1);
+}
+
+TEST_F(EmbreeSceneCacheTest, FailedBuildIsRetried)
+{
+    TestEmbreeSceneCache cache;
+    const int key = 0;
+
+    std::promise<void> buildStarted, finishBuild;
+    auto finishBuildFuture = finishBuild.get_future().share();
+    auto failingBuild = [&]() -> std::shared_ptr<CachedEmbreeScene> {
+        buildStarted.set_value();
+        finishBuildFuture.wait();
+        throw std::runtime_error("Build failed");
+    };
+    auto firstRequest = std::async(std::launch::async, [&]() { return cache.getOrBuild(&key, failingBuild); });
+    buildStarted.get_future().wait();
+
+    // A request that waits for the failing build receives its exception.
+    std::atomic_int numBuilds { 0 };
+    auto build = [&]() {
+        numBuilds.fetch_add(1);
+        return createEmptyScene();
+    };
+    auto waitingRequest = std::async(std::launch::async, [&]() { return cache.getOrBuild(&key, build); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    finishBuild.set_value();
+
+    ASSERT_THROW(firstRequest.get(), std::runtime_error);
+    // The waiting request either saw the failed build or arrived after its item was erased and built the scene.
+    try {
+        ASSERT_NE(waitingRequest.get(), nullptr);
+        ASSERT_EQ(numBuilds.load(), 1);
+    } catch (const std::runtime_error&) {
+        ASSERT_EQ(numBuilds.load(), 0);
+    }
+
+    // The failed item was erased so the next request builds the scene again.
+    const auto pScene = cache.getOrBuild(&key, build);
+    ASSERT_NE(pScene, nullptr);
+    ASSERT_EQ(cache.getOrBuild(&key, build), pScene);
+    ASSERT_EQ(numBuilds.load(), 1);
+}
+
+TEST_F(EmbreeSceneCacheTest, TracksResidency)
+{
+    TestEmbreeSceneCache cache;
+    // Sub scenes are only used as keys so any address will do.
+    const int keys[2] = { 0, 1 };
+    const auto* pSubScene = reinterpret_cast<const SubScene*>(&keys[0]);
+    const auto* pFailingSubScene = reinterpret_cast<const SubScene*>(&keys[1]);
+
+    std::atomic_bool isCached { true }, failingIsCached { true };
+    cache.trackResidency(pSubScene, &isCached);
+    cache.trackResidency(pFailingSubScene, &failingIsCached);
+    ASSERT_FALSE(isCached.load());
+    ASSERT_FALSE(failingIsCached.load());
+
+    // Scenes count as cached while they are being built (requesting them does not start another build).
+    const auto pScene = cache.getOrBuild(pSubScene, [&]() {
+        EXPECT_TRUE(isCached.load());
+        return createEmptyScene();
+    });
+    ASSERT_NE(pScene, nullptr);
+    ASSERT_TRUE(isCached.load());
+
+    auto failingBuild = [&]() -> std::shared_ptr<CachedEmbreeScene> {
+        EXPECT_TRUE(failingIsCached.load());
+        throw std::runtime_error("Build failed");
+    };
+    ASSERT_THROW(cache.getOrBuild(pFailingSubScene, failingBuild), std::runtime_error);
+    ASSERT_FALSE(failingIsCached.load());
+    ASSERT_TRUE(isCached.load());
+
+    // Flags that are registered after the scene was built start out as cached.
+    std::atomic_bool lateIsCached { false };
+    cache.trackResidency(pSubScene, &lateIsCached);
+    ASSERT_TRUE(lateIsCached.load());
+}
@@ -0,0 +1,120 @@
+#include "pandora/utility/free_list_allocator_ts.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace pandora;
+
+TEST(FreeListAllocatorTS, SingleThreadAllocationRelease)
+{
+    FreeListAllocatorTS<uint64_t> allocator;
+
+    auto [handle1, pValue1] = allocator.allocate(420);
+    ASSERT_EQ(*pValue1, 420);
+    ASSERT_EQ(&allocator.get(handle1), pValue1);
+
+    auto [handle2, pValue2] = allocator.allocate(69);
+    ASSERT_NE(handle1, handle2);
+    ASSERT_EQ(allocator.get(handle2), 69);
+
+    allocator.release(handle2);
+    auto [handle3, pValue3] = allocator.allocate(17);
+    ASSERT_EQ(handle3, handle2);
+    ASSERT_EQ(*pValue3, 17);
+    ASSERT_EQ(allocator.get(handle1), 420);
+}
+
+TEST(FreeListAllocatorTS, SingleThreadAllocationAlignment)
+{
+    struct alignas(32) MyStruct {
+        MyStruct(uint64_t a1, uint64_t a2, uint64_t a3)
+            : a1(a1)
+            , a2(a2)
+            , a3(a3)
+        {
+        }
+        uint64_t a1, a2, a3; // 3 * 8 bytes = 24 bytes
+    };
+    size_t alignment = std::alignment_of_v<MyStruct>;
+
+    FreeListAllocatorTS<MyStruct> allocator;
+    for (int i = 0; i < 1000; i++) {
+        auto [handle, p] = allocator.allocate(2, 3, 4);
+        ASSERT_EQ(p->a1, 2);
+        ASSERT_EQ(p->a2, 3);
+        ASSERT_EQ(p->a3, 4);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % alignment, 0);
+    }
+}
+
+TEST(FreeListAllocatorTS, MultiThreadAllocationRelease)
+{
+    using Handle = FreeListAllocatorTS<uint64_t>::Handle;
+    FreeListAllocatorTS<uint64_t> allocator;
+
+    // Every thread releases half of its items itself and hands the other half to the next thread, such that handles
+    //  move between the thread local free lists (through the shared pool).
+    constexpr int numThreads = 4;
+    constexpr int numRounds = 50;
+    constexpr int itemsPerRound = 1000;
+    std::vector<std::vector<Handle>> handedOver(numThreads);
+    std::vector<std::mutex> handedOverMutexes(numThreads);
+
+    std::atomic_int numLiveItems { 0 };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            std::mt19937 rng { static_cast<unsigned>(t) };
+            for (int round = 0; round < numRounds; round++) {
+                std::vector<Handle> handles;
+                for (int i = 0; i < itemsPerRound; i++) {
+                    const uint64_t value = (uint64_t(t) << 32) | uint64_t(round * itemsPerRound + i);
+                    auto [handle, pItem] = allocator.allocate(value);
+                    ASSERT_EQ(*pItem, value);
+                    handles.push_back(handle);
+                }
+                numLiveItems.fetch_add(itemsPerRound);
+
+                // No other thread may have been handed the same memory in the mean time.
+                for (int i = 0; i < itemsPerRound; i++)
+                    ASSERT_EQ(allocator.get(handles[i]), (uint64_t(t) << 32) | uint64_t(round * itemsPerRound + i));
+
+                std::shuffle(std::begin(handles), std::end(handles), rng);
+                for (int i = 0; i < itemsPerRound / 2; i++)
+                    allocator.release(handles[i]);
+                numLiveItems.fetch_sub(itemsPerRound / 2);
+                {
+                    std::lock_guard l { handedOverMutexes[(t + 1) % numThreads] };
+                    auto& next = handedOver[(t + 1) % numThreads];
+                    next.insert(std::end(next), std::begin(handles) + itemsPerRound / 2, std::end(handles));
+                }
+
+                std::vector<Handle> toRelease;
+                {
+                    std::lock_guard l { handedOverMutexes[t] };
+                    std::swap(toRelease, handedOver[t]);
+                }
+                for (Handle handle : toRelease)
+                    allocator.release(handle);
+                numLiveItems.fetch_sub(static_cast<int>(toRelease.size()));
+            }
+        }));
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    for (int t = 0; t < numThreads; t++) {
+        for (Handle handle : handedOver[t])
+            allocator.release(handle);
+        numLiveItems.fetch_sub(static_cast<int>(handedOver[t].size()));
+    }
+    ASSERT_EQ(numLiveItems.load(), 0);
+
+    // Released handles are recycled: the allocator should not have grown much beyond the peak number of live items.
+    ASSERT_LE(allocator.sizeBytes(), 4 * numThreads * itemsPerRound * sizeof(uint64_t) + (1u << 16) * sizeof(uint64_t));
+}
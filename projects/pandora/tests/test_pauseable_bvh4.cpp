@@ -0,0 +1,397 @@
+#include "pandora/graphics_core/bounds.h"
+#include "pandora/graphics_core/interaction.h"
+#include "pandora/graphics_core/ray.h"
+#include "pandora/traversal/pauseable_bvh/pauseable_bvh4.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace pandora;
+
+namespace {
+
+struct TestRayState {
+    uint32_t rayIdx;
+};
+
+struct PausedRay {
+    uint32_t rayIdx;
+    uint32_t leafID;
+    PauseableBVHInsertHandle insertHandle;
+};
+
+struct TestContext {
+    // Pause (some of) the rays that visit a leaf, like the batching points of the top-level BVH do.
+    bool pause { false };
+    std::vector<PausedRay> pausedRays;
+
+    std::vector<int> hitLeafIDs;
+    std::vector<bool> anyHits;
+};
+
+// Axis aligned box that is intersected when the leaf is visited, or that pauses the ray so that the test can intersect
+//  it later and resume the traversal. Boxes fill their bounds so rays that are culled by (too tight) node bounds lose
+//  their hits.
+struct TestLeaf {
+    glm::vec3 boxMin, boxMax;
+    uint32_t id;
+    TestContext* pContext { nullptr };
+
+    Bounds getBounds() const
+    {
+        return Bounds(boxMin, boxMax);
+    }
+
+    // Distance to the first intersection with the box within [tnear, tfar)
+    std::optional<float> intersectBox(const Ray& ray) const
+    {
+        float tEntry = std::numeric_limits<float>::lowest();
+        float tExit = std::numeric_limits<float>::max();
+        for (int axis = 0; axis < 3; axis++) {
+            const float invDirection = 1.0f / ray.direction[axis];
+            const float t0 = (boxMin[axis] - ray.origin[axis]) * invDirection;
+            const float t1 = (boxMax[axis] - ray.origin[axis]) * invDirection;
+            tEntry = std::max(tEntry, std::min(t0, t1));
+            tExit = std::min(tExit, std::max(t0, t1));
+        }
+        if (tEntry > tExit)
+            return {};
+
+        for (float t : { tEntry, tExit }) {
+            if (t >= ray.tnear && t < ray.tfar)
+                return t;
+        }
+        return {};
+    }
+
+    bool intersectClosest(Ray& ray, uint32_t rayIdx) const
+    {
+        if (auto optT = intersectBox(ray)) {
+            ray.tfar = *optT;
+            pContext->hitLeafIDs[rayIdx] = static_cast<int>(id);
+            return true;
+        }
+        return false;
+    }
+
+    bool shouldPause(uint32_t rayIdx) const
+    {
+        return pContext->pause && (rayIdx + id) % 3 != 0;
+    }
+
+    std::optional<bool> intersect(Ray& ray, SurfaceInteraction&, const TestRayState& state, const PauseableBVHInsertHandle& insertHandle) const
+    {
+        if (shouldPause(state.rayIdx)) {
+            pContext->pausedRays.push_back({ state.rayIdx, id, insertHandle });
+            return {};
+        }
+        return intersectClosest(ray, state.rayIdx);
+    }
+
+    std::optional<bool> intersectAny(Ray& ray, const TestRayState& state, const PauseableBVHInsertHandle& insertHandle) const
+    {
+        if (shouldPause(state.rayIdx)) {
+            pContext->pausedRays.push_back({ state.rayIdx, id, insertHandle });
+            return {};
+        }
+        return intersectBox(ray).has_value();
+    }
+
+    void intersectBatch(
+        gsl::span<Ray* const> rays, gsl::span<SurfaceInteraction* const> surfaceInteractions, gsl::span<const TestRayState> states,
+        gsl::span<const PauseableBVHInsertHandle> insertHandles, gsl::span<std::optional<bool>> outResults) const
+    {
+        for (size_t i = 0; i < static_cast<size_t>(rays.size()); i++)
+            outResults[i] = intersect(*rays[i], *surfaceInteractions[i], states[i], insertHandles[i]);
+    }
+
+    void intersectAnyBatch(
+        gsl::span<Ray* const> rays, gsl::span<const TestRayState> states, gsl::span<const PauseableBVHInsertHandle> insertHandles,
+        gsl::span<std::optional<bool>> outResults) const
+    {
+        for (size_t i = 0; i < static_cast<size_t>(rays.size()); i++)
+            outResults[i] = intersectAny(*rays[i], states[i], insertHandles[i]);
+    }
+};
+
+enum class Resume {
+    None, // Leafs never pause rays
+    Scalar, // Paused rays are resumed one at a time through intersect / intersectAny
+    Batched // Paused rays are resumed together through intersectBatch / intersectAnyBatch
+};
+
+struct ClosestHitResult {
+    std::vector<int> hitLeafIDs;
+    std::vector<float> tfars;
+};
+
+}
+
+static std::vector<TestLeaf> createRandomLeafs(unsigned numLeafs, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> centerDist(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> extentDist(0.05f, 0.8f);
+
+    std::vector<TestLeaf> leafs;
+    for (uint32_t i = 0; i < numLeafs; i++) {
+        const glm::vec3 center { centerDist(rng), centerDist(rng), centerDist(rng) };
+        const glm::vec3 halfExtent { extentDist(rng), extentDist(rng), extentDist(rng) };
+        leafs.push_back(TestLeaf { center - halfExtent, center + halfExtent, i });
+    }
+    return leafs;
+}
+
+static std::vector<Ray> createRandomRays(unsigned numRays, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> originDist(-15.0f, 15.0f);
+    std::uniform_real_distribution<float> targetDist(-8.0f, 8.0f);
+
+    std::vector<Ray> rays;
+    for (unsigned i = 0; i < numRays; i++) {
+        const glm::vec3 origin { originDist(rng), originDist(rng), originDist(rng) };
+        const glm::vec3 target { targetDist(rng), targetDist(rng), targetDist(rng) };
+        rays.emplace_back(origin, glm::normalize(target - origin));
+    }
+    return rays;
+}
+
+template <PauseableBVHNodeLayout NodeLayout>
+static ClosestHitResult traceClosestHit(const std::vector<TestLeaf>& leafs, std::vector<Ray> rays, PauseableBVHTraversal traversal, Resume resume)
+{
+    TestContext context;
+    context.pause = (resume != Resume::None);
+    context.hitLeafIDs.assign(rays.size(), -1);
+
+    std::vector<TestLeaf> bvhLeafs = leafs;
+    for (auto& leaf : bvhLeafs)
+        leaf.pContext = &context;
+    PauseableBVH4<TestLeaf, TestRayState, TestRayState, NodeLayout> bvh { bvhLeafs, traversal };
+
+    // Every ray should exit the BVH exactly once, no matter how often it was paused.
+    std::vector<int> numExits(rays.size(), 0);
+    const auto onExit = [&](uint32_t rayIdx, bool hit) {
+        numExits[rayIdx]++;
+        // Hits that are found while the ray is paused are not known to the BVH.
+        if (!context.pause) {
+            EXPECT_EQ(hit, context.hitLeafIDs[rayIdx] != -1);
+        }
+    };
+
+    std::vector<SurfaceInteraction> surfaceInteractions(rays.size());
+    for (uint32_t i = 0; i < static_cast<uint32_t>(rays.size()); i++) {
+        if (auto optHit = bvh.intersect(rays[i], surfaceInteractions[i], TestRayState { i }))
+            onExit(i, *optHit);
+    }
+
+    while (!context.pausedRays.empty()) {
+        const auto pausedRays = std::exchange(context.pausedRays, {});
+
+        // Intersect the leafs at which the rays were paused before resuming them.
+        for (const auto& pausedRay : pausedRays)
+            bvhLeafs[pausedRay.leafID].intersectClosest(rays[pausedRay.rayIdx], pausedRay.rayIdx);
+
+        if (resume == Resume::Scalar) {
+            for (const auto& [rayIdx, leafID, insertHandle] : pausedRays) {
+                if (auto optHit = bvh.intersect(rays[rayIdx], surfaceInteractions[rayIdx], TestRayState { rayIdx }, insertHandle))
+                    onExit(rayIdx, *optHit);
+            }
+        } else {
+            std::vector<Ray> batchRays;
+            std::vector<SurfaceInteraction*> batchSurfaceInteractions;
+            std::vector<TestRayState> batchStates;
+            std::vector<PauseableBVHInsertHandle> batchInsertHandles;
+            for (const auto& [rayIdx, leafID, insertHandle] : pausedRays) {
+                batchRays.push_back(rays[rayIdx]);
+                batchSurfaceInteractions.push_back(&surfaceInteractions[rayIdx]);
+                batchStates.push_back({ rayIdx });
+                batchInsertHandles.push_back(insertHandle);
+            }
+            bvh.intersectBatch(batchRays, batchSurfaceInteractions, batchStates, batchInsertHandles, std::pmr::new_delete_resource(),
+                [&](uint32_t i, bool hit) { onExit(pausedRays[i].rayIdx, hit); });
+            for (size_t i = 0; i < pausedRays.size(); i++)
+                rays[pausedRays[i].rayIdx] = batchRays[i];
+        }
+    }
+
+    for (int numRayExits : numExits)
+        EXPECT_EQ(numRayExits, 1);
+
+    ClosestHitResult result;
+    result.hitLeafIDs = context.hitLeafIDs;
+    for (const Ray& ray : rays)
+        result.tfars.push_back(ray.tfar);
+    return result;
+}
+
+template <PauseableBVHNodeLayout NodeLayout>
+static std::vector<bool> traceAnyHit(const std::vector<TestLeaf>& leafs, std::vector<Ray> rays, PauseableBVHTraversal traversal, Resume resume)
+{
+    TestContext context;
+    context.pause = (resume != Resume::None);
+    context.anyHits.assign(rays.size(), false);
+
+    std::vector<TestLeaf> bvhLeafs = leafs;
+    for (auto& leaf : bvhLeafs)
+        leaf.pContext = &context;
+    PauseableBVH4<TestLeaf, TestRayState, TestRayState, NodeLayout> bvh { bvhLeafs, traversal };
+
+    std::vector<int> numExits(rays.size(), 0);
+    const auto onExit = [&](uint32_t rayIdx, bool hit) {
+        numExits[rayIdx]++;
+        if (hit)
+            context.anyHits[rayIdx] = true;
+    };
+
+    for (uint32_t i = 0; i < static_cast<uint32_t>(rays.size()); i++) {
+        if (auto optHit = bvh.intersectAny(rays[i], TestRayState { i }))
+            onExit(i, *optHit);
+    }
+
+    while (!context.pausedRays.empty()) {
+        auto pausedRays = std::exchange(context.pausedRays, {});
+
+        // Rays that hit the leaf at which they were paused are done.
+        pausedRays.erase(std::remove_if(std::begin(pausedRays), std::end(pausedRays), [&](const PausedRay& pausedRay) {
+            if (!leafs[pausedRay.leafID].intersectBox(rays[pausedRay.rayIdx]))
+                return false;
+            onExit(pausedRay.rayIdx, true);
+            return true;
+        }),
+            std::end(pausedRays));
+
+        if (resume == Resume::Scalar) {
+            for (const auto& [rayIdx, leafID, insertHandle] : pausedRays) {
+                if (auto optHit = bvh.intersectAny(rays[rayIdx], TestRayState { rayIdx }, insertHandle))
+                    onExit(rayIdx, *optHit);
+            }
+        } else {
+            std::vector<Ray> batchRays;
+            std::vector<TestRayState> batchStates;
+            std::vector<PauseableBVHInsertHandle> batchInsertHandles;
+            for (const auto& [rayIdx, leafID, insertHandle] : pausedRays) {
+                batchRays.push_back(rays[rayIdx]);
+                batchStates.push_back({ rayIdx });
+                batchInsertHandles.push_back(insertHandle);
+            }
+            bvh.intersectAnyBatch(batchRays, batchStates, batchInsertHandles, std::pmr::new_delete_resource(),
+                [&](uint32_t i, bool hit) { onExit(pausedRays[i].rayIdx, hit); });
+        }
+    }
+
+    for (int numRayExits : numExits)
+        EXPECT_EQ(numRayExits, 1);
+    return context.anyHits;
+}
+
+static ClosestHitResult bruteForceClosestHit(const std::vector<TestLeaf>& leafs, std::vector<Ray> rays)
+{
+    ClosestHitResult result;
+    for (Ray& ray : rays) {
+        int hitLeafID = -1;
+        for (const auto& leaf : leafs) {
+            if (auto optT = leaf.intersectBox(ray)) {
+                ray.tfar = *optT;
+                hitLeafID = static_cast<int>(leaf.id);
+            }
+        }
+        result.hitLeafIDs.push_back(hitLeafID);
+        result.tfars.push_back(ray.tfar);
+    }
+    return result;
+}
+
+static std::vector<bool> bruteForceAnyHit(const std::vector<TestLeaf>& leafs, const std::vector<Ray>& rays)
+{
+    std::vector<bool> result;
+    for (const Ray& ray : rays) {
+        result.push_back(std::any_of(std::begin(leafs), std::end(leafs), [&](const TestLeaf& leaf) { return leaf.intersectBox(ray).has_value(); }));
+    }
+    return result;
+}
+
+template <PauseableBVHNodeLayout NodeLayout>
+static void testClosestHit(PauseableBVHTraversal traversal, Resume resume)
+{
+    std::mt19937 rng { 12345 };
+    const auto leafs = createRandomLeafs(2000, rng);
+    const auto rays = createRandomRays(3000, rng);
+
+    const auto reference = bruteForceClosestHit(leafs, rays);
+    ASSERT_GT(std::count(std::begin(reference.hitLeafIDs), std::end(reference.hitLeafIDs), -1), 0);
+    ASSERT_LT(std::count(std::begin(reference.hitLeafIDs), std::end(reference.hitLeafIDs), -1), static_cast<long>(rays.size()));
+
+    // The scalar child mask traversal without pausing is the mode that the other modes should agree with.
+    const auto scalar = traceClosestHit<PauseableBVHNodeLayout::Full>(leafs, rays, PauseableBVHTraversal::ChildMask, Resume::None);
+    const auto result = traceClosestHit<NodeLayout>(leafs, rays, traversal, resume);
+    for (size_t i = 0; i < rays.size(); i++) {
+        ASSERT_EQ(scalar.hitLeafIDs[i], reference.hitLeafIDs[i]);
+        ASSERT_EQ(scalar.tfars[i], reference.tfars[i]);
+        ASSERT_EQ(result.hitLeafIDs[i], scalar.hitLeafIDs[i]);
+        ASSERT_EQ(result.tfars[i], scalar.tfars[i]);
+    }
+}
+
+template <PauseableBVHNodeLayout NodeLayout>
+static void testAnyHit(PauseableBVHTraversal traversal, Resume resume)
+{
+    std::mt19937 rng { 67890 };
+    const auto leafs = createRandomLeafs(2000, rng);
+    const auto rays = createRandomRays(3000, rng);
+
+    const auto reference = bruteForceAnyHit(leafs, rays);
+    const auto scalar = traceAnyHit<PauseableBVHNodeLayout::Full>(leafs, rays, PauseableBVHTraversal::ChildMask, Resume::None);
+    const auto result = traceAnyHit<NodeLayout>(leafs, rays, traversal, resume);
+    for (size_t i = 0; i < rays.size(); i++) {
+        ASSERT_EQ(scalar[i], reference[i]);
+        ASSERT_EQ(result[i], scalar[i]);
+    }
+}
+
+TEST(PauseableBVH4, ClosestHitChildMask)
+{
+    testClosestHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ChildMask, Resume::Scalar);
+    testClosestHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ChildMask, Resume::Batched);
+}
+
+TEST(PauseableBVH4, ClosestHitQuantized)
+{
+    testClosestHit<PauseableBVHNodeLayout::Quantized>(PauseableBVHTraversal::ChildMask, Resume::None);
+    testClosestHit<PauseableBVHNodeLayout::Quantized>(PauseableBVHTraversal::ChildMask, Resume::Scalar);
+    testClosestHit<PauseableBVHNodeLayout::Quantized>(PauseableBVHTraversal::ChildMask, Resume::Batched);
+}
+
+TEST(PauseableBVH4, ClosestHitParentPointer)
+{
+    testClosestHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ParentPointer, Resume::None);
+    testClosestHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ParentPointer, Resume::Scalar);
+    testClosestHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ParentPointer, Resume::Batched);
+    testClosestHit<PauseableBVHNodeLayout::Quantized>(PauseableBVHTraversal::ParentPointer, Resume::Batched);
+}
+
+TEST(PauseableBVH4, AnyHitChildMask)
+{
+    testAnyHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ChildMask, Resume::Scalar);
+    testAnyHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ChildMask, Resume::Batched);
+}
+
+TEST(PauseableBVH4, AnyHitQuantized)
+{
+    testAnyHit<PauseableBVHNodeLayout::Quantized>(PauseableBVHTraversal::ChildMask, Resume::None);
+    testAnyHit<PauseableBVHNodeLayout::Quantized>(PauseableBVHTraversal::ChildMask, Resume::Scalar);
+    testAnyHit<PauseableBVHNodeLayout::Quantized>(PauseableBVHTraversal::ChildMask, Resume::Batched);
+}
+
+TEST(PauseableBVH4, AnyHitParentPointer)
+{
+    testAnyHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ParentPointer, Resume::None);
+    testAnyHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ParentPointer, Resume::Scalar);
+    testAnyHit<PauseableBVHNodeLayout::Full>(PauseableBVHTraversal::ParentPointer, Resume::Batched);
+    testAnyHit<PauseableBVHNodeLayout::Quantized>(PauseableBVHTraversal::ParentPointer, Resume::Batched);
+}
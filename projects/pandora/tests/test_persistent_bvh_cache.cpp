@@ -0,0 +1,104 @@
+#include "pandora/graphics_core/scene.h"
+#include "pandora/shapes/triangle.h"
+#include "pandora/traversal/batching.h"
+#include "pandora/traversal/persistent_bvh_cache.h"
+#include "pandora/traversal/sub_scene.h"
+#include "gtest/gtest.h"
+#include <limits>
+#include <memory>
+#include <random>
+#include <stream/cache/lru_cache_ts.h>
+#include <stream/serialize/in_memory_serializer.h>
+#include <vector>
+
+using namespace pandora;
+
+static std::shared_ptr<TriangleShape> createRandomTriangles(unsigned numTriangles, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> centerDist(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> offsetDist(-1.0f, 1.0f);
+
+    std::vector<glm::uvec3> indices;
+    std::vector<glm::vec3> positions;
+    for (unsigned i = 0; i < numTriangles; i++) {
+        const glm::vec3 center { centerDist(rng), centerDist(rng), centerDist(rng) };
+        for (int v = 0; v < 3; v++)
+            positions.push_back(center + glm::vec3(offsetDist(rng), offsetDist(rng), offsetDist(rng)));
+        indices.push_back(glm::uvec3(3 * i + 0, 3 * i + 1, 3 * i + 2));
+    }
+    return std::make_shared<TriangleShape>(std::move(indices), std::move(positions), std::vector<glm::vec3> {}, std::vector<glm::vec2> {});
+}
+
+static std::vector<Ray> createRandomRays(unsigned numRays, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> originDist(-15.0f, 15.0f);
+    std::uniform_real_distribution<float> targetDist(-8.0f, 8.0f);
+
+    std::vector<Ray> rays;
+    for (unsigned i = 0; i < numRays; i++) {
+        const glm::vec3 origin { originDist(rng), originDist(rng), originDist(rng) };
+        const glm::vec3 target { targetDist(rng), targetDist(rng), targetDist(rng) };
+        rays.emplace_back(origin, glm::normalize(target - origin));
+    }
+    return rays;
+}
+
+TEST(PersistentBVH, SerializeRoundTrip)
+{
+    std::mt19937 rng { 42 };
+    std::vector<std::shared_ptr<SceneObject>> sceneObjects;
+    for (int i = 0; i < 3; i++)
+        sceneObjects.push_back(std::make_shared<SceneObject>(SceneObject { createRandomTriangles(500, rng), nullptr, nullptr, nullptr }));
+
+    SubScene subScene;
+    for (const auto& pSceneObject : sceneObjects)
+        subScene.sceneObjects.push_back(pSceneObject.get());
+    ASSERT_TRUE(PersistentBVH::supportsSubScene(subScene));
+
+    tasking::LRUCacheTS::Builder geometryCacheBuilder { std::make_unique<tasking::InMemorySerializer>() };
+    for (const auto& pSceneObject : sceneObjects)
+        geometryCacheBuilder.registerCacheable(pSceneObject->pShape.get());
+    auto geometryCache = geometryCacheBuilder.build(std::numeric_limits<size_t>::max());
+    const auto shapeOwners = detail::makeSubSceneResident(subScene, geometryCache);
+
+    // Reference: a BVH that was built in memory and never serialized.
+    const PersistentBVH referenceBVH { subScene };
+
+    // Build, serialize and evict through the cache builder, then load it back from the serialized data.
+    tasking::LRUCacheTS::Builder bvhCacheBuilder { std::make_unique<tasking::InMemorySerializer>() };
+    auto bvhs = createPersistentBVHs(gsl::span(&subScene, 1), geometryCache, bvhCacheBuilder);
+    ASSERT_EQ(bvhs.size(), 1u);
+    ASSERT_NE(bvhs[0], nullptr);
+    ASSERT_EQ(bvhs[0]->numLeafs(), 1500u);
+    PersistentBVHCache bvhCache { std::move(bvhs), bvhCacheBuilder, std::numeric_limits<size_t>::max() };
+
+    PersistentBVH* pBVH = bvhCache.get(0);
+    ASSERT_FALSE(pBVH->isResident());
+    ASSERT_GT(bvhCache.nonResidentSizeBytes(pBVH), 0);
+    const auto pResidentBVH = bvhCache.makeResident(pBVH);
+    ASSERT_TRUE(pResidentBVH->isResident());
+
+    int numHits = 0;
+    for (const Ray& ray : createRandomRays(2000, rng)) {
+        Ray referenceRay = ray;
+        SurfaceInteraction referenceSI;
+        const bool referenceHit = referenceBVH.intersect(referenceRay, referenceSI);
+
+        Ray loadedRay = ray;
+        SurfaceInteraction loadedSI;
+        const bool loadedHit = pResidentBVH->intersect(loadedRay, loadedSI);
+
+        ASSERT_EQ(loadedHit, referenceHit);
+        if (referenceHit) {
+            ASSERT_EQ(loadedRay.tfar, referenceRay.tfar);
+            ASSERT_EQ(loadedSI.pSceneObject, referenceSI.pSceneObject);
+            numHits++;
+        }
+
+        Ray referenceAnyRay = ray;
+        Ray loadedAnyRay = ray;
+        ASSERT_EQ(pResidentBVH->intersectAny(loadedAnyRay), referenceBVH.intersectAny(referenceAnyRay));
+    }
+    // Make sure that the test actually exercises the leafs.
+    ASSERT_GT(numHits, 0);
+}
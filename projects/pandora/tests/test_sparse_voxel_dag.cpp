@@ -0,0 +1,127 @@
+#include "pandora/graphics_core/bounds.h"
+#include "pandora/graphics_core/ray.h"
+#include "pandora/svo/sparse_voxel_dag.h"
+#include "pandora/svo/voxel_grid.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <optional>
+#include <random>
+#include <vector>
+
+using namespace pandora;
+
+static VoxelGrid createRandomVoxelGrid(int resolution, float fillRate, std::mt19937& rng)
+{
+    VoxelGrid grid { Bounds(glm::vec3(-2.0f, -1.0f, 0.5f), glm::vec3(2.0f, 3.0f, 3.0f)), resolution };
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for (int z = 0; z < resolution; z++) {
+        for (int y = 0; y < resolution; y++) {
+            for (int x = 0; x < resolution; x++) {
+                grid.set(x, y, z, dist(rng) < fillRate);
+            }
+        }
+    }
+    return grid;
+}
+
+static std::vector<Ray> createRandomRays(unsigned numRays, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> originDist(-4.0f, 5.0f);
+    std::uniform_real_distribution<float> directionDist(-1.0f, 1.0f);
+    std::uniform_int_distribution<int> axisDist(0, 5);
+
+    std::vector<Ray> rays;
+    for (unsigned i = 0; i < numRays; i++) {
+        const glm::vec3 origin { originDist(rng), originDist(rng), originDist(rng) };
+        glm::vec3 direction { directionDist(rng), directionDist(rng), directionDist(rng) };
+        // Also cover the direction components that are clamped to avoid division by zero (with both signs).
+        switch (axisDist(rng)) {
+        case 0:
+            direction.x = 0.0f;
+            break;
+        case 1:
+            direction.y = -0.0f;
+            break;
+        case 2:
+            direction.x = direction.z = 0.0f;
+            break;
+        default:
+            break;
+        }
+        rays.emplace_back(origin, glm::normalize(direction));
+    }
+    return rays;
+}
+
+// Traces packets of every size from 1 to 8 rays through intersect8 and compares the hits and entry distances to those
+//  returned by intersectScalar.
+static void testIntersect8(const SparseVoxelDAG& svdag, const std::vector<Ray>& rays)
+{
+    size_t numHits = 0;
+    for (size_t packetStart = 0, packetSize = 1; packetStart < rays.size(); packetStart += packetSize, packetSize = packetSize % 8 + 1) {
+        const size_t numLanes = std::min(packetSize, rays.size() - packetStart);
+        const gsl::span<const Ray> packet(rays.data() + packetStart, numLanes);
+
+        std::array<float, 8> entryDistances;
+        const uint32_t hitMask = svdag.intersect8(packet, entryDistances);
+        ASSERT_EQ(hitMask >> numLanes, 0u);
+
+        for (size_t lane = 0; lane < numLanes; lane++) {
+            const std::optional<float> scalarEntryDistance = svdag.intersectScalar(packet[lane]);
+            const bool hit = hitMask & (1u << lane);
+            ASSERT_EQ(hit, scalarEntryDistance.has_value());
+            if (hit) {
+                ASSERT_NEAR(entryDistances[lane], *scalarEntryDistance, 1e-5f * std::max(1.0f, *scalarEntryDistance));
+                numHits++;
+            }
+        }
+    }
+
+    // Make sure that the test does not pass trivially.
+    ASSERT_GT(numHits, 0u);
+    ASSERT_LT(numHits, rays.size());
+}
+
+TEST(SparseVoxelDAG, Intersect8MatchesScalar)
+{
+    std::mt19937 rng { 123 };
+    const auto rays = createRandomRays(5000, rng);
+    for (float fillRate : { 0.002f, 0.05f, 0.3f }) {
+        const VoxelGrid grid = createRandomVoxelGrid(32, fillRate, rng);
+        const SparseVoxelDAG svdag { grid };
+        testIntersect8(svdag, rays);
+    }
+}
+
+TEST(SparseVoxelDAG, Intersect8MatchesScalarSphere)
+{
+    // Large filled regions are collapsed into leafs at higher levels of the DAG.
+    std::mt19937 rng { 456 };
+    const auto rays = createRandomRays(5000, rng);
+    VoxelGrid grid { Bounds(glm::vec3(-1.0f), glm::vec3(1.0f)), 64 };
+    grid.fillSphere();
+    const SparseVoxelDAG svdag { grid };
+    testIntersect8(svdag, rays);
+}
+
+TEST(SparseVoxelDAG, Intersect8RaysStartingInside)
+{
+    // Rays that start inside the bounds (like rays that are resumed by the top-level BVH).
+    std::mt19937 rng { 789 };
+    std::uniform_real_distribution<float> originDistX(-1.99f, 1.99f);
+    std::uniform_real_distribution<float> originDistY(-0.99f, 2.99f);
+    std::uniform_real_distribution<float> originDistZ(0.51f, 2.99f);
+    std::uniform_real_distribution<float> directionDist(-1.0f, 1.0f);
+    std::vector<Ray> rays;
+    for (int i = 0; i < 5000; i++) {
+        const glm::vec3 origin { originDistX(rng), originDistY(rng), originDistZ(rng) };
+        const glm::vec3 direction { directionDist(rng), directionDist(rng), directionDist(rng) };
+        rays.emplace_back(origin, glm::normalize(direction));
+    }
+
+    const VoxelGrid grid = createRandomVoxelGrid(16, 0.01f, rng);
+    const SparseVoxelDAG svdag { grid };
+    testIntersect8(svdag, rays);
+}
@@ -0,0 +1,110 @@
+#include "pandora/graphics_core/interaction.h"
+#include "pandora/graphics_core/ray.h"
+#include "pandora/shapes/triangle.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stream/cache/lru_cache_ts.h>
+#include <stream/serialize/in_memory_serializer.h>
+#include <vector>
+
+using namespace pandora;
+
+// Normals that are hard to encode with octahedral encoding: the poles, the axes and normals close to the fold of the
+//  octahedron (the z = 0 plane).
+static std::vector<glm::vec3> createEdgeCaseNormals()
+{
+    std::vector<glm::vec3> normals {
+        glm::vec3(0, 0, 1),
+        glm::vec3(0, 0, -1),
+        glm::vec3(1, 0, 0),
+        glm::vec3(-1, 0, 0),
+        glm::vec3(0, 1, 0),
+        glm::vec3(0, -1, 0),
+        glm::vec3(1e-6f, 1e-6f, 1),
+        glm::vec3(-1e-6f, 1e-6f, -1),
+        glm::vec3(1e-6f, -1e-6f, -1),
+    };
+    for (const float z : { 1e-3f, 1e-5f, 0.0f, -1e-5f, -1e-3f }) {
+        for (const glm::vec2 xy : { glm::vec2(1, 1), glm::vec2(-1, 1), glm::vec2(1, -1), glm::vec2(-1, -1), glm::vec2(0.3f, -0.7f), glm::vec2(-0.9f, 0.1f) })
+            normals.push_back(glm::normalize(glm::vec3(xy, z)));
+    }
+    return normals;
+}
+
+TEST(TriangleShape, SerializeRoundTrip)
+{
+    // Each vertex is identified by the x coordinate of its position (exactly representable as a float).
+    constexpr unsigned numVertices = 100000;
+    std::vector<glm::vec3> positions;
+    for (unsigned i = 0; i < numVertices; i++)
+        positions.push_back(glm::vec3(static_cast<float>(i), 0, 0));
+
+    std::mt19937 rng { 123 };
+    std::vector<glm::vec3> normals = createEdgeCaseNormals();
+    std::normal_distribution<float> normalDist;
+    while (normals.size() < numVertices)
+        normals.push_back(glm::normalize(glm::vec3(normalDist(rng), normalDist(rng), normalDist(rng))));
+
+    // Mix small steps with jumps across the whole vertex range (in both directions), so that the index deltas are
+    //  both positive and negative and some of them are large.
+    std::vector<glm::uvec3> indices {
+        glm::uvec3(0, numVertices - 1, 1),
+        glm::uvec3(numVertices - 2, 2, numVertices - 3),
+        glm::uvec3(5, 4, 3),
+        glm::uvec3(numVertices - 1, numVertices - 1, 0),
+    };
+    std::uniform_int_distribution<unsigned> vertexDist { 0, numVertices - 1 };
+    std::uniform_int_distribution<int> stepDist { -8, 8 };
+    unsigned vertex = 0;
+    for (int i = 0; i < 10000; i++) {
+        glm::uvec3 triangle;
+        for (int j = 0; j < 3; j++) {
+            if (i % 10 == 0)
+                vertex = vertexDist(rng);
+            else
+                vertex = static_cast<unsigned>(std::clamp(static_cast<int>(vertex) + stepDist(rng), 0, static_cast<int>(numVertices) - 1));
+            triangle[j] = vertex;
+        }
+        indices.push_back(triangle);
+    }
+
+    const std::vector<glm::uvec3> expectedIndices = indices;
+    const std::vector<glm::vec3> expectedNormals = normals;
+    TriangleShape shape { std::move(indices), std::move(positions), std::move(normals), {} };
+
+    // Serialize and evict the shape, then load it back.
+    tasking::LRUCacheTS::Builder cacheBuilder { std::make_unique<tasking::InMemorySerializer>() };
+    cacheBuilder.registerCacheable(&shape, true);
+    ASSERT_FALSE(shape.isResident());
+    auto cache = cacheBuilder.build(std::numeric_limits<size_t>::max());
+    const auto pShape = cache.makeResident(&shape);
+    ASSERT_EQ(pShape->numPrimitives(), static_cast<unsigned>(expectedIndices.size()));
+
+    // With 16 bits per octahedral coordinate the error is at most about 6e-5 per component.
+    constexpr float normalTolerance = 1e-4f;
+    const glm::vec2 corners[3] = { glm::vec2(0, 0), glm::vec2(1, 0), glm::vec2(0, 1) };
+    for (unsigned primitiveID = 0; primitiveID < pShape->numPrimitives(); primitiveID++) {
+        for (int j = 0; j < 3; j++) {
+            const unsigned expectedVertex = expectedIndices[primitiveID][j];
+            const glm::vec3 expectedNormal = expectedNormals[expectedVertex];
+
+            // At a corner of the triangle the interpolated position and shading normal are those of the vertex. The
+            //  ray faces the normal such that the shading normal is not flipped.
+            RayHit hit;
+            hit.geometricNormal = expectedNormal;
+            hit.geometricUV = corners[j];
+            hit.pSceneObject = nullptr;
+            hit.primitiveID = primitiveID;
+            const Ray ray { glm::vec3(0), -expectedNormal };
+            const SurfaceInteraction si = pShape->fillSurfaceInteraction(ray, hit);
+
+            ASSERT_EQ(si.position.x, static_cast<float>(expectedVertex));
+            EXPECT_NEAR(si.shading.normal.x, expectedNormal.x, normalTolerance);
+            EXPECT_NEAR(si.shading.normal.y, expectedNormal.y, normalTolerance);
+            EXPECT_NEAR(si.shading.normal.z, expectedNormal.z, normalTolerance);
+        }
+    }
+}
@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstring> // Memcpy
 #include <functional>
 #include <gsl/span>
 #include <immintrin.h> // AVX / AVX2
@@ -218,6 +218,16 @@ public:
         return _vec8(_mm256_and_si256(m_value, other.m_value));
     }
 
+    inline _vec8<uint32_t, 8> operator|(const _vec8<uint32_t, 8>& other) const
+    {
+        return _vec8(_mm256_or_si256(m_value, other.m_value));
+    }
+
+    inline _vec8<uint32_t, 8> operator^(const _vec8<uint32_t, 8>& other) const
+    {
+        return _vec8(_mm256_xor_si256(m_value, other.m_value));
+    }
+
     inline _mask8<8> operator<(const _vec8<uint32_t, 8>& other) const
     {
         return _mask8<8>(_mm256_cmpgt_epi32(other.m_value, m_value));
@@ -281,6 +291,9 @@ public:
         return *std::max_element(std::begin(values), std::end(values));
     }
 
+    friend _vec8<uint32_t, 8> floatBitsToInt(const _vec8<float, 8>& a);
+    friend _vec8<float, 8> intBitsToFloat(const _vec8<uint32_t, 8>& a);
+
     friend _vec8<uint32_t, 8> min(const _vec8<uint32_t, 8>& a, const _vec8<uint32_t, 8>& b);
     friend _vec8<uint32_t, 8> max(const _vec8<uint32_t, 8>& a, const _vec8<uint32_t, 8>& b);
 	friend _vec8<uint32_t, 8> blend(const _vec8<uint32_t, 8>& a, const _vec8<uint32_t, 8>& b, const _mask8<8>& mask);
@@ -414,6 +427,9 @@ public:
         return *std::max_element(std::begin(values), std::end(values));
     }
 
+    friend _vec8<uint32_t, 8> floatBitsToInt(const _vec8<float, 8>& a);
+    friend _vec8<float, 8> intBitsToFloat(const _vec8<uint32_t, 8>& a);
+
     friend _vec8<float, 8> min(const _vec8<float, 8>& a, const _vec8<float, 8>& b);
     friend _vec8<float, 8> max(const _vec8<float, 8>& a, const _vec8<float, 8>& b);
 	friend _vec8<float, 8> blend(const _vec8<float, 8>& a, const _vec8<float, 8>& b, const _mask8<8>& mask);
@@ -422,6 +438,16 @@ private:
     __m256 m_value;
 };
 
+inline _vec8<uint32_t, 8> floatBitsToInt(const _vec8<float, 8>& a)
+{
+    return _vec8<uint32_t, 8>(_mm256_castps_si256(a.m_value));
+}
+
+inline _vec8<float, 8> intBitsToFloat(const _vec8<uint32_t, 8>& a)
+{
+    return _vec8<float, 8>(_mm256_castsi256_ps(a.m_value));
+}
+
 inline _vec8<uint32_t, 8> min(const _vec8<uint32_t, 8>& a, const _vec8<uint32_t, 8>& b)
 {
     _vec8<uint32_t, 8> result;
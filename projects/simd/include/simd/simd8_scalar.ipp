@@ -274,6 +274,9 @@ public:
 
 	friend _vec8<T, 1> blend<T>(const _vec8<T, 1>& a, const _vec8<T, 1>& b, const _mask8<1>& mask);
 
+    friend _vec8<uint32_t, 1> floatBitsToInt(const _vec8<float, 1>& a);
+    friend _vec8<float, 1> intBitsToFloat(const _vec8<uint32_t, 1>& a);
+
 protected:
     std::array<T, 8> m_values;
 };
@@ -330,6 +333,24 @@ public:
         return result;
     }
 
+    inline _vec8<uint32_t, 1> operator|(const _vec8<uint32_t, 1>& other) const
+    {
+        _vec8<uint32_t, 1> result;
+        for (int i = 0; i < 8; i++) {
+            result.m_values[i] = m_values[i] | other.m_values[i];
+        }
+        return result;
+    }
+
+    inline _vec8<uint32_t, 1> operator^(const _vec8<uint32_t, 1>& other) const
+    {
+        _vec8<uint32_t, 1> result;
+        for (int i = 0; i < 8; i++) {
+            result.m_values[i] = m_values[i] ^ other.m_values[i];
+        }
+        return result;
+    }
+
     inline _vec8<uint32_t, 1> permute(const _vec8<uint32_t, 1>& index) const
     {
         _vec8<uint32_t, 1> result;
@@ -365,6 +386,20 @@ public:
     }
 };
 
+inline _vec8<uint32_t, 1> floatBitsToInt(const _vec8<float, 1>& a)
+{
+    _vec8<uint32_t, 1> result;
+    std::memcpy(result.m_values.data(), a.m_values.data(), sizeof(float) * 8);
+    return result;
+}
+
+inline _vec8<float, 1> intBitsToFloat(const _vec8<uint32_t, 1>& a)
+{
+    _vec8<float, 1> result;
+    std::memcpy(result.m_values.data(), a.m_values.data(), sizeof(uint32_t) * 8);
+    return result;
+}
+
 template <typename T>
 inline _vec8<T, 1> min(const _vec8<T, 1>& a, const _vec8<T, 1>& b)
 {
@@ -323,6 +323,21 @@ void simd4Tests()
         ASSERT_EQ(values.horizontalMax(), (T)7);
         ASSERT_EQ(values.horizontalMaxIndex(), 2);
     }
+
+    {
+        // When multiple lanes hold the minimum / maximum the lowest index wins (like std::min_element / max_element).
+        simd::_vec4<T, S> values(7, 1, 7, 1);
+        ASSERT_EQ(values.horizontalMinIndex(), 1);
+        ASSERT_EQ(values.horizontalMaxIndex(), 0);
+
+        simd::_vec4<T, S> values2(1, 7, 1, 7);
+        ASSERT_EQ(values2.horizontalMinIndex(), 0);
+        ASSERT_EQ(values2.horizontalMaxIndex(), 1);
+
+        simd::_vec4<T, S> values3(3, 3, 3, 3);
+        ASSERT_EQ(values3.horizontalMinIndex(), 0);
+        ASSERT_EQ(values3.horizontalMaxIndex(), 0);
+    }
 }
 
 TEST(SIMD4, Scalar)
@@ -138,6 +138,35 @@ void simd8Tests()
             ASSERT_EQ_T(values[i], expectedResults[i]);
     }
 
+    if constexpr (std::is_same_v<T, uint32_t>) {
+        simd::_vec8<uint32_t, S> a(0xFF, 0x0F, 0xF0, 0x0, 0x1, 0x2, 0x3, 0xF0F0F);
+        simd::_vec8<uint32_t, S> b(123, 0xF3, 0xDD, 0xFFFFFFFF, 0b0101, 0b0101, 0xFF, 0xABCDE);
+        std::array<T, 8> orValues, xorValues;
+        (a | b).store(orValues);
+        (a ^ b).store(xorValues);
+        std::array<uint32_t, 8> aValues, bValues;
+        a.store(aValues);
+        b.store(bValues);
+        for (int i = 0; i < 8; i++) {
+            ASSERT_EQ_T(orValues[i], aValues[i] | bValues[i]);
+            ASSERT_EQ_T(xorValues[i], aValues[i] ^ bValues[i]);
+        }
+    }
+
+    {
+        std::array<float, 8> source = { 0.0f, 1.0f, -2.5f, 3.0f, 236454.0f, 1.5f, -0.0f, 892333.0f };
+        simd::_vec8<float, S> v1(source);
+        simd::_vec8<uint32_t, S> bits = simd::floatBitsToInt(v1);
+
+        std::array<uint32_t, 8> bitValues;
+        bits.store(bitValues);
+        ASSERT_EQ(std::memcmp(source.data(), bitValues.data(), 8 * sizeof(float)), 0);
+
+        std::array<float, 8> roundTrip;
+        simd::intBitsToFloat(bits).store(roundTrip);
+        ASSERT_EQ(std::memcmp(source.data(), roundTrip.data(), 8 * sizeof(float)), 0);
+    }
+
     {
         simd::_vec8<uint32_t, S> index(7, 6, 5, 4, 3, 2, 1, 0);
         auto v3 = v2.permute(index);
@@ -268,3 +297,22 @@ TEST(SIMD8, AVX2)
     simd8Tests<float, 8>();
     simd8Tests<uint32_t, 8>();
 }
+
+TEST(Intrinsics, BitScan)
+{
+    for (int low = 0; low < 32; low++) {
+        for (int high = low; high < 32; high++) {
+            const uint32_t mask = (1u << low) | (1u << high);
+            ASSERT_EQ(simd::bitScan32(mask), low);
+            ASSERT_EQ(simd::bitScanReverse32(mask), high);
+        }
+    }
+
+    for (int low = 0; low < 64; low++) {
+        for (int high = low; high < 64; high++) {
+            const uint64_t mask = (uint64_t(1) << low) | (uint64_t(1) << high);
+            ASSERT_EQ(simd::bitScan64(mask), low);
+            ASSERT_EQ(simd::bitScanReverse64(mask), high);
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <stream/serialize/serializer.h>
+#include <vector>
 
 namespace tasking {
 
@@ -16,6 +17,8 @@ public:
 protected:
     virtual void doEvict() = 0;
     virtual void doMakeResident(Deserializer& deserializer) = 0;
+    // Allocations that doMakeResident will map, so that the cache can ask the deserializer to prefetch them.
+    virtual void getSerializedAllocations(std::vector<Allocation>& allocations) const {}
 
 private:
     friend class LRUCache;
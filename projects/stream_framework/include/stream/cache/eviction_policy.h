@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <gsl/span>
+#include <memory>
+#include <string_view>
+
+namespace tasking {
+
+// Decides which items are evicted from an LRUCacheTS. Items are identified by their index in the cache.
+//
+// onAccess / onLoad / onEvict may be called from multiple threads concurrently and should be cheap (onAccess is called
+//  for every makeResident). evict is only called by one thread at a time (the cache holds its eviction lock).
+class EvictionPolicy {
+public:
+    virtual ~EvictionPolicy() = default;
+
+    virtual std::string_view name() const = 0;
+
+    // Called once by the cache before any of the other functions.
+    virtual void init(gsl::span<const size_t> residentItemSizes, size_t maxMemory) = 0;
+
+    virtual void onAccess(uint32_t item) = 0;
+    // The item was made resident.
+    virtual void onLoad(uint32_t item) = 0;
+    // The item was evicted (either by evict or by LRUCacheTS::forceEvict).
+    virtual void onEvict(uint32_t item) = 0;
+
+    // Evicts items (through tryEvict) until at least memoryToFree bytes have been freed, or until no more items can be
+    //  evicted. tryEvict evicts the item if it is resident and not in use and returns the number of bytes that were
+    //  freed (0 if the item could not be evicted).
+    using TryEvict = std::function<size_t(uint32_t)>;
+    virtual void evict(size_t memoryToFree, const TryEvict& tryEvict) = 0;
+};
+
+// Second chance (clock) algorithm: evicts resident items that have not been accessed since the clock hand last passed.
+class ClockEvictionPolicy : public EvictionPolicy {
+public:
+    std::string_view name() const override;
+
+    void init(gsl::span<const size_t> residentItemSizes, size_t maxMemory) override;
+
+    void onAccess(uint32_t item) override;
+    void onLoad(uint32_t item) override;
+    void onEvict(uint32_t item) override;
+
+    void evict(size_t memoryToFree, const TryEvict& tryEvict) override;
+
+private:
+    size_t m_numItems { 0 };
+    std::unique_ptr<std::atomic_bool[]> m_pReferenced;
+    size_t m_clockHand { 0 };
+};
+
+// Scan resistant policy based on 2Q ("2Q: A Low Overhead High Performance Buffer Management Replacement Algorithm" by
+//  Johnson and Shasha), with a clock instead of LRU queues so that accessing an item does not require a lock.
+//
+// Loaded items enter a probation segment. Only items that are accessed again while on probation, or that are loaded
+//  again shortly after being evicted from probation (ghost entries), are promoted to the protected segment. Items that
+//  are touched only once (for example by a single shadow ray pass) thus cannot push the working set out of the cache.
+class TwoQueueEvictionPolicy : public EvictionPolicy {
+public:
+    // probationFraction: part of the cache memory reserved for the probation segment.
+    // ghostFraction: number of evicted items that are remembered, relative to the number of items that fit in the cache.
+    TwoQueueEvictionPolicy(float probationFraction = 0.25f, float ghostFraction = 0.5f);
+
+    std::string_view name() const override;
+
+    void init(gsl::span<const size_t> residentItemSizes, size_t maxMemory) override;
+
+    void onAccess(uint32_t item) override;
+    void onLoad(uint32_t item) override;
+    void onEvict(uint32_t item) override;
+
+    void evict(size_t memoryToFree, const TryEvict& tryEvict) override;
+
+private:
+    const float m_probationFraction;
+    const float m_ghostFraction;
+
+    enum class Segment : uint8_t {
+        None, // Not resident
+        Probation,
+        Protected
+    };
+    size_t m_numItems { 0 };
+    std::unique_ptr<size_t[]> m_pItemSizes;
+    std::unique_ptr<std::atomic_bool[]> m_pReferenced;
+    std::unique_ptr<std::atomic<Segment>[]> m_pSegments;
+
+    // An item is a ghost if it was evicted from probation less than m_ghostWindow evictions ago. Eviction numbers start
+    //  at 1 so that 0 means "never evicted".
+    std::unique_ptr<std::atomic_uint64_t[]> m_pEvictionNumber;
+    std::atomic_uint64_t m_probationEvictions { 0 };
+    uint64_t m_ghostWindow { 0 };
+
+    size_t m_probationTarget { 0 };
+    std::atomic_size_t m_probationBytes { 0 };
+    std::atomic_size_t m_protectedBytes { 0 };
+
+    size_t m_probationHand { 0 };
+    size_t m_protectedHand { 0 };
+};
+
+}
@@ -2,49 +2,86 @@
 #include "stream/cache/cache.h"
 #include "stream/cache/cached_ptr.h"
 #include "stream/cache/evictable.h"
+#include "stream/cache/eviction_policy.h"
 #include "stream/cache/handle.h"
+#include "stream/cache/memory_governor.h"
 #include "stream/serialize/serializer.h"
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <filesystem>
 #include <gsl/gsl>
 #include <gsl/span>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <optick.h>
-#include <unordered_map>
+#include <stdexcept>
 #include <vector>
 
 namespace tasking {
 
-class LRUCacheTS {
+class LRUCacheTS : public MemoryGovernor::Client {
 public:
     class Builder;
+    class ResidencyGroup;
 
-    ~LRUCacheTS();
+    ~LRUCacheTS() override;
 
     //LRUCacheTS(LRUCacheTS&&) = default;
     LRUCacheTS& operator=(LRUCacheTS&&) noexcept;
 
     template <typename T>
     CachedPtr<T> makeResident(T* pEvictable);
+    // Start reading the serialized state of all non-resident items in a single batch, so that the following calls to
+    //  makeResident (possibly from multiple threads) do not each have to wait for the disk.
+    template <typename T>
+    void prefetch(gsl::span<T* const> evictables);
 
     void forceEvict(Evictable* pEvictable);
 
-    size_t memoryUsage() const noexcept;
+    // Number of bytes that the item occupies when it is resident (as measured when it was registered). Both size queries
+    //  throw std::runtime_error if the item was not registered with the cache.
+    size_t residentSizeBytes(const Evictable* pEvictable) const;
+    // Estimated number of bytes that need to be loaded to make the item resident (0 if it is resident / loading).
+    size_t nonResidentSizeBytes(const Evictable* pEvictable) const;
+    // Add the item to a group that keeps track of the total nonResidentSizeBytes() of its items. An item may be part of
+    //  multiple groups. Items should be added before the cache is used by multiple threads.
+    void addToResidencyGroup(const Evictable* pEvictable, std::shared_ptr<ResidencyGroup> pGroup);
+
+    size_t memoryUsage() const noexcept override;
     size_t maxSize() const;
+    // Governor that the cache shares its memory budget with (nullptr if the cache has a budget of its own).
+    MemoryGovernor* memoryGovernor() const;
+
+    size_t evictMemory(size_t memoryToFree) override;
 
 private:
-    LRUCacheTS(std::unique_ptr<tasking::Deserializer>&& pDeserializer, gsl::span<Evictable*> items, size_t maxMemory);
+    void prefetchItems(gsl::span<Evictable* const> items);
+
+    LRUCacheTS(
+        std::unique_ptr<tasking::Deserializer>&& pDeserializer,
+        std::unique_ptr<EvictionPolicy>&& pEvictionPolicy,
+        gsl::span<Evictable*> items,
+        gsl::span<const size_t> residentItemSizes,
+        size_t maxMemory,
+        MemoryGovernor* pMemoryGovernor = nullptr,
+        const MemoryGovernor::Client* pDependency = nullptr);
 
     void evictMarked();
+    size_t evictUnused(size_t memoryToFree);
+    size_t tryEvict(uint32_t index);
+    void updateResidencyGroups(uint32_t index, bool resident);
+
+    uint32_t itemIndex(const Evictable* pItem) const;
 
 private:
     std::unique_ptr<tasking::Deserializer> m_pDeserializer;
 
     size_t m_maxMemory;
     std::atomic_size_t m_usedMemory { 0 };
+    MemoryGovernor* m_pMemoryGovernor { nullptr };
 
     enum class ItemState : uint32_t {
         Unloaded,
@@ -53,34 +90,71 @@ private:
         Evicting
     };
     struct ItemData {
-        std::atomic_bool marked { true }; // Recently accessed?
         std::atomic<ItemState> state { ItemState::Unloaded };
         std::atomic_int refCount { 0 };
+        size_t residentSizeBytes { 0 };
+        std::vector<std::shared_ptr<ResidencyGroup>> residencyGroups;
     };
     std::unique_ptr<ItemData[]> m_pItemData;
-    std::unordered_map<Evictable*, uint32_t> m_itemDataIndices;
+    std::vector<Evictable*> m_items; // Same order as m_pItemData
+
+    // Open addressing hash table (linear probing) from item to its index in m_items / m_pItemData. It is filled once in
+    //  the constructor and never modified afterwards, so lookups from multiple threads do not need any synchronization.
+    struct LookupEntry {
+        const Evictable* pItem { nullptr };
+        uint32_t index { 0 };
+    };
+    std::vector<LookupEntry> m_lookupTable;
+    uint32_t m_lookupShift;
+
+    std::unique_ptr<EvictionPolicy> m_pEvictionPolicy;
     std::mutex m_evictMutex;
 };
 
+// Total number of bytes that need to be loaded to make all items of the group resident. It is updated by the cache when
+//  items are loaded or evicted so reading it does not require a walk over the items.
+class LRUCacheTS::ResidencyGroup {
+public:
+    size_t nonResidentSizeBytes() const noexcept;
+
+private:
+    friend class LRUCacheTS;
+    std::atomic_size_t m_nonResidentSizeBytes { 0 };
+};
+
 class LRUCacheTS::Builder : public CacheBuilder {
 public:
     Builder(std::unique_ptr<tasking::Serializer>&& pSerializer);
+    // Build a cache over items that were serialized before (for example in a previous run). Items are registered through
+    //  registerSerialized; registerCacheable is not supported.
+    Builder(std::unique_ptr<tasking::Deserializer>&& pDeserializer);
 
     void registerCacheable(Evictable* pItem, bool evict = false) override;
+    // Register a non-resident item whose serialized state can be read through the deserializer.
+    void registerSerialized(Evictable* pItem, size_t residentSizeBytes);
+
+    // Changes the policy that decides which items are evicted (ClockEvictionPolicy by default).
+    void setEvictionPolicy(std::unique_ptr<EvictionPolicy>&& pEvictionPolicy);
 
     LRUCacheTS build(size_t maxMemory);
+    // Build a cache that shares the budget of the memory governor with other caches. pDependency is the cache that holds
+    //  the data that the items of this cache are useless without (if any).
+    LRUCacheTS build(MemoryGovernor& memoryGovernor, const MemoryGovernor::Client* pDependency = nullptr);
 
 private:
+    std::unique_ptr<EvictionPolicy> m_pEvictionPolicy;
     std::unique_ptr<tasking::Serializer> m_pSerializer;
+    std::unique_ptr<tasking::Deserializer> m_pDeserializer;
     std::vector<Evictable*> m_items;
+    std::vector<size_t> m_residentItemSizes;
 };
 
 template <typename T>
 inline CachedPtr<T> LRUCacheTS::makeResident(T* pEvictable)
 {
-    auto& itemData = m_pItemData[m_itemDataIndices[pEvictable]];
-    if (itemData.marked.load(std::memory_order_relaxed))
-        itemData.marked.store(false);
+    const uint32_t index = itemIndex(pEvictable);
+    auto& itemData = m_pItemData[index];
+    m_pEvictionPolicy->onAccess(index);
 
     // Ensure that the item will not be deleted by immediately increasing the reference count.
     itemData.refCount.fetch_add(1, std::memory_order_relaxed);
@@ -101,16 +175,23 @@ inline CachedPtr<T> LRUCacheTS::makeResident(T* pEvictable)
 
     if (state == ItemState::Unloaded) {
         if (itemData.state.compare_exchange_strong(state, ItemState::Loading, std::memory_order_acquire)) {
+            updateResidencyGroups(index, true);
+            const auto loadStart = std::chrono::high_resolution_clock::now();
             const size_t sizeBefore = pEvictable->sizeBytes();
             pEvictable->makeResident(*m_pDeserializer);
             const size_t sizeAfter = pEvictable->sizeBytes();
             assert(sizeAfter >= sizeBefore);
             m_usedMemory.fetch_add(sizeAfter - sizeBefore, std::memory_order_relaxed);
 
+            m_pEvictionPolicy->onLoad(index);
             itemData.state.store(ItemState::Loaded, std::memory_order_release);
 
-            if (m_usedMemory > m_maxMemory)
+            if (m_pMemoryGovernor) {
+                m_pMemoryGovernor->recordLoadTime(this, std::chrono::high_resolution_clock::now() - loadStart);
+                m_pMemoryGovernor->enforceBudget();
+            } else if (m_usedMemory > m_maxMemory) {
                 evictMarked();
+            }
         } else {
             // Other thread already started loading, we need to wait...
             while (itemData.state.load(std::memory_order_acquire) != ItemState::Loaded)
@@ -125,4 +206,43 @@ inline CachedPtr<T> LRUCacheTS::makeResident(T* pEvictable)
     return CachedPtr<T>(pEvictable, &itemData.refCount, false);
 }
 
+inline uint32_t LRUCacheTS::itemIndex(const Evictable* pItem) const
+{
+    // Fibonacci hashing of the pointer (the lower bits are always zero because of alignment).
+    const uint64_t hash = (reinterpret_cast<uintptr_t>(pItem) >> 3) * 11400714819323198485llu;
+    const size_t mask = m_lookupTable.size() - 1;
+    for (size_t slot = hash >> m_lookupShift;; slot = (slot + 1) & mask) {
+        const LookupEntry& entry = m_lookupTable[slot];
+        if (entry.pItem == pItem)
+            return entry.index;
+        // The table is never full (load factor <= 50%) so the probe sequence of a missing item ends at an empty slot.
+        if (!entry.pItem)
+            throw std::runtime_error("Item was not registered with the LRUCacheTS");
+    }
+}
+
+inline void LRUCacheTS::updateResidencyGroups(uint32_t index, bool resident)
+{
+    // Loading items count as resident (like in nonResidentSizeBytes()).
+    const auto& itemData = m_pItemData[index];
+    for (const auto& pGroup : itemData.residencyGroups) {
+        if (resident)
+            pGroup->m_nonResidentSizeBytes.fetch_sub(itemData.residentSizeBytes, std::memory_order_relaxed);
+        else
+            pGroup->m_nonResidentSizeBytes.fetch_add(itemData.residentSizeBytes, std::memory_order_relaxed);
+    }
+}
+
+inline size_t LRUCacheTS::ResidencyGroup::nonResidentSizeBytes() const noexcept
+{
+    return m_nonResidentSizeBytes.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+inline void LRUCacheTS::prefetch(gsl::span<T* const> evictables)
+{
+    std::vector<Evictable*> items { std::begin(evictables), std::end(evictables) };
+    prefetchItems(items);
+}
+
 }
\ No newline at end of file
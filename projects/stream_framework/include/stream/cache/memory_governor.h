@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace tasking {
+
+// Shares a single memory budget between multiple caches (for example the geometry cache and the bottom-level BVH
+//  caches) so that they do not each need to be provisioned for the worst case.
+//
+// Clients report the time that they spent (re)loading data. When the combined memory usage exceeds the budget, memory
+//  is evicted from the client for which the recently spent load time per resident byte is the lowest; the load times
+//  decay over time so that only the recent behaviour counts. A client may depend on another client (a BVH cannot be
+//  traversed without the geometry that it was built over), in which case the dependency is never considered cheaper to
+//  evict than the clients that depend on it.
+class MemoryGovernor {
+public:
+    class Client {
+    public:
+        virtual ~Client() = default;
+
+        virtual size_t memoryUsage() const = 0;
+        // Evicts items that are not in use until at least memoryToFree bytes have been freed, or until no more items can
+        //  be evicted. Returns the number of bytes that were freed. Should not block on work that may call enforceBudget.
+        virtual size_t evictMemory(size_t memoryToFree) = 0;
+
+    private:
+        friend class MemoryGovernor;
+        std::atomic_uint64_t m_recentLoadTimeNs { 0 };
+    };
+
+    // loadTimeHalfLife: time after which the recorded load times count for half.
+    MemoryGovernor(size_t memoryBudget, std::chrono::duration<double> loadTimeHalfLife = std::chrono::seconds(2));
+    ~MemoryGovernor();
+
+    // Clients must be registered before they start loading data and unregistered before they are destroyed.
+    void registerClient(Client* pClient, const Client* pDependency = nullptr);
+    void unregisterClient(Client* pClient);
+    // Called when a client is moved to a different address.
+    void replaceClient(Client* pOldClient, Client* pNewClient);
+
+    // Thread safe.
+    void recordLoadTime(Client* pClient, std::chrono::nanoseconds loadTime);
+    // Evicts memory from the clients if the combined memory usage exceeds the budget. Should be called by a client after
+    //  its memory usage increased (without holding any of its own locks). Returns immediately if another thread is
+    //  already evicting.
+    void enforceBudget();
+
+    size_t memoryBudget() const;
+    size_t memoryUsage() const;
+
+private:
+    size_t memoryUsageLocked() const;
+    void decayLoadTimes();
+
+private:
+    const size_t m_memoryBudget;
+    const std::chrono::duration<double> m_loadTimeHalfLife;
+
+    struct ClientData {
+        Client* pClient;
+        const Client* pDependency;
+    };
+    std::vector<ClientData> m_clients;
+    std::chrono::high_resolution_clock::time_point m_lastDecay;
+
+    mutable std::mutex m_mutex;
+};
+
+}
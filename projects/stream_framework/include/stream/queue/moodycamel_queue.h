@@ -49,6 +49,11 @@ public:
         this->enqueue(item);
     }
 
+    inline void push_bulk(gsl::span<const T> items)
+    {
+        this->enqueue_bulk(items.data(), items.size());
+    }
+
     inline bool try_pop(T& item)
     {
         /*auto threadIdx = tbb::this_task_arena::current_thread_index();
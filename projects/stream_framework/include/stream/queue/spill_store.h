@@ -0,0 +1,122 @@
+#pragma once
+#include "stream/serialize/serializer.h"
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <gsl/span>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace tasking {
+
+using SerializerFactory = std::function<std::unique_ptr<Serializer>()>;
+
+// Stores segments of queue items out of core (through the Serializer interface) in FIFO order. Items are copied
+//  bitwise so they should not own any resources. Not thread safe.
+//
+// Serializers are append only and can only be read after creating a deserializer. So the store works in
+//  generations: a generation accepts new segments until the first of its segments is reloaded. At that point
+//  the generation is sealed (the deserializer is created) and new segments go to a new generation. A generation
+//  (and its backing storage) is destroyed once all of its segments have been reloaded.
+template <typename T>
+class SpillStore {
+public:
+    SpillStore(SerializerFactory serializerFactory);
+
+    void spill(gsl::span<const T> items);
+
+    // Reload the oldest segment, the callback is called with the items in the segment.
+    // Returns false if there were no spilled segments.
+    template <typename F>
+    bool reloadSegment(F&& f);
+
+    size_t numSpilledItems() const;
+
+private:
+    struct Generation {
+        std::unique_ptr<Serializer> pSerializer;
+        std::unique_ptr<Deserializer> pDeserializer;
+        size_t numSegments { 0 };
+    };
+    struct Segment {
+        Generation* pGeneration;
+        Allocation allocation;
+        size_t numItems;
+    };
+
+    const SerializerFactory m_serializerFactory;
+
+    std::deque<std::unique_ptr<Generation>> m_generations;
+    std::deque<Segment> m_segments;
+    size_t m_numSpilledItems { 0 };
+};
+
+template <typename T>
+inline SpillStore<T>::SpillStore(SerializerFactory serializerFactory)
+    : m_serializerFactory(std::move(serializerFactory))
+{
+}
+
+template <typename T>
+inline void SpillStore<T>::spill(gsl::span<const T> items)
+{
+    static_assert(std::is_trivially_destructible_v<T>);
+    if (items.empty())
+        return;
+
+    if (m_generations.empty() || m_generations.back()->pDeserializer) {
+        auto pGeneration = std::make_unique<Generation>();
+        pGeneration->pSerializer = m_serializerFactory();
+        m_generations.push_back(std::move(pGeneration));
+    }
+
+    Generation* pGeneration = m_generations.back().get();
+    const size_t numBytes = items.size() * sizeof(T);
+    auto [allocation, pMemory] = pGeneration->pSerializer->allocateAndMap(numBytes);
+    std::memcpy(pMemory, items.data(), numBytes);
+
+    pGeneration->numSegments++;
+    m_segments.push_back(Segment { pGeneration, allocation, static_cast<size_t>(items.size()) });
+    m_numSpilledItems += items.size();
+}
+
+template <typename T>
+template <typename F>
+inline bool SpillStore<T>::reloadSegment(F&& f)
+{
+    if (m_segments.empty())
+        return false;
+
+    const Segment segment = m_segments.front();
+    m_segments.pop_front();
+
+    Generation* pGeneration = segment.pGeneration;
+    if (!pGeneration->pDeserializer)
+        pGeneration->pDeserializer = pGeneration->pSerializer->createDeserializer();
+
+    // Copy to properly aligned memory; the serializer gives no alignment guarantees.
+    std::vector<T> items(segment.numItems);
+    const void* pMemory = pGeneration->pDeserializer->map(segment.allocation);
+    std::memcpy(items.data(), pMemory, segment.numItems * sizeof(T));
+    pGeneration->pDeserializer->unmap(pMemory);
+    m_numSpilledItems -= segment.numItems;
+
+    // Release the storage of the generation once all of its segments have been reloaded.
+    if (--pGeneration->numSegments == 0 && pGeneration->pDeserializer) {
+        assert(m_generations.front().get() == pGeneration);
+        m_generations.pop_front();
+    }
+
+    f(gsl::span<const T>(items.data(), items.size()));
+    return true;
+}
+
+template <typename T>
+inline size_t SpillStore<T>::numSpilledItems() const
+{
+    return m_numSpilledItems;
+}
+
+}
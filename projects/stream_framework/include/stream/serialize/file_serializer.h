@@ -5,30 +5,54 @@
 #include <filesystem>
 #include <mio_cache_control/mmap.hpp>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
 #include <tbb/enumerable_thread_specific.h>
 
 namespace tasking {
 
+enum class FileCompression {
+    None,
+    // Every allocation is compressed separately (one LZ4 block per allocation) so that it can be read on its own.
+    LZ4
+};
+
+// Location of a compressed allocation in the files of a SplitFileSerializer.
+struct CompressedFrame {
+    size_t offsetInFile;
+    size_t allocationSize;
+    uint32_t storedSize;
+    uint32_t fileID;
+};
+
 class SplitFileDeserializer : public Deserializer {
 public:
     ~SplitFileDeserializer();
     SplitFileDeserializer(SplitFileDeserializer&&) = default;
     SplitFileDeserializer& operator=(SplitFileDeserializer&&) = default;
 
+    // Open the files written by a persistent SplitFileSerializer (see SplitFileSerializer::createPersistent).
+    //  The folder is not removed when the deserializer is destroyed.
+    static std::unique_ptr<SplitFileDeserializer> open(std::filesystem::path folder, mio_cache_control::cache_mode fileCacheMode);
+
     const void* map(const Allocation& allocation) final;
     void unmap(const void* pMemory) final;
 
+    size_t diskSize(const Allocation& allocation) const final;
+
 private:
     friend class SplitFileSerializer;
-    SplitFileDeserializer(std::filesystem::path tempFolder, uint32_t numFiles, mio_cache_control::cache_mode fileCacheMode);
+    SplitFileDeserializer(std::filesystem::path tempFolder, uint32_t numFiles, mio_cache_control::cache_mode fileCacheMode, bool removeFolder);
 
 private:
     std::filesystem::path m_tempFolder;
     mio_cache_control::cache_mode m_fileCacheMode;
+    bool m_removeFolder;
 
     std::mutex m_mutex;
     /*struct MappedFile {
@@ -37,39 +61,97 @@ private:
     };
     std::unordered_map<uint32_t, MappedFile> m_openFiles;*/
     std::unordered_map<const void*, mio_cache_control::mmap_source> m_openFiles;
+    // Allocations that were decompressed into memory (by the pointer that map returned).
+    std::unordered_map<const void*, std::unique_ptr<std::byte[]>> m_decompressedAllocations;
+    // Only set when the files were written by a compressed serializer.
+    std::optional<std::vector<CompressedFrame>> m_compressedFrames;
 };
 
+// Open the files written by a persistent SplitFileSerializer. Reads through io_uring (IOUringDeserializer) when the files
+//  should bypass the page cache (no_buffering) and io_uring is supported, and memory maps the files otherwise.
+std::unique_ptr<Deserializer> openSplitFileDeserializer(std::filesystem::path folder, mio_cache_control::cache_mode fileCacheMode);
+
 class SplitFileSerializer : public Serializer {
 public:
     SplitFileSerializer(
         std::string_view folderName,
         size_t batchSize,
-        mio_cache_control::cache_mode fileCacheMode = mio_cache_control::cache_mode::random_access);
+        mio_cache_control::cache_mode fileCacheMode = mio_cache_control::cache_mode::random_access,
+        FileCompression compression = FileCompression::None);
     SplitFileSerializer(SplitFileSerializer&&) = default;
     SplitFileSerializer& operator=(SplitFileSerializer&&) = default;
     ~SplitFileSerializer();
 
+    // Write the files to the given folder and keep them after the serializer and its deserializer are destroyed, so that
+    //  the allocations can be read again later through SplitFileDeserializer::open.
+    static std::unique_ptr<SplitFileSerializer> createPersistent(
+        std::filesystem::path folder,
+        size_t batchSize,
+        mio_cache_control::cache_mode fileCacheMode = mio_cache_control::cache_mode::random_access,
+        FileCompression compression = FileCompression::None);
+
     std::pair<Allocation, void*> allocateAndMap(size_t numBytes) final;
     void unmapPreviousAllocations() final;
 
     std::unique_ptr<Deserializer> createDeserializer() final;
 
 private:
+    SplitFileSerializer(std::filesystem::path folder, size_t batchSize, mio_cache_control::cache_mode fileCacheMode, FileCompression compression, bool persistent);
+
+    std::tuple<size_t, uint32_t, void*> allocateInFile(size_t numBytes);
     void openNewFile(size_t minSize);
+    void compressPendingAllocations();
 
 private:
     friend class SplitFileDeserializer;
+    friend class IOUringDeserializer;
     struct FileAllocation {
         size_t offsetInFile;
         size_t allocationSize;
         uint32_t fileID;
+        uint32_t padding { 0 };
     };
     static_assert(sizeof(FileAllocation) <= sizeof(Allocation));
+    static_assert(std::has_unique_object_representations_v<FileAllocation>);
+
+    // Allocations of a compressed serializer are only written to disk (compressed) when they are unmapped, so their
+    //  location is not known yet when the Allocation is handed out. Instead, they refer to an entry in a table of frames
+    //  which is stored next to the files (see frameTablePath).
+    struct FrameAllocation {
+        size_t frameIndex;
+        size_t allocationSize;
+    };
+    static_assert(sizeof(FrameAllocation) <= sizeof(Allocation));
+    static_assert(std::has_unique_object_representations_v<FrameAllocation>);
+
+    // Location of the bytes of an allocation in the files.
+    struct StoredAllocation {
+        uint32_t fileID;
+        size_t offsetInFile;
+        size_t storedSize;
+        size_t allocationSize;
+
+        bool isCompressed() const { return storedSize != allocationSize; }
+    };
+    static std::filesystem::path frameTablePath(const std::filesystem::path& folder);
+    static std::optional<std::vector<CompressedFrame>> readFrameTable(const std::filesystem::path& folder);
+    static StoredAllocation locate(const Allocation& allocation, const std::optional<std::vector<CompressedFrame>>& compressedFrames);
+    static void decompress(const void* pStored, size_t storedSize, void* pOut, size_t allocationSize);
 
     std::filesystem::path m_tempFolder;
     mio_cache_control::cache_mode m_fileCacheMode;
+    FileCompression m_compression;
+    bool m_persistent { false };
     std::deque<mio_cache_control::mmap_sink> m_openFiles;
 
+    // Allocations of a compressed serializer that have been handed out but that have not been written to disk yet.
+    struct PendingAllocation {
+        size_t frameIndex;
+        std::vector<std::byte> memory;
+    };
+    std::deque<PendingAllocation> m_pendingAllocations;
+    std::vector<CompressedFrame> m_compressedFrames;
+
     size_t m_batchSize;
     size_t m_currentOffset { 0 };
     uint32_t m_currentFileID { 0 };
@@ -1,6 +1,7 @@
 #pragma once
 #include "stream/serialize/serializer.h"
 #include <cstddef>
+#include <type_traits>
 #include <vector>
 
 namespace tasking {
@@ -29,6 +30,7 @@ private:
         size_t offset;
 	};
     static_assert(sizeof(InMemoryAllocation) <= sizeof(Allocation));
+    static_assert(std::has_unique_object_representations_v<InMemoryAllocation>);
     std::vector<std::byte> m_memory;
 };
 
@@ -0,0 +1,93 @@
+#pragma once
+#ifdef __linux__
+#include "stream/serialize/file_serializer.h"
+#include "stream/serialize/serializer.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <gsl/span>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tbb/concurrent_hash_map.h>
+#include <tbb/concurrent_queue.h>
+#include <vector>
+
+namespace tasking {
+
+// Reads the files written by a SplitFileSerializer with direct (O_DIRECT) I/O through io_uring instead of memory mapping
+//  them. Every allocation is read into a (pooled) buffer, so the page cache is bypassed just like with the no_buffering
+//  cache mode. Allocations that are passed to prefetch are submitted to the kernel in a single batch; a later call to map
+//  only waits for the read of that allocation to complete. Compressed allocations are decompressed by map. Prefetched
+//  allocations that are not mapped in time are discarded (see expirePrefetches()).
+//
+// Uses the io_uring system calls directly (Linux 5.6 or newer), see isSupported().
+class IOUringDeserializer : public Deserializer {
+public:
+    ~IOUringDeserializer();
+
+    // Whether the kernel supports io_uring (it may also be disabled through seccomp / sysctl).
+    static bool isSupported();
+
+    // Open the files written by a persistent SplitFileSerializer (see SplitFileSerializer::createPersistent).
+    //  The folder is not removed when the deserializer is destroyed.
+    static std::unique_ptr<IOUringDeserializer> open(std::filesystem::path folder);
+
+    const void* map(const Allocation& allocation) final;
+    void unmap(const void* pMemory) final;
+
+    void prefetch(gsl::span<const Allocation> allocations) final;
+
+    size_t diskSize(const Allocation& allocation) const final;
+    // Size of the buffers of prefetched allocations that have not been mapped yet.
+    size_t memoryUsage() const final;
+
+private:
+    friend class SplitFileSerializer;
+    IOUringDeserializer(std::filesystem::path folder, bool removeFolder);
+
+    struct Ring;
+    struct Request;
+    Request* createRequest(const SplitFileSerializer::StoredAllocation& storedAllocation);
+    void submit(gsl::span<Request* const> requests);
+    void waitForCompletion(Request* pRequest);
+    void reapCompletions();
+    // Frees prefetched allocations that were not mapped within the prefetch timeout, as well as the oldest ones while the
+    //  prefetched buffers exceed their memory limit.
+    void expirePrefetches();
+
+    void* allocateBuffer(size_t size);
+    void freeBuffer(void* pBuffer, size_t size);
+
+private:
+    std::filesystem::path m_folder;
+    bool m_removeFolder;
+    std::vector<int> m_fileDescriptors; // Indexed by file ID (file IDs start at 1).
+    // Only set when the files were written by a compressed serializer.
+    std::optional<std::vector<CompressedFrame>> m_compressedFrames;
+
+    std::unique_ptr<Ring> m_pRing;
+    // The submission and completion queues are shared between threads. The locks are only held while updating the ring
+    //  (and by the thread that waits for the kernel to complete a read), never while mapping / copying data.
+    std::mutex m_submitMutex;
+    std::mutex m_completionMutex;
+
+    // Requests that were prefetched but not mapped yet (by file ID + offset) and requests that are currently mapped (by
+    //  the pointer that map returned).
+    tbb::concurrent_hash_map<uint64_t, Request*> m_prefetchedRequests;
+    tbb::concurrent_hash_map<const void*, Request*> m_mappedRequests;
+    // Prefetched requests in the order in which they were submitted (may contain requests that have been mapped since).
+    std::mutex m_prefetchOrderMutex;
+    std::deque<std::pair<uint64_t, Request*>> m_prefetchOrder;
+    std::atomic_size_t m_prefetchedBytes { 0 };
+
+    // Buffers are allocated in power of two sizes and reused to prevent allocating / freeing page aligned memory for every
+    //  allocation that is read.
+    static constexpr size_t numBufferSizeClasses = 48;
+    std::array<tbb::concurrent_bounded_queue<void*>, numBufferSizeClasses> m_bufferPool;
+};
+
+}
+#endif
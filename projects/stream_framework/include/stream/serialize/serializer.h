@@ -1,11 +1,16 @@
 #pragma once
+#include <cstdint>
+#include <gsl/span>
 #include <memory>
 #include <tuple>
 
 namespace tasking {
 
+// Opaque reference to serialized data; the meaning of the words is up to the serializer that created it. Allocations
+//  start out zeroed and serializers only store structs without padding in them, so that every byte is defined when an
+//  allocation is written to disk.
 struct Allocation {
-    char __memory[24];
+    uint64_t words[3] { 0, 0, 0 };
 };
 
 class Deserializer {
@@ -14,6 +19,16 @@ public:
 
     virtual const void* map(const Allocation& allocation) = 0;
     virtual void unmap(const void*) = 0;
+
+    // Hint that the allocations will be mapped soon, allowing the deserializer to start reading them in the background.
+    virtual void prefetch(gsl::span<const Allocation> allocations) {}
+
+    // Number of bytes that are read from disk to map the allocation (which may be compressed). Zero for deserializers that
+    //  keep their data in memory.
+    virtual size_t diskSize(const Allocation& allocation) const { return 0; }
+
+    // Memory held by the deserializer itself, such as buffers of prefetched allocations that have not been mapped yet.
+    virtual size_t memoryUsage() const { return 0; }
 };
 
 class Serializer {
@@ -17,15 +17,26 @@ struct StreamStats : public metrics::Stats {
         size_t totalItemsInSystem;
         size_t totalMemoryUsage;
     };
+    struct SelectionInfo {
+        std::string policy;
+        double score { 0.0 };
+        size_t queueSize { 0 };
+        size_t staticDataLoadCost { 0 };
+        size_t numCandidates { 0 };
+        bool overMemoryBudget { false };
+    };
     struct FlushInfo {
         std::chrono::high_resolution_clock::time_point startTime;
 
         std::string taskName;
         size_t itemsFlushed { 0 };
+        size_t itemsReloaded { 0 };
+        bool staticDataPrefetched { false };
         metrics::Stopwatch<std::chrono::nanoseconds> staticDataLoadTime;
         metrics::Stopwatch<std::chrono::nanoseconds> processingTime;
 
         GeneralStats genStats;
+        SelectionInfo selection;
     };
     std::mutex infoAtFlushesMutex;
     std::vector<FlushInfo> infoAtFlushes;
@@ -39,6 +50,7 @@ protected:
 
 private:
     static nlohmann::json toJSON(const GeneralStats& genStats);
+    static nlohmann::json toJSON(const SelectionInfo& selectionInfo);
     static nlohmann::json toJSON(const FlushInfo& flushInfo);
 };
 
@@ -1,11 +1,20 @@
 #pragma once
 #include "stream/queue/moodycamel_queue.h"
+#include "stream/queue/spill_store.h"
 #include "stream/queue/tbb_queue.h"
 #include "stream/stats.h"
+#include "stream/task_selection_policy.h"
 #include <EASTL/fixed_vector.h>
-#include <functional>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
 #include <gsl/span>
+#include <limits>
+#include <memory>
 #include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <tbb/concurrent_queue.h>
 #include <tbb/task_arena.h>
 #define __TBB_ALLOW_MUTABLE_FUNCTORS 1
 #include <tbb/task_group.h>
@@ -15,7 +24,9 @@
 #include <optick_tbb.h>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 namespace tasking {
 
@@ -26,8 +37,15 @@ struct TaskHandle {
 
 class TaskGraph {
 public:
-    TaskGraph(unsigned numSchedulers = 1);
-
+    // numPrefetches controls how many of the upcoming tasks (by queue size) may load their static data ahead of
+    //  time. Prefetching is performed by a dedicated pool of numPrefetches (I/O) threads.
+    TaskGraph(unsigned numSchedulers = 1, unsigned numPrefetches = 0);
+    ~TaskGraph();
+
+    // Kernels are stored (and called) with their concrete type. The memory resource that is passed to a kernel is a
+    //  per-worker scratch arena that is reset after every batch: allocations from it are cheap but must not outlive
+    //  the call.
+    //
     // Kernel signature: void(gsl::span<const T>, std::pmr::memory_resource*>
     template <typename T, typename Kernel>
     TaskHandle<T> addTask(std::string_view name, Kernel&& kernel);
@@ -37,6 +55,33 @@ public:
     template <typename T, typename StaticData, typename StaticDataLoader, typename Kernel>
     TaskHandle<T> addTask(std::string_view name, StaticDataLoader&& staticDataLoader, Kernel&& kernel);
 
+    // Kernel signature:             void(gsl::span<const T>, std::pmr::memory_resource*>
+    // StaticDataLoader signature:   StaticData*();
+    // StaticDataLoadCost signature: size_t(); estimated number of bytes that need to be loaded (or built) before the
+    //                               static data is available. Used by task selection policies (see usesLoadCost()).
+    template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+    TaskHandle<T> addTask(std::string_view name, StaticDataLoader&& staticDataLoader, StaticDataLoadCost&& staticDataLoadCost, Kernel&& kernel);
+
+    // Changes the policy that decides which task is flushed next (LargestQueuePolicy by default).
+    void setSelectionPolicy(std::unique_ptr<TaskSelectionPolicy>&& pSelectionPolicy);
+
+    // Soft limit on the memory used by all task queues combined (unlimited by default). When the limit is exceeded
+    //  the schedulers only select sink tasks (if any of them has work) and producers of new work are expected to
+    //  throttle themselves by checking isOverMemoryBudget().
+    void setMemoryBudget(size_t budgetBytes);
+    bool isOverMemoryBudget() const;
+
+    // Sink tasks consume items while producing little or no new work (e.g. ray hit / miss handlers).
+    template <typename T>
+    void markAsSink(TaskHandle<T> task);
+
+    // Move queued items to out-of-core storage when the memory used by all queues exceeds the spill budget. Items are
+    //  spilled in segments of (approximately) segmentSizeBytes from tasks that are not being flushed, and reloaded
+    //  when the task is flushed. Only tasks whose items are trivially destructible (and don't own resources) spill.
+    //  Enqueueing only requests a spill; the segments are written by a dedicated spill thread (also while tasks are
+    //  being flushed) and by the schedulers in between flushes, such that kernels never wait for the disk.
+    void enableSpilling(SerializerFactory serializerFactory, size_t spillBudgetBytes, size_t segmentSizeBytes = 4 * 1024 * 1024);
+
     template <typename T>
     void enqueue(TaskHandle<T> task, const T& item);
     template <typename T>
@@ -45,54 +90,234 @@ public:
     size_t approxMemoryUsage() const;
     size_t approxQueuedItems() const;
 
-    // Number of scheduler tasks that may be spawned at once. Loading can only happen from one thread (to prevent
-    //  race conditions in cache) but using multiple schedulers allow for loading / traversal in parallel.
+    // Runs until all queues are empty. Each of the schedulers flushes a different task so that static data loading
+    //  (I/O bound) of one task can overlap with the execution (compute bound) of other tasks. Schedulers that cannot
+    //  find a task to start help out with the tasks that are currently being flushed by stealing batches from them.
     void run();
 
 private:
+    class TaskBase;
+    template <typename T>
+    class Task;
+    template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+    class TypedTask;
+    class ScopedScratchMemory;
+    class ScopedEmissionBuffers;
+    struct EmissionBuffer;
+
+    TaskBase* claimTask(StreamStats::SelectionInfo& selectionInfo);
+    double scoreTask(const TaskBase* pTask, TaskSelectionCandidate& candidate) const;
+    bool helpInFlightTask();
+    bool isDone() const;
+
+    // Idle schedulers back off and then sleep until an event may have made work available: items were enqueued, a
+    //  flush was opened (so they can help out) or a flush finished (its task can be claimed again, or all work is done).
+    void waitForWork(unsigned idleRounds);
+    void wakeIdleSchedulers();
+
+    void prefetchUpcomingTasks();
+    void discardPrefetches();
+
+    void requestSpillIfOverBudget(TaskBase* pTask);
+    void processSpillRequests();
+    void processSpillRequest(TaskBase* pTask);
+
     bool allQueuesEmpty() const;
 
 private:
     class TaskBase {
     public:
+        TaskBase() = default;
         virtual ~TaskBase() = default;
 
+        // Includes items that have been spilled to disk.
         virtual size_t approxQueueSize() const = 0;
+        // Memory used by the items in the queue (excluding items that have been spilled to disk).
         virtual size_t approxQueueSizeBytes() const = 0;
-        virtual void execute(TaskGraph* pTaskGraph) = 0;
+        virtual size_t estimateStaticDataLoadCost() const = 0;
+        // The estimate may be expensive to compute (it depends on what data is resident) so it is cached until the
+        //  static data epoch of the graph changes.
+        size_t cachedStaticDataLoadCost(uint64_t staticDataEpoch) const;
+        virtual std::string_view name() const = 0;
+        virtual void execute(TaskGraph* pTaskGraph, StreamStats::SelectionInfo&& selectionInfo) = 0;
+
+        // Process batches of a flush that is in progress on another thread. Returns whether any items were processed.
+        virtual bool help() = 0;
+
+        // Reserve the task for prefetching; fails if the task has no static data or if it is already loading it.
+        virtual bool markForPrefetch() = 0;
+        // Load the static data for the next flush (called from a prefetch thread after markForPrefetch()).
+        virtual void prefetch() = 0;
+        // Destroy prefetched static data that was not consumed by a flush.
+        virtual void discardPrefetch() = 0;
+
+        // Push the staged items to the queue and detach the buffer from the task (called by the thread that owns it).
+        virtual void flushEmissionBuffer(EmissionBuffer& buffer) = 0;
+
+        // Spill the oldest items in the queue to disk. Returns the number of bytes spilled.
+        virtual size_t trySpill(const SerializerFactory& serializerFactory, size_t segmentSizeBytes) = 0;
+        // The next time that the task should be considered for spilling, in bytes of memory used by the queue.
+        std::atomic_size_t nextSpillCheckBytes { 0 };
+        // Set while the task is in the spill request queue (such that it is queued at most once).
+        std::atomic_bool spillRequested { false };
+
+        // A task can only be flushed by a single scheduler at a time.
+        bool tryClaim();
+        void release();
+        bool isClaimed() const;
+
+        bool isSink() const;
+        void setSink(bool isSink);
+
+    private:
+        std::atomic_bool m_claimed { false };
+        bool m_isSink { false };
+
+        mutable std::mutex m_loadCostMutex;
+        mutable uint64_t m_loadCostEpoch { std::numeric_limits<uint64_t>::max() };
+        mutable size_t m_loadCost { 0 };
     };
+    // Queue, flush, prefetch and spill logic shared by all tasks with items of type T. Everything that depends on
+    //  the kernel or the static data type is implemented by TypedTask.
     template <typename T>
     class alignas(64) Task : public TaskBase {
     public:
-        template <typename StaticData, typename F1, typename F2>
-        static Task<T> initialize(std::string_view name, F1&&, F2&&);
-        template <typename Kernel>
-        static Task<T> initialize(std::string_view name, Kernel&&);
-
-        Task(Task<T>&&) = default;
+        Task(std::string_view name, bool hasStaticData);
         ~Task() override = default;
 
         void enqueue(const T& item);
         void enqueue(gsl::span<const T> items);
 
+        // The staging buffer of the calling thread, or nullptr if the caller is not a kernel (see EmissionBuffer).
+        EmissionBuffer* getEmissionBuffer();
+        // Returns true if the buffer was full and has been pushed to the queue.
+        bool stage(EmissionBuffer& buffer, const T& item);
+
         size_t approxQueueSize() const override;
         size_t approxQueueSizeBytes() const override;
-        void execute(TaskGraph* pTaskGraph) override;
+        std::string_view name() const override;
+        void execute(TaskGraph* pTaskGraph, StreamStats::SelectionInfo&& selectionInfo) override;
+        bool help() override;
+
+        bool markForPrefetch() override;
+        void prefetch() override;
+        void discardPrefetch() override;
+
+        void flushEmissionBuffer(EmissionBuffer& buffer) override;
+
+        size_t trySpill(const SerializerFactory& serializerFactory, size_t segmentSizeBytes) override;
+
+    protected:
+        virtual void* loadStaticData(std::pmr::memory_resource* pMemory) = 0;
+        virtual void destroyStaticData(std::pmr::memory_resource* pMemory, void* pStaticData) = 0;
+        // Process batches until the queue is empty. Returns the number of items processed.
+        virtual size_t flushBatches(const void* pStaticData, size_t batchSize) = 0;
+
+        // Pops batches of at most batchSize items (reloading spilled items when needed) and passes each of them to f
+        //  together with the scratch memory of the worker.
+        template <typename F>
+        size_t forEachBatch(size_t batchSize, F&& f);
 
     private:
-        using TypeErasedKernel = std::function<void(gsl::span<T>, const void*, std::pmr::memory_resource*)>;
-        using TypeErasedStaticDataLoader = std::function<void*(std::pmr::memory_resource*)>;
-        using TypeErasedStaticDataDestructor = std::function<void(std::pmr::memory_resource*, void*)>;
+        size_t reloadSpilledSegment();
+        void pushEmissionBuffer(EmissionBuffer& buffer);
 
-        Task(std::string_view name, TypeErasedKernel&& kernel, TypeErasedStaticDataLoader&& staticData, TypeErasedStaticDataDestructor&& TypeErasedStaticDataDestructor);
+        // Items that are too large (or aligned too strictly) to stage a reasonable number of them in a buffer.
+        static constexpr bool canStage();
 
     private:
         const std::string m_name;
-
-        const TypeErasedKernel m_kernel;
-        const TypeErasedStaticDataLoader m_staticDataLoader;
-        const TypeErasedStaticDataDestructor m_staticDataDestructor;
+        const bool m_hasStaticData;
         MoodyCamelQueue<T> m_workQueue;
+        // Indexed by the thread index in the task arena.
+        std::vector<EmissionBuffer*> m_emissionBuffers;
+
+        static constexpr size_t maxBatchSize = 512;
+
+        // State of the flush that is currently in progress (if any) so that idle schedulers can help out.
+        std::atomic_bool m_flushOpen { false };
+        std::atomic<const void*> m_pFlushStaticData { nullptr };
+        std::atomic_size_t m_flushBatchSize { 0 };
+        std::atomic_int m_numHelpers { 0 };
+        std::atomic_size_t m_itemsFlushedByHelpers { 0 };
+
+        // Static data loaded ahead of time by a prefetch thread. Loading is the state that is also used by the flush
+        //  itself while it is loading the static data (such that no prefetch can be started in the mean time).
+        enum class PrefetchState {
+            None,
+            Loading,
+            Ready
+        };
+        std::atomic<PrefetchState> m_prefetchState { PrefetchState::None };
+        void* m_pPrefetchedStaticData { nullptr };
+
+        // Items that were spilled to disk. The counter is incremented before items are taken out of the work queue
+        //  and decremented after they are put back so that the task never appears to be empty while it is not.
+        std::mutex m_spillMutex;
+        std::unique_ptr<SpillStore<T>> m_pSpillStore;
+        std::atomic_size_t m_numSpilledItems { 0 };
+        std::atomic_size_t m_itemsReloaded { 0 };
+    };
+    // StaticData is void for tasks without static data; StaticDataLoadCost is std::nullptr_t if no estimate is given.
+    template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+    class TypedTask final : public Task<T> {
+    public:
+        TypedTask(std::string_view name, StaticDataLoader staticDataLoader, StaticDataLoadCost staticDataLoadCost, Kernel kernel);
+
+        size_t estimateStaticDataLoadCost() const override;
+
+    protected:
+        void* loadStaticData(std::pmr::memory_resource* pMemory) override;
+        void destroyStaticData(std::pmr::memory_resource* pMemory, void* pStaticData) override;
+        size_t flushBatches(const void* pStaticData, size_t batchSize) override;
+
+    private:
+        StaticDataLoader m_staticDataLoader;
+        StaticDataLoadCost m_staticDataLoadCost;
+        Kernel m_kernel;
+    };
+
+    // Scratch memory for kernels. Every worker thread owns an arena that is released (reset) when the scope ends. If
+    //  the arena of the worker is already in use further up the stack (a kernel that waits for TBB tasks may execute
+    //  other batches on the same thread) then a temporary arena is used instead.
+    class ScopedScratchMemory {
+    public:
+        ScopedScratchMemory();
+        ~ScopedScratchMemory();
+
+        std::pmr::memory_resource* get();
+
+    private:
+        std::pmr::monotonic_buffer_resource* m_pMemoryResource;
+        std::optional<std::pmr::monotonic_buffer_resource> m_fallbackMemoryResource;
+        bool* m_pWorkerArenaInUse { nullptr };
+    };
+
+    // Items that kernels enqueue one by one are staged in small per-thread buffers (one per destination task) and
+    //  pushed to the queue of the task in bulk, either when the buffer is full or when the batch that is being
+    //  processed ends. This keeps the atomic operations on the shared queues out of the inner loops of the kernels.
+    struct EmissionBuffer {
+        static constexpr size_t sizeBytes = 4096;
+
+        alignas(64) std::byte storage[sizeBytes];
+        size_t numItems { 0 };
+        TaskBase* pTask { nullptr };
+        int threadIdx { -1 };
+    };
+    struct ThreadEmissionState {
+        int kernelDepth { 0 };
+        std::vector<std::unique_ptr<EmissionBuffer>> activeBuffers;
+        std::vector<std::unique_ptr<EmissionBuffer>> freeBuffers;
+    };
+    static thread_local ThreadEmissionState s_threadEmissionState;
+    static EmissionBuffer* acquireEmissionBuffer(TaskBase* pTask, int threadIdx);
+
+    // Items enqueued by the calling thread while the scope is alive are staged in emission buffers. All buffers of
+    //  the thread are flushed when the scope ends.
+    class ScopedEmissionBuffers {
+    public:
+        ScopedEmissionBuffers();
+        ~ScopedEmissionBuffers();
     };
 
     tbb::task_arena m_taskArena;
@@ -101,6 +326,36 @@ private:
     std::vector<std::unique_ptr<TaskBase>> m_tasks;
     std::mutex m_staticDataMutex; // Run only one at a time because the cache implementation is not thread safe
     const unsigned m_numSchedulers;
+    std::unique_ptr<TaskSelectionPolicy> m_pSelectionPolicy;
+
+    size_t m_memoryBudget;
+
+    SerializerFactory m_spillSerializerFactory;
+    size_t m_spillBudget;
+    size_t m_spillSegmentSize;
+    tbb::concurrent_bounded_queue<TaskBase*> m_spillRequests;
+    std::thread m_spillThread;
+
+    // Used by the schedulers to determine whether any more work may be produced (termination detection).
+    std::atomic_int m_activeFlushes { 0 };
+    std::atomic_uint64_t m_flushEpoch { 0 };
+    // Incremented whenever a flush or a prefetch finished loading static data. Data only becomes resident (and other
+    //  data is only evicted to make room for it) while static data is loaded, so load cost estimates that were made in
+    //  the same epoch are still valid.
+    std::atomic_uint64_t m_staticDataEpoch { 0 };
+
+    std::mutex m_idleMutex;
+    std::condition_variable m_idleCondition;
+    uint64_t m_wakeGeneration { 0 }; // Protected by m_idleMutex
+    std::atomic_int m_numIdleSchedulers { 0 };
+    // Set once the sleeping schedulers have been notified so that producers don't all take the mutex.
+    std::atomic_bool m_wakePending { false };
+
+    // Tasks for which the static data is (being) loaded ahead of time but which have not been flushed yet.
+    const unsigned m_maxPrefetches;
+    std::atomic_int m_numPrefetches { 0 };
+    tbb::concurrent_bounded_queue<TaskBase*> m_prefetchQueue;
+    std::vector<std::thread> m_prefetchThreads;
 };
 
 template <typename T, typename Kernel>
@@ -108,7 +363,8 @@ inline TaskHandle<T> TaskGraph::addTask(std::string_view name, Kernel&& kernel)
 {
     uint32_t taskIdx = static_cast<uint32_t>(m_tasks.size());
 
-    std::unique_ptr<TaskBase> pTask = std::make_unique<Task<T>>(Task<T>::initialize(name, std::move(kernel)));
+    using TaskType = TypedTask<T, void, std::nullptr_t, std::nullptr_t, std::decay_t<Kernel>>;
+    std::unique_ptr<TaskBase> pTask = std::make_unique<TaskType>(name, nullptr, nullptr, std::forward<Kernel>(kernel));
     m_tasks.push_back(std::move(pTask));
 
     return TaskHandle<T> { taskIdx };
@@ -120,25 +376,54 @@ inline TaskHandle<T> TaskGraph::addTask(std::string_view name, StaticDataLoader&
     static_assert(std::is_move_constructible<StaticData>());
     uint32_t taskIdx = static_cast<uint32_t>(m_tasks.size());
 
-    std::unique_ptr<TaskBase> pTask = std::make_unique<Task<T>>(
-        Task<T>::template initialize<StaticData>(name, std::move(kernel), std::move(staticDataLoader)));
+    using TaskType = TypedTask<T, StaticData, std::decay_t<StaticDataLoader>, std::nullptr_t, std::decay_t<Kernel>>;
+    std::unique_ptr<TaskBase> pTask = std::make_unique<TaskType>(
+        name, std::forward<StaticDataLoader>(staticDataLoader), nullptr, std::forward<Kernel>(kernel));
+    m_tasks.push_back(std::move(pTask));
+
+    return TaskHandle<T> { taskIdx };
+}
+
+template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+inline TaskHandle<T> TaskGraph::addTask(std::string_view name, StaticDataLoader&& staticDataLoader, StaticDataLoadCost&& staticDataLoadCost, Kernel&& kernel)
+{
+    static_assert(std::is_move_constructible<StaticData>());
+    uint32_t taskIdx = static_cast<uint32_t>(m_tasks.size());
+
+    using TaskType = TypedTask<T, StaticData, std::decay_t<StaticDataLoader>, std::decay_t<StaticDataLoadCost>, std::decay_t<Kernel>>;
+    std::unique_ptr<TaskBase> pTask = std::make_unique<TaskType>(
+        name, std::forward<StaticDataLoader>(staticDataLoader), std::forward<StaticDataLoadCost>(staticDataLoadCost), std::forward<Kernel>(kernel));
     m_tasks.push_back(std::move(pTask));
 
     return TaskHandle<T> { taskIdx };
 }
 
+template <typename T>
+inline void TaskGraph::markAsSink(TaskHandle<T> taskHandle)
+{
+    m_tasks[taskHandle.index]->setSink(true);
+}
+
 template <typename T>
 inline void TaskGraph::enqueue(TaskHandle<T> taskHandle, const T& item)
 {
     Task<T>* pTask = reinterpret_cast<Task<T>*>(m_tasks[taskHandle.index].get());
 
-    if (m_inTaskArena) {
+    if (EmissionBuffer* pBuffer = pTask->getEmissionBuffer()) {
+        // Only check for spilling when the staged items have actually been added to the queue.
+        if (!pTask->stage(*pBuffer, item))
+            return;
+    } else if (m_inTaskArena) {
         pTask->enqueue(item);
     } else {
         m_taskArena.execute([&]() {
             pTask->enqueue(item);
         });
     }
+    wakeIdleSchedulers();
+
+    if (m_spillSerializerFactory && pTask->approxQueueSizeBytes() > pTask->nextSpillCheckBytes.load(std::memory_order_relaxed))
+        requestSpillIfOverBudget(pTask);
 }
 
 template <typename T>
@@ -153,88 +438,113 @@ inline void TaskGraph::enqueue(TaskHandle<T> taskHandle, gsl::span<const T> item
             pTask->enqueue(items);
         });
     }
+    wakeIdleSchedulers();
+
+    if (m_spillSerializerFactory && pTask->approxQueueSizeBytes() > pTask->nextSpillCheckBytes.load(std::memory_order_relaxed))
+        requestSpillIfOverBudget(pTask);
 }
 
 template <typename T>
-template <typename F>
-inline TaskGraph::Task<T> TaskGraph::Task<T>::initialize(std::string_view name, F&& kernel)
+inline TaskGraph::Task<T>::Task(std::string_view name, bool hasStaticData)
+    : m_name(name)
+    , m_hasStaticData(hasStaticData)
+    , m_emissionBuffers(std::thread::hardware_concurrency(), nullptr)
 {
-    return TaskGraph::Task<T>(
-        name,
-        [=](gsl::span<T> dynamicData, const void*, std::pmr::memory_resource* pMemory) {
-            kernel(dynamicData, pMemory);
-        },
-        [](std::pmr::memory_resource*) { return nullptr; },
-        [](std::pmr::memory_resource* pMemoryResource, void*) {});
 }
 
 template <typename T>
-template <typename StaticData, typename F1, typename F2>
-inline TaskGraph::Task<T> TaskGraph::Task<T>::initialize(std::string_view name, F1&& kernel, F2&& staticDataLoader)
+inline void TaskGraph::Task<T>::enqueue(const T& item)
 {
-    return TaskGraph::Task<T>(
-        name,
-        [=](gsl::span<T> dynamicData, const void* pStaticData, std::pmr::memory_resource* pMemory) {
-            kernel(dynamicData, reinterpret_cast<const StaticData*>(pStaticData), pMemory);
-        },
-        [=](std::pmr::memory_resource* pMemoryResource) -> void* {
-            void* pMem = pMemoryResource->allocate(sizeof(StaticData), std::alignment_of_v<StaticData>);
-            StaticData copy = staticDataLoader();
-            StaticData* pStaticData = new (pMem) StaticData(std::move(copy));
-            return reinterpret_cast<void*>(pStaticData);
-        },
-        [](std::pmr::memory_resource* pMemoryResource, void* pMem) {
-            StaticData* pStaticData = reinterpret_cast<StaticData*>(pMem);
-            pStaticData->~StaticData();
-            pMemoryResource->deallocate(pMem, sizeof(StaticData), std::alignment_of_v<StaticData>);
-        });
+    m_workQueue.push(item);
 }
 
 template <typename T>
-inline TaskGraph::Task<T>::Task(
-    std::string_view name,
-    TaskGraph::Task<T>::TypeErasedKernel&& kernel,
-    TaskGraph::Task<T>::TypeErasedStaticDataLoader&& staticDataLoader,
-    TaskGraph::Task<T>::TypeErasedStaticDataDestructor&& staticDataDestructor)
-    : m_name(name)
-    , m_kernel(std::move(kernel))
-    , m_staticDataLoader(std::move(staticDataLoader))
-    , m_staticDataDestructor(std::move(staticDataDestructor))
+inline void TaskGraph::Task<T>::enqueue(gsl::span<const T> items)
 {
+    m_workQueue.push_bulk(items);
 }
 
 template <typename T>
-inline void TaskGraph::Task<T>::enqueue(const T& item)
+constexpr bool TaskGraph::Task<T>::canStage()
 {
-    m_workQueue.push(item);
+    return alignof(T) <= 64 && EmissionBuffer::sizeBytes / sizeof(T) >= 8;
 }
 
 template <typename T>
-inline void TaskGraph::Task<T>::enqueue(gsl::span<const T> items)
+inline TaskGraph::EmissionBuffer* TaskGraph::Task<T>::getEmissionBuffer()
+{
+    if constexpr (!canStage()) {
+        return nullptr;
+    } else {
+        if (s_threadEmissionState.kernelDepth == 0)
+            return nullptr;
+
+        const int threadIdx = tbb::this_task_arena::current_thread_index();
+        if (threadIdx < 0 || threadIdx >= static_cast<int>(m_emissionBuffers.size()))
+            return nullptr;
+
+        EmissionBuffer*& pBuffer = m_emissionBuffers[threadIdx];
+        if (!pBuffer)
+            pBuffer = acquireEmissionBuffer(this, threadIdx);
+        return pBuffer;
+    }
+}
+
+template <typename T>
+inline bool TaskGraph::Task<T>::stage(EmissionBuffer& buffer, const T& item)
+{
+    T* pItems = reinterpret_cast<T*>(buffer.storage);
+    new (&pItems[buffer.numItems++]) T(item);
+    if (buffer.numItems < EmissionBuffer::sizeBytes / sizeof(T))
+        return false;
+
+    pushEmissionBuffer(buffer);
+    return true;
+}
+
+template <typename T>
+inline void TaskGraph::Task<T>::pushEmissionBuffer(EmissionBuffer& buffer)
 {
-    for (const auto& item : items)
-        m_workQueue.push(item);
+    T* pItems = reinterpret_cast<T*>(buffer.storage);
+    m_workQueue.push_bulk(gsl::span<const T>(pItems, buffer.numItems));
+    std::destroy_n(pItems, buffer.numItems);
+    buffer.numItems = 0;
+}
+
+template <typename T>
+inline void TaskGraph::Task<T>::flushEmissionBuffer(EmissionBuffer& buffer)
+{
+    pushEmissionBuffer(buffer);
+    m_emissionBuffers[buffer.threadIdx] = nullptr;
 }
 
 template <typename T>
 inline size_t TaskGraph::Task<T>::approxQueueSize() const
 {
-    return m_workQueue.unsafe_size();
+    return m_workQueue.unsafe_size() + m_numSpilledItems.load(std::memory_order_relaxed);
 }
 
 template <typename T>
 inline size_t TaskGraph::Task<T>::approxQueueSizeBytes() const
 {
-    //return m_workQueue.unsafe_size() * sizeof(T);
-    return m_workQueue.unsafe_size_bytes();
+    // Based on the number of items that are currently in the queue: the size of the blocks allocated by the queue only
+    //  ever grows so it would keep the graph over its memory budget after the queue has been drained.
+    return m_workQueue.unsafe_size() * sizeof(T);
 }
 
 template <typename T>
-inline void TaskGraph::Task<T>::execute(TaskGraph* pTaskGraph)
+inline std::string_view TaskGraph::Task<T>::name() const
+{
+    return m_name;
+}
+
+template <typename T>
+inline void TaskGraph::Task<T>::execute(TaskGraph* pTaskGraph, StreamStats::SelectionInfo&& selectionInfo)
 {
     StreamStats::FlushInfo flushStats;
     flushStats.taskName = m_name;
     flushStats.genStats = StreamStats::GeneralStats { pTaskGraph->approxQueuedItems(), pTaskGraph->approxMemoryUsage() };
+    flushStats.selection = std::move(selectionInfo);
     flushStats.startTime = std::chrono::high_resolution_clock::now();
 
     //std::pmr::memory_resource* pMemory = std::pmr::new_delete_resource();
@@ -250,8 +560,23 @@ inline void TaskGraph::Task<T>::execute(TaskGraph* pTaskGraph)
         OPTICK_EVENT_DYNAMIC(taskName.c_str());
         auto stopWatch = flushStats.staticDataLoadTime.getScopedStopwatch();
 
-        // Allocate and construct static data
-        pStaticData = m_staticDataLoader(pMemory);
+        PrefetchState prefetchState = PrefetchState::None;
+        if (m_prefetchState.compare_exchange_strong(prefetchState, PrefetchState::Loading)) {
+            // Allocate and construct static data
+            pStaticData = loadStaticData(pMemory);
+            pTaskGraph->m_staticDataEpoch.fetch_add(1);
+        } else {
+            // A prefetch thread is (or was) loading the static data; wait for it to finish.
+            while (m_prefetchState.load() != PrefetchState::Ready)
+                std::this_thread::yield();
+
+            // Prefetched static data lives outside of the flush so it is allocated from the heap.
+            pStaticData = m_pPrefetchedStaticData;
+            pMemory = std::pmr::new_delete_resource();
+            m_pPrefetchedStaticData = nullptr;
+            pTaskGraph->m_numPrefetches.fetch_sub(1);
+            flushStats.staticDataPrefetched = true;
+        }
     }
 
     {
@@ -261,9 +586,16 @@ inline void TaskGraph::Task<T>::execute(TaskGraph* pTaskGraph)
         std::atomic_size_t itemsFlushed { 0 };
 
         // Queues with little items should be popped using smaller batches to improve parallelism.
-        static constexpr size_t maxBatchSize = 512;
-        const size_t approxSize = m_workQueue.unsafe_size();
-        const size_t fairShareBatchSize = std::clamp(approxSize / std::thread::hardware_concurrency(), static_cast<size_t>(8), static_cast<size_t>(512));
+        const size_t approxSize = std::max(approxQueueSize(), static_cast<size_t>(1));
+        const size_t fairShareBatchSize = std::clamp(approxSize / std::thread::hardware_concurrency(), static_cast<size_t>(8), maxBatchSize);
+
+        // Allow idle schedulers to steal batches while the flush is in progress.
+        m_itemsFlushedByHelpers.store(0);
+        m_itemsReloaded.store(0);
+        m_flushBatchSize.store(fairShareBatchSize);
+        m_pFlushStaticData.store(pStaticData);
+        m_flushOpen.store(true);
+        pTaskGraph->wakeIdleSchedulers();
 
         const unsigned numThreads = std::min(std::thread::hardware_concurrency(), static_cast<unsigned>((approxSize - 1) / fairShareBatchSize + 1));
         tbb::task_group tg;
@@ -272,32 +604,22 @@ inline void TaskGraph::Task<T>::execute(TaskGraph* pTaskGraph)
                 Optick::tryRegisterThreadWithOptick();
                 OPTICK_EVENT_DYNAMIC(taskName.c_str());
 
-                size_t itemsFlushedLocal = 0;
-                eastl::fixed_vector<T, maxBatchSize, false> workBatch;
-                auto executeKernel = [&]() {
-                    m_kernel(gsl::make_span(workBatch.data(), workBatch.data() + workBatch.size()), pStaticData, std::pmr::new_delete_resource());
-                    itemsFlushedLocal += workBatch.size();
-                };
-
-                while (m_workQueue.unsafe_size() > 0) {
-                    while (true) {
-                        workBatch.resize(fairShareBatchSize);
-                        const size_t numItems = m_workQueue.try_pop_bulk(workBatch);
-                        workBatch.resize(numItems);
-                        if (numItems == 0)
-                            break;
-
-                        executeKernel();
-                        workBatch.clear();
-                    }
-                }
-
+                const size_t itemsFlushedLocal = flushBatches(pStaticData, fairShareBatchSize);
                 itemsFlushed.fetch_add(itemsFlushedLocal, std::memory_order_relaxed);
             });
         }
         tg.wait();
 
-        flushStats.itemsFlushed = itemsFlushed.load(std::memory_order_relaxed);
+        // Close the flush and wait for the helpers to finish before the static data is destroyed. A helper first
+        //  registers itself and only then checks whether the flush is open, so any helper that saw the flush
+        //  as open is visible to us here.
+        m_flushOpen.store(false);
+        while (m_numHelpers.load() > 0)
+            std::this_thread::yield();
+        m_pFlushStaticData.store(nullptr);
+
+        flushStats.itemsFlushed = itemsFlushed.load(std::memory_order_relaxed) + m_itemsFlushedByHelpers.load();
+        flushStats.itemsReloaded = m_itemsReloaded.load();
     }
 
     {
@@ -307,14 +629,197 @@ inline void TaskGraph::Task<T>::execute(TaskGraph* pTaskGraph)
         const std::string taskName = fmt::format("{}::staticDataDestruct", m_name);
         OPTICK_EVENT_DYNAMIC(taskName.c_str());
         // Call destructor on static data and free memory
-        m_staticDataDestructor(pMemory, pStaticData);
+        destroyStaticData(pMemory, pStaticData);
+        m_prefetchState.store(PrefetchState::None);
     }
 
-    /*auto& stats = StreamStats::getSingleton();
+    auto& stats = StreamStats::getSingleton();
     {
         std::lock_guard l { stats.infoAtFlushesMutex };
         stats.infoAtFlushes.emplace_back(std::move(flushStats));
-    }*/
+    }
+}
+
+template <typename T>
+inline bool TaskGraph::Task<T>::help()
+{
+    m_numHelpers.fetch_add(1);
+
+    size_t itemsFlushed = 0;
+    if (m_flushOpen.load()) {
+        OPTICK_EVENT_DYNAMIC(m_name.c_str());
+        itemsFlushed = flushBatches(m_pFlushStaticData.load(), m_flushBatchSize.load());
+        m_itemsFlushedByHelpers.fetch_add(itemsFlushed);
+    }
+
+    m_numHelpers.fetch_sub(1);
+    return itemsFlushed > 0;
 }
 
-}
\ No newline at end of file
+template <typename T>
+inline bool TaskGraph::Task<T>::markForPrefetch()
+{
+    if (!m_hasStaticData)
+        return false;
+
+    PrefetchState prefetchState = PrefetchState::None;
+    return m_prefetchState.compare_exchange_strong(prefetchState, PrefetchState::Loading);
+}
+
+template <typename T>
+inline void TaskGraph::Task<T>::prefetch()
+{
+    const std::string taskName = fmt::format("{}::staticDataPrefetch", m_name);
+    OPTICK_EVENT_DYNAMIC(taskName.c_str());
+
+    assert(m_prefetchState.load() == PrefetchState::Loading);
+    m_pPrefetchedStaticData = loadStaticData(std::pmr::new_delete_resource());
+    m_prefetchState.store(PrefetchState::Ready);
+}
+
+template <typename T>
+inline void TaskGraph::Task<T>::discardPrefetch()
+{
+    if (m_prefetchState.load() == PrefetchState::None)
+        return;
+
+    while (m_prefetchState.load() != PrefetchState::Ready)
+        std::this_thread::yield();
+
+    destroyStaticData(std::pmr::new_delete_resource(), m_pPrefetchedStaticData);
+    m_pPrefetchedStaticData = nullptr;
+    m_prefetchState.store(PrefetchState::None);
+}
+
+template <typename T>
+inline size_t TaskGraph::Task<T>::trySpill(const SerializerFactory& serializerFactory, size_t segmentSizeBytes)
+{
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+        // Items that own resources cannot be copied to disk.
+        return 0;
+    } else {
+        // Don't block the scheduler if another thread is already spilling (or reloading) the items of this task.
+        std::unique_lock lock { m_spillMutex, std::try_to_lock };
+        if (!lock.owns_lock())
+            return 0;
+
+        if (!m_pSpillStore)
+            m_pSpillStore = std::make_unique<SpillStore<T>>(serializerFactory);
+
+        const size_t segmentSize = std::max(segmentSizeBytes / sizeof(T), static_cast<size_t>(1));
+        m_numSpilledItems.fetch_add(segmentSize);
+
+        std::vector<T> segment(segmentSize);
+        const size_t numItems = m_workQueue.try_pop_bulk(segment);
+        segment.resize(numItems);
+        m_pSpillStore->spill(segment);
+
+        m_numSpilledItems.fetch_sub(segmentSize - numItems);
+        return numItems * sizeof(T);
+    }
+}
+
+template <typename T>
+inline size_t TaskGraph::Task<T>::reloadSpilledSegment()
+{
+    if (m_numSpilledItems.load(std::memory_order_relaxed) == 0)
+        return 0;
+
+    std::lock_guard lock { m_spillMutex };
+    if (!m_pSpillStore)
+        return 0;
+
+    size_t numItems = 0;
+    m_pSpillStore->reloadSegment([&](gsl::span<const T> items) {
+        m_workQueue.push_bulk(items);
+        numItems = items.size();
+    });
+    m_numSpilledItems.fetch_sub(numItems);
+    m_itemsReloaded.fetch_add(numItems);
+    return numItems;
+}
+
+template <typename T>
+template <typename F>
+inline size_t TaskGraph::Task<T>::forEachBatch(size_t batchSize, F&& f)
+{
+    size_t itemsFlushed = 0;
+    eastl::fixed_vector<T, maxBatchSize, false> workBatch;
+    while (m_workQueue.unsafe_size() > 0 || reloadSpilledSegment() > 0) {
+        while (true) {
+            workBatch.resize(batchSize);
+            const size_t numItems = m_workQueue.try_pop_bulk(workBatch);
+            workBatch.resize(numItems);
+            if (numItems == 0)
+                break;
+
+            {
+                ScopedScratchMemory scratchMemory;
+                ScopedEmissionBuffers emissionBuffers;
+                f(gsl::make_span(workBatch.data(), workBatch.data() + workBatch.size()), scratchMemory.get());
+            }
+            itemsFlushed += workBatch.size();
+            workBatch.clear();
+        }
+    }
+    return itemsFlushed;
+}
+
+template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+inline TaskGraph::TypedTask<T, StaticData, StaticDataLoader, StaticDataLoadCost, Kernel>::TypedTask(
+    std::string_view name, StaticDataLoader staticDataLoader, StaticDataLoadCost staticDataLoadCost, Kernel kernel)
+    : Task<T>(name, !std::is_void_v<StaticData>)
+    , m_staticDataLoader(std::move(staticDataLoader))
+    , m_staticDataLoadCost(std::move(staticDataLoadCost))
+    , m_kernel(std::move(kernel))
+{
+}
+
+template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+inline size_t TaskGraph::TypedTask<T, StaticData, StaticDataLoader, StaticDataLoadCost, Kernel>::estimateStaticDataLoadCost() const
+{
+    if constexpr (std::is_same_v<StaticDataLoadCost, std::nullptr_t>)
+        return 0;
+    else
+        return m_staticDataLoadCost();
+}
+
+template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+inline void* TaskGraph::TypedTask<T, StaticData, StaticDataLoader, StaticDataLoadCost, Kernel>::loadStaticData(std::pmr::memory_resource* pMemoryResource)
+{
+    if constexpr (std::is_void_v<StaticData>) {
+        return nullptr;
+    } else {
+        void* pMem = pMemoryResource->allocate(sizeof(StaticData), std::alignment_of_v<StaticData>);
+        StaticData copy = m_staticDataLoader();
+        StaticData* pStaticData = new (pMem) StaticData(std::move(copy));
+        return reinterpret_cast<void*>(pStaticData);
+    }
+}
+
+template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+inline void TaskGraph::TypedTask<T, StaticData, StaticDataLoader, StaticDataLoadCost, Kernel>::destroyStaticData(std::pmr::memory_resource* pMemoryResource, void* pMem)
+{
+    if constexpr (!std::is_void_v<StaticData>) {
+        StaticData* pStaticData = reinterpret_cast<StaticData*>(pMem);
+        pStaticData->~StaticData();
+        pMemoryResource->deallocate(pMem, sizeof(StaticData), std::alignment_of_v<StaticData>);
+    }
+}
+
+template <typename T, typename StaticData, typename StaticDataLoader, typename StaticDataLoadCost, typename Kernel>
+inline size_t TaskGraph::TypedTask<T, StaticData, StaticDataLoader, StaticDataLoadCost, Kernel>::flushBatches(const void* pStaticData, size_t batchSize)
+{
+    if constexpr (std::is_void_v<StaticData>) {
+        return this->forEachBatch(batchSize, [&](gsl::span<T> batch, std::pmr::memory_resource* pMemory) {
+            m_kernel(batch, pMemory);
+        });
+    } else {
+        const StaticData* pTypedStaticData = reinterpret_cast<const StaticData*>(pStaticData);
+        return this->forEachBatch(batchSize, [&](gsl::span<T> batch, std::pmr::memory_resource* pMemory) {
+            m_kernel(batch, pTypedStaticData, pMemory);
+        });
+    }
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+namespace tasking {
+
+// Information about a task that is known to the scheduler at the time a new task is selected for flushing.
+struct TaskSelectionCandidate {
+    std::string_view taskName;
+    size_t queueSize;
+    size_t queueSizeBytes;
+
+    // Estimated number of bytes that need to be loaded (or built) before the static data is available.
+    // Only computed when the policy asks for it because it may be relatively expensive (see usesLoadCost()).
+    size_t staticDataLoadCost;
+};
+
+// Determines which task is flushed next. The task with the highest score (that is not flushed by another scheduler
+//  already) is selected.
+class TaskSelectionPolicy {
+public:
+    virtual ~TaskSelectionPolicy() = default;
+
+    virtual std::string_view name() const = 0;
+    virtual bool usesLoadCost() const = 0;
+    virtual double score(const TaskSelectionCandidate& candidate) const = 0;
+};
+
+// Flush the task with the most queued items.
+class LargestQueuePolicy : public TaskSelectionPolicy {
+public:
+    std::string_view name() const override;
+    bool usesLoadCost() const override;
+    double score(const TaskSelectionCandidate& candidate) const override;
+};
+
+// Flush the task that processes the most items per byte of static data that needs to be loaded. The fixed cost
+//  represents the overhead of a flush (in bytes) and prevents tasks with resident static data from being selected
+//  when they only have a handful of items queued.
+class LoadCostPolicy : public TaskSelectionPolicy {
+public:
+    LoadCostPolicy(size_t fixedCostBytes = 4 * 1024 * 1024);
+
+    std::string_view name() const override;
+    bool usesLoadCost() const override;
+    double score(const TaskSelectionCandidate& candidate) const override;
+
+private:
+    const size_t m_fixedCostBytes;
+};
+
+}
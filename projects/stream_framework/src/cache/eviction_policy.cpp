@@ -0,0 +1,162 @@
+#include "stream/cache/eviction_policy.h"
+#include <algorithm>
+#include <numeric>
+
+namespace tasking {
+
+std::string_view ClockEvictionPolicy::name() const
+{
+    return "clock";
+}
+
+void ClockEvictionPolicy::init(gsl::span<const size_t> residentItemSizes, size_t maxMemory)
+{
+    m_numItems = residentItemSizes.size();
+    m_pReferenced = std::make_unique<std::atomic_bool[]>(m_numItems);
+    m_clockHand = 0;
+}
+
+void ClockEvictionPolicy::onAccess(uint32_t item)
+{
+    // Prevent writing to the cache line if the item was already referenced.
+    if (!m_pReferenced[item].load(std::memory_order_relaxed))
+        m_pReferenced[item].store(true, std::memory_order_relaxed);
+}
+
+void ClockEvictionPolicy::onLoad(uint32_t item)
+{
+}
+
+void ClockEvictionPolicy::onEvict(uint32_t item)
+{
+    m_pReferenced[item].store(false, std::memory_order_relaxed);
+}
+
+void ClockEvictionPolicy::evict(size_t memoryToFree, const TryEvict& tryEvict)
+{
+    // Items that were accessed since the hand last passed them get a second chance. The hand may need to go around
+    //  twice because the first round might only reset the references.
+    size_t freedMemory = 0;
+    for (size_t i = 0; i < 2 * m_numItems && freedMemory < memoryToFree; i++) {
+        const auto item = static_cast<uint32_t>(m_clockHand);
+        m_clockHand = (m_clockHand + 1) % m_numItems;
+
+        if (m_pReferenced[item].load(std::memory_order_relaxed))
+            m_pReferenced[item].store(false, std::memory_order_relaxed);
+        else
+            freedMemory += tryEvict(item);
+    }
+}
+
+TwoQueueEvictionPolicy::TwoQueueEvictionPolicy(float probationFraction, float ghostFraction)
+    : m_probationFraction(probationFraction)
+    , m_ghostFraction(ghostFraction)
+{
+}
+
+std::string_view TwoQueueEvictionPolicy::name() const
+{
+    return "2q";
+}
+
+void TwoQueueEvictionPolicy::init(gsl::span<const size_t> residentItemSizes, size_t maxMemory)
+{
+    m_numItems = residentItemSizes.size();
+    m_pItemSizes = std::make_unique<size_t[]>(m_numItems);
+    std::copy(std::begin(residentItemSizes), std::end(residentItemSizes), m_pItemSizes.get());
+    m_pReferenced = std::make_unique<std::atomic_bool[]>(m_numItems);
+    m_pSegments = std::make_unique<std::atomic<Segment>[]>(m_numItems);
+    m_pEvictionNumber = std::make_unique<std::atomic_uint64_t[]>(m_numItems);
+    for (size_t i = 0; i < m_numItems; i++) {
+        m_pSegments[i].store(Segment::None, std::memory_order_relaxed);
+        m_pEvictionNumber[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Remember roughly as many evicted items as fit in the given fraction of the cache.
+    const size_t totalSize = std::accumulate(std::begin(residentItemSizes), std::end(residentItemSizes), size_t(0));
+    const double averageItemSize = std::max(1.0, static_cast<double>(totalSize) / std::max(m_numItems, size_t(1)));
+    const double itemsInCache = static_cast<double>(maxMemory) / averageItemSize;
+    m_ghostWindow = std::max(uint64_t(1), static_cast<uint64_t>(std::min(m_ghostFraction * itemsInCache, double(m_numItems))));
+
+    m_probationTarget = static_cast<size_t>(m_probationFraction * static_cast<double>(maxMemory));
+}
+
+void TwoQueueEvictionPolicy::onAccess(uint32_t item)
+{
+    // Prevent writing to the cache line if the item was already referenced.
+    if (!m_pReferenced[item].load(std::memory_order_relaxed))
+        m_pReferenced[item].store(true, std::memory_order_relaxed);
+}
+
+void TwoQueueEvictionPolicy::onLoad(uint32_t item)
+{
+    // The access that caused the item to be loaded does not count as a second access.
+    m_pReferenced[item].store(false, std::memory_order_relaxed);
+
+    const uint64_t evictionNumber = m_pEvictionNumber[item].load(std::memory_order_relaxed);
+    const bool isGhost = evictionNumber != 0 && m_probationEvictions.load(std::memory_order_relaxed) - evictionNumber < m_ghostWindow;
+    if (isGhost) {
+        m_pSegments[item].store(Segment::Protected, std::memory_order_relaxed);
+        m_protectedBytes.fetch_add(m_pItemSizes[item], std::memory_order_relaxed);
+    } else {
+        m_pSegments[item].store(Segment::Probation, std::memory_order_relaxed);
+        m_probationBytes.fetch_add(m_pItemSizes[item], std::memory_order_relaxed);
+    }
+}
+
+void TwoQueueEvictionPolicy::onEvict(uint32_t item)
+{
+    m_pReferenced[item].store(false, std::memory_order_relaxed);
+
+    const Segment segment = m_pSegments[item].exchange(Segment::None, std::memory_order_relaxed);
+    if (segment == Segment::Probation) {
+        m_probationBytes.fetch_sub(m_pItemSizes[item], std::memory_order_relaxed);
+        m_pEvictionNumber[item].store(m_probationEvictions.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    } else if (segment == Segment::Protected) {
+        m_protectedBytes.fetch_sub(m_pItemSizes[item], std::memory_order_relaxed);
+    }
+}
+
+void TwoQueueEvictionPolicy::evict(size_t memoryToFree, const TryEvict& tryEvict)
+{
+    size_t freedMemory = 0;
+    size_t probationStepsWithoutProgress = 0;
+    for (size_t i = 0; i < 6 * m_numItems && freedMemory < memoryToFree; i++) {
+        // Evict from probation while it is over its budget, unless none of its items can be evicted (all in use).
+        const bool probationOverBudget = m_probationBytes.load(std::memory_order_relaxed) > m_probationTarget;
+        const bool protectedEmpty = m_protectedBytes.load(std::memory_order_relaxed) == 0;
+        if ((probationOverBudget || protectedEmpty) && probationStepsWithoutProgress < 2 * m_numItems) {
+            const auto item = static_cast<uint32_t>(m_probationHand);
+            m_probationHand = (m_probationHand + 1) % m_numItems;
+            probationStepsWithoutProgress++;
+
+            if (m_pSegments[item].load(std::memory_order_relaxed) != Segment::Probation)
+                continue;
+
+            if (m_pReferenced[item].load(std::memory_order_relaxed)) {
+                // Accessed again while on probation: promote to the protected segment.
+                m_pReferenced[item].store(false, std::memory_order_relaxed);
+                m_pSegments[item].store(Segment::Protected, std::memory_order_relaxed);
+                m_probationBytes.fetch_sub(m_pItemSizes[item], std::memory_order_relaxed);
+                m_protectedBytes.fetch_add(m_pItemSizes[item], std::memory_order_relaxed);
+                probationStepsWithoutProgress = 0;
+            } else if (const size_t itemFreedMemory = tryEvict(item); itemFreedMemory > 0) {
+                freedMemory += itemFreedMemory;
+                probationStepsWithoutProgress = 0;
+            }
+        } else {
+            const auto item = static_cast<uint32_t>(m_protectedHand);
+            m_protectedHand = (m_protectedHand + 1) % m_numItems;
+
+            if (m_pSegments[item].load(std::memory_order_relaxed) != Segment::Protected)
+                continue;
+
+            if (m_pReferenced[item].load(std::memory_order_relaxed))
+                m_pReferenced[item].store(false, std::memory_order_relaxed);
+            else
+                freedMemory += tryEvict(item);
+        }
+    }
+}
+
+}
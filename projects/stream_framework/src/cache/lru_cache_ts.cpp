@@ -1,46 +1,115 @@
 #include "stream/cache/lru_cache_ts.h"
 #include "enumerate.h"
 #include <cassert>
+#include <utility>
 #include <spdlog/spdlog.h>
 
 namespace tasking {
 
-LRUCacheTS::LRUCacheTS(std::unique_ptr<tasking::Deserializer>&& pDeserializer, gsl::span<Evictable*> items, size_t maxMemory)
+LRUCacheTS::LRUCacheTS(
+    std::unique_ptr<tasking::Deserializer>&& pDeserializer,
+    std::unique_ptr<EvictionPolicy>&& pEvictionPolicy,
+    gsl::span<Evictable*> items,
+    gsl::span<const size_t> residentItemSizes,
+    size_t maxMemory,
+    MemoryGovernor* pMemoryGovernor,
+    const MemoryGovernor::Client* pDependency)
     : m_pDeserializer(std::move(pDeserializer))
     , m_maxMemory(maxMemory)
+    , m_pMemoryGovernor(pMemoryGovernor)
+    , m_pEvictionPolicy(std::move(pEvictionPolicy))
 {
+    m_pEvictionPolicy->init(residentItemSizes, maxMemory);
+
+    // Keep the load factor of the lookup table at or below 50% so that probe sequences stay short.
+    uint32_t lookupTableBits = 1;
+    while ((size_t(1) << lookupTableBits) < 2 * items.size())
+        lookupTableBits++;
+    m_lookupTable.resize(size_t(1) << lookupTableBits);
+    m_lookupShift = 64 - lookupTableBits;
+
+    m_items.assign(std::begin(items), std::end(items));
     m_pItemData = std::make_unique<ItemData[]>(items.size());
     for (uint32_t i = 0; i < items.size(); i++) {
-        m_itemDataIndices[items[i]] = i;
-        if (items[i]->isResident())
+        const uint64_t hash = (reinterpret_cast<uintptr_t>(items[i]) >> 3) * 11400714819323198485llu;
+        size_t slot = hash >> m_lookupShift;
+        while (m_lookupTable[slot].pItem) {
+            assert(m_lookupTable[slot].pItem != items[i]); // Item registered twice.
+            slot = (slot + 1) & (m_lookupTable.size() - 1);
+        }
+        m_lookupTable[slot] = LookupEntry { items[i], i };
+
+        m_pItemData[i].residentSizeBytes = residentItemSizes[i];
+        if (items[i]->isResident()) {
             m_pItemData[i].state = ItemState::Loaded;
+            m_pEvictionPolicy->onLoad(i);
+        }
         m_usedMemory.fetch_add(items[i]->sizeBytes(), std::memory_order::memory_order_relaxed);
     }
+
+    if (m_pMemoryGovernor)
+        m_pMemoryGovernor->registerClient(this, pDependency);
 }
 
 LRUCacheTS& LRUCacheTS::operator=(LRUCacheTS&& other) noexcept
 {
+    if (m_pMemoryGovernor)
+        m_pMemoryGovernor->unregisterClient(this);
+    m_pMemoryGovernor = std::exchange(other.m_pMemoryGovernor, nullptr);
+    if (m_pMemoryGovernor)
+        m_pMemoryGovernor->replaceClient(&other, this);
+
     m_pDeserializer = std::move(other.m_pDeserializer);
     m_maxMemory = other.m_maxMemory;
     m_usedMemory.store(other.m_usedMemory.load());
 
     m_pItemData = std::move(other.m_pItemData);
-    m_itemDataIndices = std::move(other.m_itemDataIndices);
+    m_items = std::move(other.m_items);
+    m_lookupTable = std::move(other.m_lookupTable);
+    m_lookupShift = other.m_lookupShift;
+    m_pEvictionPolicy = std::move(other.m_pEvictionPolicy);
     return *this;
 }
 
 LRUCacheTS::~LRUCacheTS()
 {
     spdlog::info("~LRUCacheTS(): memory usage = {} bytes", m_usedMemory.load());
-    for (auto& [pItem, _] : m_itemDataIndices) {
+    if (m_pMemoryGovernor)
+        m_pMemoryGovernor->unregisterClient(this);
+
+    for (Evictable* pItem : m_items) {
         if (pItem->isResident())
             pItem->evict();
     }
 }
 
+size_t LRUCacheTS::residentSizeBytes(const Evictable* pEvictable) const
+{
+    const auto& itemData = m_pItemData[itemIndex(pEvictable)];
+    return itemData.residentSizeBytes;
+}
+
+size_t LRUCacheTS::nonResidentSizeBytes(const Evictable* pEvictable) const
+{
+    const auto& itemData = m_pItemData[itemIndex(pEvictable)];
+    const ItemState state = itemData.state.load(std::memory_order_relaxed);
+    if (state == ItemState::Loaded || state == ItemState::Loading)
+        return 0;
+    else
+        return itemData.residentSizeBytes;
+}
+
+void LRUCacheTS::addToResidencyGroup(const Evictable* pEvictable, std::shared_ptr<ResidencyGroup> pGroup)
+{
+    auto& itemData = m_pItemData[itemIndex(pEvictable)];
+    pGroup->m_nonResidentSizeBytes.fetch_add(nonResidentSizeBytes(pEvictable), std::memory_order_relaxed);
+    itemData.residencyGroups.push_back(std::move(pGroup));
+}
+
 size_t LRUCacheTS::memoryUsage() const noexcept
 {
-    return m_usedMemory;
+    // Includes data that the deserializer prefetched for items that are not resident yet.
+    return m_usedMemory + (m_pDeserializer ? m_pDeserializer->memoryUsage() : 0);
 }
 
 size_t LRUCacheTS::maxSize() const
@@ -48,16 +117,37 @@ size_t LRUCacheTS::maxSize() const
     return m_maxMemory;
 }
 
+MemoryGovernor* LRUCacheTS::memoryGovernor() const
+{
+    return m_pMemoryGovernor;
+}
+
+void LRUCacheTS::prefetchItems(gsl::span<Evictable* const> items)
+{
+    std::vector<Allocation> allocations;
+    for (Evictable* pItem : items) {
+        const auto& itemData = m_pItemData[itemIndex(pItem)];
+        if (itemData.state.load(std::memory_order_relaxed) == ItemState::Unloaded)
+            pItem->getSerializedAllocations(allocations);
+    }
+
+    if (!allocations.empty())
+        m_pDeserializer->prefetch(allocations);
+}
+
 void LRUCacheTS::forceEvict(Evictable* pEvictable)
 {
     assert(pEvictable->isResident());
 
-    auto& itemData = m_pItemData[m_itemDataIndices[pEvictable]];
+    const uint32_t index = itemIndex(pEvictable);
+    auto& itemData = m_pItemData[index];
 
     m_usedMemory -= pEvictable->sizeBytes();
     pEvictable->evict();
     m_usedMemory += pEvictable->sizeBytes();
     itemData.state = ItemState::Unloaded;
+    m_pEvictionPolicy->onEvict(index);
+    updateResidencyGroups(index, false);
 }
 
 void LRUCacheTS::evictMarked()
@@ -68,56 +158,87 @@ void LRUCacheTS::evictMarked()
     if (m_usedMemory.load(std::memory_order_relaxed) < m_maxMemory)
         return;
 
-    // Evict marked items.
-    int64_t freedMem { 0 };
-    for (auto& [pItem, itemDataIndex] : m_itemDataIndices) {
-        // NOTE: no other thread will try to load / use the item since the memory limit has been exceeded.
-        auto& itemData = m_pItemData[itemDataIndex];
-        const bool marked = itemData.marked.load(std::memory_order_relaxed);
-        const ItemState state = itemData.state.load(std::memory_order_acquire);
-
-        // If marked (not touched since last evict) and loaded in memory
-        if (marked && state == ItemState::Loaded) {
-            // Dont try to evict if someone (which includes us) is holding the item.
-            if (itemData.refCount.load(std::memory_order_relaxed) != 0)
-                continue;
-
-            // Exchange state to evicting (if another thread requests the object it will wait for us to
-            //  evict before starting to load it again).
-            itemData.state.exchange(ItemState::Evicting);
-
-            // Check again that no other thread accessed the object. If this is the case we need to continue
-            // because that thread could also try to evict, which means it needs to wait for us (only a single
-            // thread may evict at any time) and we need to wait for it to release the object => deadlock.
-            if (itemData.refCount.load() != 0) {
-                itemData.state.store(ItemState::Loaded, std::memory_order_acquire);
-                continue;
-            }
-
-            freedMem += pItem->sizeBytes();
-            pItem->evict();
-            freedMem -= pItem->sizeBytes();
+    // NOTE: no other thread will try to load / use the items since the memory limit has been exceeded.
+    evictUnused(m_usedMemory.load(std::memory_order_relaxed) - m_maxMemory);
 
-            itemData.state.store(ItemState::Unloaded, std::memory_order_release);
-        }
+    if (m_usedMemory.load(std::memory_order_relaxed) > m_maxMemory)
+        spdlog::warn("LRUCacheTS: memory usage exceeded limit after eviction");
+}
+
+size_t LRUCacheTS::evictMemory(size_t memoryToFree)
+{
+    std::lock_guard l { m_evictMutex };
+    return evictUnused(memoryToFree);
+}
+
+size_t LRUCacheTS::evictUnused(size_t memoryToFree)
+{
+    size_t freedMem { 0 };
+    m_pEvictionPolicy->evict(memoryToFree, [&](uint32_t index) {
+        const size_t itemFreedMem = tryEvict(index);
+        freedMem += itemFreedMem;
+        return itemFreedMem;
+    });
 
-        itemData.marked.store(true, std::memory_order_relaxed);
+    m_usedMemory.fetch_sub(freedMem, std::memory_order_relaxed);
+    return freedMem;
+}
+
+size_t LRUCacheTS::tryEvict(uint32_t index)
+{
+    auto& itemData = m_pItemData[index];
+    if (itemData.state.load(std::memory_order_acquire) != ItemState::Loaded)
+        return 0;
+
+    // Dont try to evict if someone (which includes us) is holding the item.
+    if (itemData.refCount.load(std::memory_order_relaxed) != 0)
+        return 0;
+
+    // Exchange state to evicting (if another thread requests the object it will wait for us to
+    //  evict before starting to load it again).
+    itemData.state.exchange(ItemState::Evicting);
+
+    // Check again that no other thread accessed the object. If this is the case we need to continue
+    // because that thread could also try to evict, which means it needs to wait for us (only a single
+    // thread may evict at any time) and we need to wait for it to release the object => deadlock.
+    if (itemData.refCount.load() != 0) {
+        itemData.state.store(ItemState::Loaded, std::memory_order_release);
+        return 0;
     }
 
-    auto newMemoryUsage = m_usedMemory.fetch_sub(freedMem, std::memory_order_relaxed) - freedMem;
+    Evictable* pItem = m_items[index];
+    const size_t sizeBefore = pItem->sizeBytes();
+    pItem->evict();
+    const size_t sizeAfter = pItem->sizeBytes();
+    m_pEvictionPolicy->onEvict(index);
+    updateResidencyGroups(index, false);
 
-    if (newMemoryUsage > m_maxMemory)
-        spdlog::warn("LRUCacheTS: memory usage exceeded limit after eviction");
+    itemData.state.store(ItemState::Unloaded, std::memory_order_release);
+    return sizeBefore - sizeAfter;
 }
 
 LRUCacheTS::Builder::Builder(std::unique_ptr<Serializer>&& pSerializer)
-    : m_pSerializer(std::move(pSerializer))
+    : m_pEvictionPolicy(std::make_unique<ClockEvictionPolicy>())
+    , m_pSerializer(std::move(pSerializer))
 {
 }
 
+LRUCacheTS::Builder::Builder(std::unique_ptr<Deserializer>&& pDeserializer)
+    : m_pEvictionPolicy(std::make_unique<ClockEvictionPolicy>())
+    , m_pDeserializer(std::move(pDeserializer))
+{
+}
+
+void LRUCacheTS::Builder::setEvictionPolicy(std::unique_ptr<EvictionPolicy>&& pEvictionPolicy)
+{
+    m_pEvictionPolicy = std::move(pEvictionPolicy);
+}
+
 void LRUCacheTS::Builder::registerCacheable(Evictable* pItem, bool evict)
 {
+    assert(m_pSerializer);
     m_items.push_back(pItem);
+    m_residentItemSizes.push_back(pItem->sizeBytes());
 
     pItem->serialize(*m_pSerializer);
 
@@ -125,9 +246,29 @@ void LRUCacheTS::Builder::registerCacheable(Evictable* pItem, bool evict)
         pItem->evict();
 }
 
+void LRUCacheTS::Builder::registerSerialized(Evictable* pItem, size_t residentSizeBytes)
+{
+    assert(m_pDeserializer);
+    assert(!pItem->isResident());
+    m_items.push_back(pItem);
+    m_residentItemSizes.push_back(residentSizeBytes);
+}
+
 LRUCacheTS LRUCacheTS::Builder::build(size_t maxMemory)
 {
-    return LRUCacheTS(m_pSerializer->createDeserializer(), m_items, maxMemory);
+    if (m_pDeserializer)
+        return LRUCacheTS(std::move(m_pDeserializer), std::move(m_pEvictionPolicy), m_items, m_residentItemSizes, maxMemory);
+    else
+        return LRUCacheTS(m_pSerializer->createDeserializer(), std::move(m_pEvictionPolicy), m_items, m_residentItemSizes, maxMemory);
+}
+
+LRUCacheTS LRUCacheTS::Builder::build(MemoryGovernor& memoryGovernor, const MemoryGovernor::Client* pDependency)
+{
+    const size_t maxMemory = memoryGovernor.memoryBudget();
+    if (m_pDeserializer)
+        return LRUCacheTS(std::move(m_pDeserializer), std::move(m_pEvictionPolicy), m_items, m_residentItemSizes, maxMemory, &memoryGovernor, pDependency);
+    else
+        return LRUCacheTS(m_pSerializer->createDeserializer(), std::move(m_pEvictionPolicy), m_items, m_residentItemSizes, maxMemory, &memoryGovernor, pDependency);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "stream/cache/memory_governor.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <spdlog/spdlog.h>
+
+namespace tasking {
+
+MemoryGovernor::MemoryGovernor(size_t memoryBudget, std::chrono::duration<double> loadTimeHalfLife)
+    : m_memoryBudget(memoryBudget)
+    , m_loadTimeHalfLife(loadTimeHalfLife)
+    , m_lastDecay(std::chrono::high_resolution_clock::now())
+{
+}
+
+MemoryGovernor::~MemoryGovernor()
+{
+    assert(m_clients.empty());
+}
+
+void MemoryGovernor::registerClient(Client* pClient, const Client* pDependency)
+{
+    std::lock_guard l { m_mutex };
+    m_clients.push_back(ClientData { pClient, pDependency });
+}
+
+void MemoryGovernor::unregisterClient(Client* pClient)
+{
+    std::lock_guard l { m_mutex };
+    m_clients.erase(
+        std::remove_if(std::begin(m_clients), std::end(m_clients), [&](const ClientData& clientData) { return clientData.pClient == pClient; }),
+        std::end(m_clients));
+    // Clients that depended on it now stand on their own.
+    for (auto& clientData : m_clients) {
+        if (clientData.pDependency == pClient)
+            clientData.pDependency = nullptr;
+    }
+}
+
+void MemoryGovernor::replaceClient(Client* pOldClient, Client* pNewClient)
+{
+    std::lock_guard l { m_mutex };
+    for (auto& clientData : m_clients) {
+        if (clientData.pClient == pOldClient)
+            clientData.pClient = pNewClient;
+        if (clientData.pDependency == pOldClient)
+            clientData.pDependency = pNewClient;
+    }
+    pNewClient->m_recentLoadTimeNs.store(pOldClient->m_recentLoadTimeNs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void MemoryGovernor::recordLoadTime(Client* pClient, std::chrono::nanoseconds loadTime)
+{
+    pClient->m_recentLoadTimeNs.fetch_add(static_cast<uint64_t>(loadTime.count()), std::memory_order_relaxed);
+}
+
+void MemoryGovernor::enforceBudget()
+{
+    std::unique_lock l { m_mutex, std::try_to_lock };
+    if (!l.owns_lock())
+        return;
+
+    size_t usage = memoryUsageLocked();
+    if (usage <= m_memoryBudget)
+        return;
+
+    spdlog::debug("MemoryGovernor: evicting (memory usage = {} bytes)", usage);
+    decayLoadTimes();
+
+    // Value of keeping the memory of a client resident: time recently spent loading it per resident byte.
+    auto ownValue = [](const Client* pClient) {
+        const size_t clientUsage = pClient->memoryUsage();
+        if (clientUsage == 0)
+            return 0.0;
+        return static_cast<double>(pClient->m_recentLoadTimeNs.load(std::memory_order_relaxed)) / static_cast<double>(clientUsage);
+    };
+    auto value = [&](const ClientData& clientData) {
+        double result = ownValue(clientData.pClient);
+        for (const auto& dependentData : m_clients) {
+            if (dependentData.pDependency == clientData.pClient)
+                result = std::max(result, ownValue(dependentData.pClient));
+        }
+        return result;
+    };
+
+    // Free slightly more than needed so that not every following load has to evict.
+    const size_t targetUsage = m_memoryBudget - m_memoryBudget / 16;
+    std::vector<ClientData> candidates = m_clients;
+    while (usage > targetUsage && !candidates.empty()) {
+        auto victimIter = std::min_element(std::begin(candidates), std::end(candidates),
+            [&](const ClientData& lhs, const ClientData& rhs) { return value(lhs) < value(rhs); });
+
+        // Evict in steps so that the values are re-evaluated as the memory usage of the clients changes.
+        const size_t memoryToFree = usage - targetUsage;
+        const size_t step = std::max(memoryToFree / 4, std::min(memoryToFree, m_memoryBudget / 64));
+        if (victimIter->pClient->evictMemory(step) == 0)
+            candidates.erase(victimIter);
+
+        usage = memoryUsageLocked();
+    }
+
+    if (usage > m_memoryBudget)
+        spdlog::warn("MemoryGovernor: memory usage exceeded budget after eviction");
+}
+
+size_t MemoryGovernor::memoryBudget() const
+{
+    return m_memoryBudget;
+}
+
+size_t MemoryGovernor::memoryUsage() const
+{
+    std::lock_guard l { m_mutex };
+    return memoryUsageLocked();
+}
+
+size_t MemoryGovernor::memoryUsageLocked() const
+{
+    size_t usage = 0;
+    for (const auto& clientData : m_clients)
+        usage += clientData.pClient->memoryUsage();
+    return usage;
+}
+
+void MemoryGovernor::decayLoadTimes()
+{
+    const auto now = std::chrono::high_resolution_clock::now();
+    const double factor = std::exp2(-std::chrono::duration<double>(now - m_lastDecay) / m_loadTimeHalfLife);
+    m_lastDecay = now;
+
+    for (const auto& clientData : m_clients) {
+        auto& loadTime = clientData.pClient->m_recentLoadTimeNs;
+        uint64_t current = loadTime.load(std::memory_order_relaxed);
+        while (!loadTime.compare_exchange_weak(current, static_cast<uint64_t>(static_cast<double>(current) * factor), std::memory_order_relaxed))
+            continue;
+    }
+}
+
+}
@@ -1,20 +1,41 @@
 #include "stream/serialize/file_serializer.h"
+#include "stream/serialize/io_uring_deserializer.h"
+#include <cassert>
 #include <fstream>
+#include <limits>
+#include <lz4.h>
+#include <stdexcept>
 #include <spdlog/spdlog.h>
 
 namespace tasking {
-SplitFileSerializer::SplitFileSerializer(std::string_view folderName, size_t batchSize, mio_cache_control::cache_mode fileCacheMode)
-    : m_tempFolder(std::filesystem::temp_directory_path() / folderName)
+SplitFileSerializer::SplitFileSerializer(std::string_view folderName, size_t batchSize, mio_cache_control::cache_mode fileCacheMode, FileCompression compression)
+    : SplitFileSerializer(std::filesystem::temp_directory_path() / folderName, batchSize, fileCacheMode, compression, false)
+{
+}
+
+SplitFileSerializer::SplitFileSerializer(std::filesystem::path folder, size_t batchSize, mio_cache_control::cache_mode fileCacheMode, FileCompression compression, bool persistent)
+    : m_tempFolder(folder)
     , m_fileCacheMode(fileCacheMode)
+    , m_compression(compression)
+    , m_persistent(persistent)
     , m_batchSize(batchSize)
 {
     if (std::filesystem::exists(m_tempFolder)) {
         std::filesystem::remove_all(m_tempFolder);
     }
-    spdlog::info("Creating temporary folder \"{}\"", m_tempFolder.string());
+    if (m_persistent)
+        spdlog::info("Creating folder \"{}\"", m_tempFolder.string());
+    else
+        spdlog::info("Creating temporary folder \"{}\"", m_tempFolder.string());
     std::filesystem::create_directories(m_tempFolder);
 }
 
+std::unique_ptr<SplitFileSerializer> SplitFileSerializer::createPersistent(std::filesystem::path folder, size_t batchSize, mio_cache_control::cache_mode fileCacheMode, FileCompression compression)
+{
+    // Cannot use make_unique with private constructors
+    return std::unique_ptr<SplitFileSerializer>(new SplitFileSerializer(folder, batchSize, fileCacheMode, compression, true));
+}
+
 SplitFileSerializer::~SplitFileSerializer()
 {
     m_openFiles.clear();
@@ -23,35 +44,160 @@ SplitFileSerializer::~SplitFileSerializer()
 std::pair<Allocation, void*> SplitFileSerializer::allocateAndMap(size_t numBytes)
 {
     assert(numBytes < m_batchSize);
+    Allocation allocation;
+    if (m_compression == FileCompression::None) {
+        auto [offset, fileID, pMemory] = allocateInFile(numBytes);
+
+        FileAllocation fileAllocation { offset, numBytes, fileID };
+        std::memcpy(&allocation, &fileAllocation, sizeof(FileAllocation));
+        return { allocation, pMemory };
+    } else {
+        // The data is compressed and written to the file when the allocation is unmapped.
+        const size_t frameIndex = m_compressedFrames.size();
+        m_compressedFrames.push_back({});
+        auto& pendingAllocation = m_pendingAllocations.emplace_back(PendingAllocation { frameIndex, std::vector<std::byte>(numBytes) });
+
+        FrameAllocation frameAllocation { frameIndex, numBytes };
+        std::memcpy(&allocation, &frameAllocation, sizeof(FrameAllocation));
+        return { allocation, pendingAllocation.memory.data() };
+    }
+}
+
+void SplitFileSerializer::unmapPreviousAllocations()
+{
+    compressPendingAllocations();
+    m_openFiles.clear();
+}
+
+std::tuple<size_t, uint32_t, void*> SplitFileSerializer::allocateInFile(size_t numBytes)
+{
     if (m_currentOffset + numBytes > m_batchSize || !m_currentFile.is_open() || !m_currentFile.is_mapped())
         openNewFile(numBytes);
 
     const size_t offset = m_currentOffset;
     m_currentOffset += numBytes;
     void* pMemory = reinterpret_cast<void*>(m_currentFile.data() + offset);
-
-    FileAllocation fileAllocation { offset, numBytes, m_currentFileID };
-    Allocation allocation;
-    std::memcpy(&allocation, &fileAllocation, sizeof(FileAllocation));
-
-    return { allocation, pMemory };
+    return { offset, m_currentFileID, pMemory };
 }
 
-void SplitFileSerializer::unmapPreviousAllocations()
+void SplitFileSerializer::compressPendingAllocations()
 {
-    m_openFiles.clear();
+    std::vector<char> compressed;
+    for (const auto& [frameIndex, memory] : m_pendingAllocations) {
+        assert(memory.size() <= static_cast<size_t>(LZ4_MAX_INPUT_SIZE));
+        compressed.resize(LZ4_compressBound(static_cast<int>(memory.size())));
+        const int compressedSize = LZ4_compress_default(
+            reinterpret_cast<const char*>(memory.data()), compressed.data(), static_cast<int>(memory.size()), static_cast<int>(compressed.size()));
+
+        // Store the allocation uncompressed if compressing does not make it smaller.
+        const bool storeCompressed = compressedSize > 0 && static_cast<size_t>(compressedSize) < memory.size();
+        const void* pStored = storeCompressed ? static_cast<const void*>(compressed.data()) : static_cast<const void*>(memory.data());
+        const size_t storedSize = storeCompressed ? static_cast<size_t>(compressedSize) : memory.size();
+
+        auto [offset, fileID, pMemory] = allocateInFile(storedSize);
+        std::memcpy(pMemory, pStored, storedSize);
+        m_compressedFrames[frameIndex] = CompressedFrame { offset, memory.size(), static_cast<uint32_t>(storedSize), fileID };
+    }
+    m_pendingAllocations.clear();
 }
 
 std::unique_ptr<Deserializer> SplitFileSerializer::createDeserializer()
 {
+    if (m_compression != FileCompression::None) {
+        compressPendingAllocations();
+
+        std::ofstream file { frameTablePath(m_tempFolder), std::ios::binary | std::ios::out };
+        file.write(reinterpret_cast<const char*>(m_compressedFrames.data()), m_compressedFrames.size() * sizeof(CompressedFrame));
+        if (!file)
+            throw std::runtime_error("SplitFileSerializer failed to write frame table to " + m_tempFolder.string());
+    }
+
     // Cannot use make_unique with private constructors
     m_currentFile.unmap();
-    return std::unique_ptr<SplitFileDeserializer>(new SplitFileDeserializer(m_tempFolder, m_currentFileID, m_fileCacheMode));
+    if (m_persistent && m_currentFileID > 0) {
+        // Files are created at the full batch size. Trim the unused part of the last file so that it does not take up disk
+        //  space for as long as the files are kept around.
+        const auto filePath = m_tempFolder / (std::to_string(m_currentFileID) + ".bin");
+        std::filesystem::resize_file(filePath, m_currentOffset);
+    }
+#ifdef __linux__
+    if (m_fileCacheMode == mio_cache_control::cache_mode::no_buffering && IOUringDeserializer::isSupported())
+        return std::unique_ptr<IOUringDeserializer>(new IOUringDeserializer(m_tempFolder, !m_persistent));
+#endif
+    return std::unique_ptr<SplitFileDeserializer>(new SplitFileDeserializer(m_tempFolder, m_currentFileID, m_fileCacheMode, !m_persistent));
 }
 
-SplitFileDeserializer::SplitFileDeserializer(std::filesystem::path tempFolder, uint32_t maxFileID, mio_cache_control::cache_mode fileCacheMode)
+std::unique_ptr<SplitFileDeserializer> SplitFileDeserializer::open(std::filesystem::path folder, mio_cache_control::cache_mode fileCacheMode)
+{
+    if (!std::filesystem::is_directory(folder))
+        throw std::runtime_error("SplitFileDeserializer cannot open folder " + folder.string());
+
+    // Cannot use make_unique with private constructors
+    return std::unique_ptr<SplitFileDeserializer>(new SplitFileDeserializer(folder, 0, fileCacheMode, false));
+}
+
+std::unique_ptr<Deserializer> openSplitFileDeserializer(std::filesystem::path folder, mio_cache_control::cache_mode fileCacheMode)
+{
+#ifdef __linux__
+    if (fileCacheMode == mio_cache_control::cache_mode::no_buffering && IOUringDeserializer::isSupported())
+        return IOUringDeserializer::open(folder);
+#endif
+    return SplitFileDeserializer::open(folder, fileCacheMode);
+}
+
+std::filesystem::path SplitFileSerializer::frameTablePath(const std::filesystem::path& folder)
+{
+    return folder / "frames.bin";
+}
+
+std::optional<std::vector<CompressedFrame>> SplitFileSerializer::readFrameTable(const std::filesystem::path& folder)
+{
+    const auto filePath = frameTablePath(folder);
+    if (!std::filesystem::exists(filePath))
+        return {};
+
+    const size_t fileSize = std::filesystem::file_size(filePath);
+    if (fileSize % sizeof(CompressedFrame) != 0)
+        throw std::runtime_error("Corrupt SplitFileSerializer frame table " + filePath.string());
+
+    std::vector<CompressedFrame> frames(fileSize / sizeof(CompressedFrame));
+    std::ifstream file { filePath, std::ios::binary | std::ios::in };
+    file.read(reinterpret_cast<char*>(frames.data()), fileSize);
+    if (!file)
+        throw std::runtime_error("Failed to read SplitFileSerializer frame table " + filePath.string());
+    return frames;
+}
+
+SplitFileSerializer::StoredAllocation SplitFileSerializer::locate(const Allocation& allocation, const std::optional<std::vector<CompressedFrame>>& compressedFrames)
+{
+    if (compressedFrames) {
+        FrameAllocation frameAllocation;
+        std::memcpy(&frameAllocation, &allocation, sizeof(decltype(frameAllocation)));
+        assert(frameAllocation.frameIndex < compressedFrames->size());
+
+        const CompressedFrame& frame = (*compressedFrames)[frameAllocation.frameIndex];
+        assert(frame.allocationSize == frameAllocation.allocationSize);
+        return StoredAllocation { frame.fileID, frame.offsetInFile, frame.storedSize, frame.allocationSize };
+    } else {
+        FileAllocation fileAllocation;
+        std::memcpy(&fileAllocation, &allocation, sizeof(decltype(fileAllocation)));
+        return StoredAllocation { fileAllocation.fileID, fileAllocation.offsetInFile, fileAllocation.allocationSize, fileAllocation.allocationSize };
+    }
+}
+
+void SplitFileSerializer::decompress(const void* pStored, size_t storedSize, void* pOut, size_t allocationSize)
+{
+    const int decompressedSize = LZ4_decompress_safe(
+        static_cast<const char*>(pStored), static_cast<char*>(pOut), static_cast<int>(storedSize), static_cast<int>(allocationSize));
+    if (decompressedSize < 0 || static_cast<size_t>(decompressedSize) != allocationSize)
+        throw std::runtime_error("Failed to decompress SplitFileSerializer allocation");
+}
+
+SplitFileDeserializer::SplitFileDeserializer(std::filesystem::path tempFolder, uint32_t maxFileID, mio_cache_control::cache_mode fileCacheMode, bool removeFolder)
     : m_tempFolder(tempFolder)
     , m_fileCacheMode(fileCacheMode)
+    , m_removeFolder(removeFolder)
+    , m_compressedFrames(SplitFileSerializer::readFrameTable(tempFolder))
 {
     /*for (uint32_t fileID = 1; fileID <= maxFileID; fileID++) {
         const auto fileName = std::to_string(fileID) + ".bin";
@@ -66,18 +212,29 @@ SplitFileDeserializer::~SplitFileDeserializer()
     std::scoped_lock l { m_mutex };
 
     m_openFiles.clear();
-    std::filesystem::remove_all(m_tempFolder);
+    m_decompressedAllocations.clear();
+    if (m_removeFolder)
+        std::filesystem::remove_all(m_tempFolder);
 }
 
 const void* SplitFileDeserializer::map(const Allocation& allocation)
 {
-    SplitFileSerializer::FileAllocation fileAllocation;
-    std::memcpy(&fileAllocation, &allocation, sizeof(decltype(fileAllocation)));
+    const auto storedAllocation = SplitFileSerializer::locate(allocation, m_compressedFrames);
 
-    const auto fileName = std::to_string(fileAllocation.fileID) + ".bin";
+    const auto fileName = std::to_string(storedAllocation.fileID) + ".bin";
     const auto filePath = m_tempFolder / fileName;
 
-    auto mappedFile = mio_cache_control::mmap_source(filePath.string(), fileAllocation.offsetInFile, fileAllocation.allocationSize, m_fileCacheMode);
+    auto mappedFile = mio_cache_control::mmap_source(filePath.string(), storedAllocation.offsetInFile, storedAllocation.storedSize, m_fileCacheMode);
+    if (storedAllocation.isCompressed()) {
+        auto pDecompressed = std::make_unique<std::byte[]>(storedAllocation.allocationSize);
+        SplitFileSerializer::decompress(mappedFile.data(), storedAllocation.storedSize, pDecompressed.get(), storedAllocation.allocationSize);
+        const void* pResult = pDecompressed.get();
+
+        std::scoped_lock l { m_mutex };
+        m_decompressedAllocations.insert({ pResult, std::move(pDecompressed) });
+        return pResult;
+    }
+
     const void* pResult = mappedFile.data();
 
     std::scoped_lock l { m_mutex };
@@ -104,11 +261,18 @@ void SplitFileDeserializer::unmap(const void* pMemory)
 
     if (auto iter = m_openFiles.find(pMemory); iter != std::end(m_openFiles)) {
         m_openFiles.erase(iter);
+    } else if (auto iter = m_decompressedAllocations.find(pMemory); iter != std::end(m_decompressedAllocations)) {
+        m_decompressedAllocations.erase(iter);
     } else {
         spdlog::error("SplitFileDeserializer trying to unmap a file that was not mapped");
     }
 }
 
+size_t SplitFileDeserializer::diskSize(const Allocation& allocation) const
+{
+    return SplitFileSerializer::locate(allocation, m_compressedFrames).storedSize;
+}
+
 static void createFileOfSize(std::filesystem::path filePath, size_t size)
 {
     // https://stackoverflow.com/questions/7896035/c-make-a-file-of-a-specific-size
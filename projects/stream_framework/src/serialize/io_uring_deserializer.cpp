@@ -0,0 +1,514 @@
+#ifdef __linux__
+#include "stream/serialize/io_uring_deserializer.h"
+#include "stream/serialize/file_serializer.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace tasking {
+
+// Offsets and buffers of direct I/O reads need to be aligned to the logical block size of the device. 4KB covers all
+//  common devices.
+static constexpr size_t directIOAlignment = 4096;
+static constexpr unsigned ringEntries = 256;
+static constexpr size_t maxPooledBuffersPerSizeClass = 16;
+// Prefetched allocations that have not been mapped after this time (or that do not fit in the limit) are discarded.
+static constexpr auto prefetchTimeout = std::chrono::seconds(10);
+static constexpr size_t maxPrefetchedBytes = 512llu * 1024 * 1024;
+
+static int ioUringSetup(unsigned entries, io_uring_params* pParams)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, pParams));
+}
+
+static int ioUringEnter(int ringFD, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, ringFD, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+static int ioUringRegister(int ringFD, unsigned opcode, void* pArg, unsigned numArgs)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, ringFD, opcode, pArg, numArgs));
+}
+
+static uint64_t requestKey(uint32_t fileID, size_t offsetInFile)
+{
+    assert(offsetInFile < (1llu << 40));
+    return (static_cast<uint64_t>(fileID) << 40) | offsetInFile;
+}
+
+struct IOUringDeserializer::Ring {
+    Ring();
+    ~Ring();
+
+    int fd { -1 };
+
+    void* pSQRingMemory { nullptr };
+    size_t sqRingSize { 0 };
+    void* pCQRingMemory { nullptr };
+    size_t cqRingSize { 0 };
+    io_uring_sqe* pSQEs { nullptr };
+    size_t sqesSize { 0 };
+
+    unsigned* pSQHead;
+    unsigned* pSQTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* pSQArray;
+
+    unsigned* pCQHead;
+    unsigned* pCQTail;
+    unsigned cqMask;
+    io_uring_cqe* pCQEs;
+};
+
+struct IOUringDeserializer::Request {
+    int fd;
+    size_t readOffset; // Aligned offset in the file
+    size_t readSize; // Aligned number of bytes to read
+    size_t dataOffset; // Offset of the allocation in the buffer
+    size_t dataSize; // Number of bytes stored in the file
+    size_t allocationSize; // Size of the allocation after decompressing
+
+    void* pBuffer;
+    size_t bufferSize;
+    std::atomic_bool completed { false };
+    int result { 0 };
+
+    std::chrono::steady_clock::time_point prefetchTime;
+};
+
+IOUringDeserializer::Ring::Ring()
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd = ioUringSetup(ringEntries, &params);
+    if (fd < 0)
+        throw std::runtime_error(std::string("io_uring_setup failed: ") + std::strerror(errno));
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+    pSQRingMemory = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (pSQRingMemory == MAP_FAILED)
+        throw std::runtime_error("Failed to map io_uring submission queue");
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        pCQRingMemory = pSQRingMemory;
+    } else {
+        pCQRingMemory = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (pCQRingMemory == MAP_FAILED)
+            throw std::runtime_error("Failed to map io_uring completion queue");
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    pSQEs = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (pSQEs == MAP_FAILED)
+        throw std::runtime_error("Failed to map io_uring submission queue entries");
+
+    auto* pSQRing = static_cast<char*>(pSQRingMemory);
+    pSQHead = reinterpret_cast<unsigned*>(pSQRing + params.sq_off.head);
+    pSQTail = reinterpret_cast<unsigned*>(pSQRing + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(pSQRing + params.sq_off.ring_mask);
+    sqEntries = *reinterpret_cast<unsigned*>(pSQRing + params.sq_off.ring_entries);
+    pSQArray = reinterpret_cast<unsigned*>(pSQRing + params.sq_off.array);
+
+    auto* pCQRing = static_cast<char*>(pCQRingMemory);
+    pCQHead = reinterpret_cast<unsigned*>(pCQRing + params.cq_off.head);
+    pCQTail = reinterpret_cast<unsigned*>(pCQRing + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(pCQRing + params.cq_off.ring_mask);
+    pCQEs = reinterpret_cast<io_uring_cqe*>(pCQRing + params.cq_off.cqes);
+}
+
+IOUringDeserializer::Ring::~Ring()
+{
+    if (pSQEs && pSQEs != MAP_FAILED)
+        munmap(pSQEs, sqesSize);
+    if (pCQRingMemory && pCQRingMemory != MAP_FAILED && pCQRingMemory != pSQRingMemory)
+        munmap(pCQRingMemory, cqRingSize);
+    if (pSQRingMemory && pSQRingMemory != MAP_FAILED)
+        munmap(pSQRingMemory, sqRingSize);
+    if (fd >= 0)
+        close(fd);
+}
+
+bool IOUringDeserializer::isSupported()
+{
+    static const bool supported = []() {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        const int fd = ioUringSetup(1, &params);
+        if (fd < 0)
+            return false;
+
+        // io_uring itself is available since Linux 5.1 but IORING_OP_READ was only added in 5.6, which is also the first
+        //  version that can be probed for the supported opcodes. Older kernels fail the probe.
+        constexpr unsigned numProbeOps = 256;
+        std::vector<std::byte> probeMemory(sizeof(io_uring_probe) + numProbeOps * sizeof(io_uring_probe_op));
+        auto* pProbe = reinterpret_cast<io_uring_probe*>(probeMemory.data());
+        const bool probed = ioUringRegister(fd, IORING_REGISTER_PROBE, pProbe, numProbeOps) >= 0;
+        close(fd);
+        return probed && pProbe->last_op >= IORING_OP_READ && (pProbe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    }();
+    return supported;
+}
+
+std::unique_ptr<IOUringDeserializer> IOUringDeserializer::open(std::filesystem::path folder)
+{
+    if (!std::filesystem::is_directory(folder))
+        throw std::runtime_error("IOUringDeserializer cannot open folder " + folder.string());
+
+    // Cannot use make_unique with private constructors
+    return std::unique_ptr<IOUringDeserializer>(new IOUringDeserializer(folder, false));
+}
+
+IOUringDeserializer::IOUringDeserializer(std::filesystem::path folder, bool removeFolder)
+    : m_folder(folder)
+    , m_removeFolder(removeFolder)
+    , m_compressedFrames(SplitFileSerializer::readFrameTable(folder))
+    , m_pRing(std::make_unique<Ring>())
+{
+    // The files are never modified after they have been written, so open all of them up front.
+    m_fileDescriptors.push_back(-1);
+    for (uint32_t fileID = 1;; fileID++) {
+        const auto filePath = m_folder / (std::to_string(fileID) + ".bin");
+        if (!std::filesystem::exists(filePath))
+            break;
+
+        int fd = ::open(filePath.c_str(), O_RDONLY | O_DIRECT);
+        if (fd < 0 && errno == EINVAL) {
+            // File system does not support direct I/O (tmpfs for example).
+            fd = ::open(filePath.c_str(), O_RDONLY);
+        }
+        if (fd < 0)
+            throw std::runtime_error("IOUringDeserializer cannot open file " + filePath.string());
+        m_fileDescriptors.push_back(fd);
+    }
+
+    for (auto& bufferQueue : m_bufferPool)
+        bufferQueue.set_capacity(maxPooledBuffersPerSizeClass);
+}
+
+IOUringDeserializer::~IOUringDeserializer()
+{
+    // The kernel may still be writing to the buffers of prefetched requests.
+    for (auto& [_, pRequest] : m_prefetchedRequests) {
+        waitForCompletion(pRequest);
+        std::free(pRequest->pBuffer);
+        delete pRequest;
+    }
+    for (auto& [_, pRequest] : m_mappedRequests) {
+        std::free(pRequest->pBuffer);
+        delete pRequest;
+    }
+    for (auto& bufferQueue : m_bufferPool) {
+        void* pBuffer;
+        while (bufferQueue.try_pop(pBuffer))
+            std::free(pBuffer);
+    }
+
+    m_pRing.reset();
+    for (int fd : m_fileDescriptors) {
+        if (fd >= 0)
+            close(fd);
+    }
+    if (m_removeFolder)
+        std::filesystem::remove_all(m_folder);
+}
+
+const void* IOUringDeserializer::map(const Allocation& allocation)
+{
+    const auto storedAllocation = SplitFileSerializer::locate(allocation, m_compressedFrames);
+
+    Request* pRequest = nullptr;
+    {
+        decltype(m_prefetchedRequests)::accessor accessor;
+        if (m_prefetchedRequests.find(accessor, requestKey(storedAllocation.fileID, storedAllocation.offsetInFile))) {
+            pRequest = accessor->second;
+            m_prefetchedRequests.erase(accessor);
+        }
+    }
+    if (pRequest) {
+        m_prefetchedBytes.fetch_sub(pRequest->bufferSize, std::memory_order_relaxed);
+        expirePrefetches();
+    } else {
+        pRequest = createRequest(storedAllocation);
+        submit(gsl::span(&pRequest, 1));
+    }
+    waitForCompletion(pRequest);
+
+    if (pRequest->result < 0 || static_cast<size_t>(pRequest->result) < pRequest->dataOffset + pRequest->dataSize) {
+        const std::string error = pRequest->result < 0 ? std::strerror(-pRequest->result) : "unexpected end of file";
+        freeBuffer(pRequest->pBuffer, pRequest->bufferSize);
+        delete pRequest;
+        throw std::runtime_error("IOUringDeserializer failed to read allocation: " + error);
+    }
+
+    if (pRequest->dataSize != pRequest->allocationSize) {
+        // Replace the buffer holding the compressed data by the decompressed allocation.
+        void* pDecompressed = allocateBuffer(pRequest->allocationSize);
+        try {
+            SplitFileSerializer::decompress(
+                static_cast<const char*>(pRequest->pBuffer) + pRequest->dataOffset, pRequest->dataSize, pDecompressed, pRequest->allocationSize);
+        } catch (...) {
+            freeBuffer(pDecompressed, pRequest->allocationSize);
+            freeBuffer(pRequest->pBuffer, pRequest->bufferSize);
+            delete pRequest;
+            throw;
+        }
+        freeBuffer(pRequest->pBuffer, pRequest->bufferSize);
+        pRequest->pBuffer = pDecompressed;
+        pRequest->bufferSize = pRequest->allocationSize;
+        pRequest->dataOffset = 0;
+    }
+
+    const void* pResult = static_cast<const char*>(pRequest->pBuffer) + pRequest->dataOffset;
+    m_mappedRequests.insert({ pResult, pRequest });
+    return pResult;
+}
+
+void IOUringDeserializer::unmap(const void* pMemory)
+{
+    Request* pRequest = nullptr;
+    {
+        decltype(m_mappedRequests)::accessor accessor;
+        if (m_mappedRequests.find(accessor, pMemory)) {
+            pRequest = accessor->second;
+            m_mappedRequests.erase(accessor);
+        }
+    }
+
+    if (pRequest) {
+        freeBuffer(pRequest->pBuffer, pRequest->bufferSize);
+        delete pRequest;
+    } else {
+        spdlog::error("IOUringDeserializer trying to unmap memory that was not mapped");
+    }
+}
+
+void IOUringDeserializer::prefetch(gsl::span<const Allocation> allocations)
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<Request*> requests;
+    std::vector<std::pair<uint64_t, Request*>> keyedRequests;
+    for (const Allocation& allocation : allocations) {
+        const auto storedAllocation = SplitFileSerializer::locate(allocation, m_compressedFrames);
+        const uint64_t key = requestKey(storedAllocation.fileID, storedAllocation.offsetInFile);
+
+        // Skip allocations that were already prefetched.
+        decltype(m_prefetchedRequests)::accessor accessor;
+        if (m_prefetchedRequests.insert(accessor, key)) {
+            Request* pRequest = createRequest(storedAllocation);
+            pRequest->prefetchTime = now;
+            m_prefetchedBytes.fetch_add(pRequest->bufferSize, std::memory_order_relaxed);
+            accessor->second = pRequest;
+            requests.push_back(pRequest);
+            keyedRequests.push_back({ key, pRequest });
+        }
+    }
+
+    if (!requests.empty()) {
+        {
+            std::lock_guard l { m_prefetchOrderMutex };
+            m_prefetchOrder.insert(std::end(m_prefetchOrder), std::begin(keyedRequests), std::end(keyedRequests));
+        }
+        submit(requests);
+    }
+    expirePrefetches();
+}
+
+void IOUringDeserializer::expirePrefetches()
+{
+    // Expiring is best effort; don't hold up the caller if another thread is already doing it.
+    std::unique_lock l { m_prefetchOrderMutex, std::try_to_lock };
+    if (!l.owns_lock())
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    while (!m_prefetchOrder.empty()) {
+        const auto [key, pOrderedRequest] = m_prefetchOrder.front();
+
+        Request* pRequest = nullptr;
+        {
+            // Requests that have been mapped since they were prefetched are owned by map; only look at them when they are
+            //  still in the prefetch table.
+            decltype(m_prefetchedRequests)::accessor accessor;
+            if (m_prefetchedRequests.find(accessor, key) && accessor->second == pOrderedRequest) {
+                const bool expired = m_prefetchedBytes.load(std::memory_order_relaxed) > maxPrefetchedBytes
+                    || now - pOrderedRequest->prefetchTime > prefetchTimeout;
+                if (!expired)
+                    break;
+
+                pRequest = accessor->second;
+                m_prefetchedRequests.erase(accessor);
+            }
+        }
+        m_prefetchOrder.pop_front();
+
+        if (pRequest) {
+            m_prefetchedBytes.fetch_sub(pRequest->bufferSize, std::memory_order_relaxed);
+            // The kernel may still be writing to the buffer.
+            waitForCompletion(pRequest);
+            freeBuffer(pRequest->pBuffer, pRequest->bufferSize);
+            delete pRequest;
+        }
+    }
+}
+
+size_t IOUringDeserializer::memoryUsage() const
+{
+    return m_prefetchedBytes.load(std::memory_order_relaxed);
+}
+
+IOUringDeserializer::Request* IOUringDeserializer::createRequest(const SplitFileSerializer::StoredAllocation& storedAllocation)
+{
+    assert(storedAllocation.fileID > 0 && storedAllocation.fileID < m_fileDescriptors.size());
+
+    const size_t readStart = storedAllocation.offsetInFile & ~(directIOAlignment - 1);
+    const size_t readEnd = (storedAllocation.offsetInFile + storedAllocation.storedSize + directIOAlignment - 1) & ~(directIOAlignment - 1);
+
+    auto* pRequest = new Request();
+    pRequest->fd = m_fileDescriptors[storedAllocation.fileID];
+    pRequest->readOffset = readStart;
+    pRequest->readSize = std::max(readEnd - readStart, directIOAlignment);
+    pRequest->dataOffset = storedAllocation.offsetInFile - readStart;
+    pRequest->dataSize = storedAllocation.storedSize;
+    pRequest->allocationSize = storedAllocation.allocationSize;
+    pRequest->bufferSize = pRequest->readSize;
+    pRequest->pBuffer = allocateBuffer(pRequest->bufferSize);
+    return pRequest;
+}
+
+size_t IOUringDeserializer::diskSize(const Allocation& allocation) const
+{
+    return SplitFileSerializer::locate(allocation, m_compressedFrames).storedSize;
+}
+
+void IOUringDeserializer::submit(gsl::span<Request* const> requests)
+{
+    Ring& ring = *m_pRing;
+
+    std::lock_guard l { m_submitMutex };
+    size_t numQueued = 0;
+    while (numQueued < requests.size()) {
+        // Fill the submission queue as far as possible.
+        unsigned tail = *ring.pSQTail;
+        const unsigned head = __atomic_load_n(ring.pSQHead, __ATOMIC_ACQUIRE);
+        unsigned toSubmit = 0;
+        while (numQueued < requests.size() && tail - head < ring.sqEntries) {
+            const Request* pRequest = requests[numQueued++];
+            const unsigned index = tail & ring.sqMask;
+            io_uring_sqe* pSQE = &ring.pSQEs[index];
+            std::memset(pSQE, 0, sizeof(io_uring_sqe));
+            pSQE->opcode = IORING_OP_READ;
+            pSQE->fd = pRequest->fd;
+            pSQE->off = pRequest->readOffset;
+            pSQE->addr = reinterpret_cast<uint64_t>(pRequest->pBuffer);
+            pSQE->len = static_cast<uint32_t>(pRequest->readSize);
+            pSQE->user_data = reinterpret_cast<uint64_t>(pRequest);
+            ring.pSQArray[index] = index;
+            tail++;
+            toSubmit++;
+        }
+        __atomic_store_n(ring.pSQTail, tail, __ATOMIC_RELEASE);
+
+        while (toSubmit > 0) {
+            const int ret = ioUringEnter(ring.fd, toSubmit, 0, 0);
+            if (ret < 0) {
+                if (errno == EAGAIN || errno == EBUSY || errno == EINTR) {
+                    // Completion queue is full; make some room (unless another thread is already doing so).
+                    if (std::unique_lock cl { m_completionMutex, std::try_to_lock }; cl.owns_lock())
+                        reapCompletions();
+                    std::this_thread::yield();
+                    continue;
+                }
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+            }
+            toSubmit -= static_cast<unsigned>(ret);
+        }
+    }
+}
+
+void IOUringDeserializer::waitForCompletion(Request* pRequest)
+{
+    while (!pRequest->completed.load(std::memory_order_acquire)) {
+        // A single thread waits for the kernel at a time. Other threads wait for that thread to process the completion
+        //  of their request.
+        std::unique_lock l { m_completionMutex, std::try_to_lock };
+        if (!l.owns_lock()) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        reapCompletions();
+        if (pRequest->completed.load(std::memory_order_acquire))
+            break;
+
+        // Our request is in flight (or about to be submitted) so there will be a completion to wait for.
+        if (ioUringEnter(m_pRing->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN)
+            throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+        reapCompletions();
+    }
+}
+
+void IOUringDeserializer::reapCompletions()
+{
+    Ring& ring = *m_pRing;
+
+    unsigned head = *ring.pCQHead;
+    const unsigned tail = __atomic_load_n(ring.pCQTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const io_uring_cqe& cqe = ring.pCQEs[head & ring.cqMask];
+        auto* pRequest = reinterpret_cast<Request*>(cqe.user_data);
+        pRequest->result = cqe.res;
+        pRequest->completed.store(true, std::memory_order_release);
+        head++;
+    }
+    __atomic_store_n(ring.pCQHead, head, __ATOMIC_RELEASE);
+}
+
+static size_t bufferSizeClass(size_t size)
+{
+    size_t sizeClass = 0;
+    while ((directIOAlignment << sizeClass) < size)
+        sizeClass++;
+    return sizeClass;
+}
+
+void* IOUringDeserializer::allocateBuffer(size_t size)
+{
+    const size_t sizeClass = bufferSizeClass(size);
+    assert(sizeClass < numBufferSizeClasses);
+
+    void* pBuffer;
+    if (m_bufferPool[sizeClass].try_pop(pBuffer))
+        return pBuffer;
+
+    pBuffer = std::aligned_alloc(directIOAlignment, directIOAlignment << sizeClass);
+    if (!pBuffer)
+        throw std::bad_alloc();
+    return pBuffer;
+}
+
+void IOUringDeserializer::freeBuffer(void* pBuffer, size_t size)
+{
+    if (!m_bufferPool[bufferSizeClass(size)].try_push(pBuffer))
+        std::free(pBuffer);
+}
+
+}
+#endif
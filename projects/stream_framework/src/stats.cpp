@@ -35,13 +35,28 @@ nlohmann::json StreamStats::toJSON(const GeneralStats& genStats)
     return ret;
 }
 
+nlohmann::json StreamStats::toJSON(const SelectionInfo& selectionInfo)
+{
+    nlohmann::json ret;
+    ret["policy"] = selectionInfo.policy;
+    ret["score"] = selectionInfo.score;
+    ret["queue_size"] = selectionInfo.queueSize;
+    ret["static_data_load_cost"] = selectionInfo.staticDataLoadCost;
+    ret["num_candidates"] = selectionInfo.numCandidates;
+    ret["over_memory_budget"] = selectionInfo.overMemoryBudget;
+    return ret;
+}
+
 nlohmann::json StreamStats::toJSON(const FlushInfo& flushInfo)
 {
     nlohmann::json ret;
     ret["start_time"] = flushInfo.startTime.time_since_epoch().count();
     ret["general_stats"] = toJSON(flushInfo.genStats);
+    ret["selection"] = toJSON(flushInfo.selection);
     ret["task_name"] = flushInfo.taskName;
     ret["items_flushed"] = flushInfo.itemsFlushed;
+    ret["items_reloaded"] = flushInfo.itemsReloaded;
+    ret["static_data_prefetched"] = flushInfo.staticDataPrefetched;
     ret["static_data_load_time"] = flushInfo.staticDataLoadTime;
     ret["processing_time"] = flushInfo.processingTime;
     return ret;
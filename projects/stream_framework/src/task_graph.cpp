@@ -1,6 +1,9 @@
 #include "stream/task_graph.h"
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <optick.h>
 #include <optick_tbb.h>
@@ -8,12 +11,131 @@
 
 namespace tasking {
 
-TaskGraph::TaskGraph(unsigned numSchedulers)
+TaskGraph::TaskGraph(unsigned numSchedulers, unsigned numPrefetches)
     : m_numSchedulers(numSchedulers)
+    , m_pSelectionPolicy(std::make_unique<LargestQueuePolicy>())
+    , m_memoryBudget(std::numeric_limits<size_t>::max())
+    , m_spillBudget(std::numeric_limits<size_t>::max())
+    , m_spillSegmentSize(0)
     , m_taskArena(static_cast<int>(std::thread::hardware_concurrency()))
+    , m_maxPrefetches(numPrefetches)
 {
     auto& stats = StreamStats::getSingleton();
     (void)stats;
+
+    for (unsigned i = 0; i < m_maxPrefetches; i++) {
+        m_prefetchThreads.emplace_back([this]() {
+            while (true) {
+                TaskBase* pTask;
+                m_prefetchQueue.pop(pTask);
+                if (!pTask)
+                    return;
+
+                pTask->prefetch();
+                m_staticDataEpoch.fetch_add(1);
+            }
+        });
+    }
+}
+
+TaskGraph::~TaskGraph()
+{
+    // Push dummy items to unblock the pop operations
+    for (size_t i = 0; i < m_prefetchThreads.size(); i++)
+        m_prefetchQueue.push(nullptr);
+
+    for (auto& thread : m_prefetchThreads)
+        thread.join();
+
+    if (m_spillThread.joinable()) {
+        m_spillRequests.push(nullptr);
+        m_spillThread.join();
+    }
+}
+
+void TaskGraph::setSelectionPolicy(std::unique_ptr<TaskSelectionPolicy>&& pSelectionPolicy)
+{
+    assert(!m_inTaskArena);
+    m_pSelectionPolicy = std::move(pSelectionPolicy);
+}
+
+void TaskGraph::setMemoryBudget(size_t budgetBytes)
+{
+    m_memoryBudget = budgetBytes;
+}
+
+bool TaskGraph::isOverMemoryBudget() const
+{
+    // Computed from the live queue sizes so that producers resume as soon as the queues have drained (rather than
+    //  when a scheduler selects the next task).
+    return approxMemoryUsage() > m_memoryBudget;
+}
+
+void TaskGraph::enableSpilling(SerializerFactory serializerFactory, size_t spillBudgetBytes, size_t segmentSizeBytes)
+{
+    assert(!m_inTaskArena);
+    m_spillSerializerFactory = std::move(serializerFactory);
+    m_spillBudget = spillBudgetBytes;
+    m_spillSegmentSize = segmentSizeBytes;
+
+    for (const auto& pTask : m_tasks)
+        pTask->nextSpillCheckBytes.store(segmentSizeBytes);
+
+    if (!m_spillThread.joinable()) {
+        m_spillThread = std::thread([this]() {
+            while (true) {
+                TaskBase* pTask;
+                m_spillRequests.pop(pTask);
+                if (!pTask)
+                    return;
+
+                processSpillRequest(pTask);
+            }
+        });
+    }
+}
+
+void TaskGraph::requestSpillIfOverBudget(TaskBase* pTask)
+{
+    // Checking the budget requires visiting all tasks. To amortize that cost the task is only reconsidered once
+    //  another segment worth of items has been added to its queue.
+    const size_t queueSizeBytes = pTask->approxQueueSizeBytes();
+    pTask->nextSpillCheckBytes.store(queueSizeBytes + m_spillSegmentSize, std::memory_order_relaxed);
+
+    // Items of a task that is being flushed are about to be consumed (they are hot).
+    if (pTask->isClaimed())
+        return;
+
+    if (approxMemoryUsage() <= m_spillBudget)
+        return;
+
+    // Writing to disk is left to the spill thread so that the kernel that enqueued the items is not held up.
+    if (!pTask->spillRequested.exchange(true))
+        m_spillRequests.push(pTask);
+}
+
+void TaskGraph::processSpillRequests()
+{
+    // The spill thread may be busy with another task (or may not get any CPU time) so the schedulers help out.
+    TaskBase* pTask;
+    while (m_spillRequests.try_pop(pTask))
+        processSpillRequest(pTask);
+}
+
+void TaskGraph::processSpillRequest(TaskBase* pTask)
+{
+    // Cleared before spilling such that items that are enqueued in the mean time can request another spill.
+    pTask->spillRequested.store(false);
+
+    // A single request may stand for many segments (e.g. when a kernel enqueued a large span at once) so keep spilling
+    //  until the graph is back under budget. The task may have been selected for flushing or the queues may have
+    //  drained since the spill was requested.
+    OPTICK_EVENT("Spill");
+    while (!pTask->isClaimed() && approxMemoryUsage() > m_spillBudget) {
+        if (pTask->trySpill(m_spillSerializerFactory, m_spillSegmentSize) == 0)
+            break;
+    }
+    pTask->nextSpillCheckBytes.store(pTask->approxQueueSizeBytes() + m_spillSegmentSize, std::memory_order_relaxed);
 }
 
 void TaskGraph::run()
@@ -21,30 +143,41 @@ void TaskGraph::run()
     m_inTaskArena = true;
     m_taskArena.execute([&] {
         tbb::task_group tg;
-        std::function<void()> schedule = [&]() {
+        auto schedule = [&]() {
             Optick::tryRegisterThreadWithOptick();
 
-            TaskBase* pTask { nullptr };
-            {
-                OPTICK_EVENT("Task Selection");
-                auto bestTaskIter = std::max_element(
-                    std::begin(m_tasks),
-                    std::end(m_tasks),
-                    [](const auto& lhs, const auto& rhs) {
-                        return lhs->approxQueueSize() < rhs->approxQueueSize();
-                    });
-                assert(bestTaskIter != std::end(m_tasks));
-
-                // TODO: cannot assume this when we allow multiple tasks to execute in parallel (need better stop condition)!
-                pTask = bestTaskIter->get();
-            }
-            if (pTask->approxQueueSize() == 0)
-                return;
+            // NOTE: flushes run in isolation. Otherwise a thread that is waiting for the tasks spawned by a flush (or by
+            //  the static data loader) may pick up another scheduler which would only return once all work is done. That
+            //  work includes the flush that is suspended on the stack of the very same thread => deadlock.
+            unsigned idleRounds = 0;
+            while (true) {
+                processSpillRequests();
+
+                StreamStats::SelectionInfo selectionInfo;
+                if (TaskBase* pTask = claimTask(selectionInfo)) {
+                    tbb::this_task_arena::isolate([&]() { pTask->execute(this, std::move(selectionInfo)); });
+                    pTask->release();
+                    m_activeFlushes.fetch_sub(1);
+                    wakeIdleSchedulers();
+                    idleRounds = 0;
+                    continue;
+                }
 
-            pTask->execute(this);
-            tg.run(schedule);
+                // All tasks with work are being flushed by other schedulers; steal some of their batches.
+                if (tbb::this_task_arena::isolate([&]() { return helpInFlightTask(); })) {
+                    idleRounds = 0;
+                    continue;
+                }
+
+                if (isDone())
+                    return;
+
+                waitForWork(idleRounds++);
+            }
         };
 
+        // Schedulers only return when no work is left in the system. Keep looping in case work was added after the
+        //  last scheduler exited (e.g. by an external thread).
         while (!allQueuesEmpty()) {
             for (unsigned i = 0; i < m_numSchedulers; i++) {
                 tg.run(schedule);
@@ -53,6 +186,193 @@ void TaskGraph::run()
         }
     });
     m_inTaskArena = false;
+
+    discardPrefetches();
+}
+
+TaskGraph::TaskBase* TaskGraph::claimTask(StreamStats::SelectionInfo& selectionInfo)
+{
+    OPTICK_EVENT("Task Selection");
+
+    while (true) {
+        const bool overBudget = isOverMemoryBudget();
+
+        // Any task with queued items is selectable, even if the policy assigns it a non-positive score. When over
+        //  the memory budget, sink tasks take precedence over tasks that may produce more work.
+        TaskBase* pBestTask { nullptr };
+        TaskSelectionCandidate bestCandidate {};
+        double bestScore = -std::numeric_limits<double>::infinity();
+        bool bestIsSink = false;
+        size_t numCandidates = 0;
+        for (const auto& pTask : m_tasks) {
+            if (pTask->isClaimed())
+                continue;
+
+            TaskSelectionCandidate candidate;
+            const double score = scoreTask(pTask.get(), candidate);
+            if (candidate.queueSize == 0)
+                continue;
+
+            numCandidates++;
+            const bool isSink = overBudget && pTask->isSink();
+            if ((isSink && !bestIsSink) || (isSink == bestIsSink && score > bestScore)) {
+                pBestTask = pTask.get();
+                bestCandidate = candidate;
+                bestScore = score;
+                bestIsSink = isSink;
+            }
+        }
+
+        if (!pBestTask)
+            return nullptr;
+
+        // Another scheduler might have claimed the task in the mean time; in that case select a new task.
+        if (pBestTask->tryClaim()) {
+            // Register the flush before any items are popped from the queue (see isDone()).
+            m_activeFlushes.fetch_add(1);
+            m_flushEpoch.fetch_add(1);
+
+            selectionInfo.policy = m_pSelectionPolicy->name();
+            selectionInfo.score = bestScore;
+            selectionInfo.queueSize = bestCandidate.queueSize;
+            selectionInfo.staticDataLoadCost = bestCandidate.staticDataLoadCost;
+            selectionInfo.numCandidates = numCandidates;
+            selectionInfo.overMemoryBudget = overBudget;
+
+            prefetchUpcomingTasks();
+            return pBestTask;
+        }
+    }
+}
+
+double TaskGraph::scoreTask(const TaskBase* pTask, TaskSelectionCandidate& candidate) const
+{
+    candidate.taskName = pTask->name();
+    candidate.queueSize = pTask->approxQueueSize();
+    candidate.queueSizeBytes = pTask->approxQueueSizeBytes();
+    candidate.staticDataLoadCost = 0;
+    if (candidate.queueSize == 0)
+        return 0.0;
+
+    if (m_pSelectionPolicy->usesLoadCost())
+        candidate.staticDataLoadCost = pTask->cachedStaticDataLoadCost(m_staticDataEpoch.load());
+    return m_pSelectionPolicy->score(candidate);
+}
+
+void TaskGraph::prefetchUpcomingTasks()
+{
+    if (m_maxPrefetches == 0 || m_numPrefetches.load() >= static_cast<int>(m_maxPrefetches))
+        return;
+
+    OPTICK_EVENT("Prefetch Selection");
+
+    // Predict which tasks will be flushed next using the same selection policy as claimTask().
+    std::vector<std::pair<double, TaskBase*>> candidates;
+    for (const auto& pTask : m_tasks) {
+        if (pTask->isClaimed())
+            continue;
+
+        TaskSelectionCandidate candidate;
+        if (const double score = scoreTask(pTask.get(), candidate); candidate.queueSize > 0)
+            candidates.push_back({ score, pTask.get() });
+    }
+    std::sort(std::begin(candidates), std::end(candidates),
+        [](const auto& lhs, const auto& rhs) {
+            return lhs.first > rhs.first;
+        });
+
+    for (const auto& [_, pTask] : candidates) {
+        // Reserve a prefetch slot
+        if (m_numPrefetches.fetch_add(1) >= static_cast<int>(m_maxPrefetches)) {
+            m_numPrefetches.fetch_sub(1);
+            return;
+        }
+
+        // The task might not have any static data or it might already be prefetched.
+        if (pTask->markForPrefetch())
+            m_prefetchQueue.push(pTask);
+        else
+            m_numPrefetches.fetch_sub(1);
+    }
+}
+
+void TaskGraph::discardPrefetches()
+{
+    // A prefetch may have been started for a task right after its queue was drained. That static data will not be
+    //  consumed by any flush so we have to clean it up ourselves.
+    for (const auto& pTask : m_tasks)
+        pTask->discardPrefetch();
+    m_numPrefetches.store(0);
+}
+
+bool TaskGraph::helpInFlightTask()
+{
+    TaskBase* pBestTask { nullptr };
+    size_t bestQueueSize = 0;
+    for (const auto& pTask : m_tasks) {
+        if (!pTask->isClaimed())
+            continue;
+
+        const size_t queueSize = pTask->approxQueueSize();
+        if (queueSize > bestQueueSize) {
+            pBestTask = pTask.get();
+            bestQueueSize = queueSize;
+        }
+    }
+
+    if (!pBestTask)
+        return false;
+    return pBestTask->help();
+}
+
+void TaskGraph::waitForWork(unsigned idleRounds)
+{
+    // Work often shows up right away (e.g. when a flush is opened after its static data was loaded) so yield a couple
+    //  of times before going to sleep.
+    constexpr unsigned numYieldRounds = 8;
+    if (idleRounds < numYieldRounds) {
+        std::this_thread::yield();
+        return;
+    }
+
+    // The timeout grows exponentially up to a couple of milliseconds. It bounds the delay when a wake-up is missed, for
+    //  example because the items that kernels stage in emission buffers are pushed without notifying the schedulers.
+    const auto timeout = std::chrono::microseconds(50 << std::min(idleRounds - numYieldRounds, 5u));
+    m_numIdleSchedulers.fetch_add(1);
+    {
+        std::unique_lock l { m_idleMutex };
+        m_wakePending.store(false);
+        const uint64_t generation = m_wakeGeneration;
+        m_idleCondition.wait_for(l, timeout, [&]() { return m_wakeGeneration != generation; });
+    }
+    m_numIdleSchedulers.fetch_sub(1);
+}
+
+void TaskGraph::wakeIdleSchedulers()
+{
+    // Called whenever items are enqueued so it should be cheap when no scheduler is sleeping.
+    if (m_numIdleSchedulers.load(std::memory_order_relaxed) == 0 || m_wakePending.load(std::memory_order_relaxed) || m_wakePending.exchange(true))
+        return;
+
+    {
+        std::lock_guard l { m_idleMutex };
+        m_wakeGeneration++;
+    }
+    m_idleCondition.notify_all();
+}
+
+bool TaskGraph::isDone() const
+{
+    // Work can only be created by kernels, which only run as part of a flush. If no flush was active before and after
+    //  checking the queues, and no flush was started in between (epoch did not change), then no new work can appear.
+    const uint64_t epochBefore = m_flushEpoch.load();
+    if (m_activeFlushes.load() != 0)
+        return false;
+
+    if (!allQueuesEmpty())
+        return false;
+
+    return m_activeFlushes.load() == 0 && m_flushEpoch.load() == epochBefore;
 }
 
 size_t TaskGraph::approxMemoryUsage() const
@@ -82,4 +402,112 @@ bool TaskGraph::allQueuesEmpty() const
     return true;
 }
 
-}
\ No newline at end of file
+bool TaskGraph::TaskBase::tryClaim()
+{
+    bool expected = false;
+    return m_claimed.compare_exchange_strong(expected, true);
+}
+
+void TaskGraph::TaskBase::release()
+{
+    m_claimed.store(false);
+}
+
+bool TaskGraph::TaskBase::isClaimed() const
+{
+    return m_claimed.load();
+}
+
+bool TaskGraph::TaskBase::isSink() const
+{
+    return m_isSink;
+}
+
+void TaskGraph::TaskBase::setSink(bool isSink)
+{
+    m_isSink = isSink;
+}
+
+size_t TaskGraph::TaskBase::cachedStaticDataLoadCost(uint64_t staticDataEpoch) const
+{
+    std::lock_guard l { m_loadCostMutex };
+    if (m_loadCostEpoch != staticDataEpoch) {
+        m_loadCost = estimateStaticDataLoadCost();
+        m_loadCostEpoch = staticDataEpoch;
+    }
+    return m_loadCost;
+}
+
+// Large enough for the scratch allocations of a typical batch so that the arena rarely needs to go to the heap.
+static constexpr size_t workerArenaSize = 256 * 1024;
+
+struct WorkerArena {
+    std::unique_ptr<std::byte[]> pBuffer { std::make_unique<std::byte[]>(workerArenaSize) };
+    std::pmr::monotonic_buffer_resource memoryResource { pBuffer.get(), workerArenaSize, std::pmr::new_delete_resource() };
+    bool inUse { false };
+};
+static thread_local WorkerArena workerArena;
+
+TaskGraph::ScopedScratchMemory::ScopedScratchMemory()
+{
+    if (!workerArena.inUse) {
+        workerArena.inUse = true;
+        m_pWorkerArenaInUse = &workerArena.inUse;
+        m_pMemoryResource = &workerArena.memoryResource;
+    } else {
+        m_fallbackMemoryResource.emplace(std::pmr::new_delete_resource());
+        m_pMemoryResource = &m_fallbackMemoryResource.value();
+    }
+}
+
+TaskGraph::ScopedScratchMemory::~ScopedScratchMemory()
+{
+    // Returns the arena to its initial buffer (and frees any memory that was taken from the heap).
+    m_pMemoryResource->release();
+    if (m_pWorkerArenaInUse)
+        *m_pWorkerArenaInUse = false;
+}
+
+std::pmr::memory_resource* TaskGraph::ScopedScratchMemory::get()
+{
+    return m_pMemoryResource;
+}
+
+thread_local TaskGraph::ThreadEmissionState TaskGraph::s_threadEmissionState;
+
+TaskGraph::EmissionBuffer* TaskGraph::acquireEmissionBuffer(TaskBase* pTask, int threadIdx)
+{
+    auto& state = s_threadEmissionState;
+    std::unique_ptr<EmissionBuffer> pBuffer;
+    if (state.freeBuffers.empty()) {
+        pBuffer = std::make_unique<EmissionBuffer>();
+    } else {
+        pBuffer = std::move(state.freeBuffers.back());
+        state.freeBuffers.pop_back();
+    }
+
+    pBuffer->pTask = pTask;
+    pBuffer->threadIdx = threadIdx;
+    state.activeBuffers.push_back(std::move(pBuffer));
+    return state.activeBuffers.back().get();
+}
+
+TaskGraph::ScopedEmissionBuffers::ScopedEmissionBuffers()
+{
+    s_threadEmissionState.kernelDepth++;
+}
+
+TaskGraph::ScopedEmissionBuffers::~ScopedEmissionBuffers()
+{
+    // A nested scope (another batch executed by this thread while the kernel was waiting) also flushes the buffers
+    //  of the outer scope. That is harmless: the outer kernel simply acquires a new buffer.
+    auto& state = s_threadEmissionState;
+    for (auto& pBuffer : state.activeBuffers) {
+        pBuffer->pTask->flushEmissionBuffer(*pBuffer);
+        state.freeBuffers.push_back(std::move(pBuffer));
+    }
+    state.activeBuffers.clear();
+    state.kernelDepth--;
+}
+
+}
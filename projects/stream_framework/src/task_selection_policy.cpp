@@ -0,0 +1,43 @@
+#include "stream/task_selection_policy.h"
+
+namespace tasking {
+
+std::string_view LargestQueuePolicy::name() const
+{
+    return "largest_queue";
+}
+
+bool LargestQueuePolicy::usesLoadCost() const
+{
+    return false;
+}
+
+double LargestQueuePolicy::score(const TaskSelectionCandidate& candidate) const
+{
+    return static_cast<double>(candidate.queueSize);
+}
+
+LoadCostPolicy::LoadCostPolicy(size_t fixedCostBytes)
+    : m_fixedCostBytes(fixedCostBytes)
+{
+}
+
+std::string_view LoadCostPolicy::name() const
+{
+    return "load_cost";
+}
+
+bool LoadCostPolicy::usesLoadCost() const
+{
+    return true;
+}
+
+double LoadCostPolicy::score(const TaskSelectionCandidate& candidate) const
+{
+    if (candidate.queueSize == 0)
+        return 0.0;
+
+    return static_cast<double>(candidate.queueSize) / static_cast<double>(m_fixedCostBytes + candidate.staticDataLoadCost);
+}
+
+}
@@ -1,5 +1,10 @@
 #include "stream/serialize/file_serializer.h"
+#include "stream/serialize/io_uring_deserializer.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
 #include <gtest/gtest.h>
+#include <thread>
 #include <vector>
 #include <optional>
 
@@ -50,3 +55,176 @@ TEST(SplitFileSerializer, WriteNoUnmap)
         ASSERT_EQ(*pInt, i);
     }
 }
+
+TEST(SplitFileSerializer, PersistentReopen)
+{
+    const auto folder = std::filesystem::temp_directory_path() / "TEST_PersistentReopen";
+    std::vector<tasking::Allocation> allocations;
+
+    {
+        auto pSerializer = tasking::SplitFileSerializer::createPersistent(folder, 64);
+        for (int i = 0; i < 40; i++) {
+            auto [allocation, pMemory] = pSerializer->allocateAndMap(sizeof(int));
+            new (pMemory) int(i);
+            pSerializer->unmapPreviousAllocations();
+
+            allocations.push_back(allocation);
+        }
+
+        // Destroying the deserializer should not remove the files.
+        auto pDeserializer = pSerializer->createDeserializer();
+    }
+    ASSERT_TRUE(std::filesystem::exists(folder));
+
+    {
+        auto pDeserializer = tasking::SplitFileDeserializer::open(folder, mio_cache_control::cache_mode::random_access);
+        for (int i = 0; i < 40; i++) {
+            const int* pInt = reinterpret_cast<const int*>(pDeserializer->map(allocations[i]));
+            ASSERT_EQ(*pInt, i);
+            pDeserializer->unmap(pInt);
+        }
+    }
+
+    std::filesystem::remove_all(folder);
+}
+
+TEST(SplitFileSerializer, CompressedReopen)
+{
+    const auto folder = std::filesystem::temp_directory_path() / "TEST_CompressedReopen";
+    std::vector<tasking::Allocation> allocations;
+
+    {
+        auto pSerializer = tasking::SplitFileSerializer::createPersistent(
+            folder, 64 * 1024, mio_cache_control::cache_mode::random_access, tasking::FileCompression::LZ4);
+        for (int i = 0; i < 40; i++) {
+            // Map multiple allocations before unmapping them.
+            auto [allocation1, pMemory1] = pSerializer->allocateAndMap(1000 * sizeof(int));
+            auto [allocation2, pMemory2] = pSerializer->allocateAndMap(sizeof(int));
+            std::fill_n(static_cast<int*>(pMemory1), 1000, i);
+            new (pMemory2) int(i);
+            pSerializer->unmapPreviousAllocations();
+
+            allocations.push_back(allocation1);
+            allocations.push_back(allocation2);
+        }
+        pSerializer->createDeserializer();
+    }
+
+    auto pDeserializer = tasking::SplitFileDeserializer::open(folder, mio_cache_control::cache_mode::random_access);
+    for (int i = 0; i < 40; i++) {
+        // The large allocation compresses well, the small one is stored as is.
+        ASSERT_LT(pDeserializer->diskSize(allocations[2 * i]), 1000 * sizeof(int));
+        ASSERT_EQ(pDeserializer->diskSize(allocations[2 * i + 1]), sizeof(int));
+
+        const int* pInts = reinterpret_cast<const int*>(pDeserializer->map(allocations[2 * i]));
+        ASSERT_TRUE(std::all_of(pInts, pInts + 1000, [=](int v) { return v == i; }));
+        pDeserializer->unmap(pInts);
+
+        const int* pInt = reinterpret_cast<const int*>(pDeserializer->map(allocations[2 * i + 1]));
+        ASSERT_EQ(*pInt, i);
+        pDeserializer->unmap(pInt);
+    }
+    pDeserializer.reset();
+
+    std::filesystem::remove_all(folder);
+}
+
+#ifdef __linux__
+TEST(IOUringDeserializer, PrefetchAndMap)
+{
+    if (!tasking::IOUringDeserializer::isSupported())
+        GTEST_SKIP();
+
+    const auto folder = std::filesystem::temp_directory_path() / "TEST_IOUringPrefetchAndMap";
+    std::vector<tasking::Allocation> allocations;
+
+    // Allocations of varying sizes so that most of them are not aligned to the block size.
+    auto pSerializer = tasking::SplitFileSerializer::createPersistent(folder, 64 * 1024, mio_cache_control::cache_mode::no_buffering);
+    for (int i = 0; i < 200; i++) {
+        auto [allocation, pMemory] = pSerializer->allocateAndMap((i % 17 + 1) * 100 * sizeof(int));
+        int* pInts = static_cast<int*>(pMemory);
+        for (int j = 0; j < (i % 17 + 1) * 100; j++)
+            pInts[j] = i * 10000 + j;
+        pSerializer->unmapPreviousAllocations();
+
+        allocations.push_back(allocation);
+    }
+    pSerializer->createDeserializer();
+
+    auto pDeserializer = tasking::openSplitFileDeserializer(folder, mio_cache_control::cache_mode::no_buffering);
+    ASSERT_NE(dynamic_cast<tasking::IOUringDeserializer*>(pDeserializer.get()), nullptr);
+
+    // Prefetch half of the allocations, the other half is read on demand.
+    pDeserializer->prefetch(gsl::span<const tasking::Allocation>(allocations).subspan(0, 100));
+
+    std::vector<std::thread> threads;
+    std::atomic_int numErrors { 0 };
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t]() {
+            for (int i = t; i < 200; i += 4) {
+                const int* pInts = static_cast<const int*>(pDeserializer->map(allocations[i]));
+                for (int j = 0; j < (i % 17 + 1) * 100; j++) {
+                    if (pInts[j] != i * 10000 + j)
+                        numErrors++;
+                }
+                pDeserializer->unmap(pInts);
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    ASSERT_EQ(numErrors.load(), 0);
+
+    pDeserializer.reset();
+    std::filesystem::remove_all(folder);
+}
+
+TEST(IOUringDeserializer, PrefetchMemoryUsage)
+{
+    if (!tasking::IOUringDeserializer::isSupported())
+        GTEST_SKIP();
+
+    const auto folder = std::filesystem::temp_directory_path() / "TEST_IOUringPrefetchMemoryUsage";
+    std::vector<tasking::Allocation> allocations;
+
+    auto pSerializer = tasking::SplitFileSerializer::createPersistent(folder, 64 * 1024, mio_cache_control::cache_mode::no_buffering);
+    for (int i = 0; i < 50; i++) {
+        auto [allocation, pMemory] = pSerializer->allocateAndMap(1000 * sizeof(int));
+        int* pInts = static_cast<int*>(pMemory);
+        for (int j = 0; j < 1000; j++)
+            pInts[j] = i;
+        pSerializer->unmapPreviousAllocations();
+
+        allocations.push_back(allocation);
+    }
+    pSerializer->createDeserializer();
+
+    auto pDeserializer = tasking::openSplitFileDeserializer(folder, mio_cache_control::cache_mode::no_buffering);
+    ASSERT_EQ(pDeserializer->memoryUsage(), 0);
+
+    // Buffers of prefetched allocations count towards the memory usage until they are mapped.
+    pDeserializer->prefetch(allocations);
+    const size_t prefetchedMemoryUsage = pDeserializer->memoryUsage();
+    ASSERT_GE(prefetchedMemoryUsage, allocations.size() * 1000 * sizeof(int));
+
+    for (int i = 0; i < 25; i++) {
+        const int* pInts = static_cast<const int*>(pDeserializer->map(allocations[i]));
+        ASSERT_TRUE(std::all_of(pInts, pInts + 1000, [=](int v) { return v == i; }));
+        pDeserializer->unmap(pInts);
+    }
+    ASSERT_LT(pDeserializer->memoryUsage(), prefetchedMemoryUsage);
+    ASSERT_GT(pDeserializer->memoryUsage(), 0);
+
+    for (int i = 25; i < 50; i++) {
+        const int* pInts = static_cast<const int*>(pDeserializer->map(allocations[i]));
+        ASSERT_TRUE(std::all_of(pInts, pInts + 1000, [=](int v) { return v == i; }));
+        pDeserializer->unmap(pInts);
+    }
+    ASSERT_EQ(pDeserializer->memoryUsage(), 0);
+
+    // Allocations that are prefetched but never mapped are freed by the deserializer.
+    pDeserializer->prefetch(allocations);
+    pDeserializer.reset();
+    std::filesystem::remove_all(folder);
+}
+#endif
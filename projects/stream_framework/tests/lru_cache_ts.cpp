@@ -4,8 +4,10 @@
 #include <cstring>
 #include <gsl/span>
 #include <gtest/gtest.h>
+#include <memory>
 #include <random>
 #include <spdlog/spdlog.h>
+#include <stdexcept>
 #include <tbb/parallel_for.h>
 #include <thread>
 #include <vector>
@@ -14,9 +16,9 @@ struct DummyDataTS : public tasking::Evictable {
     int value;
     tasking::Allocation alloc;
 
-    DummyDataTS(int v)
-        : Evictable(true)
-        , value(v)
+    DummyDataTS(int v, bool resident = true)
+        : Evictable(resident)
+        , value(resident ? v : -1)
     {
     }
     size_t sizeBytes() const override
@@ -91,6 +93,104 @@ TEST(LRUCacheTS, RegisterAndEvict)
     }
 }
 
+TEST(LRUCacheTS, UnregisteredItem)
+{
+    std::vector<DummyDataTS> data;
+    for (int i = 0; i < 50; i++)
+        data.push_back(DummyDataTS(i));
+
+    tasking::LRUCacheTS::Builder builder { std::make_unique<tasking::InMemorySerializer>() };
+    for (int i = 0; i < static_cast<int>(data.size()); i++) {
+        builder.registerCacheable(&data[i], true);
+    }
+    auto cache = builder.build(data.size() * 750);
+
+    DummyDataTS unregistered { 123 };
+    ASSERT_THROW(cache.makeResident(&unregistered), std::runtime_error);
+    ASSERT_THROW(cache.residentSizeBytes(&unregistered), std::runtime_error);
+    ASSERT_THROW(cache.nonResidentSizeBytes(&unregistered), std::runtime_error);
+    auto pItem = cache.makeResident(&data[0]);
+    ASSERT_EQ(cache.nonResidentSizeBytes(&data[0]), 0);
+    ASSERT_GT(cache.residentSizeBytes(&data[0]), 0);
+}
+
+TEST(LRUCacheTS, ResidencyGroup)
+{
+    std::vector<DummyDataTS> data;
+    for (int i = 0; i < 50; i++)
+        data.push_back(DummyDataTS(i));
+
+    tasking::LRUCacheTS::Builder builder { std::make_unique<tasking::InMemorySerializer>() };
+    for (auto& d : data)
+        builder.registerCacheable(&d, true);
+    // Room for 20 resident items, so loading items evicts other items.
+    auto cache = builder.build(data.size() * sizeof(DummyDataTS) + 20 * 1000);
+
+    auto pAllItems = std::make_shared<tasking::LRUCacheTS::ResidencyGroup>();
+    auto pEvenItems = std::make_shared<tasking::LRUCacheTS::ResidencyGroup>();
+    for (int i = 0; i < static_cast<int>(data.size()); i++) {
+        cache.addToResidencyGroup(&data[i], pAllItems);
+        if (i % 2 == 0)
+            cache.addToResidencyGroup(&data[i], pEvenItems);
+    }
+
+    auto checkGroups = [&]() {
+        size_t expectedAll = 0, expectedEven = 0;
+        for (int i = 0; i < static_cast<int>(data.size()); i++) {
+            const size_t nonResidentSize = cache.nonResidentSizeBytes(&data[i]);
+            expectedAll += nonResidentSize;
+            if (i % 2 == 0)
+                expectedEven += nonResidentSize;
+        }
+        ASSERT_EQ(pAllItems->nonResidentSizeBytes(), expectedAll);
+        ASSERT_EQ(pEvenItems->nonResidentSizeBytes(), expectedEven);
+    };
+    checkGroups();
+    ASSERT_EQ(pAllItems->nonResidentSizeBytes(), data.size() * cache.residentSizeBytes(&data[0]));
+
+    std::mt19937 rng { 123 };
+    std::uniform_int_distribution<int> dist { 0, static_cast<int>(data.size()) - 1 };
+    for (int i = 0; i < 200; i++) {
+        const int itemIdx = dist(rng);
+        ASSERT_EQ(cache.makeResident(&data[itemIdx])->value, itemIdx);
+        checkGroups();
+    }
+
+    ASSERT_EQ(cache.makeResident(&data[0])->value, 0);
+    cache.forceEvict(&data[0]);
+    checkGroups();
+}
+
+TEST(LRUCacheTS, RegisterSerialized)
+{
+    // Serialize the items up front and register non-resident copies that only know where their data is stored.
+    auto pSerializer = std::make_unique<tasking::InMemorySerializer>();
+    std::vector<DummyDataTS> data;
+    for (int i = 0; i < 50; i++) {
+        DummyDataTS source { i };
+        source.serialize(*pSerializer);
+
+        DummyDataTS item { i, false };
+        item.alloc = source.alloc;
+        data.push_back(item);
+    }
+
+    tasking::LRUCacheTS::Builder builder { pSerializer->createDeserializer() };
+    for (int i = 0; i < static_cast<int>(data.size()); i++) {
+        builder.registerSerialized(&data[i], sizeof(DummyDataTS) + 1000);
+    }
+
+    const size_t maxMemory = data.size() * 750;
+    auto cache = builder.build(maxMemory);
+    for (int i = 0; i < static_cast<int>(data.size()); i++) {
+        ASSERT_EQ(cache.nonResidentSizeBytes(&data[i]), sizeof(DummyDataTS) + 1000);
+
+        auto pSharedOwner = cache.makeResident(&data[i]);
+        ASSERT_TRUE(pSharedOwner->isResident());
+        ASSERT_EQ(pSharedOwner->value, i);
+    }
+}
+
 /*TEST(LRUCacheTS, ManualEvictFail)
 {
     std::vector<DummyDataTS> data;
@@ -239,3 +339,66 @@ TEST(LRUCacheTS, MultithreadedAccess)
     for (int answer : answers)
         ASSERT_EQ(answer, refSum);
 }
+
+TEST(LRUCacheTS, TwoQueueScanResistance)
+{
+    std::vector<DummyDataTS> data;
+    for (int i = 0; i < 100; i++)
+        data.push_back(DummyDataTS(i));
+
+    tasking::LRUCacheTS::Builder builder { std::make_unique<tasking::InMemorySerializer>() };
+    builder.setEvictionPolicy(std::make_unique<tasking::TwoQueueEvictionPolicy>());
+    for (auto& d : data)
+        builder.registerCacheable(&d, true);
+
+    // Room for 30 resident items.
+    const size_t maxMemory = data.size() * sizeof(DummyDataTS) + 30 * 1000;
+    auto cache = builder.build(maxMemory);
+
+    // Items that are accessed repeatedly (working set).
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 10; i++)
+            ASSERT_EQ(cache.makeResident(&data[i])->value, i);
+    }
+
+    // Items that are accessed only once should not push the working set out of the cache.
+    for (int i = 10; i < static_cast<int>(data.size()); i++)
+        ASSERT_EQ(cache.makeResident(&data[i])->value, i);
+
+    for (int i = 0; i < 10; i++)
+        ASSERT_TRUE(data[i].isResident());
+    ASSERT_LE(cache.memoryUsage(), maxMemory);
+}
+
+TEST(LRUCacheTS, SharedMemoryGovernor)
+{
+    std::vector<DummyDataTS> data1, data2;
+    for (int i = 0; i < 50; i++) {
+        data1.push_back(DummyDataTS(i));
+        data2.push_back(DummyDataTS(i + 50));
+    }
+
+    tasking::LRUCacheTS::Builder builder1 { std::make_unique<tasking::InMemorySerializer>() };
+    for (auto& d : data1)
+        builder1.registerCacheable(&d, true);
+    tasking::LRUCacheTS::Builder builder2 { std::make_unique<tasking::InMemorySerializer>() };
+    for (auto& d : data2)
+        builder2.registerCacheable(&d, true);
+
+    // Room for 40 resident items in total.
+    const size_t memoryBudget = 100 * sizeof(DummyDataTS) + 40 * 1000;
+    tasking::MemoryGovernor memoryGovernor { memoryBudget };
+    {
+        auto cache1 = builder1.build(memoryGovernor);
+        auto cache2 = builder2.build(memoryGovernor, &cache1);
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 50; i++) {
+                ASSERT_EQ(cache1.makeResident(&data1[i])->value, i);
+                ASSERT_EQ(cache2.makeResident(&data2[i])->value, i + 50);
+                ASSERT_LE(memoryGovernor.memoryUsage(), memoryBudget);
+            }
+        }
+        ASSERT_EQ(memoryGovernor.memoryUsage(), cache1.memoryUsage() + cache2.memoryUsage());
+    }
+    ASSERT_EQ(memoryGovernor.memoryUsage(), 0);
+}
@@ -1,9 +1,16 @@
 #include "stream/task_graph.h"
 #include "stream/cache/lru_cache.h"
 #include "stream/serialize/dummy_serializer.h"
+#include "stream/serialize/in_memory_serializer.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
 #include <gtest/gtest.h>
+#include <memory>
+#include <numeric>
 #include <random>
+#include <thread>
 #include <tuple>
 #include <vector>
 
@@ -31,6 +38,39 @@ TEST(TaskGraph, SingleTask)
         ASSERT_EQ(output[i], 1);
 }
 
+TEST(TaskGraph, ScratchMemory)
+{
+    constexpr size_t range = 4096;
+
+    std::vector<int> output;
+    output.resize(range, 0);
+
+    std::atomic_bool usedGlobalHeap { false };
+    tasking::TaskGraph g;
+    auto task = g.addTask<int>(
+        "task",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            if (pMemoryResource == std::pmr::new_delete_resource())
+                usedGlobalHeap.store(true);
+
+            // Exceeds the initial buffer of the arena so that it has to grow.
+            std::pmr::vector<int> scratch { pMemoryResource };
+            for (int i = 0; i < 128; i++)
+                scratch.insert(std::end(scratch), std::begin(numbers), std::end(numbers));
+            for (const int number : scratch)
+                output[number]++;
+        });
+
+    for (int i = 0; i < range; i++)
+        g.enqueue(task, i);
+
+    g.run();
+
+    ASSERT_FALSE(usedGlobalHeap.load());
+    for (int i = 0; i < range; i++)
+        ASSERT_EQ(output[i], 128);
+}
+
 TEST(TaskGraph, TaskChain)
 {
     constexpr size_t range = 1024;
@@ -196,3 +236,508 @@ TEST(TaskGraph, CachedStaticData)
     for (int i = 0; i < range; i++)
         ASSERT_EQ(output[i], 123 + i);
 }
+
+TEST(TaskGraph, MultipleSchedulers)
+{
+    constexpr size_t range = 64 * 1024;
+
+    std::vector<std::atomic_int> output(range);
+    for (auto& v : output)
+        v.store(0);
+
+    tasking::TaskGraph g { 4 };
+    auto task3 = g.addTask<std::pair<int, int>>(
+        "task3",
+        [&](gsl::span<const std::pair<int, int>> numbers, std::pmr::memory_resource* pMemoryResource) {
+            for (const auto [initialNumber, number] : numbers)
+                output[initialNumber].fetch_add(number);
+        });
+    auto task2 = g.addTask<std::pair<int, int>>(
+        "task2",
+        [&](gsl::span<const std::pair<int, int>> numbers, std::pmr::memory_resource* pMemoryResource) {
+            for (const auto [initialNumber, number] : numbers)
+                g.enqueue(task3, { initialNumber, number + 1 });
+        });
+    tasking::TaskHandle<int> task1;
+    task1 = g.addTask<int>(
+        "task1",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            for (const int number : numbers) {
+                // Feed back into itself a couple of times so that tasks keep producing work while others are flushed.
+                if (number < static_cast<int>(range / 2))
+                    g.enqueue(task1, number + static_cast<int>(range / 2));
+                g.enqueue(task2, { number, number * 2 });
+            }
+        });
+
+    for (int i = 0; i < static_cast<int>(range / 2); i++)
+        g.enqueue(task1, i);
+
+    g.run();
+
+    ASSERT_EQ(g.approxQueuedItems(), 0);
+    for (int i = 0; i < static_cast<int>(range); i++)
+        ASSERT_EQ(output[i].load(), i * 2 + 1);
+}
+
+TEST(TaskGraph, OverlappingStaticDataLoads)
+{
+    constexpr size_t range = 1024;
+    constexpr int numTasks = 4;
+
+    struct StaticData {
+        int adder;
+    };
+
+    std::atomic_int numLoading { 0 };
+    std::atomic_int maxNumLoading { 0 };
+
+    std::vector<std::atomic_int> output(numTasks * range);
+    for (auto& v : output)
+        v.store(0);
+
+    tasking::TaskGraph g { numTasks };
+    std::vector<tasking::TaskHandle<int>> tasks;
+    for (int taskIdx = 0; taskIdx < numTasks; taskIdx++) {
+        tasks.push_back(g.addTask<int, StaticData>(
+            "task",
+            [&]() {
+                // Simulate (I/O bound) loading of static data
+                const int currentlyLoading = numLoading.fetch_add(1) + 1;
+                int prevMax = maxNumLoading.load();
+                while (prevMax < currentlyLoading && !maxNumLoading.compare_exchange_weak(prevMax, currentlyLoading))
+                    ;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                numLoading.fetch_sub(1);
+
+                return StaticData { 3 };
+            },
+            [&](gsl::span<const int> numbers, const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
+                for (const int number : numbers)
+                    output[number].fetch_add(number + pStaticData->adder);
+            }));
+    }
+
+    for (int taskIdx = 0; taskIdx < numTasks; taskIdx++) {
+        for (int i = 0; i < static_cast<int>(range); i++)
+            g.enqueue(tasks[taskIdx], taskIdx * static_cast<int>(range) + i);
+    }
+
+    g.run();
+
+    for (int i = 0; i < static_cast<int>(numTasks * range); i++)
+        ASSERT_EQ(output[i].load(), i + 3);
+
+    // Static data of different tasks should be loaded concurrently (if the machine has the threads to do so).
+    if (std::thread::hardware_concurrency() >= numTasks)
+        ASSERT_GT(maxNumLoading.load(), 1);
+}
+
+TEST(TaskGraph, IdleSchedulersSleep)
+{
+    constexpr auto loadTime = std::chrono::milliseconds(500);
+
+    struct StaticData {
+        int adder;
+    };
+
+    std::atomic_int sum { 0 };
+
+    tasking::TaskGraph g { 4 };
+    auto task = g.addTask<int, StaticData>(
+        "task",
+        [&]() {
+            // Simulate (I/O bound) loading of static data
+            std::this_thread::sleep_for(loadTime);
+            return StaticData { 1 };
+        },
+        [&](gsl::span<const int> numbers, const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
+            for (const int number : numbers)
+                sum.fetch_add(number + pStaticData->adder);
+        });
+    g.enqueue(task, 1);
+
+    const std::clock_t cpuTimeStart = std::clock();
+    g.run();
+    const double cpuTime = static_cast<double>(std::clock() - cpuTimeStart) / CLOCKS_PER_SEC;
+
+    ASSERT_EQ(sum.load(), 2);
+
+    // While the static data is loading the other schedulers have nothing to do. They should sleep rather than spin on
+    //  the cores that the loader (and other threads) need.
+    if (std::thread::hardware_concurrency() >= 4)
+        ASSERT_LT(cpuTime, 0.25 * std::chrono::duration<double>(loadTime).count());
+}
+
+TEST(TaskGraph, PrefetchStaticData)
+{
+    constexpr size_t range = 1024;
+    constexpr int numTasks = 8;
+
+    struct StaticData {
+        int adder;
+        std::shared_ptr<int> pToken;
+    };
+
+    // Every copy of the static data holds a reference to the token so that we can detect leaked prefetches.
+    auto pToken = std::make_shared<int>(0);
+    std::atomic_int numLoads { 0 };
+
+    std::vector<std::atomic_int> output(numTasks * range);
+    for (auto& v : output)
+        v.store(0);
+
+    {
+        tasking::TaskGraph g { 1, 2 };
+        std::vector<tasking::TaskHandle<int>> tasks;
+        for (int taskIdx = 0; taskIdx < numTasks; taskIdx++) {
+            tasks.push_back(g.addTask<int, StaticData>(
+                "task",
+                [&, taskIdx]() {
+                    numLoads.fetch_add(1);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    return StaticData { taskIdx, pToken };
+                },
+                [&, taskIdx](gsl::span<const int> numbers, const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
+                    EXPECT_EQ(pStaticData->adder, taskIdx);
+                    for (const int number : numbers)
+                        output[number].fetch_add(number + pStaticData->adder);
+                }));
+        }
+
+        for (int taskIdx = 0; taskIdx < numTasks; taskIdx++) {
+            for (int i = 0; i < static_cast<int>(range); i++)
+                g.enqueue(tasks[taskIdx], taskIdx * static_cast<int>(range) + i);
+        }
+
+        g.run();
+        ASSERT_EQ(g.approxQueuedItems(), 0);
+    }
+
+    for (int i = 0; i < static_cast<int>(numTasks * range); i++)
+        ASSERT_EQ(output[i].load(), i + i / static_cast<int>(range));
+
+    // All static data (prefetched or not) should have been destroyed.
+    ASSERT_EQ(pToken.use_count(), 1);
+    ASSERT_GE(numLoads.load(), numTasks);
+}
+
+TEST(TaskGraph, LoadCostSelectionPolicy)
+{
+    constexpr int numItemsExpensive = 200;
+    constexpr int numItemsCheap = 100;
+
+    struct StaticData {
+        int adder;
+    };
+
+    std::atomic_int firstFlushedTask { -1 };
+    std::atomic_int sum { 0 };
+
+    tasking::TaskGraph g;
+    g.setSelectionPolicy(std::make_unique<tasking::LoadCostPolicy>(1024));
+    auto makeTask = [&](int taskIdx, size_t loadCost) {
+        return g.addTask<int, StaticData>(
+            "task",
+            []() { return StaticData { 1 }; },
+            [=]() { return loadCost; },
+            [&, taskIdx](gsl::span<const int> numbers, const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
+                int expected = -1;
+                firstFlushedTask.compare_exchange_strong(expected, taskIdx);
+                for (const int number : numbers)
+                    sum.fetch_add(number + pStaticData->adder);
+            });
+    };
+    // The task with the largest queue requires a lot of data to be loaded.
+    auto expensiveTask = makeTask(0, 1024 * 1024);
+    auto cheapTask = makeTask(1, 0);
+
+    for (int i = 0; i < numItemsExpensive; i++)
+        g.enqueue(expensiveTask, 1);
+    for (int i = 0; i < numItemsCheap; i++)
+        g.enqueue(cheapTask, 1);
+
+    g.run();
+
+    ASSERT_EQ(firstFlushedTask.load(), 1);
+    ASSERT_EQ(sum.load(), 2 * (numItemsExpensive + numItemsCheap));
+}
+
+TEST(TaskGraph, LoadCostIsCachedUntilStaticDataIsLoaded)
+{
+    constexpr int numTasks = 16;
+
+    struct StaticData {
+        int adder;
+    };
+
+    std::atomic_int numLoadCostEstimates { 0 };
+    std::atomic_int sum { 0 };
+
+    // Prefetching scores all tasks a second time after every claim.
+    tasking::TaskGraph g { 1, 1 };
+    g.setSelectionPolicy(std::make_unique<tasking::LoadCostPolicy>(1024));
+    std::vector<tasking::TaskHandle<int>> tasks;
+    for (int taskIdx = 0; taskIdx < numTasks; taskIdx++) {
+        tasks.push_back(g.addTask<int, StaticData>(
+            "task",
+            []() { return StaticData { 1 }; },
+            [&]() {
+                numLoadCostEstimates.fetch_add(1);
+                return size_t(0);
+            },
+            [&](gsl::span<const int> numbers, const StaticData* pStaticData, std::pmr::memory_resource* pMemoryResource) {
+                for (const int number : numbers)
+                    sum.fetch_add(number + pStaticData->adder);
+            }));
+    }
+
+    // Every task is flushed once (which loads its static data once, either in the flush or in a prefetch).
+    for (int taskIdx = 0; taskIdx < numTasks; taskIdx++) {
+        for (int i = 0; i <= taskIdx; i++)
+            g.enqueue(tasks[taskIdx], 1);
+    }
+
+    g.run();
+
+    // The k-th task to be flushed is estimated at most once for each of the (at most k + 1) loads that completed before
+    //  it was claimed, plus once before the first load. Without caching every task with queued items would be rescored
+    //  on every claim and again to select the task to prefetch.
+    EXPECT_LE(numLoadCostEstimates.load(), numTasks * (numTasks + 1) / 2 + numTasks);
+    ASSERT_EQ(sum.load(), numTasks * (numTasks + 1));
+}
+
+TEST(TaskGraph, MemoryBudgetFavoursSinks)
+{
+    constexpr int numItemsProducer = 200;
+    constexpr int numItemsSink = 100;
+
+    std::atomic_int firstFlushedTask { -1 };
+    std::atomic_int numConsumed { 0 };
+    std::atomic_bool overBudgetDuringFlush { false };
+
+    tasking::TaskGraph g;
+    g.setMemoryBudget(1);
+    auto sinkTask = g.addTask<int>(
+        "sink",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            int expected = -1;
+            firstFlushedTask.compare_exchange_strong(expected, 1);
+            if (g.isOverMemoryBudget())
+                overBudgetDuringFlush.store(true);
+            numConsumed.fetch_add(static_cast<int>(numbers.size()));
+        });
+    auto producerTask = g.addTask<int>(
+        "producer",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            int expected = -1;
+            firstFlushedTask.compare_exchange_strong(expected, 0);
+            for (const int number : numbers)
+                g.enqueue(sinkTask, number);
+        });
+    g.markAsSink(sinkTask);
+
+    // The producer has the larger queue but the sink should be flushed first because we're over budget.
+    for (int i = 0; i < numItemsProducer; i++)
+        g.enqueue(producerTask, i);
+    for (int i = 0; i < numItemsSink; i++)
+        g.enqueue(sinkTask, i);
+
+    g.run();
+
+    ASSERT_EQ(firstFlushedTask.load(), 1);
+    ASSERT_TRUE(overBudgetDuringFlush.load());
+    ASSERT_EQ(numConsumed.load(), numItemsProducer + numItemsSink);
+}
+
+TEST(TaskGraph, MemoryBudgetRecoversAfterDrain)
+{
+    constexpr int numItemsInitial = 4096;
+    constexpr int numItemsSpawned = 2048;
+    constexpr int spawnSize = 64;
+
+    std::atomic_int numConsumed { 0 };
+    std::atomic_int numSpawned { 0 };
+    std::atomic_int numDeferred { 0 };
+
+    tasking::TaskGraph g;
+    g.setMemoryBudget(256 * sizeof(int));
+    tasking::TaskHandle<int> sinkTask;
+    sinkTask = g.addTask<int>(
+        "sink",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            numConsumed.fetch_add(static_cast<int>(numbers.size()));
+
+            // Mimics the integrators: new paths are only spawned while the queues are within budget.
+            if (g.isOverMemoryBudget()) {
+                numDeferred.fetch_add(1);
+                return;
+            }
+            const int startIndex = numSpawned.fetch_add(spawnSize);
+            for (int i = startIndex; i < std::min(startIndex + spawnSize, numItemsSpawned); i++)
+                g.enqueue(sinkTask, i);
+        });
+    g.markAsSink(sinkTask);
+
+    for (int i = 0; i < numItemsInitial; i++)
+        g.enqueue(sinkTask, i);
+    ASSERT_TRUE(g.isOverMemoryBudget());
+
+    g.run();
+
+    // Draining the queue must bring the graph back within budget such that new work is scheduled again.
+    ASSERT_FALSE(g.isOverMemoryBudget());
+    ASSERT_EQ(g.approxMemoryUsage(), 0);
+    ASSERT_GT(numDeferred.load(), 0);
+    ASSERT_GE(numSpawned.load(), numItemsSpawned);
+    ASSERT_EQ(numConsumed.load(), numItemsInitial + numItemsSpawned);
+}
+
+TEST(TaskGraph, SpillToDisk)
+{
+    constexpr size_t range = 16 * 1024;
+
+    std::vector<std::atomic_int> output(range);
+    for (auto& v : output)
+        v.store(0);
+
+    std::atomic_int numSerializersCreated { 0 };
+
+    tasking::TaskGraph g { 2 };
+    g.enableSpilling(
+        [&]() {
+            numSerializersCreated.fetch_add(1);
+            return std::make_unique<tasking::InMemorySerializer>();
+        },
+        1, 64 * sizeof(std::pair<int, int>));
+
+    auto task3 = g.addTask<std::pair<int, int>>(
+        "task3",
+        [&](gsl::span<const std::pair<int, int>> numbers, std::pmr::memory_resource* pMemoryResource) {
+            for (const auto [initialNumber, number] : numbers)
+                output[initialNumber].fetch_add(number);
+        });
+    auto task2 = g.addTask<std::pair<int, int>>(
+        "task2",
+        [&](gsl::span<const std::pair<int, int>> numbers, std::pmr::memory_resource* pMemoryResource) {
+            for (const auto [initialNumber, number] : numbers)
+                g.enqueue(task3, { initialNumber, number + 1 });
+        });
+    auto task1 = g.addTask<int>(
+        "task1",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            for (const int number : numbers)
+                g.enqueue(task2, { number, number * 2 });
+        });
+
+    for (int i = 0; i < static_cast<int>(range); i++)
+        g.enqueue(task1, i);
+    ASSERT_EQ(g.approxQueuedItems(), range);
+
+    g.run();
+
+    ASSERT_EQ(g.approxQueuedItems(), 0);
+    ASSERT_GT(numSerializersCreated.load(), 0);
+    for (int i = 0; i < static_cast<int>(range); i++)
+        ASSERT_EQ(output[i].load(), i * 2 + 1);
+}
+
+TEST(TaskGraph, SpillOffEnqueuePath)
+{
+    constexpr int numItemsCold = 1024;
+    constexpr int numItemsHot = 4096;
+
+    std::atomic_int numSerializersCreated { 0 };
+    std::atomic_bool spilledOnEnqueuingThread { false };
+    std::atomic_bool spilledItemsUncounted { false };
+    std::atomic_int sum { 0 };
+
+    const auto enqueuingThread = std::this_thread::get_id();
+    tasking::TaskGraph g;
+    g.enableSpilling(
+        [&]() {
+            numSerializersCreated.fetch_add(1);
+            if (std::this_thread::get_id() == enqueuingThread)
+                spilledOnEnqueuingThread.store(true);
+            return std::make_unique<tasking::InMemorySerializer>();
+        },
+        1, 64 * sizeof(int));
+
+    auto coldTask = g.addTask<int>(
+        "cold",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            for (const int number : numbers)
+                sum.fetch_add(number);
+        });
+    auto hotTask = g.addTask<int>(
+        "hot",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            // Items that have been spilled to disk still need to be processed but no longer occupy memory.
+            if (g.approxMemoryUsage() < g.approxQueuedItems() * sizeof(int))
+                spilledItemsUncounted.store(true);
+            for (const int number : numbers)
+                sum.fetch_add(number);
+        });
+
+    for (int i = 0; i < numItemsCold; i++)
+        g.enqueue(coldTask, i);
+    for (int i = 0; i < numItemsHot; i++)
+        g.enqueue(hotTask, i);
+
+    // Enqueueing only requests a spill; the items are written by the spill thread or the schedulers.
+    ASSERT_FALSE(spilledOnEnqueuingThread.load());
+
+    g.run();
+
+    ASSERT_GT(numSerializersCreated.load(), 0);
+    ASSERT_TRUE(spilledItemsUncounted.load());
+    ASSERT_EQ(g.approxQueuedItems(), 0);
+    ASSERT_EQ(sum.load(), numItemsCold * (numItemsCold - 1) / 2 + numItemsHot * (numItemsHot - 1) / 2);
+}
+
+TEST(TaskGraph, SpillBackUnderBudget)
+{
+    constexpr size_t segmentSize = 64;
+    constexpr size_t numSegments = 64;
+    constexpr size_t spillBudget = 4 * segmentSize * sizeof(int);
+
+    std::atomic_int sum { 0 };
+    std::atomic_bool underBudget { false };
+
+    // With a single scheduler, no scheduler is available to spill while the producer is being flushed.
+    tasking::TaskGraph g { 1 };
+    g.enableSpilling([]() { return std::make_unique<tasking::InMemorySerializer>(); }, spillBudget, segmentSize * sizeof(int));
+
+    auto consumer = g.addTask<int>(
+        "consumer",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            for (const int number : numbers)
+                sum.fetch_add(number);
+        });
+    auto producer = g.addTask<int>(
+        "producer",
+        [&](gsl::span<const int> numbers, std::pmr::memory_resource* pMemoryResource) {
+            // Enqueue many segments at once (which requests a single spill).
+            std::vector<int> items(numSegments * segmentSize);
+            std::iota(std::begin(items), std::end(items), 0);
+            g.enqueue(consumer, gsl::span<const int>(items));
+
+            // The queues should be brought back under the spill budget while this flush is still running.
+            const auto start = std::chrono::high_resolution_clock::now();
+            while (std::chrono::high_resolution_clock::now() - start < std::chrono::seconds(10)) {
+                if (g.approxMemoryUsage() <= spillBudget) {
+                    underBudget.store(true);
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+
+    g.enqueue(producer, 0);
+    g.run();
+
+    ASSERT_TRUE(underBudget.load());
+    ASSERT_EQ(g.approxQueuedItems(), 0);
+    constexpr int numItems = static_cast<int>(numSegments * segmentSize);
+    ASSERT_EQ(sum.load(), numItems * (numItems - 1) / 2);
+}
@@ -13,17 +13,20 @@
 #include "stream/task_graph.h"
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <optional>
 #include <optick.h>
 #include <optick_tbb.h>
 #include <pandora/graphics_core/perspective_camera.h>
 #include <pandora/traversal/batching_acceleration_structure.h>
 #include <pandora/traversal/embree_acceleration_structure.h>
 #include <pandora/traversal/offline_batching_acceleration_structure.h>
+#include <pandora/traversal/scene_package.h>
 #include <pbf/pbf_importer.h>
 #include <pbrt/pbrt_importer.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <stream/cache/lru_cache.h>
 #include <stream/cache/lru_cache_ts.h>
+#include <stream/cache/memory_governor.h>
 #include <stream/serialize/file_serializer.h>
 #include <stream/serialize/in_memory_serializer.h>
 #include <stream/stats.h>
@@ -67,10 +70,21 @@ int main(int argc, char** argv)
 		("spp", po::value<int>()->default_value(1), "samples per pixel")
 		("concurrency", po::value<unsigned>()->default_value(500*1000), "Number of paths traced concurrently")
 		("schedulers", po::value<unsigned>()->default_value(2), "Number of scheduler tasks spawned concurrently")
+		("prefetch", po::value<unsigned>()->default_value(0), "Number of batching points for which static data is prefetched (0 = disabled)")
+		("selection", po::value<std::string>()->default_value("largest_queue"), "Task selection policy (largest_queue or load_cost)")
+		("queuebudget", po::value<size_t>()->default_value(0), "Memory budget for all ray queues combined (MB, 0 = unlimited)")
+		("spillbudget", po::value<size_t>()->default_value(0), "Ray queues are spilled to disk when exceeding this size (MB, 0 = never)")
 		("geomcache", po::value<size_t>()->default_value(100 * 1000), "Geometry cache size (MB)")
+		("geomeviction", po::value<std::string>()->default_value("clock"), "Geometry cache eviction policy (clock or 2q)")
 		("bvhcache", po::value<size_t>()->default_value(100 * 1000), "Bot level BVH cache size (MB)")
+		("memory", po::value<size_t>()->default_value(0), "Memory budget shared by the geometry and bot level BVH caches (MB, 0 = use geomcache and bvhcache)")
 		("primgroup", po::value<unsigned>()->default_value(1000 * 1000), "Number of primitives per batching point")
 		("svdagres", po::value<unsigned>()->default_value(128), "Resolution of the voxel grid used to create the SVDAG")
+		("raysort", po::value<bool>()->default_value(false), "Sort rays at batching points before bottom level traversal")
+		("toptraversal", po::value<std::string>()->default_value("childmask"), "Top level traversal state of paused rays (childmask or parentpointer)")
+		("persistentbvh", po::value<bool>()->default_value(false), "Build the bottom level BVHs while preprocessing and load them from disk instead of rebuilding them")
+		("scenecache", po::value<std::string>()->default_value(""), "Folder in which the preprocessed scene is stored and from which it is reused (empty = disabled)")
+		("compressgeom", po::value<bool>()->default_value(false), "Compress the preprocessed geometry that is stored on disk (LZ4)")
 		("help", "show all arguments");
     // clang-format on
 
@@ -99,12 +113,23 @@ int main(int argc, char** argv)
     int spp = vm["spp"].as<int>();
     const unsigned concurrency = vm["concurrency"].as<unsigned>();
     const unsigned schedulers = vm["schedulers"].as<unsigned>();
+    const unsigned prefetch = vm["prefetch"].as<unsigned>();
+    const std::string selectionPolicy = vm["selection"].as<std::string>();
+    const size_t queueBudgetMB = vm["queuebudget"].as<size_t>();
+    const size_t spillBudgetMB = vm["spillbudget"].as<size_t>();
     const size_t geomCacheSizeMB = vm["geomcache"].as<size_t>();
+    const std::string geomEvictionPolicy = vm["geomeviction"].as<std::string>();
     const size_t bvhCacheSizeMB = vm["bvhcache"].as<size_t>();
     const size_t geomCacheSize = geomCacheSizeMB * 1000000;
     const size_t bvhCacheSize = bvhCacheSizeMB * 1000000;
+    const size_t memoryBudgetMB = vm["memory"].as<size_t>();
     const unsigned primitivesPerBatchingPoint = vm["primgroup"].as<unsigned>();
     const unsigned svdagRes = vm["svdagres"].as<unsigned>();
+    const bool raySort = vm["raysort"].as<bool>();
+    const std::string topLevelTraversalName = vm["toptraversal"].as<std::string>();
+    const bool persistentBVHs = vm["persistentbvh"].as<bool>();
+    const std::filesystem::path scenePackageFolder = vm["scenecache"].as<std::string>();
+    const auto geometryCompression = vm["compressgeom"].as<bool>() ? tasking::FileCompression::LZ4 : tasking::FileCompression::None;
 
     std::cout << "Rendering with the following settings:\n";
     std::cout << "  file:           " << vm["file"].as<std::string>() << "\n";
@@ -115,10 +140,21 @@ int main(int argc, char** argv)
     std::cout << "  spp:            " << spp << std::endl;
     std::cout << "  concurrency:    " << concurrency << "\n";
     std::cout << "  schedulers:     " << schedulers << "\n";
+    std::cout << "  prefetch:       " << prefetch << "\n";
+    std::cout << "  selection:      " << selectionPolicy << "\n";
+    std::cout << "  queue budget:   " << queueBudgetMB << "MB\n";
+    std::cout << "  spill budget:   " << spillBudgetMB << "MB\n";
     std::cout << "  geom cache:     " << geomCacheSizeMB << "MB\n";
+    std::cout << "  geom eviction:  " << geomEvictionPolicy << "\n";
     std::cout << "  bot bvh cache:  " << bvhCacheSizeMB << "MB\n";
+    std::cout << "  memory budget:  " << memoryBudgetMB << "MB\n";
     std::cout << "  batching point: " << primitivesPerBatchingPoint << " primitives\n";
     std::cout << "  svdag res:      " << svdagRes << "\n";
+    std::cout << "  ray sort:       " << raySort << "\n";
+    std::cout << "  top traversal:  " << topLevelTraversalName << "\n";
+    std::cout << "  persistent bvh: " << persistentBVHs << "\n";
+    std::cout << "  scene cache:    " << scenePackageFolder.string() << "\n";
+    std::cout << "  compress geom:  " << vm["compressgeom"].as<bool>() << "\n";
     std::cout << std::flush;
 
     g_stats.config.sceneFile = vm["file"].as<std::string>();
@@ -129,25 +165,63 @@ int main(int argc, char** argv)
     g_stats.config.spp = spp;
     g_stats.config.concurrency = concurrency;
     g_stats.config.schedulers = schedulers;
+    g_stats.config.prefetch = prefetch;
+    g_stats.config.selectionPolicy = selectionPolicy;
 
+    g_stats.config.queueBudget = queueBudgetMB * 1000000;
+    g_stats.config.spillBudget = spillBudgetMB * 1000000;
     g_stats.config.geomCacheSize = geomCacheSize;
     g_stats.config.bvhCacheSize = bvhCacheSize;
+    g_stats.config.memoryBudget = memoryBudgetMB * 1000000;
     g_stats.config.primGroupSize = primitivesPerBatchingPoint;
     g_stats.config.svdagRes = svdagRes;
+    g_stats.config.raySort = raySort;
+    g_stats.config.topLevelTraversal = topLevelTraversalName;
+    g_stats.config.persistentBVHs = persistentBVHs;
+
+    PauseableBVHTraversal topLevelTraversal = PauseableBVHTraversal::ChildMask;
+    if (topLevelTraversalName == "parentpointer") {
+        topLevelTraversal = PauseableBVHTraversal::ParentPointer;
+    } else if (topLevelTraversalName != "childmask") {
+        spdlog::error("Unknown top level traversal {}", topLevelTraversalName);
+        exit(1);
+    }
+
+    //using AccelBuilder = EmbreeAccelerationStructureBuilder;
+    using AccelBuilder = BatchingAccelerationStructureBuilder;
+    //using AccelBuilder = OfflineBatchingAccelerationStructureBuilder;
+
+    // The scene package stores the scene after preprocessing, so loading it skips both parsing the scene file and preprocessing.
+    const std::filesystem::path sceneFilePath = vm["file"].as<std::string>();
+    const ScenePackageKey scenePackageKey { sceneFilePath, cameraID, subdiv, primitivesPerBatchingPoint, svdagRes, persistentBVHs };
+    const bool useScenePackage = std::is_same_v<AccelBuilder, BatchingAccelerationStructureBuilder> && !scenePackageFolder.empty();
+    std::optional<ScenePackage> optScenePackage;
+    if (useScenePackage && isScenePackageValid(scenePackageFolder, scenePackageKey)) {
+        OPTICK_EVENT("loadScenePackage");
+        auto stopWatch = g_stats.timings.loadFromFileTime.getScopedStopwatch();
+        optScenePackage = loadScenePackage(scenePackageFolder);
+    }
 
     spdlog::info("Loading scene");
     // WARNING: This cache is not used during rendering when using the batched acceleration structure.
     //          A new cache is instantiated when splitting the scene into smaller objects. Scroll down...
-    //auto pSerializer = std::make_unique<tasking::InMemorySerializer>();
-    auto pSerializer = std::make_unique<tasking::SplitFileSerializer>(
-        "pandora_pre_geom", 512 * 1024 * 1024, mio_cache_control::cache_mode::sequential);
-    tasking::LRUCacheTS::Builder cacheBuilder { std::move(pSerializer) };
+    // The serializer (re)creates its folder on disk so it is only created when the scene is parsed from its source.
+    tasking::LRUCacheTS::Builder cacheBuilder = [&]() {
+        if (optScenePackage)
+            return std::move(optScenePackage->geometryCacheBuilder);
+
+        //auto pSerializer = std::make_unique<tasking::InMemorySerializer>();
+        auto pSerializer = std::make_unique<tasking::SplitFileSerializer>(
+            "pandora_pre_geom", 512 * 1024 * 1024, mio_cache_control::cache_mode::sequential);
+        return tasking::LRUCacheTS::Builder { std::move(pSerializer) };
+    }();
 
     RenderConfig renderConfig;
-    {
+    if (optScenePackage) {
+        renderConfig = std::move(optScenePackage->renderConfig);
+    } else {
         OPTICK_EVENT("loadFromFile");
         auto stopWatch = g_stats.timings.loadFromFileTime.getScopedStopwatch();
-        const std::filesystem::path sceneFilePath = vm["file"].as<std::string>();
         if (sceneFilePath.extension() == ".pbrt")
             renderConfig = pbrt::loadFromPBRTFile(sceneFilePath, cameraID, &cacheBuilder, subdiv, false);
         else if (sceneFilePath.extension() == ".pbf")
@@ -160,26 +234,64 @@ int main(int argc, char** argv)
         }
     }
     const glm::ivec2 resolution = renderConfig.resolution;
-    tasking::LRUCacheTS geometryCache = cacheBuilder.build(std::numeric_limits<size_t>::max());
+    auto createGeometryEvictionPolicy = [&]() -> std::unique_ptr<tasking::EvictionPolicy> {
+        if (geomEvictionPolicy == "2q")
+            return std::make_unique<tasking::TwoQueueEvictionPolicy>();
+        if (geomEvictionPolicy != "clock") {
+            spdlog::error("Unknown geometry cache eviction policy {}", geomEvictionPolicy);
+            exit(1);
+        }
+        return std::make_unique<tasking::ClockEvictionPolicy>();
+    };
+    // The geometry cache and the bot level BVH caches share a single memory budget (if specified).
+    std::optional<tasking::MemoryGovernor> optMemoryGovernor;
+    if (memoryBudgetMB > 0)
+        optMemoryGovernor.emplace(memoryBudgetMB * 1000000);
+    auto buildRenderGeometryCache = [&]() {
+        cacheBuilder.setEvictionPolicy(createGeometryEvictionPolicy());
+        return optMemoryGovernor ? cacheBuilder.build(*optMemoryGovernor) : cacheBuilder.build(geomCacheSize);
+    };
+    tasking::LRUCacheTS geometryCache = optScenePackage ? buildRenderGeometryCache() : cacheBuilder.build(std::numeric_limits<size_t>::max());
 
     // Store geometry loaded data before we start splitting the large shapes as part of preprocess.
     g_stats.asyncTriggerSnapshot();
 
-    tasking::TaskGraph taskGraph { schedulers };
+    tasking::TaskGraph taskGraph { schedulers, prefetch };
+    if (selectionPolicy == "load_cost") {
+        taskGraph.setSelectionPolicy(std::make_unique<tasking::LoadCostPolicy>());
+    } else if (selectionPolicy != "largest_queue") {
+        spdlog::error("Unknown task selection policy {}", selectionPolicy);
+        exit(1);
+    }
+    if (queueBudgetMB > 0)
+        taskGraph.setMemoryBudget(queueBudgetMB * 1000000);
+    if (spillBudgetMB > 0) {
+        taskGraph.enableSpilling(
+            []() {
+                // Each spill generation gets its own folder which is removed when all its rays have been reloaded.
+                static std::atomic_int spillID { 0 };
+                return std::make_unique<tasking::SplitFileSerializer>(
+                    fmt::format("pandora_ray_spill_{}", spillID++), 256 * 1024 * 1024, mio_cache_control::cache_mode::sequential);
+            },
+            spillBudgetMB * 1000000);
+    }
 
-    //using AccelBuilder = EmbreeAccelerationStructureBuilder;
-    using AccelBuilder = BatchingAccelerationStructureBuilder;
-    //using AccelBuilder = OfflineBatchingAccelerationStructureBuilder;
     if constexpr (std::is_same_v<AccelBuilder, BatchingAccelerationStructureBuilder> || std::is_same_v<AccelBuilder, OfflineBatchingAccelerationStructureBuilder>) {
-        spdlog::info("Preprocessing scene");
-        auto pSerializer = std::make_unique<tasking::SplitFileSerializer>(
-            "pandora_render_geom", 512 * 1024 * 1024, mio_cache_control::cache_mode::no_buffering);
-        //auto pSerializer = std::make_unique<tasking::InMemorySerializer>();
-
-        cacheBuilder = tasking::LRUCacheTS::Builder { std::move(pSerializer) };
-        AccelBuilder::preprocessScene(*renderConfig.pScene, geometryCache, cacheBuilder, primitivesPerBatchingPoint);
-        auto newCache = cacheBuilder.build(geomCacheSizeMB * 1000000);
-        geometryCache = std::move(newCache);
+        if (!optScenePackage) {
+            spdlog::info("Preprocessing scene");
+            std::unique_ptr<tasking::Serializer> pSerializer;
+            if (useScenePackage)
+                pSerializer = createScenePackageGeometrySerializer(scenePackageFolder, geometryCompression);
+            else
+                pSerializer = std::make_unique<tasking::SplitFileSerializer>(
+                    "pandora_render_geom", 512 * 1024 * 1024, mio_cache_control::cache_mode::no_buffering, geometryCompression);
+            //auto pSerializer = std::make_unique<tasking::InMemorySerializer>();
+
+            cacheBuilder = tasking::LRUCacheTS::Builder { std::move(pSerializer) };
+            AccelBuilder::preprocessScene(*renderConfig.pScene, geometryCache, cacheBuilder, primitivesPerBatchingPoint);
+            auto newCache = buildRenderGeometryCache();
+            geometryCache = std::move(newCache);
+        }
     }
 
     // Reset stats so that geometry loaded / evicted only contains the data from during the render, not the loading and preprocess.
@@ -201,7 +313,36 @@ int main(int argc, char** argv)
 
     spdlog::info("Building acceleration structure");
     //AccelBuilder accelBuilder { *renderConfig.pScene, &taskGraph };
-    AccelBuilder accelBuilder { renderConfig.pScene.get(), &geometryCache, &taskGraph, primitivesPerBatchingPoint, bvhCacheSize, svdagRes };
+    auto accelBuilder = [&]() {
+        if constexpr (std::is_same_v<AccelBuilder, BatchingAccelerationStructureBuilder>) {
+            if (optScenePackage)
+                return AccelBuilder { std::move(optScenePackage->subScenes), std::move(optScenePackage->svdags), &geometryCache, &taskGraph, bvhCacheSize, raySort, topLevelTraversal };
+        }
+        return AccelBuilder { renderConfig.pScene.get(), &geometryCache, &taskGraph, primitivesPerBatchingPoint, bvhCacheSize, svdagRes, raySort, topLevelTraversal };
+    }();
+    if constexpr (std::is_same_v<AccelBuilder, BatchingAccelerationStructureBuilder>) {
+        if (optScenePackage) {
+            if (optScenePackage->persistentBVHCacheBuilder)
+                accelBuilder.usePersistentBVHs(std::move(optScenePackage->persistentBVHs), std::move(*optScenePackage->persistentBVHCacheBuilder));
+        } else if (persistentBVHs) {
+            std::unique_ptr<tasking::Serializer> pSerializer;
+            if (useScenePackage)
+                pSerializer = createScenePackageBVHSerializer(scenePackageFolder);
+            else
+                pSerializer = std::make_unique<tasking::SplitFileSerializer>(
+                    "pandora_render_bvh", 512 * 1024 * 1024, mio_cache_control::cache_mode::no_buffering);
+            accelBuilder.createPersistentBVHs(std::move(pSerializer));
+        }
+
+        if (useScenePackage && !optScenePackage) {
+            try {
+                writeScenePackage(
+                    scenePackageFolder, scenePackageKey, renderConfig, geometryCache, accelBuilder.subScenes(), accelBuilder.svdags(), accelBuilder.persistentBVHs());
+            } catch (const std::exception& e) {
+                spdlog::error("Failed to write scene package: {}", e.what());
+            }
+        }
+    }
     Sensor sensor { renderConfig.resolution };
 
     try {